@@ -68,6 +68,14 @@ namespace lapis {
 			LapisGui<LapisController>::singleton().renderFullGui();
 			return 0;
 		}
+		else if (parsed == pr::recalculateRequested) {
+			LapisController lc;
+			if (!lc.recalculatePointMetrics(rp.recalculateCubeFile())) {
+				lapisCout << "Recalculation Failed\n";
+				return 1;
+			}
+			return 0;
+		}
 
 		LapisController lc;
 		try {
@@ -10,17 +10,8 @@ namespace lapis {
 	}
 	Raster<csm_t> FillCsm::postProcess(const Raster<csm_t>& csm)
 	{
-		Raster<csm_t> out{ (Alignment)csm };
-		for (cell_t cell = 0; cell < csm.ncell(); ++cell) {
-			if (!csm[cell].has_value()) {
-				_fillSingleValue(csm, out, cell);
-			}
-			else {
-				out[cell].has_value() = true;
-				out[cell].value() = csm[cell].value();
-			}
-		}
-
+		Raster<csm_t> out = csm;
+		_fillAll(csm, out);
 		return out;
 	}
 	void FillCsm::describeInPdf(MetadataPdf& pdf, CsmParameterGetter* getter)
@@ -32,77 +23,141 @@ namespace lapis {
 		desc << "Small holes in the CSM were filled with an inverse distance weighted mean of the values in nearby cells.";
 		pdf.writeTextBlockWithWrap(desc.str());
 	}
-	void FillCsm::_fillSingleValue(const Raster<csm_t>& original, Raster<csm_t>& output, cell_t cell)
+	namespace {
+		//the closest value found so far looking in one direction from a cell, and how many steps away it is
+		struct RayState {
+			rowcol_t dist;
+			csm_t value;
+		};
+		constexpr rowcol_t noValueOnRay = std::numeric_limits<rowcol_t>::max();
+		constexpr RayState emptyRay = { noValueOnRay, 0 };
+
+		//the state of a cell, given the cell one step further along the ray
+		inline RayState stepRay(bool nextHas, csm_t nextValue, const RayState& nextState) {
+			if (nextHas) {
+				return { 1, nextValue };
+			}
+			return { nextState.dist == noValueOnRay ? noValueOnRay : nextState.dist + 1, nextState.value };
+		}
+	}
+
+	void FillCsm::_fillAll(const Raster<csm_t>& original, Raster<csm_t>& output)
 	{
 		//the algorithm here to distinguish legitimately absent data from holes is:
 		//in all 8 cardinal directions, look for data up to a certain distance away
 		//if you find data or the edge of the raster in at least neighborsneeded directions,
 		//then assign the value to be an inverse-distance-weighted mean of the closest value found in each direction
 
-		struct Direction {
-			rowcol_t rowDir, colDir;
-		};
-		static std::vector<Direction> directions = {
-			{0,1},{0,-1},{1,0},{-1,0},
-			{1,1},{1,-1},{-1,1},{-1,-1}
+		//instead of walking each ray separately, the closest value in each direction is found for every cell with two passes over the raster,
+		//like a distance transform. The bottom-up pass finds the values to the east, south, southeast, and southwest,
+		//and the top-down pass finds the rest. The bottom-up pass visits the holes in exactly the reverse order of the top-down pass,
+		//so its results can be kept in a stack
+		const rowcol_t nrow = original.nrow();
+		const rowcol_t ncol = original.ncol();
+
+		struct LaterRays {
+			RayState e, s, se, sw;
 		};
-		static size_t firstDiagonal = 4;
-		static coord_t sqrtTwo = std::sqrt(2.);
+		std::vector<LaterRays> laterRays;
 
-		struct ValueDist {
-			csm_t value;
-			csm_t dist;
+		std::vector<csm_t> thisValue(ncol), otherValue(ncol);
+		std::vector<char> thisHas(ncol), otherHas(ncol);
+		auto readRow = [&](rowcol_t row, std::vector<csm_t>& values, std::vector<char>& has) {
+			for (rowcol_t col = 0; col < ncol; ++col) {
+				auto v = original.atRCUnsafe(row, col);
+				has[col] = v.has_value();
+				values[col] = v.has_value() ? v.value() : 0;
+			}
 		};
-		std::vector<ValueDist> foundValues;
-		foundValues.reserve(8);
 
-		int missesSoFar = 0;
+		std::vector<RayState> thisA(ncol), thisB(ncol), thisC(ncol);
+		std::vector<RayState> otherA(ncol, emptyRay), otherB(ncol, emptyRay), otherC(ncol, emptyRay);
+
+		//bottom-up: A is south, B is southeast, C is southwest. 'other' is the row below
+		std::fill(otherHas.begin(), otherHas.end(), 0);
+		for (rowcol_t row = nrow - 1; row >= 0; --row) {
+			readRow(row, thisValue, thisHas);
+			RayState east = emptyRay;
+			for (rowcol_t col = ncol - 1; col >= 0; --col) {
+				thisA[col] = stepRay(otherHas[col], otherValue[col], otherA[col]);
+				thisB[col] = col + 1 < ncol ? stepRay(otherHas[col + 1], otherValue[col + 1], otherB[col + 1]) : emptyRay;
+				thisC[col] = col > 0 ? stepRay(otherHas[col - 1], otherValue[col - 1], otherC[col - 1]) : emptyRay;
+				if (!thisHas[col]) {
+					laterRays.push_back({ east, thisA[col], thisB[col], thisC[col] });
+				}
+				east = stepRay(thisHas[col], thisValue[col], east);
+			}
+			std::swap(thisValue, otherValue);
+			std::swap(thisHas, otherHas);
+			std::swap(thisA, otherA);
+			std::swap(thisB, otherB);
+			std::swap(thisC, otherC);
+		}
 
-		rowcol_t row = original.rowFromCell(cell);
-		rowcol_t col = original.colFromCell(cell);
+		const csm_t sqrtTwo = (csm_t)std::sqrt(2.);
+		struct RayCheck {
+			RayState state;
+			rowcol_t distToEdge;
+			bool isDiagonal;
+		};
 
-		for (size_t i = 0; i < directions.size(); ++i) {
+		//top-down: A is north, B is northeast, C is northwest. 'other' is the row above
+		std::fill(otherHas.begin(), otherHas.end(), 0);
+		std::fill(otherA.begin(), otherA.end(), emptyRay);
+		std::fill(otherB.begin(), otherB.end(), emptyRay);
+		std::fill(otherC.begin(), otherC.end(), emptyRay);
+		for (rowcol_t row = 0; row < nrow; ++row) {
+			readRow(row, thisValue, thisHas);
+			RayState west = emptyRay;
+			for (rowcol_t col = 0; col < ncol; ++col) {
+				thisA[col] = stepRay(otherHas[col], otherValue[col], otherA[col]);
+				thisB[col] = col + 1 < ncol ? stepRay(otherHas[col + 1], otherValue[col + 1], otherB[col + 1]) : emptyRay;
+				thisC[col] = col > 0 ? stepRay(otherHas[col - 1], otherValue[col - 1], otherC[col - 1]) : emptyRay;
 
-			bool isDiagonal = i >= firstDiagonal;
-			rowcol_t maxPixelDist = isDiagonal ? _diagonalFillDist : _cardinalFillDist;
-			csm_t distMultiplier = isDiagonal ? sqrtTwo : 1.;
+				if (!thisHas[col]) {
+					LaterRays later = laterRays.back();
+					laterRays.pop_back();
 
-			bool missed = true;
+					//in the same order as the original ray-walking version of this algorithm, so the sums come out the same
+					std::array<RayCheck, 8> rays = { {
+						{later.e, ncol - col, false},
+						{west, col + 1, false},
+						{later.s, nrow - row, false},
+						{thisA[col], row + 1, false},
+						{later.se, std::min(nrow - 1 - row, ncol - 1 - col) + 1, true},
+						{later.sw, std::min(nrow - 1 - row, col) + 1, true},
+						{thisB[col], std::min(row, ncol - 1 - col) + 1, true},
+						{thisC[col], std::min(row, col) + 1, true} } };
 
-			for (rowcol_t d = 1; d <= maxPixelDist; ++d) {
-				rowcol_t thisRow = row + d * directions[i].rowDir;
-				rowcol_t thisCol = col + d * directions[i].colDir;
-				if (thisRow < 0 || thisCol < 0 || thisRow >= original.nrow() || thisCol >= original.ncol()) {
-					//in this case, we found the edge of the raster
-					//we don't have a value to contribute to the eventual mean, but we don't count it as a miss either
-					missed = false;
-					break;
-				}
-				auto v = original.atRCUnsafe(thisRow, thisCol);
-				if (!v.has_value()) {
-					continue;
-				}
-				missed = false;
-				foundValues.emplace_back(v.value(), distMultiplier * d);
-				break;
-			}
-			if (missed) {
-				missesSoFar++;
-				if (missesSoFar > _maxMisses) {
-					return;
+					int misses = 0;
+					csm_t numerator = 0;
+					csm_t denominator = 0;
+					for (const RayCheck& ray : rays) {
+						rowcol_t maxPixelDist = ray.isDiagonal ? _diagonalFillDist : _cardinalFillDist;
+						if (ray.state.dist <= maxPixelDist) {
+							csm_t dist = (ray.isDiagonal ? sqrtTwo : (csm_t)1.) * ray.state.dist;
+							csm_t inverseDist = 1 / dist;
+							numerator += inverseDist * ray.state.value;
+							denominator += inverseDist;
+						}
+						else if (ray.distToEdge > maxPixelDist) {
+							//finding the edge of the raster doesn't contribute a value, but doesn't count as a miss either
+							misses++;
+						}
+					}
+					if (misses <= _maxMisses && denominator > 0) {
+						auto v = output.atRCUnsafe(row, col);
+						v.has_value() = true;
+						v.value() = numerator / denominator;
+					}
 				}
+				west = stepRay(thisHas[col], thisValue[col], west);
 			}
+			std::swap(thisValue, otherValue);
+			std::swap(thisHas, otherHas);
+			std::swap(thisA, otherA);
+			std::swap(thisB, otherB);
+			std::swap(thisC, otherC);
 		}
-
-		csm_t numerator = 0;
-		csm_t denominator = 0;
-		for (const ValueDist v : foundValues) {
-			csm_t inverseDist = 1 / v.dist;
-			numerator += inverseDist * v.value;
-			denominator += inverseDist;
-		}
-		auto v = output[cell];
-		v.has_value() = true;
-		v.value() = numerator / denominator;
 	}
 }
\ No newline at end of file
@@ -14,7 +14,8 @@ namespace lapis {
 		void describeInPdf(MetadataPdf& pdf, CsmParameterGetter* getter) override;
 
 	protected:
-		void _fillSingleValue(const Raster<csm_t>& original, Raster<csm_t>& output, cell_t cell);
+		//sets every cell of output which is a fillable hole in original. Cells with values in original aren't touched
+		void _fillAll(const Raster<csm_t>& original, Raster<csm_t>& output);
 
 	private:
 		int _maxMisses;
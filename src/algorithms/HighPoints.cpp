@@ -100,56 +100,39 @@ namespace lapis {
 		std::vector<cell_t> candidates;
 		candidates.reserve(csm.ncell() / 10);
 
+		//the CSM is copied into a buffer with a one-pixel border, and nodata is replaced with a value that can never be a high point
+		//or prevent a neighbor from being one. That lets every pixel be compared to its neighbors without checking bounds or
+		//has_value(), and each row reduces to comparisons between contiguous arrays, which the compiler can vectorize
+		constexpr csm_t sentinel = -std::numeric_limits<csm_t>::infinity();
+		const size_t stride = (size_t)csm.ncol() + 2;
+		std::vector<csm_t> padded(stride * ((size_t)csm.nrow() + 2), sentinel);
 		for (rowcol_t row = 0; row < csm.nrow(); ++row) {
+			csm_t* paddedRow = padded.data() + (row + 1) * stride + 1;
 			for (rowcol_t col = 0; col < csm.ncol(); ++col) {
-				auto center = csm.atRCUnsafe(row, col);
-				if (!center.has_value()) {
-					continue;
+				auto v = csm.atRCUnsafe(row, col);
+				if (v.has_value()) {
+					paddedRow[col] = v.value();
 				}
-				if (center.value() < _minHt) {
-					continue;
-				}
-				bool isHighPoint = true;
+			}
+		}
+
+		std::vector<uint8_t> isHighPoint(csm.ncol());
+		for (rowcol_t row = 0; row < csm.nrow(); ++row) {
+			const csm_t* above = padded.data() + row * stride + 1;
+			const csm_t* center = above + stride;
+			const csm_t* below = center + stride;
+
+			for (rowcol_t col = 0; col < csm.ncol(); ++col) {
+				const csm_t c = center[col];
 
 				//this setup with priority is to ensure that areas with strictly equal height only get one candidate
-				struct rc { rowcol_t row, col; };
-				std::vector<rc> higherPriorityNeighbors = { {row + 1,col},{row,col + 1},{row + 1,col + 1},{row - 1,col + 1} };
-				std::vector<rc> lowerPriorityNeighbors = { {row - 1,col},{row,col - 1},{row - 1,col - 1},{row + 1,col - 1} };
-
-				for (auto& thisRC : higherPriorityNeighbors) {
-					rowcol_t rowNudge = thisRC.row;
-					rowcol_t colNudge = thisRC.col;
-					if (rowNudge < 0 || colNudge < 0 || rowNudge >= csm.nrow() || colNudge >= csm.ncol()) {
-						continue;
-					}
-					auto compare = csm.atRCUnsafe(rowNudge, colNudge);
-					if (!compare.has_value()) {
-						continue;
-					}
-					if (compare.value() > center.value()) {
-						isHighPoint = false;
-						break;
-					}
-				}
-				if (isHighPoint) {
-					for (auto& thisRC : lowerPriorityNeighbors) {
-						rowcol_t rowNudge = thisRC.row;
-						rowcol_t colNudge = thisRC.col;
-						if (rowNudge < 0 || colNudge < 0 || rowNudge >= csm.nrow() || colNudge >= csm.ncol()) {
-							continue;
-						}
-						auto compare = csm.atRCUnsafe(rowNudge, colNudge);
-						if (!compare.has_value()) {
-							continue;
-						}
-						if (compare.value() >= center.value()) {
-							isHighPoint = false;
-							break;
-						}
-					}
-				}
+				const bool higherPriorityBeats = (below[col] > c) | (center[col + 1] > c) | (below[col + 1] > c) | (above[col + 1] > c);
+				const bool lowerPriorityBeats = (above[col] >= c) | (center[col - 1] >= c) | (above[col - 1] >= c) | (below[col - 1] >= c);
+				isHighPoint[col] = ((coord_t)c >= _minHt) & !higherPriorityBeats & !lowerPriorityBeats;
+			}
 
-				if (isHighPoint) {
+			for (rowcol_t col = 0; col < csm.ncol(); ++col) {
+				if (isHighPoint[col]) {
 					candidates.push_back(csm.cellFromRowColUnsafe(row, col));
 				}
 			}
@@ -3,14 +3,14 @@
 #include"..\parameters\ParameterGetter.hpp"
 
 namespace lapis {
-	MaxPoint::MaxPoint(coord_t footprintDiameter)
-		:_footprintRadius(footprintDiameter/2.)
+	MaxPoint::MaxPoint(coord_t footprintDiameter, bool exactFootprint)
+		:_footprintRadius(footprintDiameter/2.), _exactFootprint(exactFootprint)
 	{
 	}
 	std::unique_ptr<CsmMaker> MaxPoint::getCsmMaker(const Alignment& a)
 	{
 		Alignment buffered = Alignment(bufferExtent(a, _footprintRadius), a.xOrigin(), a.yOrigin(), a.xres(), a.yres());
-		return std::make_unique<MaxPointCsmMaker>(buffered, _footprintRadius);
+		return std::make_unique<MaxPointCsmMaker>(buffered, _footprintRadius, _exactFootprint);
 	}
 	csm_t MaxPoint::combineCells(csm_t a, csm_t b)
 	{
@@ -25,7 +25,13 @@ namespace lapis {
 		if (_footprintRadius > 0) {
 			desc << "Returns were treated as circles with radius " <<
 				pdf.numberWithUnits(_footprintRadius, getter->unitSingular(), getter->unitPlural()) << ", ";
-			desc << "in order to account for the width of a lidar pulse.";
+			desc << "in order to account for the width of a lidar pulse. ";
+			if (_exactFootprint) {
+				desc << "Every cell touched by the circle was given the height of the return.";
+			}
+			else {
+				desc << "The circle was approximated by its center and eight points on its edge.";
+			}
 		}
 		pdf.writeTextBlockWithWrap(desc.str());
 	}
@@ -33,59 +39,136 @@ namespace lapis {
 	{
 		return _footprintRadius;
 	}
+	bool MaxPoint::exactFootprint()
+	{
+		return _exactFootprint;
+	}
+
+	//the purpose of this value is to avoid ties caused by the footprint algorithm messing with the high points TAO algorithm
+	//cells reached only by the edge of a footprint get a slightly lower value than the cell the return is actually in
+	static constexpr coord_t footprintEpsilon = -0.000001;
+
+	MaxPointCsmMaker::MaxPointCsmMaker(const Alignment& a, coord_t footprintRadius, bool exactFootprint)
+		: _align(a), _footprintRadius(footprintRadius), _exactFootprint(exactFootprint),
+		_heights(a.ncell(), std::numeric_limits<csm_t>::lowest())
+	{
+	}
+	void MaxPointCsmMaker::addPoints(const std::span<LasPoint>& points)
+	{
+		if (_footprintRadius == 0) {
+			_addPointsNoFootprint(points);
+		}
+		else if (_exactFootprint) {
+			_addPointsExactDisc(points);
+		}
+		else {
+			_addPointsNineSamples(points);
+		}
+	}
+	std::shared_ptr<Raster<csm_t>> MaxPointCsmMaker::currentCsm()
+	{
+		auto csm = std::make_shared<Raster<csm_t>>(_align);
+		for (cell_t cell = 0; cell < csm->ncell(); ++cell) {
+			if (_heights[cell] > std::numeric_limits<csm_t>::lowest()) {
+				csm->atCellUnsafe(cell).has_value() = true;
+				csm->atCellUnsafe(cell).value() = _heights[cell];
+			}
+		}
+		return csm;
+	}
 
-	MaxPointCsmMaker::MaxPointCsmMaker(const Alignment& a, coord_t footprintRadius)
-		: _footprintRadius(footprintRadius)
+	void MaxPointCsmMaker::_addPointsNoFootprint(const std::span<LasPoint>& points)
 	{
-		_csm = std::make_shared<Raster<csm_t>>(a);
+		//the cells are calculated for a batch of points at a time, which has no dependencies between points and so can be vectorized
+		//the max-updates can collide with each other, so they're done one at a time afterwards
+		constexpr size_t batchSize = 256;
+		std::array<cell_t, batchSize> cells;
+		const cell_t ncol = _align.ncol();
 
-		//there are generally far more points than cells, so it's worth it to do some goofy stuff to reduce the amount of work in the core loop
-		//in particular, this escapes the need to handle has_value() inside the point loop
-		for (cell_t cell : CellIterator(*_csm)) {
-			_csm->atCellUnsafe(cell).value() = std::numeric_limits<csm_t>::lowest();
+		for (size_t start = 0; start < points.size(); start += batchSize) {
+			size_t n = std::min(batchSize, points.size() - start);
+			const LasPoint* batch = points.data() + start;
+			for (size_t i = 0; i < n; ++i) {
+				cells[i] = _rowFromY(batch[i].y) * ncol + _colFromX(batch[i].x);
+			}
+			for (size_t i = 0; i < n; ++i) {
+				_update(cells[i], (csm_t)batch[i].z);
+			}
 		}
 	}
-	void MaxPointCsmMaker::addPoints(const std::span<LasPoint>& points)
+
+	void MaxPointCsmMaker::_addPointsNineSamples(const std::span<LasPoint>& points)
 	{
 		const coord_t diagonal = _footprintRadius / std::sqrt(2);
-		const coord_t epsilon = -0.000001; //the purpose of this value is to avoid ties caused by the footprint algorithm messing with the high points TAO algorithm
 		struct XYEpsilon {
 			coord_t x, y, epsilon;
 		};
-		std::vector<XYEpsilon> circle;
-		if (_footprintRadius == 0) {
-			circle = { {0.,0.,0.} };
-		}
-		else {
-			circle = { {0,0,0},
-				{_footprintRadius,0,epsilon},
-				{-_footprintRadius,0,epsilon},
-				{0,_footprintRadius,epsilon},
-				{0,-_footprintRadius,epsilon},
-				{diagonal,diagonal,2 * epsilon},
-				{diagonal,-diagonal,2 * epsilon},
-				{-diagonal,diagonal,2 * epsilon},
-				{-diagonal,-diagonal,2 * epsilon} };
-		}
+		const std::array<XYEpsilon, 9> circle = { {
+			{0,0,0},
+			{_footprintRadius,0,footprintEpsilon},
+			{-_footprintRadius,0,footprintEpsilon},
+			{0,_footprintRadius,footprintEpsilon},
+			{0,-_footprintRadius,footprintEpsilon},
+			{diagonal,diagonal,2 * footprintEpsilon},
+			{diagonal,-diagonal,2 * footprintEpsilon},
+			{-diagonal,diagonal,2 * footprintEpsilon},
+			{-diagonal,-diagonal,2 * footprintEpsilon} } };
+		const cell_t ncol = _align.ncol();
 
 		for (const LasPoint& p : points) {
-			for (const XYEpsilon& direction : circle) {
-				coord_t x = p.x + direction.x;
-				coord_t y = p.y + direction.y;
-				csm_t z = p.z + direction.epsilon;
-				cell_t cell = _csm->cellFromXYUnsafe(x, y);
+			rowcol_t minCol = _colFromX(p.x - _footprintRadius);
+			rowcol_t maxCol = _colFromX(p.x + _footprintRadius);
+			rowcol_t minRow = _rowFromY(p.y + _footprintRadius);
+			rowcol_t maxRow = _rowFromY(p.y - _footprintRadius);
+
+			//when the footprint is small compared to the cells, it usually doesn't leave the cell the return is in
+			//in that case, the center of the circle is the highest of the samples, so it's the only one that matters
+			if (minCol == maxCol && minRow == maxRow) {
+				_update(minRow * ncol + minCol, (csm_t)p.z);
+				continue;
+			}
 
-				_csm->atCellUnsafe(cell).value() = std::max(_csm->atCellUnsafe(cell).value(), z);
+			for (const XYEpsilon& direction : circle) {
+				cell_t cell = _rowFromY(p.y + direction.y) * ncol + _colFromX(p.x + direction.x);
+				_update(cell, (csm_t)(p.z + direction.epsilon));
 			}
 		}
 	}
-	std::shared_ptr<Raster<csm_t>> MaxPointCsmMaker::currentCsm()
+
+	void MaxPointCsmMaker::_addPointsExactDisc(const std::span<LasPoint>& points)
 	{
-		for (cell_t cell : CellIterator(*_csm)) {
-			if (_csm->atCellUnsafe(cell).value() > std::numeric_limits<csm_t>::lowest()) {
-				_csm->atCellUnsafe(cell).has_value() = true;
+		const coord_t radiusSq = _footprintRadius * _footprintRadius;
+		const coord_t xres = _align.xres();
+		const coord_t yres = _align.yres();
+		const cell_t ncol = _align.ncol();
+
+		for (const LasPoint& p : points) {
+			rowcol_t minCol = _colFromX(p.x - _footprintRadius);
+			rowcol_t maxCol = _colFromX(p.x + _footprintRadius);
+			rowcol_t minRow = _rowFromY(p.y + _footprintRadius);
+			rowcol_t maxRow = _rowFromY(p.y - _footprintRadius);
+
+			if (minCol == maxCol && minRow == maxRow) {
+				_update(minRow * ncol + minCol, (csm_t)p.z);
+				continue;
+			}
+
+			cell_t centerCell = _rowFromY(p.y) * ncol + _colFromX(p.x);
+			for (rowcol_t row = minRow; row <= maxRow; ++row) {
+				coord_t cellYmax = _align.ymax() - row * yres;
+				coord_t dy = std::max({ cellYmax - yres - p.y, p.y - cellYmax, (coord_t)0 });
+				for (rowcol_t col = minCol; col <= maxCol; ++col) {
+					coord_t cellXmin = _align.xmin() + col * xres;
+					coord_t dx = std::max({ cellXmin - p.x, p.x - cellXmin - xres, (coord_t)0 });
+
+					//the distance from the return to the nearest point of the cell
+					if (dx * dx + dy * dy >= radiusSq) {
+						continue;
+					}
+					cell_t cell = row * ncol + col;
+					_update(cell, (csm_t)(cell == centerCell ? p.z : p.z + footprintEpsilon));
+				}
 			}
 		}
-		return _csm;
 	}
 }
\ No newline at end of file
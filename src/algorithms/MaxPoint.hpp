@@ -8,19 +8,40 @@ namespace lapis {
 
 	class MaxPointCsmMaker : public CsmMaker {
 	public:
-		MaxPointCsmMaker(const Alignment& a, coord_t footprintRadius);
+		MaxPointCsmMaker(const Alignment& a, coord_t footprintRadius, bool exactFootprint = false);
 		void addPoints(const std::span<LasPoint>& points) override;
 		std::shared_ptr<Raster<csm_t>> currentCsm() override;
 	private:
+		Alignment _align;
 		coord_t _footprintRadius;
-		std::shared_ptr<Raster<csm_t>> _csm;
+		bool _exactFootprint;
+
+		//there are generally far more points than cells, so the heights are kept in a plain vector instead of a raster
+		//cells without any points are left at the lowest value of csm_t, and are turned into nodata in currentCsm
+		std::vector<csm_t> _heights;
+
+		//the same as the Unsafe functions in Alignment, but without the debug checks, and inlined so the point loops can be vectorized
+		rowcol_t _colFromX(coord_t x) const {
+			return std::min((rowcol_t)((x - _align.xmin()) / _align.xres()), _align.ncol() - 1);
+		}
+		rowcol_t _rowFromY(coord_t y) const {
+			return std::min((rowcol_t)((_align.ymax() - y) / _align.yres()), _align.nrow() - 1);
+		}
+		void _update(cell_t cell, csm_t z) {
+			_heights[cell] = std::max(_heights[cell], z);
+		}
+
+		void _addPointsNoFootprint(const std::span<LasPoint>& points);
+		void _addPointsNineSamples(const std::span<LasPoint>& points);
+		void _addPointsExactDisc(const std::span<LasPoint>& points);
 	};
 
 	//this is the simplest algorithm: each cell is assigned the height of the highest point that falls within it
 	//You can get a little fancy by providing a footprint size and modeling las returns as circles instead of points
+	//By default, the circle is approximated by its center and eight points on its edge. If exactFootprint is true, every cell the circle touches is used instead
 	class MaxPoint : public CsmAlgorithm {
 	public:
-		MaxPoint(coord_t footprintDiameter);
+		MaxPoint(coord_t footprintDiameter, bool exactFootprint = false);
 
 		std::unique_ptr<CsmMaker> getCsmMaker(const Alignment& a) override;
 
@@ -30,9 +51,11 @@ namespace lapis {
 
 		//just for testing
 		coord_t footprintRadius();
+		bool exactFootprint();
 
 	private:
 		coord_t _footprintRadius;
+		bool _exactFootprint;
 	};
 }
 
@@ -10,16 +10,10 @@ namespace lapis {
 	Raster<csm_t> SmoothAndFill::postProcess(const Raster<csm_t>& csm)
 	{
 
+		//both steps work from the original values, so the filled cells don't feed into the smoothing
 		Raster<csm_t> out{ (Alignment)csm };
-		for (cell_t cell = 0; cell < csm.ncell(); ++cell) {
-			if (csm[cell].has_value()) {
-				_smoothSingleValue(csm, out, cell);
-			}
-			else {
-				_fillSingleValue(csm, out, cell);
-			}
-		}
-
+		_smoothAll(csm, out);
+		_fillAll(csm, out);
 		return out;
 	}
 	void SmoothAndFill::describeInPdf(MetadataPdf& pdf, CsmParameterGetter* getter)
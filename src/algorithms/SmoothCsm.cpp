@@ -15,12 +15,7 @@ namespace lapis {
 		}
 
 		Raster<csm_t> out{ (Alignment)csm };
-		for (cell_t cell = 0; cell < csm.ncell(); ++cell) {
-			if (csm[cell].has_value()) {
-				_smoothSingleValue(csm, out, cell);
-			}
-		}
-
+		_smoothAll(csm, out);
 		return out;
 	}
 	void SmoothCsm::describeInPdf(MetadataPdf& pdf, CsmParameterGetter* getter)
@@ -35,26 +30,75 @@ namespace lapis {
 			<< "noise in the CSM.";
 		pdf.writeTextBlockWithWrap(desc.str());
 	}
-	void SmoothCsm::_smoothSingleValue(const Raster<csm_t>& original, Raster<csm_t>& out, cell_t cell)
+	void SmoothCsm::_smoothAll(const Raster<csm_t>& original, Raster<csm_t>& out)
 	{
-		csm_t numerator = 0;
-		csm_t denominator = 0;
-		rowcol_t row = original.rowFromCell(cell);
-		rowcol_t col = original.colFromCell(cell);
-		for (rowcol_t nudgeRow = std::max(0, row - _smoothLookDist); nudgeRow <= std::min(original.nrow() - 1, row + _smoothLookDist); ++nudgeRow) {
-			for (rowcol_t nudgeCol = std::max(0, col - _smoothLookDist); nudgeCol <= std::min(original.ncol() - 1, col + _smoothLookDist); ++nudgeCol) {
-				auto v = original.atRCUnsafe(nudgeRow, nudgeCol);
-				if (v.has_value()) {
-					numerator += v.value();
-					denominator++;
+		//the window sums are calculated in two passes: first the sum of each column of the window, then a sliding sum of those along the row
+		//the rows are handled in blocks, so only a few rows of the original need to be copied into plain arrays at once
+		const rowcol_t k = _smoothLookDist;
+		const rowcol_t nrow = original.nrow();
+		const rowcol_t ncol = original.ncol();
+		constexpr rowcol_t blockRows = 64;
+
+		std::vector<csm_t> values;
+		std::vector<int> hasValue;
+		std::vector<double> colSum(ncol);
+		std::vector<int> colCount(ncol);
+
+		for (rowcol_t blockStart = 0; blockStart < nrow; blockStart += blockRows) {
+			rowcol_t blockEnd = std::min(nrow, blockStart + blockRows);
+			rowcol_t firstRow = std::max(0, blockStart - k);
+			rowcol_t lastRow = std::min(nrow - 1, blockEnd - 1 + k);
+
+			size_t nvals = (size_t)(lastRow - firstRow + 1) * ncol;
+			values.assign(nvals, 0);
+			hasValue.assign(nvals, 0);
+			for (rowcol_t row = firstRow; row <= lastRow; ++row) {
+				size_t offset = (size_t)(row - firstRow) * ncol;
+				for (rowcol_t col = 0; col < ncol; ++col) {
+					auto v = original.atRCUnsafe(row, col);
+					if (v.has_value()) {
+						values[offset + col] = v.value();
+						hasValue[offset + col] = 1;
+					}
+				}
+			}
+
+			for (rowcol_t row = blockStart; row < blockEnd; ++row) {
+				std::fill(colSum.begin(), colSum.end(), 0.);
+				std::fill(colCount.begin(), colCount.end(), 0);
+				for (rowcol_t windowRow = std::max(0, row - k); windowRow <= std::min(nrow - 1, row + k); ++windowRow) {
+					const csm_t* v = values.data() + (size_t)(windowRow - firstRow) * ncol;
+					const int* h = hasValue.data() + (size_t)(windowRow - firstRow) * ncol;
+					for (rowcol_t col = 0; col < ncol; ++col) {
+						colSum[col] += v[col];
+						colCount[col] += h[col];
+					}
+				}
+
+				const int* thisRowHas = hasValue.data() + (size_t)(row - firstRow) * ncol;
+				double sum = 0;
+				int count = 0;
+				for (rowcol_t col = 0; col < std::min(k, ncol); ++col) {
+					sum += colSum[col];
+					count += colCount[col];
+				}
+				for (rowcol_t col = 0; col < ncol; ++col) {
+					if (col + k < ncol) {
+						sum += colSum[col + k];
+						count += colCount[col + k];
+					}
+					if (col - k - 1 >= 0) {
+						sum -= colSum[col - k - 1];
+						count -= colCount[col - k - 1];
+					}
+					if (!thisRowHas[col] || count == 0) {
+						continue;
+					}
+					auto v = out.atRCUnsafe(row, col);
+					v.has_value() = true;
+					v.value() = (csm_t)(sum / count);
 				}
 			}
 		}
-		if (denominator == 0) {
-			return;
-		}
-		auto v = out[cell];
-		v.has_value() = true;
-		v.value() = numerator / denominator;
 	}
 }
\ No newline at end of file
@@ -14,7 +14,8 @@ namespace lapis {
 		void describeInPdf(MetadataPdf& pdf, CsmParameterGetter* getter) override;
 
 	protected:
-		void _smoothSingleValue(const Raster<csm_t>& original, Raster<csm_t>& out, cell_t cell);
+		//sets every cell of out which has a value in original to the mean of the window around it in original
+		void _smoothAll(const Raster<csm_t>& original, Raster<csm_t>& out);
 
 	private:
 		int _smoothLookDist;
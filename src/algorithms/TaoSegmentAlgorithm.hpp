@@ -17,6 +17,10 @@ namespace lapis {
 
 		virtual Raster<taoid_t> segment(const Raster<csm_t>& csm, const std::vector<cell_t>& taos, UniqueIdGenerator& idGenerator) = 0;
 
+		//the number of tiles which haven't been started yet, for algorithms which can put idle threads to work on the last few
+		//this is called before each tile is segmented, and calls from different threads can arrive out of order
+		virtual void setTilesRemaining(cell_t nTile) {}
+
 		virtual void describeInPdf(MetadataPdf& pdf, TaoParameterGetter* getter) = 0;
 	};
 
@@ -30,7 +34,7 @@ namespace lapis {
 	class GenerateIdByTile : public UniqueIdGenerator {
 	public:
 		GenerateIdByTile(cell_t nTiles, cell_t thisTile)
-			: _nTiles((taoid_t)nTiles), _previousId((taoid_t)(thisTile - nTiles + 1))
+			: _nTiles((taoid_t)nTiles), _firstId((taoid_t)(thisTile + 1)), _previousId((taoid_t)(thisTile - nTiles + 1))
 		{
 		}
 		taoid_t nextId()
@@ -38,8 +42,18 @@ namespace lapis {
 			_previousId += _nTiles;
 			return _previousId;
 		}
+		//the position of the id in the sequence this generator produces, or -1 if the id can't come from this generator
+		int64_t indexOf(taoid_t id) const
+		{
+			int64_t offset = (int64_t)id - (int64_t)_firstId;
+			if (offset < 0 || offset % _nTiles != 0) {
+				return -1;
+			}
+			return offset / _nTiles;
+		}
 	private:
 		taoid_t _nTiles;
+		taoid_t _firstId;
 		taoid_t _previousId;
 	};
 }
@@ -5,43 +5,68 @@
 
 namespace lapis {
 	//this data structure is taken from https://www.researchgate.net/publication/261191274_Hierarchical_Queues_general_description_and_implementation_in_MAMBA_Image_library
+	//each bin is a FIFO list threaded through an array indexed by cell, so nothing is allocated after construction
+	//this relies on each cell being in the queue at most once at a time, which the watershed guarantees
+	//the next array can be shared between queues, as long as they never hold the same cells
 	class HierarchicalQueue {
 	public:
-		HierarchicalQueue(csm_t min, csm_t max, csm_t binSize);
+		HierarchicalQueue(csm_t min, csm_t max, csm_t binSize, std::vector<cell_t>& next);
 
 		void push(csm_t height, cell_t cell);
 
 		//pops the next element of the queue and returns it, or returns -1 if the queue is empty
 		cell_t popAndReturn();
 
-		size_t size();
+		size_t size() const;
+
+		//the bin a value would go in if the queue were just started
+		size_t bin(csm_t height) const;
+
+		//returns an empty queue to its initial state
+		void restart();
 
 	private:
-		csm_t min, max, binSize;
-		size_t currentQueue;
-		std::vector<std::queue<cell_t>> queues;
-		size_t _size;
+		csm_t _max, _binSize;
+		size_t _currentBin = 0;
+		size_t _size = 0;
+		std::vector<cell_t> _heads;
+		std::vector<cell_t> _tails;
+		std::vector<cell_t>& _next;
 	};
 
-	size_t HierarchicalQueue::size() {
+	HierarchicalQueue::HierarchicalQueue(csm_t min, csm_t max, csm_t binSize, std::vector<cell_t>& next)
+		: _max(max), _binSize(binSize), _next(next)
+	{
+		size_t nBins = std::max((size_t)std::ceil((max - min) / binSize), (size_t)1);
+		_heads.resize(nBins, -1);
+		_tails.resize(nBins, -1);
+	}
+
+	size_t HierarchicalQueue::size() const {
 		return _size;
 	}
 
-	HierarchicalQueue::HierarchicalQueue(csm_t min, csm_t max, csm_t binSize) {
-		this->min = min;
-		this->max = max;
-		this->binSize = binSize;
-		currentQueue = 0;
-		size_t nBins = (size_t)std::ceil((max - min) / binSize);
-		queues = std::vector<std::queue<cell_t>>(nBins);
-		_size = 0;
+	size_t HierarchicalQueue::bin(csm_t height) const {
+		//values above the max go in the first bin
+		size_t bin = height >= _max ? 0 : (size_t)((_max - height) / _binSize);
+		return std::min(bin, _heads.size() - 1); //this is needed if the value is exactly equal to min
+	}
+
+	void HierarchicalQueue::restart() {
+		_currentBin = 0;
 	}
 
 	void HierarchicalQueue::push(csm_t height, cell_t cell) {
-		size_t bin = (size_t)((max - height) / binSize);
-		bin = std::max(bin, currentQueue);
-		bin = std::min(bin, queues.size() - 1); //this is needed if the value is exactly equal to min
-		queues[bin].push(cell);
+		size_t bin = std::max(this->bin(height), _currentBin);
+
+		_next[cell] = -1;
+		if (_tails[bin] < 0) {
+			_heads[bin] = cell;
+		}
+		else {
+			_next[_tails[bin]] = cell;
+		}
+		_tails[bin] = cell;
 		++_size;
 	}
 
@@ -49,75 +74,243 @@ namespace lapis {
 		if (_size == 0) {
 			return -1;
 		}
-		while (!queues[currentQueue].size()) {
-			currentQueue++;
+		while (_heads[_currentBin] < 0) {
+			_currentBin++;
+		}
+		cell_t out = _heads[_currentBin];
+		_heads[_currentBin] = _next[out];
+		if (_heads[_currentBin] < 0) {
+			_tails[_currentBin] = -1;
 		}
-		cell_t out = queues[currentQueue].front();
-		queues[currentQueue].pop();
 		--_size;
 		return out;
 	}
-	WatershedSegment::WatershedSegment(coord_t canopyCutoff, coord_t maxHt, coord_t binSize)
-		: _canopyCutoff(canopyCutoff), _maxHt(maxHt), _binSize(binSize)
+	//counts the calls to segment which are currently running, even if one throws
+	class ActiveCall {
+	public:
+		ActiveCall(std::atomic<int>& counter) : _counter(counter), _nActive(++counter) {}
+		~ActiveCall() { --_counter; }
+		ActiveCall(const ActiveCall&) = delete;
+		ActiveCall& operator=(const ActiveCall&) = delete;
+
+		//the number of calls running when this one started, including itself
+		int nActive() const { return _nActive; }
+	private:
+		std::atomic<int>& _counter;
+		int _nActive;
+	};
+
+	WatershedSegment::WatershedSegment(coord_t canopyCutoff, coord_t maxHt, coord_t binSize, int nThread, cell_t minCellsForThreads)
+		: _canopyCutoff(canopyCutoff), _maxHt(maxHt), _binSize(binSize), _nThread(std::max(nThread, 1)), _minCellsForThreads(minCellsForThreads)
 	{
 	}
+	void WatershedSegment::setTilesRemaining(cell_t nTile)
+	{
+		cell_t current = _tilesRemaining;
+		while (nTile < current && !_tilesRemaining.compare_exchange_weak(current, nTile)) {
+		}
+	}
+	int WatershedSegment::_threadsForCall(const Raster<csm_t>& csm, int activeCalls) const
+	{
+		//small tiles finish faster than the threads can be started, and until the last few tiles the other threads have their own tiles to work on
+		if (_nThread == 1 || csm.ncell() < _minCellsForThreads || _tilesRemaining >= _nThread) {
+			return 1;
+		}
+		//the tiles still running split the threads between them
+		return std::max(_nThread / activeCalls, 1);
+	}
 	Raster<taoid_t> WatershedSegment::segment(const Raster<csm_t>& csm, const std::vector<cell_t>& taos, UniqueIdGenerator& idGenerator)
 	{
 		//this is modified from https://arxiv.org/pdf/1511.04463.pdf
 		//algorithm 5 on page 15
-		HierarchicalQueue open{ _canopyCutoff, _maxHt, _binSize };
-		const taoid_t CANDIDATE = -2;
-		const taoid_t QUEUED = -3;
-		const taoid_t INTENTIONALLY_UNABELLED = 0;
-		Raster<taoid_t> labels((Alignment)csm);
-		for (cell_t cell = 0; cell < labels.ncell(); ++cell) {
-			if (csm[cell].has_value()) {
-				labels[cell].has_value() = true;
-				if (csm[cell].value() >= _canopyCutoff) {
-					labels[cell].value() = CANDIDATE;
-				}
-				else {
-					labels[cell].value() = INTENTIONALLY_UNABELLED;
+
+		ActiveCall call{ _activeCalls };
+		int nThread = _threadsForCall(csm, call.nActive());
+
+		//the labels and heights are stored with a one-pixel border of NO_DATA, so neighbors can be found with fixed offsets
+		//and no bounds checks
+		const cell_t stride = (cell_t)csm.ncol() + 2;
+		const cell_t nPadded = stride * ((cell_t)csm.nrow() + 2);
+
+		std::vector<taoid_t> labels(nPadded, NO_DATA);
+		std::vector<csm_t> heights(nPadded, 0);
+		for (rowcol_t row = 0; row < csm.nrow(); ++row) {
+			cell_t paddedStart = (row + 1) * stride + 1;
+			for (rowcol_t col = 0; col < csm.ncol(); ++col) {
+				auto v = csm.atRCUnsafe(row, col);
+				if (v.has_value()) {
+					heights[paddedStart + col] = v.value();
+					labels[paddedStart + col] = v.value() >= _canopyCutoff ? CANDIDATE : INTENTIONALLY_UNLABELLED;
 				}
 			}
 		}
 
+		std::vector<cell_t> seeds;
+		seeds.reserve(taos.size());
 		for (const cell_t& c : taos) {
-			labels[c].value() = QUEUED;
-			open.push(csm[c].value(), c);
+			cell_t p = (csm.rowFromCellUnsafe(c) + 1) * stride + csm.colFromCellUnsafe(c) + 1;
+			if (labels[p] == NO_DATA || labels[p] == QUEUED) {
+				continue;
+			}
+			labels[p] = QUEUED;
+			seeds.push_back(p);
 		}
 
-		while (open.size()) {
-			cell_t c;
-			c = open.popAndReturn();
-			if (labels[c].has_value() && labels[c].value() == QUEUED) {
-				labels[c].value() = idGenerator.nextId();
-			}
-			rowcol_t row = labels.rowFromCellUnsafe(c);
-			rowcol_t col = labels.colFromCellUnsafe(c);
+		std::vector<std::vector<cell_t>> regions;
+		if (nThread > 1) {
+			regions = _seedsByRegion(seeds, labels, csm.nrow(), stride, nThread);
+		}
+
+		//all of the seeds are pushed before flooding starts, so within a bin they're popped before anything else, in the order given
+		//that means the ids can be handed out up front, in the same order the queue would have produced them
+		std::vector<cell_t> next(nPadded, -1);
+		HierarchicalQueue open{ _canopyCutoff, _maxHt, _binSize, next };
+		std::vector<cell_t> popOrder = seeds;
+		std::stable_sort(popOrder.begin(), popOrder.end(), [&](cell_t a, cell_t b) {return open.bin(heights[a]) < open.bin(heights[b]); });
+		for (cell_t c : popOrder) {
+			labels[c] = idGenerator.nextId();
+		}
 
-			struct rc { rowcol_t row, col; };
-			std::vector<rc> neighbors = { {row + 1,col},{row - 1,col},{row,col + 1},{row,col - 1},
-				{row + 1,col + 1},{row - 1,col - 1},{row + 1,col - 1},{row - 1,col + 1}
+		if (regions.size() <= 1) {
+			_flood(seeds, open, labels, heights, stride);
+		}
+		else {
+			//the regions are independent of each other, so flooding them separately gives the same result as flooding them together
+			std::sort(regions.begin(), regions.end(), [](const auto& a, const auto& b) {return a.size() > b.size(); });
+			std::atomic<size_t> nextRegion = 0;
+			auto floodThread = [&]() {
+				HierarchicalQueue threadQueue{ _canopyCutoff, _maxHt, _binSize, next };
+				for (size_t i = nextRegion++; i < regions.size(); i = nextRegion++) {
+					_flood(regions[i], threadQueue, labels, heights, stride);
+				}
 			};
-			for (auto& thisRC : neighbors) {
-				rowcol_t rowNudge = thisRC.row;
-				rowcol_t colNudge = thisRC.col;
-				if (rowNudge < 0 || colNudge < 0 || rowNudge >= csm.nrow() || colNudge >= csm.ncol()) {
-					continue;
+			std::vector<std::thread> threads;
+			for (int i = 0; i < std::min(nThread, (int)regions.size()); ++i) {
+				threads.push_back(std::thread(floodThread));
+			}
+			for (std::thread& t : threads) {
+				t.join();
+			}
+		}
+
+		Raster<taoid_t> out((Alignment)csm);
+		for (rowcol_t row = 0; row < csm.nrow(); ++row) {
+			cell_t paddedStart = (row + 1) * stride + 1;
+			for (rowcol_t col = 0; col < csm.ncol(); ++col) {
+				taoid_t label = labels[paddedStart + col];
+				if (label != NO_DATA) {
+					auto v = out.atRCUnsafe(row, col);
+					v.has_value() = true;
+					v.value() = label;
 				}
-				cell_t n = csm.cellFromRowColUnsafe(rowNudge, colNudge);
-				if (!labels[n].has_value() || labels[n] != CANDIDATE) {
+			}
+		}
+		return out;
+	}
+	void WatershedSegment::_flood(const std::vector<cell_t>& seeds, HierarchicalQueue& open, std::vector<taoid_t>& labels,
+		const std::vector<csm_t>& heights, cell_t stride) const
+	{
+		open.restart();
+		for (cell_t c : seeds) {
+			open.push(heights[c], c);
+		}
+
+		const std::array<cell_t, 8> neighborOffsets = { stride, -stride, 1, -1, stride + 1, -stride - 1, stride - 1, -stride + 1 };
+		while (open.size()) {
+			cell_t c = open.popAndReturn();
+			const taoid_t label = labels[c];
+			for (cell_t offset : neighborOffsets) {
+				cell_t n = c + offset;
+				if (labels[n] != CANDIDATE) {
 					continue;
 				}
-				labels[n].value() = labels[c].value();
+				labels[n] = label;
 				//the original algorithm had an optimization here using a regular queue but that was only an optimization
 				//if the cells you started from were kind of arbitrary
 				//by handpicking high points, it's unneccesary, and comes with a bit of overhead as well
-				open.push(csm[n].value(), n);
+				open.push(heights[n], n);
 			}
 		}
-		return labels;
+	}
+	std::vector<std::vector<cell_t>> WatershedSegment::_seedsByRegion(const std::vector<cell_t>& seeds, const std::vector<taoid_t>& labels,
+		rowcol_t nrow, cell_t stride, int nThread) const
+	{
+		//a union-find over the padded cells; -1 for cells which can't be flooded
+		std::vector<cell_t> parent(labels.size(), -1);
+		auto find = [&](cell_t c) {
+			while (parent[c] != c) {
+				parent[c] = parent[parent[c]];
+				c = parent[c];
+			}
+			return c;
+		};
+		auto unite = [&](cell_t a, cell_t b) {
+			a = find(a);
+			b = find(b);
+			if (a != b) {
+				parent[std::max(a, b)] = std::min(a, b);
+			}
+		};
+		auto floodable = [&](cell_t c) {
+			return labels[c] == CANDIDATE || labels[c] == QUEUED;
+		};
+
+		//each strip only looks at the rows above it within the strip, so the threads never touch the same cells
+		rowcol_t stripHeight = (nrow + nThread - 1) / nThread;
+		auto labelStrip = [&](rowcol_t firstRow, rowcol_t lastRow) {
+			for (rowcol_t row = firstRow; row < lastRow; ++row) {
+				cell_t paddedStart = (row + 1) * stride + 1;
+				for (cell_t c = paddedStart; c < paddedStart + stride - 2; ++c) {
+					if (!floodable(c)) {
+						continue;
+					}
+					parent[c] = c;
+					if (parent[c - 1] >= 0) {
+						unite(c, c - 1);
+					}
+					if (row > firstRow) {
+						for (cell_t n : { c - stride - 1, c - stride, c - stride + 1 }) {
+							if (parent[n] >= 0) {
+								unite(c, n);
+							}
+						}
+					}
+				}
+			}
+		};
+		std::vector<std::thread> threads;
+		for (rowcol_t firstRow = 0; firstRow < nrow; firstRow += stripHeight) {
+			threads.push_back(std::thread(labelStrip, firstRow, std::min(firstRow + stripHeight, nrow)));
+		}
+		for (std::thread& t : threads) {
+			t.join();
+		}
+
+		//joining the strips at the seams
+		for (rowcol_t row = stripHeight; row < nrow; row += stripHeight) {
+			cell_t paddedStart = (row + 1) * stride + 1;
+			for (cell_t c = paddedStart; c < paddedStart + stride - 2; ++c) {
+				if (parent[c] < 0) {
+					continue;
+				}
+				for (cell_t n : { c - stride - 1, c - stride, c - stride + 1 }) {
+					if (parent[n] >= 0) {
+						unite(c, n);
+					}
+				}
+			}
+		}
+
+		std::vector<std::vector<cell_t>> out;
+		std::unordered_map<cell_t, size_t> regionIndex;
+		for (cell_t c : seeds) {
+			auto [it, added] = regionIndex.emplace(find(c), out.size());
+			if (added) {
+				out.emplace_back();
+			}
+			out[it->second].push_back(c);
+		}
+		return out;
 	}
 	void WatershedSegment::describeInPdf(MetadataPdf& pdf, TaoParameterGetter* getter)
 	{
@@ -5,18 +5,48 @@
 #include"TaoSegmentAlgorithm.hpp"
 
 namespace lapis {
+	class HierarchicalQueue;
+
 	class WatershedSegment : public TaoSegmentAlgorithm {
 	public:
-		WatershedSegment(coord_t canopyCutoff, coord_t maxHt, coord_t binSize);
+		//if nThread is more than 1, tiles with at least minCellsForThreads cells are segmented using several threads once
+		//setTilesRemaining reports fewer tiles left than there are threads. The output is identical to the single-threaded algorithm
+		WatershedSegment(coord_t canopyCutoff, coord_t maxHt, coord_t binSize, int nThread = 1, cell_t minCellsForThreads = 1024 * 1024);
 
 		Raster<taoid_t> segment(const Raster<csm_t>& csm, const std::vector<cell_t>& taos, UniqueIdGenerator& idGenerator);
 
+		//only the smallest count reported is kept, since the tiles are started in order
+		void setTilesRemaining(cell_t nTile) override;
+
 		void describeInPdf(MetadataPdf& pdf, TaoParameterGetter* getter);
 
 	private:
 		coord_t _canopyCutoff;
 		coord_t _maxHt;
 		coord_t _binSize;
+		int _nThread;
+		cell_t _minCellsForThreads;
+		std::atomic<cell_t> _tilesRemaining = std::numeric_limits<cell_t>::max();
+		std::atomic<int> _activeCalls = 0;
+
+	protected:
+		//the number of threads a call to segment should use
+		int _threadsForCall(const Raster<csm_t>& csm, int activeCalls) const;
+
+	private:
+		static constexpr taoid_t CANDIDATE = (taoid_t)-2;
+		static constexpr taoid_t QUEUED = (taoid_t)-3;
+		static constexpr taoid_t NO_DATA = (taoid_t)-4;
+		static constexpr taoid_t INTENTIONALLY_UNLABELLED = 0;
+
+		//floods outwards from the seeds, which must already have their final labels. The labels and heights have a one-pixel border
+		void _flood(const std::vector<cell_t>& seeds, HierarchicalQueue& open, std::vector<taoid_t>& labels,
+			const std::vector<csm_t>& heights, cell_t stride) const;
+
+		//groups the seeds by the connected region of CANDIDATE and QUEUED cells they're in, which can't affect each other while flooding
+		//the labelling is done in horizontal strips on separate threads, and then joined at the seams
+		std::vector<std::vector<cell_t>> _seedsByRegion(const std::vector<cell_t>& seeds, const std::vector<taoid_t>& labels,
+			rowcol_t nrow, cell_t stride, int nThread) const;
 	};
 }
 
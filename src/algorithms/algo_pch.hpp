@@ -4,6 +4,7 @@
 
 #include<vector>
 #include<queue>
+#include<atomic>
 #include<ranges>
 
 #include"..\gis\Raster.hpp"
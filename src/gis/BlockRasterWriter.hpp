@@ -0,0 +1,85 @@
+#pragma once
+#ifndef LP_BLOCKRASTERWRITER_H
+#define LP_BLOCKRASTERWRITER_H
+
+#include"Raster.hpp"
+
+namespace lapis {
+
+	//Writes a GeoTIFF in pieces, so a raster can be output as its values become available instead of being held in memory until the end.
+	//The file is tiled internally, and compressed unless told not to be; writes which line up with the tiles don't need to touch the rest of the file.
+	//Tiles which are never written are read as nodata
+	template<class T>
+	class BlockRasterWriter {
+	public:
+		//blockSize is the internal tile size of the file, and must be a multiple of 16
+		BlockRasterWriter(const std::string& file, const Alignment& a, rowcol_t blockSize,
+			GeoTiffCompression compression = GeoTiffCompression::Deflate, const T navalue = std::numeric_limits<T>::lowest());
+
+		BlockRasterWriter(const BlockRasterWriter&) = delete;
+		BlockRasterWriter& operator=(const BlockRasterWriter&) = delete;
+
+		//r must be consistent with the alignment given in the constructor and be contained in it
+		//this function is thread-safe
+		void writeBlock(const Raster<T>& r);
+
+	private:
+		Alignment _align;
+		T _navalue;
+		GDALDatasetWrapper _wgd;
+		std::mutex _mut;
+
+		static std::vector<std::string> _creationOptions(rowcol_t blockSize, GeoTiffCompression compression);
+	};
+
+	template<class T>
+	inline BlockRasterWriter<T>::BlockRasterWriter(const std::string& file, const Alignment& a, rowcol_t blockSize,
+		GeoTiffCompression compression, const T navalue)
+		: _align(a), _navalue(navalue),
+		_wgd("GTiff", file, a.ncol(), a.nrow(), Raster<T>::GDT(), _creationOptions(blockSize, compression))
+	{
+		if (_wgd.isNull()) {
+			throw InvalidRasterFileException("Unable to open " + file + " as a raster");
+		}
+		std::array<double, 6> gt = { a.xmin(), a.xres(), 0, a.ymax(), 0, -a.yres() };
+		_wgd->SetGeoTransform(gt.data());
+		_wgd->SetProjection(a.crs().getCompleteWKT().c_str());
+		_wgd->GetRasterBand(1)->SetNoDataValue((double)navalue);
+	}
+
+	template<class T>
+	inline std::vector<std::string> BlockRasterWriter<T>::_creationOptions(rowcol_t blockSize, GeoTiffCompression compression)
+	{
+		//the file is tiled even without compression, so each block can be written without touching the rest of the file
+		std::vector<std::string> out = { "TILED=YES", "BLOCKXSIZE=" + std::to_string(blockSize), "BLOCKYSIZE=" + std::to_string(blockSize),
+			"SPARSE_OK=TRUE", "BIGTIFF=IF_SAFER" };
+		for (const std::string& option : compressionCreationOptions(compression, Raster<T>::GDT())) {
+			out.push_back(option);
+		}
+		return out;
+	}
+
+	template<class T>
+	inline void BlockRasterWriter<T>::writeBlock(const Raster<T>& r)
+	{
+		if (!_align.consistentAlignment(r)) {
+			throw AlignmentMismatchException("Alignment mismatch in writeBlock");
+		}
+		rowcol_t rowOffset = _align.rowFromYUnsafe(r.ymax() - r.yres() / 2);
+		rowcol_t colOffset = _align.colFromXUnsafe(r.xmin() + r.xres() / 2);
+		if (rowOffset < 0 || colOffset < 0 || rowOffset + r.nrow() > _align.nrow() || colOffset + r.ncol() > _align.ncol()) {
+			throw OutsideExtentException("Outside extent in writeBlock");
+		}
+
+		std::vector<T> values(r.ncell());
+		for (cell_t cell = 0; cell < r.ncell(); ++cell) {
+			values[cell] = r[cell].has_value() ? r[cell].value() : _navalue;
+		}
+
+		std::lock_guard lock{ _mut };
+		_wgd->GetRasterBand(1)->RasterIO(GF_Write, colOffset, rowOffset, r.ncol(), r.nrow(),
+			values.data(), r.ncol(), r.nrow(), Raster<T>::GDT(), 0, 0);
+	}
+}
+
+#endif
@@ -0,0 +1,121 @@
+#include"gis_pch.hpp"
+#include"ExtentIndex.hpp"
+
+namespace lapis {
+
+	ExtentIndex::ExtentIndex(const std::vector<Extent>& extents) : _extents(extents)
+	{
+		if (_extents.empty()) {
+			return;
+		}
+
+		coord_t xmax = _extents[0].xmax();
+		coord_t ymax = _extents[0].ymax();
+		_xmin = _extents[0].xmin();
+		_ymin = _extents[0].ymin();
+		coord_t totalWidth = 0, totalHeight = 0;
+		for (const Extent& e : _extents) {
+			_xmin = std::min(_xmin, e.xmin());
+			_ymin = std::min(_ymin, e.ymin());
+			xmax = std::max(xmax, e.xmax());
+			ymax = std::max(ymax, e.ymax());
+			totalWidth += e.xmax() - e.xmin();
+			totalHeight += e.ymax() - e.ymin();
+		}
+
+		_cellsize = std::max(totalWidth, totalHeight) / _extents.size();
+		if (_cellsize <= 0) {
+			_cellsize = std::max({ xmax - _xmin, ymax - _ymin, (coord_t)1 });
+		}
+		//a few very small extents spread over a large area shouldn't produce an enormous grid
+		size_t maxCells = 4 * _extents.size() + 1;
+		while (true) {
+			_ncol = (rowcol_t)std::floor((xmax - _xmin) / _cellsize) + 1;
+			_nrow = (rowcol_t)std::floor((ymax - _ymin) / _cellsize) + 1;
+			if ((size_t)_ncol * (size_t)_nrow <= maxCells) {
+				break;
+			}
+			_cellsize *= 2;
+		}
+
+		cell_t ncell = (cell_t)_nrow * _ncol;
+		std::vector<size_t> counts(ncell, 0);
+		GridRange gr;
+		for (const Extent& e : _extents) {
+			_gridRange(e, gr);
+			for (rowcol_t row = gr.minrow; row <= gr.maxrow; ++row) {
+				for (rowcol_t col = gr.mincol; col <= gr.maxcol; ++col) {
+					counts[(cell_t)row * _ncol + col]++;
+				}
+			}
+		}
+
+		_cellStarts.resize(ncell + 1, 0);
+		for (cell_t cell = 0; cell < ncell; ++cell) {
+			_cellStarts[cell + 1] = _cellStarts[cell] + counts[cell];
+		}
+		_entries.resize(_cellStarts[ncell]);
+
+		//filling in index order keeps each cell's entries sorted
+		std::vector<size_t> fill(_cellStarts.begin(), _cellStarts.end() - 1);
+		for (size_t i = 0; i < _extents.size(); ++i) {
+			_gridRange(_extents[i], gr);
+			for (rowcol_t row = gr.minrow; row <= gr.maxrow; ++row) {
+				for (rowcol_t col = gr.mincol; col <= gr.maxcol; ++col) {
+					_entries[fill[(cell_t)row * _ncol + col]++] = i;
+				}
+			}
+		}
+	}
+
+	std::vector<size_t> ExtentIndex::overlapping(const Extent& e) const
+	{
+		std::vector<size_t> out;
+		GridRange gr;
+		if (_extents.empty() || !_gridRange(e, gr)) {
+			return out;
+		}
+
+		for (rowcol_t row = gr.minrow; row <= gr.maxrow; ++row) {
+			for (rowcol_t col = gr.mincol; col <= gr.maxcol; ++col) {
+				cell_t cell = (cell_t)row * _ncol + col;
+				for (size_t j = _cellStarts[cell]; j < _cellStarts[cell + 1]; ++j) {
+					size_t i = _entries[j];
+					if (_extents[i].overlapsUnsafe(e)) {
+						out.push_back(i);
+					}
+				}
+			}
+		}
+
+		//extents which span several grid cells will be found more than once
+		std::sort(out.begin(), out.end());
+		out.erase(std::unique(out.begin(), out.end()), out.end());
+		return out;
+	}
+
+	size_t ExtentIndex::size() const
+	{
+		return _extents.size();
+	}
+
+	bool ExtentIndex::_gridRange(const Extent& e, GridRange& out) const
+	{
+		auto toCol = [&](coord_t x) {
+			return (rowcol_t)std::clamp(std::floor((x - _xmin) / _cellsize), (coord_t)0, (coord_t)(_ncol - 1));
+		};
+		auto toRow = [&](coord_t y) {
+			return (rowcol_t)std::clamp(std::floor((y - _ymin) / _cellsize), (coord_t)0, (coord_t)(_nrow - 1));
+		};
+		coord_t gridXmax = _xmin + _cellsize * _ncol;
+		coord_t gridYmax = _ymin + _cellsize * _nrow;
+		if (e.xmax() < _xmin || e.xmin() > gridXmax || e.ymax() < _ymin || e.ymin() > gridYmax) {
+			return false;
+		}
+		out.mincol = toCol(e.xmin());
+		out.maxcol = toCol(e.xmax());
+		out.minrow = toRow(e.ymin());
+		out.maxrow = toRow(e.ymax());
+		return true;
+	}
+}
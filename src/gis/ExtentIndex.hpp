@@ -0,0 +1,42 @@
+#pragma once
+#ifndef LP_EXTENTINDEX_H
+#define LP_EXTENTINDEX_H
+
+#include"gis_pch.hpp"
+#include"Extent.hpp"
+
+namespace lapis {
+
+	//A spatial index over a fixed set of extents, for finding the ones which overlap a query extent without checking all of them.
+	//The extents are binned into a uniform grid with cells about the size of an average extent, which suits collections like
+	//las tiles, where the extents are similarly sized and spread over an area
+	//The CRS of the extents isn't checked; ensuring the query is in the same CRS as the extents is the responsibility of the caller
+	class ExtentIndex {
+	public:
+		ExtentIndex() = default;
+		ExtentIndex(const std::vector<Extent>& extents);
+
+		//returns the indices, in increasing order, of the extents which overlap e, in the same sense as Extent::overlaps
+		std::vector<size_t> overlapping(const Extent& e) const;
+
+		size_t size() const;
+
+	private:
+		std::vector<Extent> _extents;
+
+		coord_t _xmin = 0, _ymin = 0, _cellsize = 1;
+		rowcol_t _nrow = 0, _ncol = 0;
+
+		//the extents in each grid cell are _entries[_cellStarts[cell]] through _entries[_cellStarts[cell+1]-1]
+		std::vector<size_t> _cellStarts;
+		std::vector<size_t> _entries;
+
+		struct GridRange {
+			rowcol_t minrow, maxrow, mincol, maxcol;
+		};
+		//returns false if the extent doesn't touch the grid at all
+		bool _gridRange(const Extent& e, GridRange& out) const;
+	};
+}
+
+#endif
@@ -12,11 +12,41 @@ namespace lapis {
 
 	//creates according to GDALDrive::Create()
 
-	GDALDatasetWrapper::GDALDatasetWrapper(const std::string& driver, const std::string& file, int ncol, int nrow, GDALDataType gdt) {
+	GDALDatasetWrapper::GDALDatasetWrapper(const std::string& driver, const std::string& file, int ncol, int nrow, GDALDataType gdt,
+		const std::vector<std::string>& options) {
 		GDALRegisterWrapper::allRegister();
 		GDALDriver* d = GetGDALDriverManager()->GetDriverByName(driver.c_str());
-		char** options = nullptr;
-		gd = d->Create(file.c_str(), ncol, nrow, 1, gdt, options);
+		CPLStringList optionList;
+		for (const std::string& option : options) {
+			optionList.AddString(option.c_str());
+		}
+		gd = d ? d->Create(file.c_str(), ncol, nrow, 1, gdt, optionList.List()) : nullptr;
+	}
+
+	//creates according to GDALDriver::CreateCopy()
+
+	GDALDatasetWrapper::GDALDatasetWrapper(const std::string& driver, const std::string& file, GDALDatasetWrapper& source,
+		const std::vector<std::string>& options) {
+		GDALRegisterWrapper::allRegister();
+		GDALDriver* d = GetGDALDriverManager()->GetDriverByName(driver.c_str());
+		CPLStringList optionList;
+		for (const std::string& option : options) {
+			optionList.AddString(option.c_str());
+		}
+		gd = d ? d->CreateCopy(file.c_str(), source.gd, FALSE, optionList.List(), nullptr, nullptr) : nullptr;
+	}
+
+	GDALDatasetWrapper GDALDatasetWrapper::createVector(const std::string& driver, const std::string& file,
+		const std::vector<std::string>& options) {
+		GDALRegisterWrapper::allRegister();
+		GDALDriver* d = GetGDALDriverManager()->GetDriverByName(driver.c_str());
+		CPLStringList optionList;
+		for (const std::string& option : options) {
+			optionList.AddString(option.c_str());
+		}
+		GDALDatasetWrapper out;
+		out.gd = d ? d->Create(file.c_str(), 0, 0, 0, GDT_Unknown, optionList.List()) : nullptr;
+		return out;
 	}
 
 	GDALDatasetWrapper::~GDALDatasetWrapper() {
@@ -44,5 +74,36 @@ namespace lapis {
 		return GDALDatasetWrapper(filename, GDAL_OF_VECTOR);
 	}
 
+	std::vector<std::string> geoTiffCreationOptions(GeoTiffCompression compression, GDALDataType gdt, int nThread) {
+		if (compression == GeoTiffCompression::None) {
+			return {};
+		}
+		std::vector<std::string> out = { "TILED=YES","BLOCKXSIZE=256","BLOCKYSIZE=256","BIGTIFF=IF_SAFER" };
+		for (const std::string& option : compressionCreationOptions(compression, gdt)) {
+			out.push_back(option);
+		}
+		if (nThread > 1) {
+			out.push_back("NUM_THREADS=" + std::to_string(nThread));
+		}
+		return out;
+	}
+
+	std::vector<std::string> compressionCreationOptions(GeoTiffCompression compression, GDALDataType gdt, bool cog) {
+		if (compression == GeoTiffCompression::None) {
+			return cog ? std::vector<std::string>{ "COMPRESS=NONE" } : std::vector<std::string>{};
+		}
+		std::vector<std::string> out;
+		out.push_back(compression == GeoTiffCompression::Zstd ? "COMPRESS=ZSTD" : "COMPRESS=DEFLATE");
+		if (cog) {
+			//the COG driver chooses the predictor suited to the data type itself
+			out.push_back("PREDICTOR=YES");
+		}
+		else {
+			//the floating point predictor is only valid for floating point data
+			out.push_back(GDALDataTypeIsFloating(gdt) ? "PREDICTOR=3" : "PREDICTOR=2");
+		}
+		return out;
+	}
+
 
 }
\ No newline at end of file
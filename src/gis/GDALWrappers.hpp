@@ -34,9 +34,18 @@ namespace lapis {
 		//creates according to GDALOpen()
 		GDALDatasetWrapper(const std::string& filename, unsigned int openFlags);
 		//creates according to GDALDrive::Create()
-		GDALDatasetWrapper(const std::string& driver, const std::string& file, int ncol, int nrow, GDALDataType gdt);
+		//options are driver-specific creation options, in the form "NAME=VALUE"
+		GDALDatasetWrapper(const std::string& driver, const std::string& file, int ncol, int nrow, GDALDataType gdt,
+			const std::vector<std::string>& options = {});
+		//creates according to GDALDriver::CreateCopy(), for drivers like COG which can only write a finished dataset
+		GDALDatasetWrapper(const std::string& driver, const std::string& file, GDALDatasetWrapper& source,
+			const std::vector<std::string>& options = {});
 		~GDALDatasetWrapper();
 
+		//creates a dataset with no raster bands, according to GDALDriver::Create(), for vector drivers like GPKG
+		static GDALDatasetWrapper createVector(const std::string& driver, const std::string& file,
+			const std::vector<std::string>& options = {});
+
 		GDALDatasetWrapper(const GDALDatasetWrapper&) = delete;
 		GDALDatasetWrapper& operator=(const GDALDatasetWrapper&) = delete;
 		GDALDatasetWrapper(GDALDatasetWrapper&& other) noexcept;
@@ -51,13 +60,25 @@ namespace lapis {
 
 
 	private:
-		GDALDataset* gd;
+		GDALDataset* gd = nullptr;
 		std::string _file;
 	};
 
 	GDALDatasetWrapper rasterGDALWrapper(const std::string& filename);
 	GDALDatasetWrapper vectorGDALWrapper(const std::string& filename);
 
+	//the compression used for geotiffs written by Lapis
+	enum class GeoTiffCompression {
+		None, Deflate, Zstd
+	};
+	//returns creation options for the GTiff driver. With compression, the file is tiled, uses the predictor suited to the data type,
+	//compresses on up to nThread threads, and is allowed to become a BigTIFF if it might exceed 4GB
+	//with no compression, the options are empty, which gives GDAL's default striped layout
+	std::vector<std::string> geoTiffCreationOptions(GeoTiffCompression compression, GDALDataType gdt, int nThread);
+	//just the COMPRESS and PREDICTOR options, for writers which handle the layout of the file themselves
+	//the COG driver takes different values than the GTiff driver, and compresses by default, so it needs cog set
+	std::vector<std::string> compressionCreationOptions(GeoTiffCompression compression, GDALDataType gdt, bool cog = false);
+
 	class GDALStringWrapper { //for use with OGRSpatialReference's export functions
 	public:
 		GDALStringWrapper() : ptr(nullptr) {}
@@ -113,6 +113,40 @@ namespace lapis {
 			return _data[cell];
 		}
 
+		//Bulk access, for loops which should run over plain arrays instead of through the per-cell proxies
+		//The has_value flags are stored as a packed bitmask, separately from the values, and the value in a cell without data is unspecified
+		//These can't be used with Raster<bool>, whose values are themselves packed bits
+		//the values of every cell, in the same order as the cell indices
+		std::span<T> values() {
+			return std::span<T>(_data.value().data(), _data.value().size());
+		}
+		std::span<const T> values() const {
+			return std::span<const T>(_data.value().data(), _data.value().size());
+		}
+		//the values of a single row
+		std::span<T> rowValues(const rowcol_t row) {
+			return values().subspan((size_t)row * _ncol, _ncol);
+		}
+		std::span<const T> rowValues(const rowcol_t row) const {
+			return values().subspan((size_t)row * _ncol, _ncol);
+		}
+		//copies has_value for the cells of the row starting at mincol into out, as one byte per cell
+		void rowHasValue(const rowcol_t row, const rowcol_t mincol, std::span<uint8_t> out) const {
+			const auto& flags = _data.has_value();
+			cell_t start = cellFromRowColUnsafe(row, mincol);
+			for (size_t i = 0; i < out.size(); ++i) {
+				out[i] = flags[start + i];
+			}
+		}
+		//sets has_value for the cells of the row starting at mincol from in
+		void setRowHasValue(const rowcol_t row, const rowcol_t mincol, std::span<const uint8_t> in) {
+			auto& flags = _data.has_value();
+			cell_t start = cellFromRowColUnsafe(row, mincol);
+			for (size_t i = 0; i < in.size(); ++i) {
+				flags[start + i] = in[i] != 0;
+			}
+		}
+
 		//This function is similar to atXY, but returns nodata if the point is outside of the extent
 		//In addition, you can specify an extraction method:
 		//near uses nearest neighbor, and bilinear does a bilinear interpolation of the four nearest points
@@ -168,7 +202,11 @@ namespace lapis {
 
 		//Writes the Raster object to the harddrive. Missing values will be replaced by naValue. It's up to the user to make sure the driver and the file extension correspond.
 		//You can specify the datatype of the file, or leave it as GDT_Unknown to choose the one that corresponds to the template of the raster object.
-		void writeRaster(const std::string& file, const std::string driver = "GTiff", const T navalue = std::numeric_limits<T>::lowest(), GDALDataType gdt = GDT_Unknown);
+		//options are driver-specific creation options, in the form "NAME=VALUE"
+		void writeRaster(const std::string& file, const std::string driver = "GTiff", const T navalue = std::numeric_limits<T>::lowest(), GDALDataType gdt = GDT_Unknown,
+			const std::vector<std::string>& options = {});
+		//writes the raster as a cloud optimized geotiff: internally tiled, compressed, and with overviews built from the data in memory
+		void writeCog(const std::string& file, const T navalue = std::numeric_limits<T>::lowest(), GeoTiffCompression compression = GeoTiffCompression::Deflate) const;
 
 		//This function produces a new raster, with alignment a, where the values are what you get by extracting at the cell centers of this
 		Raster<T> resample(const Alignment& a, ExtractMethod method) const;
@@ -210,9 +248,7 @@ namespace lapis {
 		template<class S>
 		Raster<T>& operator/=(const S rhs);
 
-	private:
-		RastData<T> _data;
-
+		//the GDAL data type corresponding to T
 		static GDALDataType GDT() {
 			if (std::is_same<T, double>::value) {
 				return GDT_Float64;
@@ -240,6 +276,13 @@ namespace lapis {
 			}
 			return GDT_Unknown;
 		}
+
+	private:
+		RastData<T> _data;
+
+		//sets has_value to false wherever other doesn't have a value. other must have the same alignment
+		template<class S>
+		void _andHasValue(const Raster<S>& other);
 	};
 
 	template<class T>
@@ -279,13 +322,12 @@ namespace lapis {
 		Raster<T> out = Raster<T>(a);
 		auto rc = r.rowColExtent(snapE, snap);
 
+		std::vector<uint8_t> hasValue(out.ncol());
 		for (rowcol_t row = 0; row < out.nrow(); ++row) {
-			for (rowcol_t col = 0; col < out.ncol(); ++col) {
-				auto vout = out.atRCUnsafe(row, col);
-				auto vr = r.atRCUnsafe(row + rc.minrow, col + rc.mincol);
-				vout.value() = vr.value();
-				vout.has_value() = vr.has_value();
-			}
+			std::span<const T> from = r.rowValues(row + rc.minrow).subspan(rc.mincol, out.ncol());
+			std::copy(from.begin(), from.end(), out.rowValues(row).begin());
+			r.rowHasValue(row + rc.minrow, rc.mincol, hasValue);
+			out.setRowHasValue(row, 0, hasValue);
 		}
 		return out;
 	}
@@ -315,16 +357,13 @@ namespace lapis {
 		if (snapE.ymax() > r.ymax()) {
 			prerows = (rowcol_t)round((snapE.ymax() - r.ymax()) / r.yres());
 		}
-		for (rowcol_t row = 0; row < out.nrow(); ++row) {
-			for (rowcol_t col = 0; col < out.ncol(); ++col) {
-				if (row < prerows || col < precols || row >= r.nrow() + prerows || col >= r.ncol() + precols) {
-					continue; //the default fill for a raster constructed from an alignment is NA, so no need to modify the value
-				}
-				auto outv = out.atRCUnsafe(row, col);
-				auto rv = r.atRCUnsafe(row - prerows, col - precols);
-				outv.value() = rv.value();
-				outv.has_value() = rv.has_value();
-			}
+		//the default fill for a raster constructed from an alignment is NA, so only the cells from r need to be set
+		std::vector<uint8_t> hasValue(r.ncol());
+		for (rowcol_t row = prerows; row < r.nrow() + prerows; ++row) {
+			std::span<const T> from = r.rowValues(row - prerows);
+			std::copy(from.begin(), from.end(), out.rowValues(row).begin() + precols);
+			r.rowHasValue(row - prerows, 0, hasValue);
+			out.setRowHasValue(row, precols, hasValue);
 		}
 		return out;
 	}
@@ -510,11 +549,12 @@ namespace lapis {
 	}
 
 	template<class T>
-	void Raster<T>::writeRaster(const std::string& file, const std::string driver, const T navalue, GDALDataType dataType) {
+	void Raster<T>::writeRaster(const std::string& file, const std::string driver, const T navalue, GDALDataType dataType,
+		const std::vector<std::string>& options) {
 		if (dataType == GDT_Unknown) {
 			dataType = GDT();
 		}
-		GDALDatasetWrapper wgd{ driver,file,ncol(),nrow(),dataType };
+		GDALDatasetWrapper wgd{ driver,file,ncol(),nrow(),dataType,options };
 		if (wgd.isNull()) {
 			throw InvalidRasterFileException("Unable to open " + file + " as a raster");
 		}
@@ -531,6 +571,34 @@ namespace lapis {
 		band->RasterIO(GF_Write, 0, 0, _ncol, _nrow, _data.value().data(), _ncol, _nrow, dataType, 0, 0);
 	}
 
+	template<class T>
+	void Raster<T>::writeCog(const std::string& file, const T navalue, GeoTiffCompression compression) const {
+		//the COG driver only supports CreateCopy, so the raster is staged in a MEM dataset first
+		GDALDatasetWrapper mem{ "MEM","",ncol(),nrow(),GDT() };
+		if (mem.isNull()) {
+			throw InvalidRasterFileException("Unable to create in-memory copy of " + file);
+		}
+		std::array<double, 6> gt = { _xmin, _xres,0,_ymax,0,-(_yres) };
+		mem->SetGeoTransform(gt.data());
+		mem->SetProjection(_crs.getCompleteWKT().c_str());
+		std::vector<T> values(ncell());
+		for (cell_t cell = 0; cell < ncell(); ++cell) {
+			values[cell] = _data[cell].has_value() ? _data[cell].value() : navalue;
+		}
+		auto band = mem->GetRasterBand(1);
+		band->SetNoDataValue((double)navalue);
+		band->RasterIO(GF_Write, 0, 0, _ncol, _nrow, values.data(), _ncol, _nrow, GDT(), 0, 0);
+
+		std::vector<std::string> options = { "BLOCKSIZE=256","OVERVIEWS=AUTO","RESAMPLING=AVERAGE","BIGTIFF=IF_SAFER" };
+		for (const std::string& option : compressionCreationOptions(compression, GDT(), true)) {
+			options.push_back(option);
+		}
+		GDALDatasetWrapper cog{ "COG",file,mem,options };
+		if (cog.isNull()) {
+			throw InvalidRasterFileException("Unable to open " + file + " as a raster");
+		}
+	}
+
 	template<class T>
 	Raster<T> Raster<T>::resample(const Alignment& a, ExtractMethod method) const {
 		Raster<T> out{ a };
@@ -563,20 +631,27 @@ namespace lapis {
 
 		RowColExtent rcExt = rowColExtent(other, SnapType::near); //snap type shouldn't matter with consistent alignments, but 'near' will correct for floating point issues
 
+		const size_t width = (size_t)(rcExt.maxcol - rcExt.mincol + 1);
+		std::vector<uint8_t> thisHasValue(width), otherHasValue(width);
 		for (rowcol_t row = rcExt.minrow; row <= rcExt.maxrow; ++row) {
-			for (rowcol_t col = rcExt.mincol; col <= rcExt.maxcol; ++col) {
-				const auto otherValue = other.atRCUnsafe(row - rcExt.minrow, col - rcExt.mincol);
-				auto thisValue = atRCUnsafe(row, col);
-				if (!otherValue.has_value()) {
+			std::span<T> thisValues = rowValues(row).subspan(rcExt.mincol, width);
+			std::span<const T> otherValues = other.rowValues(row - rcExt.minrow).subspan(0, width);
+			rowHasValue(row, rcExt.mincol, thisHasValue);
+			other.rowHasValue(row - rcExt.minrow, 0, otherHasValue);
+
+			for (size_t i = 0; i < width; ++i) {
+				if (!otherHasValue[i]) {
 					continue;
 				}
-				if (!thisValue.has_value()) {
-					thisValue.has_value() = true;
-					thisValue.value() = otherValue.value();
-					continue;
+				if (thisHasValue[i]) {
+					thisValues[i] = combiner(thisValues[i], otherValues[i]);
+				}
+				else {
+					thisValues[i] = otherValues[i];
+					thisHasValue[i] = 1;
 				}
-				thisValue.value() = combiner(thisValue.value(), otherValue.value());
 			}
+			setRowHasValue(row, rcExt.mincol, thisHasValue);
 		}
 	}
 
@@ -647,15 +722,18 @@ namespace lapis {
 		if (!isSameAlignment(rhs)) {
 			throw AlignmentMismatchException("Alignment mismatch in operator+=");
 		}
-		for (cell_t cell = 0; cell < ncell(); ++cell) {
-			_data[cell].has_value() = _data[cell].has_value() && rhs[cell].has_value();
-			_data[cell].value() += rhs[cell].value();
-		} return *this;
+		std::span<T> thisValues = values();
+		std::span<const S> rhsValues = rhs.values();
+		for (size_t i = 0; i < thisValues.size(); ++i) {
+			thisValues[i] += rhsValues[i];
+		}
+		_andHasValue(rhs);
+		return *this;
 	}
 	template<class T> template<class S>
 	Raster<T>& Raster<T>::operator+=(const S rhs) {
-		for (cell_t cell = 0; cell < ncell(); ++cell) {
-			_data[cell].value() += rhs;
+		for (T& v : values()) {
+			v += rhs;
 		}
 		return *this;
 	}
@@ -665,17 +743,20 @@ namespace lapis {
 		if (!isSameAlignment(rhs)) {
 			throw AlignmentMismatchException("Alignment mismatch in operator-=");
 		}
-		for (cell_t cell = 0; cell < ncell(); ++cell) {
-			_data[cell].has_value() = _data[cell].has_value() && rhs[cell].has_value();
-			_data[cell].value() -= rhs[cell].value();
+		std::span<T> thisValues = values();
+		std::span<const S> rhsValues = rhs.values();
+		for (size_t i = 0; i < thisValues.size(); ++i) {
+			thisValues[i] -= rhsValues[i];
 		}
+		_andHasValue(rhs);
 		return *this;
 	}
 	template<class T> template<class S>
 	Raster<T>& Raster<T>::operator-=(const S rhs) {
-		for (cell_t cell = 0; cell < ncell(); ++cell) {
-			_data[cell].value() -= rhs;
-		} return *this;
+		for (T& v : values()) {
+			v -= rhs;
+		}
+		return *this;
 	}
 
 	template<class T> template<class S>
@@ -683,15 +764,18 @@ namespace lapis {
 		if (!isSameAlignment(rhs)) {
 			throw AlignmentMismatchException("Alignment mismatch in operator*=");
 		}
-		for (cell_t cell = 0; cell < ncell(); ++cell) {
-			_data[cell].has_value() = _data[cell].has_value() && rhs[cell].has_value();
-			_data[cell].value() *= rhs[cell].value();
-		} return *this;
+		std::span<T> thisValues = values();
+		std::span<const S> rhsValues = rhs.values();
+		for (size_t i = 0; i < thisValues.size(); ++i) {
+			thisValues[i] *= rhsValues[i];
+		}
+		_andHasValue(rhs);
+		return *this;
 	}
 	template<class T> template<class S>
 	Raster<T>& Raster<T>::operator*=(const S rhs) {
-		for (cell_t cell = 0; cell < ncell(); ++cell) {
-			_data[cell].value() *= rhs;
+		for (T& v : values()) {
+			v *= rhs;
 		}
 		return *this;
 	}
@@ -701,29 +785,48 @@ namespace lapis {
 		if (!isSameAlignment(rhs)) {
 			throw AlignmentMismatchException("Alignment mismatch in operator/=");
 		}
-		for (cell_t cell = 0; cell < ncell(); ++cell) {
-			if (rhs[cell].value() == 0) {
-				_data[cell].has_value() = false;
+		_andHasValue(rhs);
+		std::span<T> thisValues = values();
+		std::span<const S> rhsValues = rhs.values();
+		auto& flags = _data.has_value();
+		for (size_t i = 0; i < thisValues.size(); ++i) {
+			if (rhsValues[i] == 0) {
+				flags[i] = false;
 			}
 			else {
-				_data[cell].has_value() = _data[cell].has_value() && rhs[cell].has_value();
-				_data[cell].value() /= rhs[cell].value();
+				thisValues[i] /= rhsValues[i];
 			}
 		}
 		return *this;
 	}
 	template<class T> template<class S>
 	Raster<T>& Raster<T>::operator/=(const S rhs) {
-		for (cell_t cell = 0; cell < ncell(); ++cell) {
-			if (rhs == 0) {
+		if (rhs == 0) {
+			for (cell_t cell = 0; cell < ncell(); ++cell) {
 				_data[cell].has_value() = false;
 			}
-			else {
-				_data[cell].value() /= rhs;
-			}
+			return *this;
+		}
+		for (T& v : values()) {
+			v /= rhs;
 		}
 		return *this;
 	}
+
+	template<class T> template<class S>
+	void Raster<T>::_andHasValue(const Raster<S>& other) {
+		std::vector<uint8_t> otherHasValue(_ncol);
+		auto& flags = _data.has_value();
+		for (rowcol_t row = 0; row < _nrow; ++row) {
+			other.rowHasValue(row, 0, otherHasValue);
+			cell_t start = cellFromRowColUnsafe(row, 0);
+			for (rowcol_t col = 0; col < _ncol; ++col) {
+				if (!otherHasValue[col]) {
+					flags[start + col] = false;
+				}
+			}
+		}
+	}
 }
 
 #endif
\ No newline at end of file
@@ -143,62 +143,64 @@ namespace lapis {
 		return xtl::xoptional<OUTPUT>(std::sqrt(numerator / denominator));
 	}
 
+	//adds the triangles from the 2x2 block of cells with the given lower-right corner to a running rumple calculation
+	//the idea here is to interpolate the height at the intersection between cells
+	//then draw isoceles right triangles with the hypotenuse going between adjacent cell centers and the opposite point at a cell intersection
 	template<class OUTPUT, class INPUT>
-	xtl::xoptional<OUTPUT> viewRumple(const CropView<INPUT>& in) {
-		OUTPUT sum = 0;
-		OUTPUT nTriangle = 0;
+	inline void addRumpleTriangles(const xtl::xoptional<INPUT>& lr, const xtl::xoptional<INPUT>& ll,
+		const xtl::xoptional<INPUT>& ur, const xtl::xoptional<INPUT>& ul, coord_t xres, OUTPUT& sum, OUTPUT& nTriangle) {
 
-		//the idea here is to interpolate the height at the intersection between cells
-		//then draw isoceles right triangles with the hypotenuse going between adjacent cell centers and the opposite point at a cell intersection
-		
+		OUTPUT numerator = 0;
+		OUTPUT denominator = 0;
+		auto runningSum = [&](const xtl::xoptional<INPUT>& x) {
+			if (x.has_value()) {
+				denominator++;
+				numerator += (OUTPUT)x.value();
+			}
+		};
 
-		for (rowcol_t row = 1; row < in.nrow(); ++row) {
-			for (rowcol_t col = 1; col < in.ncol(); ++col) {
-				auto lr = in.atRCUnsafe(row, col);
-				auto ll = in.atRCUnsafe(row, col - 1);
-				auto ur = in.atRCUnsafe(row - 1, col);
-				auto ul = in.atRCUnsafe(row - 1, col - 1);
-
-				OUTPUT numerator = 0;
-				OUTPUT denominator = 0;
-				auto runningSum = [&](auto x) {
-					if (x.has_value()) {
-						denominator++;
-						numerator += (OUTPUT)x.value();
-					}
-				};
+		runningSum(lr);
+		runningSum(ll);
+		runningSum(ur);
+		runningSum(ul);
 
-				runningSum(lr);
-				runningSum(ll);
-				runningSum(ur);
-				runningSum(ul);
+		if (denominator == 0) {
+			return;
+		}
+		OUTPUT mid = numerator / denominator;
 
-				if (denominator == 0) {
-					continue;
-				}
-				OUTPUT mid = numerator / denominator;
 
+		//a and b are the heights of two cells, and mid is the interpolated height of one of the center intersections adjacent to them
+		//this calculates the ratio between the area of this triangle and its projection to the ground
+		auto triangleAreaRatio = [&](const xtl::xoptional<INPUT>& a, const xtl::xoptional<INPUT>& b) {
+			if (!a.has_value() || !b.has_value()) {
+				return;
+			}
+			OUTPUT longdiff = (OUTPUT)a.value() - (OUTPUT)b.value();
+			OUTPUT middiff = (OUTPUT)a.value() - mid;
+
+			//the CSMs produced by lapis will always have equal xres and yres
+			//this formula doesn't look symmetric between a and b, but it actually is if you expand it out
+			//this version has slightly fewer calculations than the clearer version
+			//this was derived from the gram determinant, after a great deal of simplification
+			nTriangle++;
+			sum += (2.f / (OUTPUT)xres) * std::sqrt(0.5f + middiff * middiff + longdiff * longdiff / 2.f - longdiff * middiff);
+		};
+		triangleAreaRatio(ll, ul);
+		triangleAreaRatio(ll, lr);
+		triangleAreaRatio(ul, ur);
+		triangleAreaRatio(ur, lr);
+	}
 
-				//a and b are the heights of two cells, and mid is the interpolated height of one of the center intersections adjacent to them
-				//this calculates the ratio between the area of this triangle and its projection to the ground
-				auto triangleAreaRatio = [&](xtl::xoptional<INPUT> a, xtl::xoptional<INPUT> b, OUTPUT mid) {
-					if (!a.has_value() || !b.has_value()) {
-						return;
-					}
-					OUTPUT longdiff = (OUTPUT)a.value() - (OUTPUT)b.value();
-					OUTPUT middiff = (OUTPUT)a.value() - mid;
+	template<class OUTPUT, class INPUT>
+	xtl::xoptional<OUTPUT> viewRumple(const CropView<INPUT>& in) {
+		OUTPUT sum = 0;
+		OUTPUT nTriangle = 0;
 
-					//the CSMs produced by lapis will always have equal xres and yres
-					//this formula doesn't look symmetric between a and b, but it actually is if you expand it out
-					//this version has slightly fewer calculations than the clearer version
-					//this was derived from the gram determinant, after a great deal of simplification
-					nTriangle++;
-					sum += (2.f / (OUTPUT)in.xres()) * std::sqrt(0.5f + middiff * middiff + longdiff * longdiff / 2.f - longdiff * middiff);
-				};
-				triangleAreaRatio(ll, ul, mid);
-				triangleAreaRatio(ll, lr, mid);
-				triangleAreaRatio(ul, ur, mid);
-				triangleAreaRatio(ur, lr, mid);
+		for (rowcol_t row = 1; row < in.nrow(); ++row) {
+			for (rowcol_t col = 1; col < in.ncol(); ++col) {
+				addRumpleTriangles<OUTPUT, INPUT>(in.atRCUnsafe(row, col), in.atRCUnsafe(row, col - 1),
+					in.atRCUnsafe(row - 1, col), in.atRCUnsafe(row - 1, col - 1), in.xres(), sum, nTriangle);
 			}
 		}
 
@@ -208,6 +210,73 @@ namespace lapis {
 		return sum / nTriangle;
 	}
 
+	template<class OUTPUT>
+	struct CanopyAggregates {
+		Raster<OUTPUT> max, mean, stdDev, rumple;
+	};
+
+	//produces the same rasters as calling aggregate with viewMax, viewMean, viewStdDev, and viewRumple, but visits each cell of r only once
+	//the standard deviation is calculated from a running sum of squares in double precision, so it can differ from viewStdDev in the last few bits
+	template<class OUTPUT, class INPUT>
+	inline CanopyAggregates<OUTPUT> aggregateCanopyMetrics(const Raster<INPUT>& r, const Alignment& a) {
+		CanopyAggregates<OUTPUT> out{ Raster<OUTPUT>(a), Raster<OUTPUT>(a), Raster<OUTPUT>(a), Raster<OUTPUT>(a) };
+
+		for (cell_t bigCell : CellIterator(a, r, SnapType::out)) {
+			//the same cells a CropView would cover
+			Alignment block;
+			rowcol_t rowOffset, colOffset;
+			try {
+				block = cropAlignment(r, a.extentFromCell(bigCell), SnapType::near);
+				rowOffset = r.rowFromY(block.ymax() - (block.yres() / 2));
+				colOffset = r.colFromX(block.xmin() + (block.xres() / 2));
+			}
+			catch (OutsideExtentException e) {
+				continue; //This can happen due to floating point inaccuracies
+			}
+
+			OUTPUT maxValue = std::numeric_limits<OUTPUT>::lowest();
+			OUTPUT sum = 0;
+			OUTPUT count = 0;
+			double sumSq = 0;
+			double sumD = 0;
+			OUTPUT rumpleSum = 0;
+			OUTPUT nTriangle = 0;
+
+			for (rowcol_t row = rowOffset; row < rowOffset + block.nrow(); ++row) {
+				for (rowcol_t col = colOffset; col < colOffset + block.ncol(); ++col) {
+					const auto v = r.atRCUnsafe(row, col);
+					if (v.has_value()) {
+						OUTPUT value = (OUTPUT)v.value();
+						maxValue = std::max(maxValue, value);
+						sum += value;
+						count++;
+						sumD += value;
+						sumSq += (double)value * value;
+					}
+					if (row > rowOffset && col > colOffset) {
+						addRumpleTriangles<OUTPUT, INPUT>(v, r.atRCUnsafe(row, col - 1),
+							r.atRCUnsafe(row - 1, col), r.atRCUnsafe(row - 1, col - 1), r.xres(), rumpleSum, nTriangle);
+					}
+				}
+			}
+
+			if (count > 0) {
+				out.max[bigCell].has_value() = true;
+				out.max[bigCell].value() = maxValue;
+				out.mean[bigCell].has_value() = true;
+				out.mean[bigCell].value() = sum / count;
+				double meanD = sumD / count;
+				out.stdDev[bigCell].has_value() = true;
+				out.stdDev[bigCell].value() = (OUTPUT)std::sqrt(std::max(0., sumSq / count - meanD * meanD));
+			}
+			if (nTriangle > 0) {
+				out.rumple[bigCell].has_value() = true;
+				out.rumple[bigCell].value() = rumpleSum / nTriangle;
+			}
+		}
+		return out;
+	}
+
 	template<class OUTPUT, class INPUT>
 	xtl::xoptional<OUTPUT> viewSum(const CropView<INPUT>& in) {
 		OUTPUT value = 0;
@@ -230,13 +299,138 @@ namespace lapis {
 		return xtl::xoptional<OUTPUT>(count);
 	}
 
-	//this function will not have the expected behavior unless the CropView is 3x3
+	//The cells of an NxN window around one cell of a raster, in the same order as the cells of an NxN CropView
+	//Cells outside the raster are reported as having no value, and ncell() is the number of cells of the window inside the raster,
+	//so functions written for CropViews which check for a full window behave the same with this class
+	template<class T, int N>
+	class StencilWindow {
+	public:
+		static_assert(N > 0 && N % 2 == 1, "Stencil windows must have an odd size");
+
+		StencilWindow(coord_t xres, coord_t yres) : _xres(xres), _yres(yres) {}
+
+		xtl::xoptional<T> operator[](cell_t cell) const {
+			return hasValue[cell] ? xtl::xoptional<T>(values[cell]) : xtl::missing<T>();
+		}
+		cell_t ncell() const {
+			return _nInRaster;
+		}
+		rowcol_t nrow() const {
+			return N;
+		}
+		rowcol_t ncol() const {
+			return N;
+		}
+		coord_t xres() const {
+			return _xres;
+		}
+		coord_t yres() const {
+			return _yres;
+		}
+		//the coordinates of the center of the window
+		coord_t x() const {
+			return _x;
+		}
+		coord_t y() const {
+			return _y;
+		}
+
+		void setPosition(coord_t x, coord_t y, cell_t nInRaster) {
+			_x = x;
+			_y = y;
+			_nInRaster = nInRaster;
+		}
+
+		T values[N * N];
+		bool hasValue[N * N];
+
+	private:
+		coord_t _xres, _yres;
+		coord_t _x = 0, _y = 0;
+		cell_t _nInRaster = 0;
+	};
+
+	//calls f(cell, window) for every cell of r, where window is the NxN StencilWindow around the cell
+	//the values are copied from a rolling buffer of N rows, so each cell of the raster is only read once
+	template<class INPUT, int N, class FUNC>
+	inline void forEachStencil(const Raster<INPUT>& r, FUNC f) {
+		constexpr int half = N / 2;
+		const rowcol_t nrow = r.nrow();
+		const rowcol_t ncol = r.ncol();
+		if (nrow == 0 || ncol == 0) {
+			return;
+		}
+
+		//each row buffer is padded with empty cells on both sides, and rows outside the raster are left empty
+		const size_t width = (size_t)ncol + 2 * half;
+		std::vector<INPUT> values(N * width);
+		std::vector<uint8_t> hasValue(N * width);
+		auto slot = [](rowcol_t row) {
+			return (size_t)(((row % N) + N) % N);
+		};
+		auto loadRow = [&](rowcol_t row) {
+			INPUT* v = values.data() + slot(row) * width;
+			uint8_t* h = hasValue.data() + slot(row) * width;
+			std::fill(h, h + width, (uint8_t)0);
+			if (row < 0 || row >= nrow) {
+				return;
+			}
+			for (rowcol_t col = 0; col < ncol; ++col) {
+				const auto x = r.atRCUnsafe(row, col);
+				h[col + half] = x.has_value();
+				v[col + half] = x.value();
+			}
+		};
+
+		for (rowcol_t row = -half; row < half; ++row) {
+			loadRow(row);
+		}
+
+		StencilWindow<INPUT, N> window{ r.xres(), r.yres() };
+		for (rowcol_t row = 0; row < nrow; ++row) {
+			loadRow(row + half);
+			const cell_t rowsInRaster = std::min(row + half, nrow - 1) - std::max(row - half, 0) + 1;
+			const coord_t y = r.yFromRowUnsafe(row);
+
+			for (rowcol_t col = 0; col < ncol; ++col) {
+				const cell_t colsInRaster = std::min(col + half, ncol - 1) - std::max(col - half, 0) + 1;
+				window.setPosition(r.xFromColUnsafe(col), y, rowsInRaster * colsInRaster);
+
+				for (int windowRow = 0; windowRow < N; ++windowRow) {
+					const INPUT* v = values.data() + slot(row - half + windowRow) * width + col;
+					const uint8_t* h = hasValue.data() + slot(row - half + windowRow) * width + col;
+					for (int windowCol = 0; windowCol < N; ++windowCol) {
+						window.values[windowRow * N + windowCol] = v[windowCol];
+						window.hasValue[windowRow * N + windowCol] = h[windowCol] != 0;
+					}
+				}
+				f(r.cellFromRowColUnsafe(row, col), window);
+			}
+		}
+	}
+
+	//The equivalent of focal, but the kernel is any callable taking a StencilWindow<INPUT,N> and returning an xtl::xoptional<OUTPUT>
+	//Passing the kernel as a template parameter instead of a std::function lets it be inlined
+	template<class OUTPUT, class INPUT, int N, class KERNEL>
+	inline Raster<OUTPUT> focalStencil(const Raster<INPUT>& r, KERNEL kernel) {
+		Raster<OUTPUT> out{ (Alignment)r };
+		forEachStencil<INPUT, N>(r, [&](cell_t cell, const StencilWindow<INPUT, N>& window) {
+			xtl::xoptional<OUTPUT> v = kernel(window);
+			out[cell].has_value() = v.has_value();
+			out[cell].value() = v.value();
+			});
+		return out;
+	}
+
+	//The 3x3 topo functions below take any VIEW which is indexed like a 3x3 CropView: either a CropView or a StencilWindow<INPUT,3>
+
+	//this function will not have the expected behavior unless the view is 3x3
 	template<class OUTPUT>
 	struct slopeComponents {
 		xtl::xoptional<OUTPUT> nsSlope, ewSlope;
 	};
-	template<class OUTPUT, class INPUT>
-	inline slopeComponents<OUTPUT> getSlopeComponents(const CropView<INPUT>& in) {
+	template<class OUTPUT, class INPUT, class VIEW = CropView<INPUT>>
+	inline slopeComponents<OUTPUT> getSlopeComponents(const VIEW& in) {
 		slopeComponents<OUTPUT> out;
 		if (in.ncell() < 9) {
 			out.nsSlope = xtl::missing<OUTPUT>();
@@ -255,18 +449,16 @@ namespace lapis {
 		return out;
 	}
 
-	template<class OUTPUT, class INPUT>
-	inline xtl::xoptional<OUTPUT> viewSlopeRadians(const CropView<INPUT>& in) {
-		slopeComponents<OUTPUT> comp = getSlopeComponents<OUTPUT, INPUT>(in);
+	template<class OUTPUT>
+	inline xtl::xoptional<OUTPUT> slopeRadiansFromComponents(const slopeComponents<OUTPUT>& comp) {
 		if (!comp.nsSlope.has_value()) {
 			return xtl::missing<OUTPUT>();
 		}
 		OUTPUT slopeProp = (OUTPUT)std::sqrt(comp.nsSlope.value() * comp.nsSlope.value() + comp.ewSlope.value() * comp.ewSlope.value());
 		return xtl::xoptional<OUTPUT>((OUTPUT)std::atan(slopeProp));
 	}
-	template<class OUTPUT, class INPUT>
-	inline xtl::xoptional<OUTPUT> viewAspectRadians(const CropView<INPUT>& in) {
-		slopeComponents<OUTPUT> comp = getSlopeComponents<OUTPUT, INPUT>(in);
+	template<class OUTPUT>
+	inline xtl::xoptional<OUTPUT> aspectRadiansFromComponents(const slopeComponents<OUTPUT>& comp) {
 		if (!comp.nsSlope.has_value()) {
 			return xtl::missing<OUTPUT>();
 		}
@@ -299,15 +491,24 @@ namespace lapis {
 		}
 	}
 
-	template<class OUTPUT, class INPUT>
-	inline xtl::xoptional<OUTPUT> viewSlopeDegrees(const CropView<INPUT>& in) {
+	template<class OUTPUT, class INPUT, class VIEW = CropView<INPUT>>
+	inline xtl::xoptional<OUTPUT> viewSlopeRadians(const VIEW& in) {
+		return slopeRadiansFromComponents(getSlopeComponents<OUTPUT, INPUT, VIEW>(in));
+	}
+	template<class OUTPUT, class INPUT, class VIEW = CropView<INPUT>>
+	inline xtl::xoptional<OUTPUT> viewAspectRadians(const VIEW& in) {
+		return aspectRadiansFromComponents(getSlopeComponents<OUTPUT, INPUT, VIEW>(in));
+	}
+
+	template<class OUTPUT, class INPUT, class VIEW = CropView<INPUT>>
+	inline xtl::xoptional<OUTPUT> viewSlopeDegrees(const VIEW& in) {
 		constexpr OUTPUT toDegrees = (OUTPUT)(360. / 2. / M_PI);
-		return viewSlopeRadians<OUTPUT, INPUT>(in) * toDegrees;
+		return viewSlopeRadians<OUTPUT, INPUT, VIEW>(in) * toDegrees;
 	}
-	template<class OUTPUT, class INPUT>
-	inline xtl::xoptional<OUTPUT> viewAspectDegrees(const CropView<INPUT>& in) {
+	template<class OUTPUT, class INPUT, class VIEW = CropView<INPUT>>
+	inline xtl::xoptional<OUTPUT> viewAspectDegrees(const VIEW& in) {
 		constexpr OUTPUT toDegrees = (OUTPUT)(360. / 2. / M_PI);
-		return viewAspectRadians<OUTPUT, INPUT>(in) * toDegrees;
+		return viewAspectRadians<OUTPUT, INPUT, VIEW>(in) * toDegrees;
 	}
 
 	/*
@@ -323,8 +524,8 @@ namespace lapis {
 		xtl::xoptional<T> D, E, F, G, H;
 	};
 
-	template<class OUTPUT, class INPUT>
-	CurvatureTempVariables<OUTPUT> calcCurveTempVars(const CropView<INPUT>& in) {
+	template<class OUTPUT, class INPUT, class VIEW = CropView<INPUT>>
+	CurvatureTempVariables<OUTPUT> calcCurveTempVars(const VIEW& in) {
 		CurvatureTempVariables<OUTPUT> vars;
 #pragma warning(push)
 #pragma warning(disable : 4244)
@@ -337,32 +538,54 @@ namespace lapis {
 		return vars;
 	}
 
+	template<class OUTPUT>
+	inline xtl::xoptional<OUTPUT> curvatureFromVars(const CurvatureTempVariables<OUTPUT>& vars) {
+		return -200 * (vars.D + vars.E);
+	}
+	template<class OUTPUT>
+	inline xtl::xoptional<OUTPUT> profileCurvatureFromVars(const CurvatureTempVariables<OUTPUT>& vars) {
+		return -200 * (vars.D * vars.G * vars.G + vars.E * vars.H * vars.H + vars.F * vars.G * vars.H) / (vars.G * vars.G + vars.H * vars.H);
+	}
+	template<class OUTPUT>
+	inline xtl::xoptional<OUTPUT> planCurvatureFromVars(const CurvatureTempVariables<OUTPUT>& vars) {
+		return 200 * (vars.D * vars.H * vars.H + vars.E * vars.G * vars.G - vars.F * vars.G * vars.H) / (vars.G * vars.G + vars.H * vars.H);
+	}
 
-	template<class OUTPUT, class INPUT>
-	inline xtl::xoptional<OUTPUT> viewCurvature(const CropView<INPUT>& in) {
+	template<class OUTPUT, class INPUT, class VIEW = CropView<INPUT>>
+	inline xtl::xoptional<OUTPUT> viewCurvature(const VIEW& in) {
 		if (in.ncell() < 9) {
 			return xtl::missing<OUTPUT>();
 		}
-		auto vars = calcCurveTempVars<OUTPUT, INPUT>(in);
-		return -200 * (vars.D + vars.E);
+		return curvatureFromVars(calcCurveTempVars<OUTPUT, INPUT, VIEW>(in));
 	}
 
-	template<class OUTPUT, class INPUT>
-	inline xtl::xoptional<OUTPUT> viewProfileCurvature(const CropView<INPUT>& in) {
+	template<class OUTPUT, class INPUT, class VIEW = CropView<INPUT>>
+	inline xtl::xoptional<OUTPUT> viewProfileCurvature(const VIEW& in) {
 		if (in.ncell() < 9) {
 			return xtl::missing<OUTPUT>();
 		}
-		auto vars = calcCurveTempVars<OUTPUT, INPUT>(in);
-		return -200 * (vars.D * vars.G * vars.G + vars.E * vars.H * vars.H + vars.F * vars.G * vars.H) / (vars.G * vars.G + vars.H * vars.H);
+		return profileCurvatureFromVars(calcCurveTempVars<OUTPUT, INPUT, VIEW>(in));
 	}
 
-	template<class OUTPUT, class INPUT>
-	inline xtl::xoptional<OUTPUT> viewPlanCurvature(const CropView<INPUT>& in) {
+	template<class OUTPUT, class INPUT, class VIEW = CropView<INPUT>>
+	inline xtl::xoptional<OUTPUT> viewPlanCurvature(const VIEW& in) {
 		if (in.ncell() < 9) {
 			return xtl::missing<OUTPUT>();
 		}
-		auto vars = calcCurveTempVars<OUTPUT, INPUT>(in);
-		return 200 * (vars.D * vars.H * vars.H + vars.E * vars.G * vars.G - vars.F * vars.G * vars.H) / (vars.G * vars.G + vars.H * vars.H);
+		return planCurvatureFromVars(calcCurveTempVars<OUTPUT, INPUT, VIEW>(in));
+	}
+
+	//latitude is in radians
+	template<class OUTPUT>
+	inline xtl::xoptional<OUTPUT> sriFromSlopeAspect(coord_t latitude, const xtl::xoptional<OUTPUT>& slope, const xtl::xoptional<OUTPUT>& aspect) {
+		if (!slope.has_value()) {
+			return xtl::missing<OUTPUT>();
+		}
+		if (!aspect.has_value()) {
+			return xtl::missing<OUTPUT>();
+		}
+		return xtl::xoptional<OUTPUT>(
+			(OUTPUT)(1 + std::cos(latitude) * std::cos(slope.value()) + std::sin(latitude) * std::sin(slope.value()) * std::cos(M_PI - aspect.value())));
 	}
 
 	template<class OUTPUT, class INPUT>
@@ -379,31 +602,22 @@ namespace lapis {
 			}
 			coord_t latitude = toLonLat.transformSingleXY(in.xFromCell(4), in.yFromCell(4)).y;
 			latitude = latitude / 180. * M_PI;
-			xtl::xoptional<OUTPUT> slope = viewSlopeRadians<OUTPUT, INPUT>(in);
-			xtl::xoptional<OUTPUT> aspect = viewAspectRadians<OUTPUT, INPUT>(in);
-			if (!slope.has_value()) {
-				return xtl::missing<OUTPUT>();
-			}
-			if (!aspect.has_value()) {
-				return xtl::missing<OUTPUT>();
-			}
-			return xtl::xoptional<OUTPUT>(
-				(OUTPUT)(1 + std::cos(latitude) * std::cos(slope.value()) + std::sin(latitude) * std::sin(slope.value()) * std::cos(M_PI - aspect.value())));
+			return sriFromSlopeAspect(latitude, viewSlopeRadians<OUTPUT, INPUT>(in), viewAspectRadians<OUTPUT, INPUT>(in));
 		}
 		catch (...) {
 			return xtl::missing<OUTPUT>();
 		}
 	}
 
-	template<class OUTPUT, class INPUT>
-	inline xtl::xoptional<OUTPUT> viewTRI(const CropView<INPUT>& in) {
+	template<class OUTPUT, class INPUT, class VIEW = CropView<INPUT>>
+	inline xtl::xoptional<OUTPUT> viewTRI(const VIEW& in) {
 		if (in.ncell() < 9) {
 			return xtl::missing<OUTPUT>();
 		}
 		xtl::xoptional<OUTPUT> tri = (OUTPUT)0;
 #pragma warning(push)
 #pragma warning(disable : 4244)
-		for (cell_t cell : CellIterator(in)) {
+		for (cell_t cell = 0; cell < in.ncell(); ++cell) {
 			tri += ((in[cell] - in[4]) * (in[cell] - in[4]));
 		}
 #pragma warning(pop)
@@ -411,6 +625,71 @@ namespace lapis {
 		return tri;
 	}
 
+	template<class OUTPUT>
+	struct TopoMetrics3x3 {
+		Raster<OUTPUT> slope, aspect, curvature, profileCurvature, planCurvature, solarRadiationIndex, ruggedness;
+	};
+
+	//produces the same rasters as calling focal with the 3x3 topo functions above, but in a single pass over elev
+	//slope and aspect are in radians if radians is true, and degrees otherwise
+	template<class OUTPUT, class INPUT>
+	inline TopoMetrics3x3<OUTPUT> topoMetrics3x3(const Raster<INPUT>& elev, bool radians) {
+		Alignment a = (Alignment)elev;
+		TopoMetrics3x3<OUTPUT> out{ Raster<OUTPUT>(a), Raster<OUTPUT>(a), Raster<OUTPUT>(a), Raster<OUTPUT>(a),
+			Raster<OUTPUT>(a), Raster<OUTPUT>(a), Raster<OUTPUT>(a) };
+
+		CoordTransform toLonLat;
+		bool canTransform = true;
+		try {
+			toLonLat = CoordTransform(elev.crs(), "EPSG:4326");
+		}
+		catch (...) {
+			canTransform = false;
+		}
+
+		constexpr OUTPUT toDegrees = (OUTPUT)(360. / 2. / M_PI);
+		auto set = [](Raster<OUTPUT>& r, cell_t cell, const xtl::xoptional<OUTPUT>& v) {
+			r[cell].has_value() = v.has_value();
+			r[cell].value() = v.value();
+		};
+
+		using Window = StencilWindow<INPUT, 3>;
+		forEachStencil<INPUT, 3>(elev, [&](cell_t cell, const Window& w) {
+			//every metric needs the full window
+			if (w.ncell() < 9) {
+				return;
+			}
+			slopeComponents<OUTPUT> comp = getSlopeComponents<OUTPUT, INPUT, Window>(w);
+			xtl::xoptional<OUTPUT> slope = slopeRadiansFromComponents(comp);
+			xtl::xoptional<OUTPUT> aspect = aspectRadiansFromComponents(comp);
+			if (radians) {
+				set(out.slope, cell, slope);
+				set(out.aspect, cell, aspect);
+			}
+			else {
+				set(out.slope, cell, slope * toDegrees);
+				set(out.aspect, cell, aspect * toDegrees);
+			}
+
+			CurvatureTempVariables<OUTPUT> vars = calcCurveTempVars<OUTPUT, INPUT, Window>(w);
+			set(out.curvature, cell, curvatureFromVars(vars));
+			set(out.profileCurvature, cell, profileCurvatureFromVars(vars));
+			set(out.planCurvature, cell, planCurvatureFromVars(vars));
+
+			set(out.ruggedness, cell, viewTRI<OUTPUT, INPUT, Window>(w));
+
+			if (canTransform && slope.has_value()) {
+				try {
+					coord_t latitude = toLonLat.transformSingleXY(w.x(), w.y()).y;
+					latitude = latitude / 180. * M_PI;
+					set(out.solarRadiationIndex, cell, sriFromSlopeAspect(latitude, slope, aspect));
+				}
+				catch (...) {}
+			}
+			});
+		return out;
+	}
+
 	struct RowColOffset {
 		rowcol_t rowOffset, colOffset;
 	};
@@ -442,40 +721,101 @@ namespace lapis {
 		return out;
 	}
 
+	//a horizontal run of offsets, from minColOffset to maxColOffset inclusive
+	struct RowOffsetRun {
+		rowcol_t rowOffset, minColOffset, maxColOffset;
+	};
+	//merges the offsets into runs. The offsets must be sorted by row and then by column, as cellOffsetsFromRadius produces them
+	inline std::vector<RowOffsetRun> offsetRuns(const std::vector<RowColOffset>& offsets) {
+		std::vector<RowOffsetRun> out;
+		for (const RowColOffset& o : offsets) {
+			if (out.size() && out.back().rowOffset == o.rowOffset && out.back().maxColOffset + 1 == o.colOffset) {
+				out.back().maxColOffset = o.colOffset;
+			}
+			else {
+				out.push_back({ o.rowOffset, o.colOffset, o.colOffset });
+			}
+		}
+		return out;
+	}
+
 	inline Raster<metric_t> topoPosIndex(const Raster<coord_t>& bufferedElev, coord_t radius, const Extent& unbuffered) {
 		Raster<metric_t> tpi{ (Alignment)bufferedElev };
-		std::vector<RowColOffset> circle = cellOffsetsFromRadius(bufferedElev, radius);
-		
-		for (rowcol_t row = 0; row < tpi.nrow(); ++row) {
-			for (rowcol_t col = 0; col < tpi.ncol(); ++col) {
-				cell_t cell = bufferedElev.cellFromRowColUnsafe(row, col);
-				if (!bufferedElev[cell].has_value()) {
-					continue;
-				}
-				coord_t center = bufferedElev[cell].value();
+		std::vector<RowOffsetRun> runs = offsetRuns(cellOffsetsFromRadius(bufferedElev, radius));
+		if (!runs.size() || !bufferedElev.overlaps(unbuffered)) {
+			return cropRaster(tpi, unbuffered, SnapType::near);
+		}
+
+		//Each row of the window is at most two runs of cells, so instead of visiting every cell in the window,
+		//the sum and count of each run are taken from prefix sums of the rows of the raster.
+		//The rows are padded with empty cells on both sides so the runs never need to be clamped to the edge of the raster
+		rowcol_t pad = 0;
+		for (const RowOffsetRun& run : runs) {
+			pad = std::max({ pad, std::abs(run.minColOffset), std::abs(run.maxColOffset) });
+		}
+		const rowcol_t nrow = bufferedElev.nrow();
+		const rowcol_t ncol = bufferedElev.ncol();
+		const size_t stride = (size_t)ncol + 2 * (size_t)pad + 1;
+
+		//prefix sums lose precision with large values, so they're taken relative to an elevation in the raster
+		coord_t reference = 0;
+		for (cell_t cell = 0; cell < bufferedElev.ncell(); ++cell) {
+			if (bufferedElev[cell].has_value()) {
+				reference = bufferedElev[cell].value();
+				break;
+			}
+		}
+
+		//sums[row * stride + i] is the sum of the first i cells of the padded row
+		std::vector<coord_t> sums(nrow * stride, 0.);
+		std::vector<int32_t> counts(nrow * stride, 0);
+		for (rowcol_t row = 0; row < nrow; ++row) {
+			coord_t* rowSums = sums.data() + row * stride;
+			int32_t* rowCounts = counts.data() + row * stride;
+			for (rowcol_t col = 0; col < ncol; ++col) {
+				size_t i = (size_t)(col + pad);
+				auto v = bufferedElev.atRCUnsafe(row, col);
+				rowSums[i + 1] = rowSums[i] + (v.has_value() ? v.value() - reference : 0.);
+				rowCounts[i + 1] = rowCounts[i] + (v.has_value() ? 1 : 0);
+			}
+			for (size_t i = (size_t)(ncol + pad) + 1; i < stride; ++i) {
+				rowSums[i] = rowSums[i - 1];
+				rowCounts[i] = rowCounts[i - 1];
+			}
+		}
 
-				coord_t numerator = 0;
-				coord_t denominator = 0;
+		//only the rows inside the unbuffered extent are kept
+		Alignment::RowColExtent rc = bufferedElev.rowColExtent(unbuffered, SnapType::near);
 
-				for (RowColOffset offset : circle) {
-					rowcol_t otherrow = row + offset.rowOffset;
-					rowcol_t othercol = col + offset.colOffset;
-					if (otherrow < 0 || othercol < 0 || otherrow >= bufferedElev.nrow() || othercol >= bufferedElev.ncol()) {
-						continue;
-					}
-					auto v = bufferedElev.atRCUnsafe(otherrow, othercol);
-					if (!v.has_value()) {
-						continue;
-					}
-					denominator++;
-					numerator += v.value();
+		std::vector<coord_t> numerator(ncol);
+		std::vector<int32_t> denominator(ncol);
+		for (rowcol_t row = rc.minrow; row <= rc.maxrow; ++row) {
+			std::fill(numerator.begin(), numerator.end(), 0.);
+			std::fill(denominator.begin(), denominator.end(), 0);
+
+			for (const RowOffsetRun& run : runs) {
+				rowcol_t otherRow = row + run.rowOffset;
+				if (otherRow < 0 || otherRow >= nrow) {
+					continue;
+				}
+				const coord_t* rowSums = sums.data() + otherRow * stride;
+				const int32_t* rowCounts = counts.data() + otherRow * stride;
+				const size_t lo = (size_t)(run.minColOffset + pad);
+				const size_t hi = (size_t)(run.maxColOffset + pad) + 1;
+				for (rowcol_t col = 0; col < ncol; ++col) {
+					numerator[col] += rowSums[col + hi] - rowSums[col + lo];
+					denominator[col] += rowCounts[col + hi] - rowCounts[col + lo];
 				}
+			}
 
-				if (denominator == 0) {
+			for (rowcol_t col = 0; col < ncol; ++col) {
+				cell_t cell = bufferedElev.cellFromRowColUnsafe(row, col);
+				if (!bufferedElev[cell].has_value() || denominator[col] == 0) {
 					continue;
 				}
+				coord_t center = bufferedElev[cell].value() - reference;
 				tpi[cell].has_value() = true;
-				tpi[cell].value() = (metric_t)(center - (numerator / denominator));
+				tpi[cell].value() = (metric_t)(center - (numerator[col] / denominator[col]));
 			}
 		}
 
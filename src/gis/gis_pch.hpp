@@ -15,6 +15,7 @@
 #include<unordered_map>
 #include<thread>
 #include<mutex>
+#include<span>
 
 //lazperf
 #pragma warning (push)
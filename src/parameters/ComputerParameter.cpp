@@ -11,18 +11,36 @@ namespace lapis {
 	}
 
 	ComputerParameter::ComputerParameter() {
+		_compression.addOption("DEFLATE", 1, GeoTiffCompression::Deflate);
+		_compression.addOption("None", 0, GeoTiffCompression::None);
+		_compression.addOption("ZSTD", 2, GeoTiffCompression::Zstd);
+		_compression.setSingleLine();
+
 		_thread.addHelpText("This controls how many independent threads to run the Lapis process on.\n\n"
 			"On most computers, this should be set to 2 or 3 below the number of logical cores on the machine.\n\n"
 			"If Lapis is causing your computer to slow down, considering lowering this.");
+		_memoryBudget.addHelpText("Processing very large areas can require more memory than is available on the computer.\n\n"
+			"If this is set, Lapis will switch to slower methods which write intermediate results to the hard drive when it estimates "
+			"that it would otherwise exceed this amount.\n\n"
+			"Half of the budget goes to the canopy surface model and half to the point metrics, so together they stay under it.\n\n"
+			"Set to 0 to let Lapis choose. The canopy surface model is always kept to a bounded number of tiles in memory, but other steps will use as much memory as they need.");
+		_compression.addHelpText("The compression used for the rasters Lapis writes.\n\n"
+			"DEFLATE and ZSTD both write tiled, compressed files which are much smaller than uncompressed ones, and use the number of threads above to compress the outputs written at the end of the run. "
+			"ZSTD is faster, but some older software can't read it.\n\n"
+			"None writes uncompressed files, as older versions of Lapis did.");
 		_benchmark.addHelpText("Display output on how long individual steps take. Intended as a development feature, and will be changed to be more user-friendly in future releases.");
 	}
 	void ComputerParameter::addToCmd(BoostOptDesc& visible,
 		BoostOptDesc& hidden) {
 		_thread.addToCmd(visible, hidden);
+		_memoryBudget.addToCmd(visible, hidden);
+		_compression.addToCmd(visible, hidden);
 		_benchmark.addToCmd(visible, hidden);
 	}
 	std::ostream& ComputerParameter::printToIni(std::ostream& o) {
 		_thread.printToIni(o);
+		_memoryBudget.printToIni(o);
+		_compression.printToIni(o);
 		_benchmark.printToIni(o);
 		return o;
 	}
@@ -32,10 +50,14 @@ namespace lapis {
 	void ComputerParameter::renderGui() {
 		_title.renderGui();
 		_thread.renderGui();
+		_memoryBudget.renderGui();
+		_compression.renderGui();
 		_benchmark.renderGui();
 	}
 	void ComputerParameter::importFromBoost() {
 		_thread.importFromBoost();
+		_memoryBudget.importFromBoost();
+		_compression.importFromBoost();
 		_benchmark.importFromBoost();
 	}
 	void ComputerParameter::updateUnits() {}
@@ -52,6 +74,11 @@ namespace lapis {
 			log.logError("Number of threads must be positive");
 			return false;
 		}
+		if (std::isnan(_memoryBudget.getValueLogErrors()) || _memoryBudget.getValueLogErrors() < 0) {
+			LapisLogger& log = LapisLogger::getLogger();
+			log.logError("Memory budget must be non-negative");
+			return false;
+		}
 		return true;
 	}
 	void ComputerParameter::cleanAfterRun() {}
@@ -59,6 +86,37 @@ namespace lapis {
 	{
 		return (int)_thread.getValueLogErrors();
 	}
+	size_t ComputerParameter::memoryBudget() const
+	{
+		return (size_t)(_memoryBudget.getValueLogErrors() * 1024. * 1024. * 1024.);
+	}
+	GeoTiffCompression ComputerParameter::geoTiffCompression() const
+	{
+		return _compression.currentSelection();
+	}
+
+	int ComputerParameter::CompressionDecider::operator()(const std::string& s) const
+	{
+		static const std::regex nonepattern{ ".*no.*",std::regex::icase };
+		static const std::regex zstdpattern{ ".*z.*",std::regex::icase };
+		if (std::regex_match(s, nonepattern)) {
+			return 0;
+		}
+		if (std::regex_match(s, zstdpattern)) {
+			return 2;
+		}
+		return 1;
+	}
+	std::string ComputerParameter::CompressionDecider::operator()(int i) const
+	{
+		if (i == 0) {
+			return "none";
+		}
+		if (i == 2) {
+			return "zstd";
+		}
+		return "deflate";
+	}
 
 	int ComputerParameter::_defaultNThread() {
 		int out = std::thread::hardware_concurrency();
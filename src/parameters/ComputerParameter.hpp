@@ -29,6 +29,8 @@ namespace lapis {
 		static size_t parameterRegisteredIndex;
 
 		int nThread() const;
+		size_t memoryBudget() const;
+		GeoTiffCompression geoTiffCompression() const;
 
 	private:
 		static int _defaultNThread();
@@ -39,6 +41,16 @@ namespace lapis {
 		"The number of threads to run Lapis on. Defaults to the number of cores on the computer" };
 		std::string _threadCmd = "thread";
 
+		NumericTextBox _memoryBudget{ "Memory Budget (GB):","memory-budget",0,
+		"The approximate amount of memory, in gigabytes, Lapis should try to stay under. 0 indicates no limit" };
+
+		class CompressionDecider {
+		public:
+			int operator()(const std::string& s) const;
+			std::string operator()(int i) const;
+		};
+		RadioSelect<CompressionDecider, GeoTiffCompression> _compression{ "Output Compression:","compression" };
+
 		CheckBox _benchmark{ "Display benchmarking information","bench","" };
 	};
 }
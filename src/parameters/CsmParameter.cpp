@@ -21,10 +21,16 @@ namespace lapis {
 		_footprintDiameter.addHelpText("This value indicates the estimated diameter of a lidar pulse as it strikes the canopy.\n\n"
 			"Each return will be considered a circle with this diameter for the purpose of constructing the canopy surface model.\n\n"
 			"If this behavior is undesirable, set the value to 0.");
+		_exactFootprint.addHelpText("By default, the footprint of each return is approximated by its center and eight points on its edge, "
+			"and each CSM cell containing one of those points is given the height of the return.\n\n"
+			"If this is checked, every cell the footprint touches is used instead. This is slightly slower, but allows footprints larger than the CSM cells.");
 		_smooth.addHelpText("The desired smoothing for the output CSM.\n\n"
 			"If set to 3x3, each cell in the final raster will be equal to the average of that cell and its 8 neighbors in the pre-smoothing CSM.\n\n"
 			"If set to 5x5, it will use the average of those 9 cells and the 16 cells surrounding them.");
 		_doMetrics.addHelpText("If this is checked, Lapis will calculate summary metrics on the CSM itself, such as the mean and standard deviation of values.");
+		_cog.addHelpText("If this is checked, the CSM tiles will be written as cloud optimized geotiffs: internally tiled, compressed, and with overviews already built. "
+			"A VRT file which combines all of the tiles will also be written to the CSM folder.\n\n"
+			"This saves having to build overviews afterwards for viewing the CSM, at the cost of a little extra time during the run.");
 		_fill.addHelpText("It's somewhat common, especially in low-density lidar flights, for there to be small areas where a CSM cannot be calculated.\n"
 			"If this is checked, those areas will be filled by interpolating from nearby areas.\n");
 	}
@@ -32,16 +38,20 @@ namespace lapis {
 		BoostOptDesc& hidden) {
 		_cellsize.addToCmd(visible, hidden);
 		_footprintDiameter.addToCmd(visible, hidden);
+		_exactFootprint.addToCmd(visible, hidden);
 		_doMetrics.addToCmd(visible, hidden);
 		_smooth.addToCmd(visible, hidden);
 		_fill.addToCmd(visible, hidden);
+		_cog.addToCmd(visible, hidden);
 	}
 	std::ostream& CsmParameter::printToIni(std::ostream& o) {
 		_cellsize.printToIni(o);
 		_footprintDiameter.printToIni(o);
+		_exactFootprint.printToIni(o);
 		_doMetrics.printToIni(o);
 		_smooth.printToIni(o);
 		_fill.printToIni(o);
+		_cog.printToIni(o);
 		return o;
 	}
 	ParamCategory CsmParameter::getCategory() const {
@@ -54,9 +64,11 @@ namespace lapis {
 
 		_smooth.renderGui();
 		_footprintDiameter.renderGui();
+		_exactFootprint.renderGui();
 		_fill.renderGui();
 
 		_doMetrics.renderGui();
+		_cog.renderGui();
 	}
 	void CsmParameter::updateUnits() {
 		_cellsize.updateUnits();
@@ -65,9 +77,11 @@ namespace lapis {
 	void CsmParameter::importFromBoost() {
 		_smooth.importFromBoost();
 		_footprintDiameter.importFromBoost();
+		_exactFootprint.importFromBoost();
 		_cellsize.importFromBoost();
 		_doMetrics.importFromBoost();
 		_fill.importFromBoost();
+		_cog.importFromBoost();
 	}
 	bool CsmParameter::prepareForRun() {
 		if (_runPrepared) {
@@ -103,7 +117,8 @@ namespace lapis {
 		}
 
 		//so large that the outer edge of the circle will skip entire cells sometimes
-		if (_footprintDiameter.getValueLogErrors() >= _cellsize.getValueLogErrors() * 2) {
+		//this isn't a problem when every cell under the footprint is used
+		if (!_exactFootprint.currentState() && _footprintDiameter.getValueLogErrors() >= _cellsize.getValueLogErrors() * 2) {
 			log.logError("Pulse diameter is too large for your CSM resolution. Increase CSM cellsize or reduce pulse diameter.");
 		}
 
@@ -118,7 +133,7 @@ namespace lapis {
 			SnapType::out);
 		_csmAlign = std::make_shared<Alignment>(csmAlign);
 
-		_csmAlgorithm = std::make_unique<MaxPoint>(_footprintDiameter.getValueLogErrors());
+		_csmAlgorithm = std::make_unique<MaxPoint>(_footprintDiameter.getValueLogErrors(), _exactFootprint.currentState());
 
 		coord_t lookDist = linearUnitPresets::meter.convertOneFromThis(5, _csmAlign->crs().getXYLinearUnits());
 		if (_smooth.currentSelection() > 1 && _fill.currentState()) {
@@ -152,6 +167,10 @@ namespace lapis {
 	{
 		return _doMetrics.currentState();
 	}
+	bool CsmParameter::writeCsmAsCog() const
+	{
+		return _cog.currentState();
+	}
 	CsmAlgorithm* CsmParameter::csmAlgorithm()
 	{
 		prepareForRun();
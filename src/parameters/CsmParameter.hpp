@@ -32,6 +32,7 @@ namespace lapis {
 
 		std::shared_ptr<Alignment> csmAlign();
 		bool doCsmMetrics() const;
+		bool writeCsmAsCog() const;
 
 		CsmAlgorithm* csmAlgorithm();
 		CsmPostProcessor* csmPostProcessor();
@@ -40,10 +41,14 @@ namespace lapis {
 		Title _title{ "Canopy Surface Model Options" };
 
 		NumericTextBoxWithUnits _footprintDiameter{ "Diameter of Pulse Footprint:","footprint",0.4 };
+		CheckBox _exactFootprint{ "Exact Footprint Coverage","exact-footprint",
+		"Give a return's height to every CSM cell its footprint touches, instead of approximating the footprint with nine points." };
 		NumericTextBoxWithUnits _cellsize{ "Cellsize:","csm-cellsize",1,
 		"The desired cellsize of the output canopy surface model\n"
 			"Defaults to 1 meter" };
 		InvertedCheckBox _doMetrics{ "Calculate CSM Metrics","skip-csm-metrics" };
+		CheckBox _cog{ "Write CSM As Cloud Optimized GeoTIFF","csm-cog",
+		"Write the CSM tiles as cloud optimized geotiffs with overviews, along with a VRT covering all of them." };
 
 		class SmoothDecider {
 		public:
@@ -136,12 +136,14 @@ namespace lapis {
 			}
 		}
 		_fullExtent.setZUnits(rp.outUnits());
+		_lasExtentIndex = ExtentIndex(_lasExtents);
 
 		_runPrepared = true;
 		return true;
 	}
 	void LasFileParameter::cleanAfterRun() {
 		_lasExtents.clear();
+		_lasExtentIndex = ExtentIndex();
 		_lasFileNames.clear();
 
 		_fullExtent = Extent();
@@ -157,6 +159,11 @@ namespace lapis {
 		prepareForRun();
 		return _lasExtents;
 	}
+	const ExtentIndex& LasFileParameter::lasExtentIndex()
+	{
+		prepareForRun();
+		return _lasExtentIndex;
+	}
 	LasReader LasFileParameter::getLas(size_t n)
 	{
 		prepareForRun();
@@ -3,6 +3,7 @@
 #define LP_LASFILEPARAMETER_H
 
 #include"Parameter.hpp"
+#include"..\gis\ExtentIndex.hpp"
 
 namespace lapis {
 	class LasFileParameter : public Parameter {
@@ -30,6 +31,7 @@ namespace lapis {
 
 		const Extent& getFullExtent();
 		const std::vector<Extent>& sortedLasExtents();
+		const ExtentIndex& lasExtentIndex();
 		
 		LasReader getLas(size_t n);
 
@@ -48,6 +50,7 @@ namespace lapis {
 
 		std::vector<std::string> _lasFileNames;
 		std::vector<Extent> _lasExtents;
+		ExtentIndex _lasExtentIndex;
 		Extent _fullExtent;
 
 		struct LasFileExtent {
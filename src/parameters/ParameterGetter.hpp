@@ -4,6 +4,7 @@
 
 #include"param_pch.hpp"
 #include"..\algorithms\AllAlgorithmTypes.hpp"
+#include"..\gis\ExtentIndex.hpp"
 
 //This file defines a number of abstract classes designed to be interfaces for the classes in ProductHandler.hpp
 //In the production code, the only class inheriting from any of them will be LapisData, but other implementation will be used for data injection in tests
@@ -26,7 +27,28 @@ namespace lapis {
 		virtual const std::string& name() = 0;
 		virtual int nThread() = 0;
 		virtual const std::vector<Extent>& lasExtents() = 0;
+		//an index over lasExtents, for finding the las files which overlap an area
+		virtual const ExtentIndex& lasExtentIndex() = 0;
 		virtual std::string layoutTileName(cell_t tile) = 0;
+		//the approximate amount of memory, in bytes, that handlers should aim to stay under. 0 indicates no limit
+		virtual size_t memoryBudget() = 0;
+		//the CSM tiles and the point metrics both hold data for much of the run, so the budget is split between them and together they stay under it
+		//the CSM gets csmBudgetShare of the budget, and the point metrics get the rest. Both are 0 if there's no budget
+		static constexpr double csmBudgetShare = 0.5;
+		size_t csmMemoryBudget() {
+			return _budgetShare(csmBudgetShare);
+		}
+		size_t pointMetricMemoryBudget() {
+			return _budgetShare(1. - csmBudgetShare);
+		}
+		//the compression to use for the rasters written by the handlers
+		virtual GeoTiffCompression geoTiffCompression() = 0;
+
+	private:
+		size_t _budgetShare(double share) {
+			size_t budget = memoryBudget();
+			return budget ? std::max<size_t>((size_t)(budget * share), 1) : 0;
+		}
 	};
 
 	class PointMetricParameterGetter : public virtual SharedParameterGetter {
@@ -40,10 +62,20 @@ namespace lapis {
 		virtual bool doStratumMetrics() = 0;
 		virtual bool doAdvancedPointMetrics() = 0;
 		virtual coord_t canopyCutoff() = 0;
+		//other cutoffs to calculate the canopy metrics at, and the names of their output folders
+		virtual const std::vector<coord_t>& additionalCanopyCutoffs() = 0;
+		virtual const std::vector<std::string>& additionalCanopyCutoffNames() = 0;
 		virtual coord_t maxHt() = 0;
 		virtual coord_t binSize() = 0;
 		virtual const std::vector<coord_t>& strataBreaks() = 0;
 		virtual const std::vector<std::string>& strataNames() = 0;
+		//if true, metrics should be written to disk as they finish instead of all at once at the end of the run
+		virtual bool streamPointMetrics() = 0;
+		//if true, the calculators of each cell should be saved so metrics can be recalculated without the lidar data
+		virtual bool savePointHistograms() = 0;
+		//additional resolutions to calculate metrics at, as multiples of the metric cellsize, and the names of their output folders
+		virtual const std::vector<int>& coarseMetricFactors() = 0;
+		virtual const std::vector<std::string>& coarseMetricNames() = 0;
 	};
 
 	class CsmParameterGetter : public virtual SharedParameterGetter {
@@ -56,6 +88,8 @@ namespace lapis {
 		virtual CsmPostProcessor* csmPostProcessAlgorithm() = 0;
 		virtual bool doCsm() = 0;
 		virtual bool doCsmMetrics() = 0;
+		//if true, the CSM tiles are written as cloud optimized geotiffs, with a VRT over all of them
+		virtual bool writeCsmAsCog() = 0;
 	};
 
 	class TaoParameterGetter : public virtual SharedParameterGetter {
@@ -65,6 +99,10 @@ namespace lapis {
 		virtual TaoIdAlgorithm* taoIdAlgorithm() = 0;
 		virtual TaoSegmentAlgorithm* taoSegAlgorithm() = 0;
 		virtual bool doTaos() = 0;
+		//if true, the TAOs from every tile are written to a single geopackage instead of a shapefile per tile
+		virtual bool writeTaosToGeopackage() = 0;
+		//if true, the TAO attributes are also exported to a geoparquet file for analytics tools
+		virtual bool exportTaosToParquet() = 0;
 	};
 
 	class FineIntParameterGetter : public virtual SharedParameterGetter {
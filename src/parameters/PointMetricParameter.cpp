@@ -4,6 +4,18 @@
 
 namespace lapis {
 
+	//all this nonsense should get a non-scientific notation representation with at most two places after the decimal point, but trailing 0s removed
+	static std::string to_string_with_precision(coord_t v) {
+		std::ostringstream out;
+		out.precision(2);
+		out << std::fixed;
+		out << v;
+		std::string s = out.str();
+		s.erase(s.find_last_not_of('0') + 1, std::string::npos);
+		s.erase(s.find_last_not_of('.') + 1, std::string::npos);
+		return s;
+	}
+
 	size_t PointMetricParameter::parameterRegisteredIndex = RunParameters::singleton().registerParameter(new PointMetricParameter());
 	void PointMetricParameter::reset()
 	{
@@ -19,6 +31,9 @@ namespace lapis {
 
 		_canopyCutoff.addHelpText("Many point metrics are either calculated only on canopy points, or treat canopy points specially in some other way.\n\n"
 			"A canopy point is defined as being above some specific height, which you specify here.");
+		_additionalCutoffs.addHelpText("If you want to compare the canopy metrics at several different canopy cutoffs, you can list the others here.\n\n"
+			"They are calculated from the same data as the main cutoff, so this is much faster than doing a separate run for each. "
+			"Each cutoff's metrics are written to their own folder. Metrics which don't depend on the cutoff are only written once.");
 		_doStrata.addHelpText("Some metrics are calculated on specific height bands; for example, on all returns between 8 and 16 meters above the ground."
 			"These numbers specify those bands.");
 		_advMetrics.addHelpText("There are a very large number of point metrics that have been proposed over the years.\n\n"
@@ -26,21 +41,39 @@ namespace lapis {
 			"This checkbox controls whether Lapis calculates the more limited set, or the full set.");
 		_whichReturns.addHelpText("Depending on the application, you may want point metrics to be calculated either on first returns only, or on all returns.\n\n"
 			"You can control that with this selection.");
+		_streamOutput.addHelpText("Normally, point metrics are held in memory and written to disk at the end of the run.\n\n"
+			"If this is checked, each area's metrics are written as soon as all of the lidar files covering it are processed. "
+			"This uses less memory and avoids a long write at the end of the run, but the output files are compressed and internally tiled.");
+		_saveHistograms.addHelpText("If this is checked, the height histogram, return counts, and stratum counts of each cell are saved "
+			"to a file in the point metrics folder.\n\n"
+			"The file holds everything needed to calculate the point metrics, including ones which weren't calculated in this run, "
+			"without reprocessing the lidar data. To recalculate, run Lapis with --recalculate-point-metrics and the path of the saved file; the metrics are written to a Recalculated folder next to it. The file can be large.");
+		_coarseCellsizes.addHelpText("Point metrics can also be calculated at larger cellsizes in the same run, without reading the lidar data again.\n\n"
+			"Each cellsize here must be a whole multiple of the main cellsize, and the cells must line up with the main cells. "
+			"Each cellsize's metrics are written to their own folder. Leave this blank to only calculate metrics at the main cellsize.");
 	}
 	void PointMetricParameter::addToCmd(BoostOptDesc& visible,
 		BoostOptDesc& hidden) {
 		_canopyCutoff.addToCmd(visible, hidden);
+		_additionalCutoffs.addToCmd(visible, hidden);
 		_strata.addToCmd(visible, hidden);
 		_advMetrics.addToCmd(visible, hidden);
 		_whichReturns.addToCmd(visible, hidden);
 		_doStrata.addToCmd(visible, hidden);
+		_streamOutput.addToCmd(visible, hidden);
+		_saveHistograms.addToCmd(visible, hidden);
+		_coarseCellsizes.addToCmd(visible, hidden);
 	}
 	std::ostream& PointMetricParameter::printToIni(std::ostream& o) {
 		_canopyCutoff.printToIni(o);
+		_additionalCutoffs.printToIni(o);
 		_strata.printToIni(o);
 		_advMetrics.printToIni(o);
 		_whichReturns.printToIni(o);
 		_doStrata.printToIni(o);
+		_streamOutput.printToIni(o);
+		_saveHistograms.printToIni(o);
+		_coarseCellsizes.printToIni(o);
 		return o;
 	}
 	ParamCategory PointMetricParameter::getCategory() const {
@@ -51,9 +84,13 @@ namespace lapis {
 
 		ImGui::BeginChild("stratumleft", ImVec2(ImGui::GetContentRegionAvail().x * 0.5f - 2, ImGui::GetContentRegionAvail().y), false, 0);
 		_canopyCutoff.renderGui();
+		_additionalCutoffs.renderGui();
 		_advMetrics.renderGui();
 		ImGui::Text("Calculate Metrics Using:");
 		_whichReturns.renderGui();
+		_streamOutput.renderGui();
+		_saveHistograms.renderGui();
+		_coarseCellsizes.renderGui();
 		ImGui::EndChild();
 
 		ImGui::SameLine();
@@ -66,15 +103,21 @@ namespace lapis {
 	}
 	void PointMetricParameter::updateUnits() {
 		_canopyCutoff.updateUnits();
+		_additionalCutoffs.updateUnits();
 		_strata.updateUnits();
+		_coarseCellsizes.updateUnits();
 	}
 	void PointMetricParameter::importFromBoost() {
 
 		_canopyCutoff.importFromBoost();
+		_additionalCutoffs.importFromBoost();
 		_strata.importFromBoost();
 		_advMetrics.importFromBoost();
 		_whichReturns.importFromBoost();
 		_doStrata.importFromBoost();
+		_streamOutput.importFromBoost();
+		_saveHistograms.importFromBoost();
+		_coarseCellsizes.importFromBoost();
 	}
 	bool PointMetricParameter::prepareForRun() {
 
@@ -99,25 +142,38 @@ namespace lapis {
 
 		if (_doStrata.currentState()) {
 			if (_strata.cachedValues().size()) {
-				auto to_string_with_precision = [](coord_t v)->std::string {
-					//all this nonsense should get a non-scientific notation representation with at most two places after the decimal point, but trailing 0s removed
-					std::ostringstream out;
-					out.precision(2);
-					out << std::fixed;
-					out << v;
-					std::string s = out.str();
-					s.erase(s.find_last_not_of('0') + 1, std::string::npos);
-					s.erase(s.find_last_not_of('.') + 1, std::string::npos);
-					return s;
-				};
-				const std::vector<coord_t>& strata = _strata.cachedValues();
-				_strataNames.clear();
-				_strataNames.push_back("LessThan" + to_string_with_precision(strata[0]) + rp.unitPlural());
-				for (size_t i = 1; i < strata.size(); ++i) {
-					_strataNames.push_back(to_string_with_precision(strata[i - 1]) + "To" + to_string_with_precision(strata[i]) + rp.unitPlural());
-				}
-				_strataNames.push_back("GreaterThan" + to_string_with_precision(strata[strata.size() - 1]) + rp.unitPlural());
+				_strataNames = makeStrataNames(_strata.cachedValues(), rp.unitPlural());
+			}
+		}
+
+		_additionalCutoffValues.clear();
+		_additionalCutoffNames.clear();
+		for (coord_t cutoff : _additionalCutoffs.cachedValues()) {
+			if (std::abs(cutoff - _canopyCutoff.getValueLogErrors()) < LAPIS_EPSILON) {
+				continue;
+			}
+			_additionalCutoffValues.push_back(cutoff);
+			_additionalCutoffNames.push_back(makeCutoffName(cutoff, rp.unitPlural()));
+		}
+		if (_additionalCutoffValues.size() > 254) {
+			log.logError("Too many additional canopy cutoffs");
+			return false;
+		}
+
+		_coarseFactors.clear();
+		_coarseNames.clear();
+		const Alignment& metricAlign = *rp.metricAlign();
+		for (coord_t cellsize : _coarseCellsizes.cachedValues()) {
+			//the coarse cells are built by merging whole fine cells, so they have to nest exactly
+			coord_t converted = rp.outUnits().convertOneFromThis(cellsize, metricAlign.crs().getXYLinearUnits());
+			int factor = (int)std::round(converted / metricAlign.xres());
+			if (factor < 2 || std::abs(factor * metricAlign.xres() - converted) > LAPIS_EPSILON
+				|| std::abs(factor * metricAlign.yres() - converted) > LAPIS_EPSILON) {
+				log.logError("Additional point metric cellsizes must be multiples of the main cellsize");
+				return false;
 			}
+			_coarseFactors.push_back(factor);
+			_coarseNames.push_back("Cellsize" + to_string_with_precision(cellsize) + rp.unitPlural());
 		}
 
 		_runPrepared = true;
@@ -138,6 +194,23 @@ namespace lapis {
 	{
 		return _strata.cachedValues();
 	}
+	std::vector<std::string> PointMetricParameter::makeStrataNames(const std::vector<coord_t>& strataBreaks, const std::string& unitPlural)
+	{
+		std::vector<std::string> out;
+		if (!strataBreaks.size()) {
+			return out;
+		}
+		out.push_back("LessThan" + to_string_with_precision(strataBreaks[0]) + unitPlural);
+		for (size_t i = 1; i < strataBreaks.size(); ++i) {
+			out.push_back(to_string_with_precision(strataBreaks[i - 1]) + "To" + to_string_with_precision(strataBreaks[i]) + unitPlural);
+		}
+		out.push_back("GreaterThan" + to_string_with_precision(strataBreaks[strataBreaks.size() - 1]) + unitPlural);
+		return out;
+	}
+	std::string PointMetricParameter::makeCutoffName(coord_t cutoff, const std::string& unitPlural)
+	{
+		return "CanopyCutoff" + to_string_with_precision(cutoff) + unitPlural;
+	}
 	const std::vector<std::string>& PointMetricParameter::strataNames()
 	{
 		prepareForRun();
@@ -147,6 +220,16 @@ namespace lapis {
 	{
 		return _canopyCutoff.getValueLogErrors();
 	}
+	const std::vector<coord_t>& PointMetricParameter::additionalCanopyCutoffs()
+	{
+		prepareForRun();
+		return _additionalCutoffValues;
+	}
+	const std::vector<std::string>& PointMetricParameter::additionalCanopyCutoffNames()
+	{
+		prepareForRun();
+		return _additionalCutoffNames;
+	}
 	bool PointMetricParameter::doStratumMetrics() const
 	{
 		return _doStrata.currentState();
@@ -155,4 +238,22 @@ namespace lapis {
 	{
 		return _advMetrics.currentState();
 	}
+	bool PointMetricParameter::streamOutput() const
+	{
+		return _streamOutput.currentState();
+	}
+	bool PointMetricParameter::saveHistograms() const
+	{
+		return _saveHistograms.currentState();
+	}
+	const std::vector<int>& PointMetricParameter::coarseFactors()
+	{
+		prepareForRun();
+		return _coarseFactors;
+	}
+	const std::vector<std::string>& PointMetricParameter::coarseNames()
+	{
+		prepareForRun();
+		return _coarseNames;
+	}
 }
\ No newline at end of file
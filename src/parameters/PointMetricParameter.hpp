@@ -34,19 +34,37 @@ namespace lapis {
 		const std::vector<coord_t>& strata() const;
 		const std::vector<std::string>& strataNames();
 		coord_t canopyCutoff() const;
+		const std::vector<coord_t>& additionalCanopyCutoffs();
+		const std::vector<std::string>& additionalCanopyCutoffNames();
 		bool doStratumMetrics() const;
 		bool doAdvancedPointMetrics() const;
+		bool streamOutput() const;
+		const std::vector<int>& coarseFactors();
+		bool saveHistograms() const;
+		const std::vector<std::string>& coarseNames();
+
+		//the names used in filenames for the strata and the additional canopy cutoffs, so outputs made without a full run can match a run's
+		static std::vector<std::string> makeStrataNames(const std::vector<coord_t>& strataBreaks, const std::string& unitPlural);
+		static std::string makeCutoffName(coord_t cutoff, const std::string& unitPlural);
 
 	private:
 		Title _title{ "Point Metric Options" };
 
 		NumericTextBoxWithUnits _canopyCutoff{ "Canopy Cutoff:","canopy",2,
 		"The height threshold for a point to be considered canopy." };
+		MultiNumericTextBoxWithUnits _additionalCutoffs{ "Additional Canopy Cutoffs:","additional-canopy","",
+			"A comma-separated list of other canopy cutoffs to calculate the canopy metrics with." };
 		MultiNumericTextBoxWithUnits _strata{ "Stratum Breaks:","strata","0.5,1,2,4,8,16,32,48,64",
 			"A comma-separated list of strata breaks on which to calculate strata metrics." };
 		RadioBoolean _advMetrics{ "adv-point","All Metrics","Common Metrics",
 		"Calculate a larger suite of point metrics." };
 		InvertedCheckBox _doStrata{ "Calculate Strata Metrics","skip-strata" };
+		CheckBox _streamOutput{ "Write Metrics As They Finish","stream-point-metrics",
+		"Write point metrics to disk as each area finishes, instead of all at once at the end of the run." };
+		CheckBox _saveHistograms{ "Save Histograms For Recalculation","save-point-histograms",
+		"Save each cell's height histogram, so metrics can be recalculated later without the lidar data." };
+		MultiNumericTextBoxWithUnits _coarseCellsizes{ "Additional Cellsizes:","coarse-cellsize","",
+			"A comma-separated list of additional, larger cellsizes to calculate point metrics at. Each must be a multiple of the main cellsize." };
 
 		static constexpr int FIRST_RETURNS = RadioDoubleBoolean::FIRST;
 		static constexpr int ALL_RETURNS = RadioDoubleBoolean::SECOND;
@@ -55,6 +73,10 @@ namespace lapis {
 		RadioDoubleBoolean _whichReturns{ "skip-first-returns","skip-all-returns" };
 
 		std::vector<std::string> _strataNames;
+		std::vector<coord_t> _additionalCutoffValues;
+		std::vector<std::string> _additionalCutoffNames;
+		std::vector<int> _coarseFactors;
+		std::vector<std::string> _coarseNames;
 
 		bool _runPrepared = false;
 	};
@@ -99,6 +99,7 @@ namespace lapis {
 			_params[i]->importFromBoost();
 		}
 		_pdf.reset();
+		_recalculateCube.clear();
 	}
 
 	const Extent& RunParameters::fullExtent()
@@ -177,6 +178,10 @@ namespace lapis {
 	{
 		return getParam<LasFileParameter>().sortedLasExtents();
 	}
+	const ExtentIndex& RunParameters::lasExtentIndex()
+	{
+		return getParam<LasFileParameter>().lasExtentIndex();
+	}
 	LasReader RunParameters::getLas(size_t i)
 	{
 		auto l = getParam<LasFileParameter>().getLas(i);
@@ -199,6 +204,14 @@ namespace lapis {
 	{
 		return getParam<ComputerParameter>().nThread();
 	}
+	size_t RunParameters::memoryBudget()
+	{
+		return getParam<ComputerParameter>().memoryBudget();
+	}
+	GeoTiffCompression RunParameters::geoTiffCompression()
+	{
+		return getParam<ComputerParameter>().geoTiffCompression();
+	}
 	coord_t RunParameters::binSize()
 	{
 		return linearUnitPresets::meter.convertOneFromThis(0.01, outUnits());
@@ -211,6 +224,14 @@ namespace lapis {
 	{
 		return getParam<PointMetricParameter>().canopyCutoff();
 	}
+	const std::vector<coord_t>& RunParameters::additionalCanopyCutoffs()
+	{
+		return getParam<PointMetricParameter>().additionalCanopyCutoffs();
+	}
+	const std::vector<std::string>& RunParameters::additionalCanopyCutoffNames()
+	{
+		return getParam<PointMetricParameter>().additionalCanopyCutoffNames();
+	}
 	const std::vector<coord_t>& RunParameters::strataBreaks() 
 	{
 		static std::vector<coord_t> empty;
@@ -220,6 +241,14 @@ namespace lapis {
 	{
 		return getParam<PointMetricParameter>().strataNames();
 	}
+	const std::vector<int>& RunParameters::coarseMetricFactors()
+	{
+		return getParam<PointMetricParameter>().coarseFactors();
+	}
+	const std::vector<std::string>& RunParameters::coarseMetricNames()
+	{
+		return getParam<PointMetricParameter>().coarseNames();
+	}
 	TaoIdAlgorithm* RunParameters::taoIdAlgorithm()
 	{
 		return getParam<TaoParameter>().taoIdAlgo();
@@ -294,10 +323,22 @@ namespace lapis {
 	{
 		return getParam<CsmParameter>().doCsmMetrics();
 	}
+	bool RunParameters::writeCsmAsCog()
+	{
+		return getParam<CsmParameter>().writeCsmAsCog();
+	}
 	bool RunParameters::doTaos()
 	{
 		return doCsm() && getParam<WhichProductsParameter>().doTao();
 	}
+	bool RunParameters::writeTaosToGeopackage()
+	{
+		return getParam<TaoParameter>().writeToGeopackage();
+	}
+	bool RunParameters::exportTaosToParquet()
+	{
+		return getParam<TaoParameter>().exportToParquet();
+	}
 	bool RunParameters::doFineInt()
 	{
 		return getParam<WhichProductsParameter>().doFineInt();
@@ -310,6 +351,14 @@ namespace lapis {
 	{
 		return getParam<PointMetricParameter>().doStratumMetrics();
 	}
+	bool RunParameters::streamPointMetrics()
+	{
+		return getParam<PointMetricParameter>().streamOutput();
+	}
+	bool RunParameters::savePointHistograms()
+	{
+		return getParam<PointMetricParameter>().saveHistograms();
+	}
 
 	bool RunParameters::isDebugNoAlign()
 	{
@@ -334,6 +383,8 @@ namespace lapis {
 				("gui", "Display the GUI")
 				("ini-file", po::value<std::vector<std::string>>(), "The .ini file containing parameters for this run\n"
 					"You may specify this multiple times; values from earlier files will be preferred")
+				("recalculate-point-metrics", po::value<std::string>(), "Recalculate point metrics from a histogram cube saved by an earlier run, instead of processing lidar data\n"
+					"The metrics are written to a folder named Recalculated next to the cube")
 #ifdef _WIN32
 				("nodefault", "Don't use the options stored in lapisdefault.ini")
 #endif
@@ -396,6 +447,10 @@ namespace lapis {
 			if (vmFull.count("gui")) {
 				return ParseResults::guiRequested;
 			}
+			if (vmFull.count("recalculate-point-metrics")) {
+				_recalculateCube = vmFull.at("recalculate-point-metrics").as<std::string>();
+				return ParseResults::recalculateRequested;
+			}
 		}
 		catch (po::error_with_option_name e) {
 			LapisLogger& log = LapisLogger::getLogger();
@@ -407,6 +462,10 @@ namespace lapis {
 		importBoostAndUpdateUnits();
 		return ParseResults::validOpts;
 	}
+	const std::filesystem::path& RunParameters::recalculateCubeFile() const
+	{
+		return _recalculateCube;
+	}
 	RunParameters::ParseResults RunParameters::parseIni(const std::string& path)
 	{
 		namespace po = boost::program_options;
@@ -591,10 +650,14 @@ namespace lapis {
 		}
 
 
+		ExtentIndex lasIndex{ lasExtents };
 		for (size_t i = 0; i < lasExtents.size(); ++i) {
 			Extent& thisExtent = lasExtents[i];
 			di.totalArea += (thisExtent.ymax() - thisExtent.ymin()) * (thisExtent.xmax() - thisExtent.xmin());
-			for (size_t j = i + 1; j < lasExtents.size(); ++j) {
+			for (size_t j : lasIndex.overlapping(thisExtent)) {
+				if (j <= i) {
+					continue;
+				}
 				Extent& compareExtent = lasExtents[j];
 				if (thisExtent.overlaps(compareExtent)) {
 					Extent cr = cropExtent(thisExtent, compareExtent);
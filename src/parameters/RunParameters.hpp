@@ -42,6 +42,7 @@ namespace lapis {
 		const std::string& unitPlural();
 
 		const std::vector<Extent>& lasExtents();
+		const ExtentIndex& lasExtentIndex();
 		LasReader getLas(size_t i);
 		std::optional<LinearUnit> lasZUnits();
 
@@ -66,12 +67,18 @@ namespace lapis {
 		CsmPostProcessor* csmPostProcessAlgorithm();
 
 		int nThread();
+		size_t memoryBudget();
+		GeoTiffCompression geoTiffCompression();
 		coord_t binSize();
 		size_t tileFileSize();
 
 		coord_t canopyCutoff();
+		const std::vector<coord_t>& additionalCanopyCutoffs();
+		const std::vector<std::string>& additionalCanopyCutoffNames();
 		const std::vector<coord_t>& strataBreaks();
 		const std::vector<std::string>& strataNames();
+		const std::vector<int>& coarseMetricFactors();
+		const std::vector<std::string>& coarseMetricNames();
 
 		TaoIdAlgorithm* taoIdAlgorithm();
 		TaoSegmentAlgorithm* taoSegAlgorithm();
@@ -94,18 +101,25 @@ namespace lapis {
 		bool doAdvancedPointMetrics();
 		bool doCsm();
 		bool doCsmMetrics();
+		bool writeCsmAsCog();
 		bool doTaos();
+		bool writeTaosToGeopackage();
+		bool exportTaosToParquet();
 		bool doFineInt();
 		bool doTopo();
 		bool doStratumMetrics();
+		bool streamPointMetrics();
+		bool savePointHistograms();
 
 		bool isDebugNoAlign();
 		bool isDebugNoOutput();
 		bool isAnyDebug();
 
 		enum class ParseResults {
-			invalidOpts, helpPrinted, validOpts, guiRequested
+			invalidOpts, helpPrinted, validOpts, guiRequested, recalculateRequested
 		};
+		//the histogram cube given on the command line when the result is recalculateRequested
+		const std::filesystem::path& recalculateCubeFile() const;
 
 		ParseResults parseArgs(const std::vector<std::string>& args);
 		ParseResults parseIni(const std::string& path);
@@ -137,6 +151,8 @@ namespace lapis {
 		std::shared_ptr<Raster<bool>> _layout;
 
 		std::shared_ptr<void> _pdf;
+
+		std::filesystem::path _recalculateCube;
 	};
 
 	template<class PARAMETER>
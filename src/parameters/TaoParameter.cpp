@@ -29,6 +29,11 @@ namespace lapis {
 
 		_mindist.addHelpText("If two TAOs are very close to each other, it may represent an error rather than two separate trees. "
 			"If this is set to a value greater than 0, then if two TAOs are too close, the shorter one will be removed.");
+		_gpkg.addHelpText("If this is checked, the TAOs will be written to one geopackage, with a spatial index, instead of one shapefile per tile. "
+			"This is much faster to write and to open when there are many tiles.");
+		_parquet.addHelpText("If this is checked, the TAOs will also be written to a single geoparquet file, a columnar format which most analytics tools can read directly. "
+			"The TAOs are grouped by tile within the file, and the file includes the tile each TAO came from.\n\n"
+			"This requires a copy of GDAL built with Parquet support.");
 
 	}
 	void TaoParameter::addToCmd(BoostOptDesc& visible,
@@ -37,6 +42,8 @@ namespace lapis {
 		_mindist.addToCmd(visible, hidden);
 		_idAlgo.addToCmd(visible, hidden);
 		_segAlgo.addToCmd(visible, hidden);
+		_gpkg.addToCmd(visible, hidden);
+		_parquet.addToCmd(visible, hidden);
 	}
 	std::ostream& TaoParameter::printToIni(std::ostream& o) {
 		if (!_sameMinHt.currentState()) {
@@ -46,6 +53,8 @@ namespace lapis {
 
 		_idAlgo.printToIni(o);
 		_segAlgo.printToIni(o);
+		_gpkg.printToIni(o);
+		_parquet.printToIni(o);
 		return o;
 	}
 	ParamCategory TaoParameter::getCategory() const {
@@ -74,6 +83,9 @@ namespace lapis {
 		if (_sameMinHt.currentState()) {
 			ImGui::EndDisabled();
 		}
+
+		_gpkg.renderGui();
+		_parquet.renderGui();
 	}
 	void TaoParameter::importFromBoost() {
 
@@ -86,6 +98,8 @@ namespace lapis {
 		_mindist.importFromBoost();
 		_idAlgo.importFromBoost();
 		_segAlgo.importFromBoost();
+		_gpkg.importFromBoost();
+		_parquet.importFromBoost();
 	}
 	void TaoParameter::updateUnits() {
 		_minht.updateUnits();
@@ -137,7 +151,7 @@ namespace lapis {
 
 		switch (_segAlgo.currentSelection()) {
 		case SegAlgo::WATERSHED:
-			_segmentAlgorithm = std::make_unique<WatershedSegment>(minTaoHt(),rp.maxHt(),rp.binSize());
+			_segmentAlgorithm = std::make_unique<WatershedSegment>(minTaoHt(),rp.maxHt(),rp.binSize(),rp.nThread());
 			break;
 		default:
 			log.logError("Invalid TAO Segment algorithm");
@@ -170,6 +184,14 @@ namespace lapis {
 		prepareForRun();
 		return _segmentAlgorithm.get();
 	}
+	bool TaoParameter::writeToGeopackage() const
+	{
+		return _gpkg.currentState();
+	}
+	bool TaoParameter::exportToParquet() const
+	{
+		return _parquet.currentState();
+	}
 	int TaoParameter::IdAlgoDecider::operator()(const std::string& s) const
 	{
 		const static std::regex highpointregex{ ".*high.*",std::regex::icase };
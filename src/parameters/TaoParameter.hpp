@@ -49,6 +49,8 @@ namespace lapis {
 
 		TaoIdAlgorithm* taoIdAlgo();
 		TaoSegmentAlgorithm* taoSegAlgo();
+		bool writeToGeopackage() const;
+		bool exportToParquet() const;
 
 	private:
 
@@ -73,6 +75,10 @@ namespace lapis {
 		RadioSelect<SegAlgoDecider, SegAlgo::SegAlgo> _segAlgo{ "Canopy Segmentation Algorithm:","seg-algo" };
 		std::unique_ptr<TaoSegmentAlgorithm> _segmentAlgorithm;
 		RadioBoolean _sameMinHt{ "tao-same-min-ht","Same as Point Metric Canopy Cutoff","Other:" };
+		CheckBox _gpkg{ "Write TAOs to a Single GeoPackage","tao-gpkg",
+		"Write the TAOs from every tile to a single geopackage, instead of one shapefile per tile." };
+		CheckBox _parquet{ "Also Export TAOs as GeoParquet","tao-parquet",
+		"Also write the TAO attributes to a single geoparquet file, for loading into analytics tools." };
 
 		bool _runPrepared = false;
 	};
@@ -7,17 +7,17 @@ namespace lapis {
 
 	//A variant of overlay that will not take values from the outer edge of the overlaid raster unless it would overwrite a nodata value
 	//Intended for use when mosaicing together rasters that have edge effects, but also have a buffer
+	//The lock is taken once per row instead of once per cell; the mutex for a row is the one for its first cell
 	void overlayExcludingEdgeThreadSafe(Raster<metric_t>& base, const Raster<metric_t>& over, CsmParameterGetter* getter) {
+		if (!base.overlaps(over)) {
+			return;
+		}
 		Alignment::RowColExtent rcExt = base.rowColExtent(over, SnapType::near); //snap type doesn't matter with consistent alignments, but 'near' will correct for floating point issues
 
-		auto distFromEdge = [](const Alignment& a, rowcol_t row, rowcol_t col) {
-			rowcol_t dist = std::min(col, row);
-			dist = std::min(dist, a.ncol() - 1 - col);
-			dist = std::min(dist, a.nrow() - 1 - row);
-			return dist;
-		};
-
 		for (rowcol_t row = rcExt.minrow; row <= rcExt.maxrow; ++row) {
+			bool edgeRow = row == rcExt.minrow || row == rcExt.maxrow;
+
+			std::scoped_lock lock{ getter->cellMutex(base.cellFromRowColUnsafe(row, 0)) };
 			for (rowcol_t col = rcExt.mincol; col <= rcExt.maxcol; ++col) {
 
 				cell_t baseCell = base.cellFromRowColUnsafe(row, col);
@@ -28,14 +28,13 @@ namespace lapis {
 				if (!otherValue.has_value()) {
 					continue;
 				}
-				std::scoped_lock lock{ getter->cellMutex(baseCell) };
 				if (!thisValue.has_value()) {
 					thisValue.has_value() = true;
 					thisValue.value() = otherValue.value();
 					continue;
 				}
 
-				if (row == rcExt.minrow || row == rcExt.maxrow || col == rcExt.mincol || col == rcExt.maxcol) {
+				if (edgeRow || col == rcExt.mincol || col == rcExt.maxcol) {
 					continue;
 				}
 
@@ -71,6 +70,17 @@ namespace lapis {
 		tryRemove(csmTempDir());
 		tryRemove(csmMetricDir());
 
+		CsmParameterGetter* getter = _getter;
+		auto combiner = [getter](csm_t a, csm_t b) {
+			return getter->csmAlgorithm()->combineCells(a, b);
+		};
+		//even without a budget from the user, the tiles are spilled once there are enough of them that holding the whole CSM would be a risk
+		size_t budget = _getter->csmMemoryBudget();
+		if (!budget) {
+			budget = CsmTileStore::defaultMemoryBudget(*_getter->csmAlign(), *_getter->layout(), _getter->nThread());
+		}
+		_csmStore = CsmTileStore(*_getter->csmAlign(), _getter->layout(), combiner, budget, csmTempDir(), _getter->geoTiffCompression());
+
 		if (!_getter->doCsmMetrics()) {
 			return;
 		}
@@ -92,8 +102,10 @@ namespace lapis {
 	void CsmHandler::finishLasFile(const Extent& e, size_t index)
 	{
 		LapisLogger::getLogger().endVerboseBenchmarkTimer("Assign points to CSM cells");
-		writeRasterLogErrors(getFullTempFilename(csmTempDir(), _csmBaseName, OutputUnitLabel::Default, index), *_csmGenerators[index]->currentCsm());
+		LapisLogger::getLogger().beginVerboseBenchmarkTimer("Combine CSM into tiles");
+		_csmStore.addCsm(*_csmGenerators[index]->currentCsm());
 		_csmGenerators.erase(index);
+		LapisLogger::getLogger().endVerboseBenchmarkTimer("Combine CSM into tiles");
 	}
 	void CsmHandler::handleDem(const Raster<coord_t>& dem, size_t index)
 	{
@@ -104,11 +116,12 @@ namespace lapis {
 
 		log.beginVerboseBenchmarkTimer("Calculate canopy metrics");
 
-		for (CSMMetricRaster& metric : _csmMetrics) {
-			Raster<metric_t> tileMetric = aggregate<metric_t, csm_t>(bufferedCsm, cropAlignment(*_getter->metricAlign(), bufferedCsm, SnapType::out), metric.fun);
-			static std::mutex mut;
-
-			overlayExcludingEdgeThreadSafe(metric.raster, tileMetric, _getter);
+		if (_csmMetrics.size()) {
+			CanopyAggregates<metric_t> tileMetrics = aggregateCanopyMetrics<metric_t, csm_t>(bufferedCsm,
+				cropAlignment(*_getter->metricAlign(), bufferedCsm, SnapType::out));
+			for (CSMMetricRaster& metric : _csmMetrics) {
+				overlayExcludingEdgeThreadSafe(metric.raster, tileMetrics.*metric.field, _getter);
+			}
 		}
 		log.endVerboseBenchmarkTimer("End canopy metrics");
 
@@ -117,17 +130,27 @@ namespace lapis {
 		log.beginVerboseBenchmarkTimer("Write CSM tiles");
 		Raster<csm_t> unbuffered = cropRaster(bufferedCsm, cropExt, SnapType::near);
 
-		writeRasterLogErrors(getFullTileFilename(csmDir(), _csmBaseName, OutputUnitLabel::Default, tile), unbuffered);
+		if (_getter->writeCsmAsCog()) {
+			writeCogLogErrors(getFullTileFilename(csmDir(), _csmBaseName, OutputUnitLabel::Default, tile), unbuffered);
+		}
+		else {
+			writeRasterLogErrors(getFullTileFilename(csmDir(), _csmBaseName, OutputUnitLabel::Default, tile), unbuffered);
+		}
 		log.endVerboseBenchmarkTimer("Write CSM tiles");
 	}
 	void CsmHandler::cleanup()
 	{
+		_csmStore.clear();
 		tryRemove(csmTempDir());
 		deleteTempDirIfEmpty();
 
+		if (_getter->writeCsmAsCog()) {
+			writeVrtLogErrors(getFullFilename(csmDir(), _csmBaseName, OutputUnitLabel::Default, "vrt"), csmDir());
+		}
+
 		LapisLogger::getLogger().setProgress("Writing Canopy Metrics");
 		for (CSMMetricRaster& metric : _csmMetrics) {
-			writeRasterLogErrors(getFullFilename(csmMetricDir(), metric.name, metric.unit),metric.raster);
+			writeRasterLogErrors(getFullFilename(csmMetricDir(), metric.name, metric.unit),metric.raster, _getter->nThread());
 		}
 		_csmMetrics = std::vector<CSMMetricRaster>();
 	}
@@ -158,6 +181,11 @@ namespace lapis {
 				"The filename indicates the column and row of each tile. The location of each tile is contained in the "
 				"TileLayout.shp file in the Layout directory.";
 		}
+		if (_getter->writeCsmAsCog()) {
+			overall << " The tiles are cloud optimized geotiffs, with overviews for fast display at coarse scales. The file "
+				<< getFullFilename("", _csmBaseName, OutputUnitLabel::Default, "vrt").string()
+				<< " combines all of the tiles into a single virtual raster.";
+		}
 		pdf.writeTextBlockWithWrap(overall.str());
 		pdf.blankLine();
 		
@@ -207,66 +235,45 @@ namespace lapis {
 		}
 
 		LapisLogger& log = LapisLogger::getLogger();
-		log.beginVerboseBenchmarkTimer("Mosaic temporary CSM files");
+		log.beginVerboseBenchmarkTimer("Mosaic CSM tiles");
 
-		std::shared_ptr<Alignment> layout = _getter->layout();
 		std::shared_ptr<Alignment> csmAlign = _getter->csmAlign();
 
-		Extent thistile = layout->extentFromCell(tile);
-
 		coord_t bufferAmount = std::max(_getter->metricAlign()->xres(), _getter->metricAlign()->yres()) * 1.5;
 		bufferAmount = linearUnitPresets::meter.convertOneToThis(bufferAmount, 
 			_getter->metricAlign()->crs().getXYLinearUnits().value_or(linearUnitPresets::unknownLinear));
 
 		Raster<csm_t> bufferedCsm = getEmptyRasterFromTile<csm_t>(tile, *csmAlign, bufferAmount);
 
+		//the output is trimmed to the area covered by the las files, so the edges of the data aren't treated as missing values
 		Extent extentWithData;
 		bool extentInit = false;
 
 		const std::vector<Extent>& lasExtents = _getter->lasExtents();
-		for (size_t i = 0; i < lasExtents.size(); ++i) {
+		for (size_t i : _getter->lasExtentIndex().overlapping(bufferedCsm)) {
 			Extent thisext = lasExtents[i]; //intentional copy
 
-			//Because the geotiff format doesn't store the entire WKT, you will sometimes end up in the situation where the WKT you set
-			//and the WKT you get by writing and then reading a tif are not the same
-			//This is mostly harmless but it does cause proj's is_equivalent functions to return false sometimes
-			//In this case, we happen to know that the files we're going to be reading are the same CRS as thisext, regardless of slight WKT differences,
-			//so we give it an empty CRS to force all isConsistent functions to return true
+			//the las extents can carry a WKT which isn't byte-for-byte the same as the CSM's, even though they're the same CRS
+			//giving it an empty CRS forces all isConsistent functions to return true
 			thisext.defineCRS(CoordRef());
 
 			if (!thisext.overlaps(bufferedCsm)) {
 				continue;
 			}
-			thisext = cropExtent(thisext, bufferedCsm);
-			Raster<csm_t> thisr;
-			std::string filename = getFullTempFilename(csmTempDir(), _csmBaseName, OutputUnitLabel::Default, i).string();
-			try {
-				thisr = Raster<csm_t>{ filename,thisext, SnapType::out };
-			}
-			catch (InvalidRasterFileException e) {
-				LapisLogger::getLogger().logWarning("Unable to open " + filename);
-				continue;
-			}
-
+			thisext = bufferedCsm.alignExtent(cropExtent(thisext, bufferedCsm), SnapType::out);
 			if (!extentInit) {
-				extentWithData = thisr;
+				extentWithData = thisext;
 				extentInit = true;
 			}
 			else {
-				extentWithData = extendExtent(extentWithData, thisr);
+				extentWithData = extendExtent(extentWithData, thisext);
 			}
-
-
-			//for the same reason as the above comment
-			thisr.defineCRS(bufferedCsm.crs());
-			auto overlayFunc = [&](csm_t a, csm_t b) {
-				return _getter->csmAlgorithm()->combineCells(a, b);
-			};
-			bufferedCsm.overlay(thisr, overlayFunc);
 		}
 
-		if (!bufferedCsm.hasAnyValue()) {
-			log.endVerboseBenchmarkTimer("Mosaic temporary CSM files");
+		_csmStore.readInto(bufferedCsm);
+
+		if (!extentInit || !bufferedCsm.hasAnyValue()) {
+			log.endVerboseBenchmarkTimer("Mosaic CSM tiles");
 			return Raster<csm_t>();
 		}
 
@@ -274,7 +281,7 @@ namespace lapis {
 
 		bufferedCsm = _getter->csmPostProcessAlgorithm()->postProcess(bufferedCsm);
 
-		log.endVerboseBenchmarkTimer("Mosaic temporary CSM files");
+		log.endVerboseBenchmarkTimer("Mosaic CSM tiles");
 		return bufferedCsm;
 	}
 	std::filesystem::path CsmHandler::csmTempDir() const
@@ -294,25 +301,27 @@ namespace lapis {
 	{
 		using oul = OutputUnitLabel;
 
-		auto addMetric = [&](CsmMetricFunc fun, const std::string& name, 
+		using agg = CanopyAggregates<metric_t>;
+
+		auto addMetric = [&](CsmMetricField field, const std::string& name, 
 			oul unit, const std::string& desc) {
-			_csmMetrics.emplace_back(_getter, name, fun, unit, desc);
+			_csmMetrics.emplace_back(_getter, name, field, unit, desc);
 		};
 
-		addMetric(&viewMax<metric_t, csm_t>, "MaxCSM", oul::Default,
+		addMetric(&agg::max, "MaxCSM", oul::Default,
 			"The maximum value attained in the CSM.");
-		addMetric(&viewMean<metric_t, csm_t>, "MeanCSM", oul::Default,
+		addMetric(&agg::mean, "MeanCSM", oul::Default,
 			"The mean of the values of the CSM.");
-		addMetric(&viewStdDev<metric_t, csm_t>, "StdDevCSM", oul::Default,
+		addMetric(&agg::stdDev, "StdDevCSM", oul::Default,
 			"The standard deviation of the values of the CSM.");
-		addMetric(&viewRumple<metric_t, csm_t>, "RumpleCSM", oul::Unitless,
+		addMetric(&agg::rumple, "RumpleCSM", oul::Unitless,
 			"The surface area of the CSM, divided by the area of the ground beneath it. "
 			"A larger value indicates a more complex canopy.");
 	}
 
-	CsmHandler::CSMMetricRaster::CSMMetricRaster(ParamGetter* getter, const std::string& name, CsmMetricFunc fun,
+	CsmHandler::CSMMetricRaster::CSMMetricRaster(ParamGetter* getter, const std::string& name, CsmMetricField field,
 		OutputUnitLabel unit, const std::string& pdfDesc)
-		: name(name), fun(fun), unit(unit), raster(*getter->metricAlign()), pdfDesc(pdfDesc)
+		: name(name), field(field), unit(unit), raster(*getter->metricAlign()), pdfDesc(pdfDesc)
 	{
 	}
 }
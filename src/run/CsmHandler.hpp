@@ -3,6 +3,7 @@
 #define LP_CSMHANDLER_H
 
 #include"ProductHandler.hpp"
+#include"CsmTileStore.hpp"
 
 namespace lapis {
 	class CsmHandler : public ProductHandler {
@@ -30,15 +31,16 @@ namespace lapis {
 		std::filesystem::path csmMetricDir() const;
 
 	protected:
-		using CsmMetricFunc = ViewFunc<metric_t, csm_t>;
+		//all of the canopy metrics are calculated together by aggregateCanopyMetrics; this picks out which of its outputs a metric is
+		using CsmMetricField = Raster<metric_t> CanopyAggregates<metric_t>::*;
 		struct CSMMetricRaster {
 			std::string name;
-			CsmMetricFunc fun;
+			CsmMetricField field;
 			OutputUnitLabel unit;
 			Raster<metric_t> raster;
 			std::string pdfDesc;
 
-			CSMMetricRaster(ParamGetter* getter, const std::string& name, CsmMetricFunc fun,
+			CSMMetricRaster(ParamGetter* getter, const std::string& name, CsmMetricField field,
 				OutputUnitLabel unit, const std::string& pdfDesc);
 		};
 		std::vector<CSMMetricRaster> _csmMetrics;
@@ -47,6 +49,7 @@ namespace lapis {
 		ParamGetter* _getter;
 
 		std::unordered_map<size_t, std::unique_ptr<CsmMaker>> _csmGenerators;
+		CsmTileStore _csmStore;
 
 		void _initMetrics();
 		
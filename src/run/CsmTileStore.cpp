@@ -0,0 +1,223 @@
+#include"run_pch.hpp"
+#include"CsmTileStore.hpp"
+#include"..\gis\BlockRasterWriter.hpp"
+
+namespace lapis {
+
+	CsmTileStore::CsmTileStore(const Alignment& csmAlign, std::shared_ptr<Alignment> layout, Combiner combiner,
+		size_t memoryBudget, const std::filesystem::path& spillDir, GeoTiffCompression spillCompression)
+		: _csmAlign(csmAlign), _layout(layout), _combiner(combiner), _memoryBudget(memoryBudget), _spillDir(spillDir),
+		_spillCompression(spillCompression),
+		_state(std::make_unique<State>())
+	{
+	}
+
+	void CsmTileStore::addCsm(const Raster<csm_t>& r)
+	{
+		if (!_state || !r.hasAnyValue()) {
+			return;
+		}
+		for (cell_t tile : _tilesOverlapping(r)) {
+			Alignment tileAlign = _tileAlignment(tile);
+			if (!tileAlign.overlaps(r)) {
+				continue;
+			}
+			Raster<csm_t> piece = cropRaster(r, cropExtent(tileAlign, r), SnapType::near);
+			if (!piece.hasAnyValue()) {
+				continue;
+			}
+
+			Shard& shard = _shard(tile);
+			std::lock_guard lock{ shard.mut };
+			TileEntry& entry = shard.tiles[tile];
+			_loadIfSpilled(tile, entry);
+			if (!entry.data) {
+				entry.data = std::make_unique<Raster<csm_t>>(tileAlign);
+				_state->bytes += _bytes(*entry.data);
+			}
+			entry.data->overlay(piece, _combiner);
+			_touch(tile);
+		}
+
+		if (_memoryBudget && _state->bytes > _memoryBudget) {
+			_spillUntilUnderBudget();
+		}
+	}
+
+	void CsmTileStore::readInto(Raster<csm_t>& r) const
+	{
+		if (!_state) {
+			return;
+		}
+		for (cell_t tile : _tilesOverlapping(r)) {
+			Raster<csm_t> tileData;
+			{
+				Shard& shard = _shard(tile);
+				std::lock_guard lock{ shard.mut };
+				auto it = shard.tiles.find(tile);
+				if (it == shard.tiles.end()) {
+					continue;
+				}
+				if (it->second.data) {
+					if (!it->second.data->overlaps(r)) {
+						continue;
+					}
+					tileData = cropRaster(*it->second.data, cropExtent(*it->second.data, r), SnapType::near);
+				}
+				else if (it->second.spilled) {
+					//tiles are only read once each after the las files are finished, so there's no point in keeping them in memory again
+					tileData = Raster<csm_t>(_spillFile(tile).string());
+					tileData.defineCRS(_csmAlign.crs());
+					if (!tileData.overlaps(r)) {
+						continue;
+					}
+					tileData = cropRaster(tileData, cropExtent(tileData, r), SnapType::near);
+				}
+				else {
+					continue;
+				}
+			}
+			r.overlay(tileData, _combiner);
+		}
+	}
+
+	void CsmTileStore::clear()
+	{
+		if (!_state) {
+			return;
+		}
+		for (Shard& shard : _state->shards) {
+			std::lock_guard lock{ shard.mut };
+			shard.tiles.clear();
+		}
+		{
+			std::lock_guard lock{ _state->usage.mut };
+			_state->usage.order.clear();
+			_state->usage.positions.clear();
+		}
+		_state->bytes = 0;
+		try {
+			std::filesystem::remove_all(_spillDir);
+		}
+		catch (...) {
+			LapisLogger::getLogger().logWarning("Unable to delete " + _spillDir.string());
+		}
+	}
+
+	size_t CsmTileStore::bytesInMemory() const
+	{
+		return _state ? _state->bytes.load() : 0;
+	}
+
+	size_t CsmTileStore::defaultMemoryBudget(const Alignment& csmAlign, const Alignment& layout, int nThread)
+	{
+		//a tile can pick up an extra row and column when snapped out to the csm alignment
+		size_t cellsPerTile = (size_t)(layout.xres() / csmAlign.xres() + 2) * (size_t)(layout.yres() / csmAlign.yres() + 2);
+		size_t tilesKept = std::max<size_t>(16, 4 * (size_t)std::max(nThread, 1));
+		return tilesKept * (cellsPerTile * sizeof(csm_t) + cellsPerTile / 8 + 1);
+	}
+
+	CsmTileStore::Shard& CsmTileStore::_shard(cell_t tile) const
+	{
+		return _state->shards[tile % _nShards];
+	}
+
+	Alignment CsmTileStore::_tileAlignment(cell_t tile) const
+	{
+		return cropAlignment(_csmAlign, _layout->extentFromCell(tile), SnapType::out);
+	}
+
+	std::vector<cell_t> CsmTileStore::_tilesOverlapping(const Extent& e) const
+	{
+		std::vector<cell_t> out;
+		if (!_layout->overlaps(e)) {
+			return out;
+		}
+		for (cell_t tile : CellIterator(*_layout, cropExtent(e, *_layout), SnapType::out)) {
+			out.push_back(tile);
+		}
+		return out;
+	}
+
+	std::filesystem::path CsmTileStore::_spillFile(cell_t tile) const
+	{
+		return _spillDir / ("Tile_" + std::to_string(tile) + ".tif");
+	}
+
+	size_t CsmTileStore::_bytes(const Raster<csm_t>& r)
+	{
+		//the has_value flags are packed one bit per cell
+		return r.ncell() * sizeof(csm_t) + r.ncell() / 8 + 1;
+	}
+
+	void CsmTileStore::_loadIfSpilled(cell_t tile, TileEntry& entry)
+	{
+		if (!entry.spilled) {
+			return;
+		}
+		std::filesystem::path file = _spillFile(tile);
+		entry.data = std::make_unique<Raster<csm_t>>(file.string());
+		entry.data->defineCRS(_csmAlign.crs());
+		entry.spilled = false;
+		_state->bytes += _bytes(*entry.data);
+		std::filesystem::remove(file);
+	}
+
+	void CsmTileStore::_spillUntilUnderBudget()
+	{
+		//only one thread needs to be choosing tiles to spill at a time
+		std::unique_lock spillLock{ _state->spillMut, std::try_to_lock };
+		if (!spillLock.owns_lock()) {
+			return;
+		}
+		std::filesystem::create_directories(_spillDir);
+
+		while (_state->bytes > _memoryBudget) {
+			cell_t oldestTile = _popLeastRecent();
+			if (oldestTile < 0) {
+				return;
+			}
+
+			//if another thread uses the tile between it being chosen and the shard being locked, it's spilled anyway and read back when it's next needed
+			Shard& shard = _shard(oldestTile);
+			std::lock_guard lock{ shard.mut };
+			auto it = shard.tiles.find(oldestTile);
+			if (it == shard.tiles.end() || !it->second.data) {
+				continue;
+			}
+			TileEntry& entry = it->second;
+			{
+				BlockRasterWriter<csm_t> writer{ _spillFile(oldestTile).string(), *entry.data, 256, _spillCompression };
+				writer.writeBlock(*entry.data);
+			}
+			_state->bytes -= _bytes(*entry.data);
+			entry.data.reset();
+			entry.spilled = true;
+		}
+	}
+
+	void CsmTileStore::_touch(cell_t tile)
+	{
+		UsageOrder& usage = _state->usage;
+		std::lock_guard lock{ usage.mut };
+		auto it = usage.positions.find(tile);
+		if (it != usage.positions.end()) {
+			usage.order.splice(usage.order.end(), usage.order, it->second);
+			return;
+		}
+		usage.positions.emplace(tile, usage.order.insert(usage.order.end(), tile));
+	}
+
+	cell_t CsmTileStore::_popLeastRecent()
+	{
+		UsageOrder& usage = _state->usage;
+		std::lock_guard lock{ usage.mut };
+		if (usage.order.empty()) {
+			return -1;
+		}
+		cell_t tile = usage.order.front();
+		usage.order.pop_front();
+		usage.positions.erase(tile);
+		return tile;
+	}
+}
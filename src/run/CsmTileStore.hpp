@@ -0,0 +1,89 @@
+#pragma once
+#ifndef LP_CSMTILESTORE_H
+#define LP_CSMTILESTORE_H
+
+#include"run_pch.hpp"
+
+namespace lapis {
+
+	//Holds the CSM for each tile of the layout while the las files are being read, so the output of each file
+	//can be combined into the tiles as it finishes instead of being written to disk and read back.
+	//If a memory budget is given and the tiles in memory exceed it, the least recently used tiles are written to
+	//compressed files in the spill directory, and read back when they're needed again
+	class CsmTileStore {
+	public:
+		using Combiner = std::function<csm_t(csm_t, csm_t)>;
+
+		CsmTileStore() = default;
+		//a memory budget of 0 means the tiles are never spilled to disk. Spilled tiles are written with spillCompression
+		CsmTileStore(const Alignment& csmAlign, std::shared_ptr<Alignment> layout, Combiner combiner,
+			size_t memoryBudget, const std::filesystem::path& spillDir, GeoTiffCompression spillCompression);
+
+		//combines the values of r into every tile it overlaps, using the combiner given in the constructor
+		//r must be consistent with the csm alignment. This function is thread-safe
+		void addCsm(const Raster<csm_t>& r);
+
+		//combines the stored values of every tile overlapping r into r
+		//this function is thread-safe, but shouldn't be called while addCsm is still being called
+		void readInto(Raster<csm_t>& r) const;
+
+		//frees the tiles and deletes any spilled files
+		void clear();
+
+		//the number of bytes held by tiles which aren't spilled to disk
+		size_t bytesInMemory() const;
+
+		//a budget which holds enough tiles for each thread to be working on several at once, for runs where the user didn't set one
+		static size_t defaultMemoryBudget(const Alignment& csmAlign, const Alignment& layout, int nThread);
+
+	private:
+		struct TileEntry {
+			std::unique_ptr<Raster<csm_t>> data;
+			bool spilled = false;
+		};
+		static constexpr size_t _nShards = 64;
+		struct Shard {
+			std::mutex mut;
+			std::unordered_map<cell_t, TileEntry> tiles;
+		};
+		//the tiles in memory, from least to most recently used
+		//this has its own lock, which is never held while waiting for a shard's lock
+		struct UsageOrder {
+			std::mutex mut;
+			std::list<cell_t> order;
+			std::unordered_map<cell_t, std::list<cell_t>::iterator> positions;
+		};
+		//the locks and counters live behind a pointer so the store can be moved
+		struct State {
+			std::array<Shard, _nShards> shards;
+			std::atomic<size_t> bytes = 0;
+			UsageOrder usage;
+			std::mutex spillMut;
+		};
+
+		Alignment _csmAlign;
+		std::shared_ptr<Alignment> _layout;
+		Combiner _combiner;
+		size_t _memoryBudget = 0;
+		std::filesystem::path _spillDir;
+		GeoTiffCompression _spillCompression = GeoTiffCompression::Deflate;
+		std::unique_ptr<State> _state;
+
+		Shard& _shard(cell_t tile) const;
+		Alignment _tileAlignment(cell_t tile) const;
+		std::vector<cell_t> _tilesOverlapping(const Extent& e) const;
+		std::filesystem::path _spillFile(cell_t tile) const;
+		static size_t _bytes(const Raster<csm_t>& r);
+
+		//if the tile has been spilled, reads it back in and deletes the file. The shard must be locked by the caller
+		void _loadIfSpilled(cell_t tile, TileEntry& entry);
+		void _spillUntilUnderBudget();
+
+		//marks the tile as the most recently used
+		void _touch(cell_t tile);
+		//removes and returns the least recently used tile, or -1 if there are none
+		cell_t _popLeastRecent();
+	};
+}
+
+#endif
@@ -27,22 +27,21 @@ namespace lapis {
 	void FineIntHandler::prepareForRun()
 	{
 		tryRemove(fineIntDir());
-		tryRemove(fineIntTempDir());
 
 		_fineIntBaseName = _getter->fineIntCanopyCutoff() > std::numeric_limits<coord_t>::lowest() ? "MeanCanopyIntensity" : "MeanIntensity";
+
+		_state = std::make_unique<State>();
+		_state->tiles = std::vector<TileSums>(_getter->layout()->ncell());
+		_countLasFilesPerTile();
 	}
 	void FineIntHandler::handlePoints(const std::span<LasPoint>& points, const Extent& e, size_t index)
 	{
 		LapisLogger& log = LapisLogger::getLogger();
 
 		log.beginVerboseBenchmarkTimer("Assigning points to intensity cells");
-		if (!_tiles.contains(index)) {
-			Alignment thisAlign = cropAlignment(*_getter->fineIntAlign(), e, SnapType::out);
-			_tiles.emplace(index, NumDenom(thisAlign));
-		}
-
-		Raster<intensity_t>& numerator = _tiles.at(index).num;
-		Raster<intensity_t>& denominator = _tiles.at(index).denom;
+		NumDenom& sums = _lasFileSums(index, e);
+		Raster<intensity_t>& numerator = sums.num;
+		Raster<intensity_t>& denominator = sums.denom;
 
 		coord_t cutoff = _getter->fineIntCanopyCutoff();
 		for (const LasPoint& p : points) {
@@ -57,8 +56,9 @@ namespace lapis {
 	}
 	void FineIntHandler::finishLasFile(const Extent& e, size_t index)
 	{
-		Raster<intensity_t>& numerator = _tiles.at(index).num;
-		Raster<intensity_t>& denominator = _tiles.at(index).denom;
+		NumDenom& sums = _lasFileSums(index, e);
+		Raster<intensity_t>& numerator = sums.num;
+		Raster<intensity_t>& denominator = sums.denom;
 
 		LapisLogger::getLogger().endVerboseBenchmarkTimer("Assigning points to intensity cells");
 
@@ -70,88 +70,125 @@ namespace lapis {
 			}
 		}
 
-		writeRasterLogErrors(getFullTempFilename(fineIntTempDir(), _numeratorBasename, OutputUnitLabel::Unitless, index), numerator);
-		writeRasterLogErrors(getFullTempFilename(fineIntTempDir(), _denominatorBasename, OutputUnitLabel::Unitless, index), denominator);
+		LapisLogger::getLogger().beginVerboseBenchmarkTimer("Combine intensity into tiles");
+		_addToTiles(sums);
+		LapisLogger::getLogger().endVerboseBenchmarkTimer("Combine intensity into tiles");
 
-		_tiles.erase(index);
+		{
+			std::lock_guard lock{ _state->lasFileMut };
+			_lasFiles.erase(index);
+		}
+
+		if (index >= _state->lasFileTiles.size()) {
+			return;
+		}
+		for (cell_t tile : _state->lasFileTiles[index]) {
+			bool finished = false;
+			{
+				TileSums& tileSums = _state->tiles[tile];
+				std::lock_guard lock{ tileSums.mut };
+				finished = --tileSums.lasFilesRemaining == 0;
+			}
+			if (finished) {
+				_writeTile(tile);
+			}
+		}
 	}
 	void FineIntHandler::handleDem(const Raster<coord_t>& dem, size_t index)
 	{
 	}
 	void FineIntHandler::handleCsmTile(const Raster<csm_t>& bufferedCsm, cell_t tile)
 	{
-
+		//tiles touching a las file with no points never finish on their own, so they're written here instead
+		_writeTile(tile);
+	}
+	void FineIntHandler::_writeTile(cell_t tile)
+	{
 		LapisLogger& log = LapisLogger::getLogger();
 
-		log.beginVerboseBenchmarkTimer("Mosaic temporary intensity files");
-		Raster<intensity_t> numerator = getEmptyRasterFromTile<intensity_t>(tile, *_getter->fineIntAlign(), 0.);
-		Raster<intensity_t> denominator{ (Alignment)numerator };
-
-		Extent extentWithData;
-		bool extentInit = false;
-
-		const std::vector<Extent>& lasExtents = _getter->lasExtents();
-		for (size_t i = 0; i < lasExtents.size(); ++i) {
-			Extent thisext = lasExtents[i]; //intentional copy
+		log.beginVerboseBenchmarkTimer("Write intensity tiles");
+		std::unique_ptr<NumDenom> sums;
+		{
+			TileSums& tileSums = _state->tiles[tile];
+			std::lock_guard lock{ tileSums.mut };
+			sums = std::move(tileSums.sums);
+		}
 
-			//Because the geotiff format doesn't store the entire WKT, you will sometimes end up in the situation where the WKT you set
-			//and the WKT you get by writing and then reading a tif are not the same
-			//This is mostly harmless but it does cause proj's is_equivalent functions to return false sometimes
-			//In this case, we happen to know that the files we're going to be reading are the same CRS as thisext, regardless of slight WKT differences,
-			//so we give it an empty CRS to force all isConsistent functions to return true
-			thisext.defineCRS(CoordRef());
+		if (!sums || !sums->denom.hasAnyValue()) {
+			log.endVerboseBenchmarkTimer("Write intensity tiles");
+			return;
+		}
 
-			Raster<intensity_t> thisNumerator, thisDenominator;
+		Raster<intensity_t> meanIntensity = sums->num / sums->denom;
+		writeRasterLogErrors(getFullTileFilename(fineIntDir(), _fineIntBaseName, OutputUnitLabel::Unitless, tile), meanIntensity);
+		log.endVerboseBenchmarkTimer("Write intensity tiles");
+	}
+	void FineIntHandler::cleanup() {
+		_state.reset();
+		deleteTempDirIfEmpty();
+	}
+	FineIntHandler::NumDenom& FineIntHandler::_lasFileSums(size_t index, const Extent& e)
+	{
+		//references into an unordered_map stay valid when other elements are added, so the lock is only needed for the lookup
+		std::lock_guard lock{ _state->lasFileMut };
+		auto it = _lasFiles.find(index);
+		if (it == _lasFiles.end()) {
+			Alignment thisAlign = cropAlignment(*_getter->fineIntAlign(), e, SnapType::out);
+			it = _lasFiles.emplace(index, NumDenom(thisAlign)).first;
+		}
+		return it->second;
+	}
+	void FineIntHandler::_countLasFilesPerTile()
+	{
+		const Raster<bool>& layout = *_getter->layout();
+		const Alignment& fineIntAlign = *_getter->fineIntAlign();
+		_state->lasFileTiles = std::vector<std::vector<cell_t>>(_getter->lasExtents().size());
 
-			if (!thisext.overlaps(numerator)) {
+		for (cell_t tile : CellIterator(layout)) {
+			if (!layout.atCellUnsafe(tile).has_value()) {
 				continue;
 			}
-			thisext = cropExtent(thisext, numerator);
-
-			try {
-				//in certain circumstances, writing a raster to the harddrive and then reading it back off will cause very minor differences to the CRS which cause them to not register as consistent.
-				//this slightly hacky solution sidesteps that problem
-				Extent e = (Extent)numerator;
-				e.defineCRS(CoordRef(""));
-
-				thisNumerator = Raster<intensity_t>{ getFullTempFilename(fineIntTempDir(),_numeratorBasename,OutputUnitLabel::Unitless,i).string(),
-					e, SnapType::near};
-				thisDenominator = Raster<intensity_t>{ getFullTempFilename(fineIntTempDir(),_denominatorBasename,OutputUnitLabel::Unitless,i).string(),
-					e, SnapType::near };
-
-				thisNumerator.defineCRS(numerator.crs());
-				thisDenominator.defineCRS(denominator.crs());
+			//both the tile and the las files are snapped out to the intensity cells, so a file within a cell of the tile may still add to it
+			Extent e = layout.extentFromCell(tile);
+			Extent buffered{ e.xmin() - fineIntAlign.xres(), e.xmax() + fineIntAlign.xres(), e.ymin() - fineIntAlign.yres(), e.ymax() + fineIntAlign.yres() };
+			for (size_t i : _getter->lasExtentIndex().overlapping(buffered)) {
+				_state->lasFileTiles[i].push_back(tile);
+				_state->tiles[tile].lasFilesRemaining++;
 			}
-			catch (InvalidRasterFileException e) {
-				LapisLogger::getLogger().logWarning("Issue opening temporary intensity file " + std::to_string(i));
+		}
+	}
+	void FineIntHandler::_addToTiles(const NumDenom& lasFile)
+	{
+		const Raster<bool>& layout = *_getter->layout();
+		if (!layout.overlaps(lasFile.denom)) {
+			return;
+		}
+		auto plus = [](intensity_t a, intensity_t b) {return a + b; };
+
+		for (cell_t tile : CellIterator(layout, cropExtent(lasFile.denom, layout), SnapType::out)) {
+			if (!layout.atCellUnsafe(tile).has_value()) {
 				continue;
 			}
-
-			numerator.overlay(thisNumerator, [](intensity_t a, intensity_t b) {return a + b; });
-			denominator.overlay(thisDenominator, [](intensity_t a, intensity_t b) {return a + b; });
-
-			if (!extentInit) {
-				extentInit = true;
-				extentWithData = numerator;
+			//this matches the alignment the tile would have been given by getEmptyRasterFromTile
+			Alignment tileAlign = cropAlignment(*_getter->fineIntAlign(), layout.extentFromCell(tile), SnapType::ll);
+			if (!tileAlign.overlaps(lasFile.denom)) {
+				continue;
 			}
-			else {
-				extentWithData = extendExtent(extentWithData, numerator);
+			Extent cropExt = cropExtent(tileAlign, lasFile.denom);
+			Raster<intensity_t> num = cropRaster(lasFile.num, cropExt, SnapType::near);
+			Raster<intensity_t> denom = cropRaster(lasFile.denom, cropExt, SnapType::near);
+			if (!denom.hasAnyValue()) {
+				continue;
 			}
-		}
 
-		if (!denominator.hasAnyValue()) {
-			log.endVerboseBenchmarkTimer("Mosaic temporary intensity files");
-			return;
+			TileSums& tileSums = _state->tiles[tile];
+			std::lock_guard lock{ tileSums.mut };
+			if (!tileSums.sums) {
+				tileSums.sums = std::make_unique<NumDenom>(tileAlign);
+			}
+			tileSums.sums->num.overlay(num, plus);
+			tileSums.sums->denom.overlay(denom, plus);
 		}
-
-		Raster<intensity_t> meanIntensity = numerator / denominator;
-		meanIntensity = cropRaster(meanIntensity, extentWithData, SnapType::out);
-		writeRasterLogErrors(getFullTileFilename(fineIntDir(), _fineIntBaseName, OutputUnitLabel::Unitless, tile), meanIntensity);
-		log.endVerboseBenchmarkTimer("Mosaic temporary intensity files");
-	}
-	void FineIntHandler::cleanup() {
-		tryRemove(fineIntTempDir());
-		deleteTempDirIfEmpty();
 	}
 	void FineIntHandler::describeInPdf(MetadataPdf& pdf)
 	{
@@ -192,8 +229,4 @@ namespace lapis {
 	{
 		return parentDir() / "Intensity";
 	}
-	std::filesystem::path FineIntHandler::fineIntTempDir() const
-	{
-		return tempDir() / "Intensity";
-	}
 }
\ No newline at end of file
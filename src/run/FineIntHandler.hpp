@@ -24,11 +24,8 @@ namespace lapis {
 		void describeInPdf(MetadataPdf& pdf) override;
 
 		std::filesystem::path fineIntDir() const;
-		std::filesystem::path fineIntTempDir() const;
 
 	protected:
-		std::string _numeratorBasename = "numerator";
-		std::string _denominatorBasename = "denominator";
 		std::string _fineIntBaseName;
 
 		ParamGetter* _getter;
@@ -39,7 +36,29 @@ namespace lapis {
 			Raster<intensity_t> num;
 			Raster<intensity_t> denom;
 		};
-		std::unordered_map<size_t, NumDenom> _tiles;
+		//the sums for each las file while its points are being read
+		std::unordered_map<size_t, NumDenom> _lasFiles;
+
+		//the sums for each layout tile, which each las file adds to as it finishes
+		//once every las file overlapping the tile has finished, the tile is written and freed
+		struct TileSums {
+			std::mutex mut;
+			std::unique_ptr<NumDenom> sums;
+			int lasFilesRemaining = 0;
+		};
+		//the locks live behind a pointer so the handler can be moved
+		struct State {
+			std::mutex lasFileMut;
+			std::vector<TileSums> tiles;
+			//the layout tiles each las file counts towards
+			std::vector<std::vector<cell_t>> lasFileTiles;
+		};
+		std::unique_ptr<State> _state;
+
+		NumDenom& _lasFileSums(size_t index, const Extent& e);
+		void _addToTiles(const NumDenom& lasFile);
+		void _countLasFilesPerTile();
+		void _writeTile(cell_t tile);
 	};
 }
 
@@ -0,0 +1,299 @@
+#include"run_pch.hpp"
+#include"HistogramCube.hpp"
+
+namespace lapis {
+
+	static constexpr uint32_t histogramCubeVersion = 2;
+
+	HistogramCubeWriter::HistogramCubeWriter(const std::filesystem::path& file, const Alignment& a,
+		coord_t canopyCutoff, coord_t maxHt, coord_t binSize, const std::vector<coord_t>& strataBreaks,
+		const std::vector<coord_t>& additionalCutoffs)
+		: _ofs(file, std::ios::binary), _locations(a.ncell())
+	{
+		if (!_ofs) {
+			throw std::runtime_error("Unable to open " + file.string() + " for writing");
+		}
+		_ofs.write("LPHC", 4);
+		_writeBytes(histogramCubeVersion);
+
+		std::string wkt = a.crs().getCompleteWKT();
+		_writeBytes((uint64_t)wkt.size());
+		_ofs.write(wkt.data(), wkt.size());
+		_writeBytes((double)a.xmin());
+		_writeBytes((double)a.ymin());
+		_writeBytes((double)a.xres());
+		_writeBytes((double)a.yres());
+		_writeBytes((int32_t)a.nrow());
+		_writeBytes((int32_t)a.ncol());
+
+		_writeBytes((double)canopyCutoff);
+		_writeBytes((double)maxHt);
+		_writeBytes((double)binSize);
+		_writeBytes((uint32_t)strataBreaks.size());
+		for (coord_t v : strataBreaks) {
+			_writeBytes((double)v);
+		}
+		_writeBytes((uint32_t)additionalCutoffs.size());
+		for (coord_t v : additionalCutoffs) {
+			_writeBytes((double)v);
+		}
+
+		//filled in with the location of the index when the file is closed
+		_indexPointerPos = _ofs.tellp();
+		_writeBytes((uint64_t)0);
+	}
+
+	HistogramCubeWriter::~HistogramCubeWriter()
+	{
+		close();
+	}
+
+	void HistogramCubeWriter::writeCell(cell_t cell, const PointMetricCalculator& pmc)
+	{
+		std::ostringstream record;
+		pmc.writeTo(record);
+		std::string s = record.str();
+
+		std::string full;
+		uint32_t chunk = 0;
+		{
+			std::lock_guard lock{ _mut };
+			if (_closed) {
+				return;
+			}
+			_locations[cell] = { _nChunks, (uint32_t)_buffer.size() };
+			_buffer += s;
+			if (_buffer.size() < _chunkBytes) {
+				return;
+			}
+			full.swap(_buffer);
+			chunk = _nChunks++;
+		}
+		_writeChunk(chunk, full);
+	}
+
+	void HistogramCubeWriter::close()
+	{
+		std::string last;
+		uint32_t chunk = 0;
+		{
+			std::lock_guard lock{ _mut };
+			if (_closed) {
+				return;
+			}
+			_closed = true;
+			last.swap(_buffer);
+			chunk = _nChunks;
+		}
+		if (last.size()) {
+			_writeChunk(chunk, last);
+		}
+
+		std::lock_guard lock{ _fileMut };
+		uint64_t indexPos = (uint64_t)_ofs.tellp();
+		_writeBytes((uint64_t)_chunkStarts.size());
+		_ofs.write((const char*)_chunkStarts.data(), _chunkStarts.size() * sizeof(uint64_t));
+		for (const CellLocation& loc : _locations) {
+			_writeBytes(loc.chunk);
+			_writeBytes(loc.offset);
+		}
+		_ofs.seekp(_indexPointerPos);
+		_writeBytes(indexPos);
+		_ofs.close();
+	}
+
+	void HistogramCubeWriter::_writeChunk(uint32_t chunk, const std::string& data)
+	{
+		//a generous bound on the size of DEFLATE output, which can be slightly larger than the input for data that doesn't compress
+		std::vector<char> compressed(data.size() + data.size() / 100 + 1024);
+		size_t compressedSize = 0;
+		if (!CPLZLibDeflate(data.data(), data.size(), -1, compressed.data(), compressed.size(), &compressedSize)) {
+			throw std::runtime_error("Unable to compress histogram cube data");
+		}
+
+		std::lock_guard lock{ _fileMut };
+		if (_chunkStarts.size() <= chunk) {
+			_chunkStarts.resize(chunk + 1, 0);
+		}
+		_chunkStarts[chunk] = (uint64_t)_ofs.tellp();
+		_writeBytes((uint64_t)compressedSize);
+		_writeBytes((uint64_t)data.size());
+		_ofs.write(compressed.data(), compressedSize);
+	}
+
+	HistogramCubeReader::HistogramCubeReader(const std::filesystem::path& file)
+		: _ifs(file, std::ios::binary)
+	{
+		if (!_ifs) {
+			throw InvalidHistogramCubeException(file.string());
+		}
+		std::array<char, 4> signature{};
+		_ifs.read(signature.data(), 4);
+		uint32_t version = 0;
+		_readBytes(&version);
+		if (std::string(signature.data(), 4) != "LPHC" || version != histogramCubeVersion) {
+			throw InvalidHistogramCubeException(file.string());
+		}
+
+		uint64_t wktSize = 0;
+		_readBytes(&wktSize);
+		std::string wkt(wktSize, '\0');
+		_ifs.read(wkt.data(), wktSize);
+		double xmin = 0, ymin = 0, xres = 0, yres = 0;
+		int32_t nrow = 0, ncol = 0;
+		_readBytes(&xmin);
+		_readBytes(&ymin);
+		_readBytes(&xres);
+		_readBytes(&yres);
+		_readBytes(&nrow);
+		_readBytes(&ncol);
+		_align = Alignment(xmin, ymin, nrow, ncol, xres, yres, wkt.size() ? CoordRef(wkt) : CoordRef());
+
+		double d = 0;
+		_readBytes(&d);
+		_canopyCutoff = d;
+		_readBytes(&d);
+		_maxHt = d;
+		_readBytes(&d);
+		_binSize = d;
+		uint32_t nStrata = 0;
+		_readBytes(&nStrata);
+		for (uint32_t i = 0; i < nStrata; ++i) {
+			_readBytes(&d);
+			_strataBreaks.push_back(d);
+		}
+		uint32_t nCutoffs = 0;
+		_readBytes(&nCutoffs);
+		for (uint32_t i = 0; i < nCutoffs; ++i) {
+			_readBytes(&d);
+			_additionalCutoffs.push_back(d);
+		}
+
+		uint64_t indexPos = 0;
+		_readBytes(&indexPos);
+		if (!_ifs || !indexPos) {
+			//the writer never finished
+			throw InvalidHistogramCubeException(file.string());
+		}
+		_ifs.seekg(indexPos);
+		uint64_t nChunks = 0;
+		_readBytes(&nChunks);
+		_chunkStarts.resize(nChunks);
+		_ifs.read((char*)_chunkStarts.data(), nChunks * sizeof(uint64_t));
+		_locations.resize(_align.ncell());
+		for (HistogramCubeWriter::CellLocation& loc : _locations) {
+			_readBytes(&loc.chunk);
+			_readBytes(&loc.offset);
+		}
+		if (!_ifs) {
+			throw InvalidHistogramCubeException(file.string());
+		}
+
+		for (cell_t cell = 0; cell < _align.ncell(); ++cell) {
+			if (_locations[cell].chunk != HistogramCubeWriter::noChunk) {
+				_cellsInFileOrder.push_back(cell);
+			}
+		}
+		std::sort(_cellsInFileOrder.begin(), _cellsInFileOrder.end(), [&](cell_t a, cell_t b) {
+			return std::make_pair(_locations[a].chunk, _locations[a].offset) < std::make_pair(_locations[b].chunk, _locations[b].offset);
+			});
+
+		_settings = PointMetricCalculator::Settings(_canopyCutoff, _maxHt, _binSize, _strataBreaks, _additionalCutoffs);
+	}
+
+	const Alignment& HistogramCubeReader::alignment() const
+	{
+		return _align;
+	}
+	coord_t HistogramCubeReader::canopyCutoff() const
+	{
+		return _canopyCutoff;
+	}
+	coord_t HistogramCubeReader::maxHt() const
+	{
+		return _maxHt;
+	}
+	coord_t HistogramCubeReader::binSize() const
+	{
+		return _binSize;
+	}
+	const std::vector<coord_t>& HistogramCubeReader::strataBreaks() const
+	{
+		return _strataBreaks;
+	}
+	const std::vector<coord_t>& HistogramCubeReader::additionalCutoffs() const
+	{
+		return _additionalCutoffs;
+	}
+
+	const PointMetricCalculator::Settings& HistogramCubeReader::settings() const
+	{
+		return _settings;
+	}
+
+	bool HistogramCubeReader::readCell(cell_t cell, PointMetricCalculator& pmc)
+	{
+		const HistogramCubeWriter::CellLocation& loc = _locations[cell];
+		if (loc.chunk == HistogramCubeWriter::noChunk) {
+			return false;
+		}
+		_loadChunk(loc.chunk);
+		_chunk.clear();
+		_chunk.seekg(loc.offset);
+		PointMetricCalculator::SettingsScope scope{ _settings };
+		pmc.readFrom(_chunk);
+		return true;
+	}
+
+	void HistogramCubeReader::_loadChunk(uint32_t chunk)
+	{
+		if (chunk == _loadedChunk) {
+			return;
+		}
+		if (chunk >= _chunkStarts.size()) {
+			throw InvalidHistogramCubeException("chunk index out of range");
+		}
+		_ifs.clear();
+		_ifs.seekg(_chunkStarts[chunk]);
+		uint64_t compressedSize = 0, size = 0;
+		_readBytes(&compressedSize);
+		_readBytes(&size);
+		std::vector<char> compressed(compressedSize);
+		_ifs.read(compressed.data(), compressedSize);
+		std::string data(size, '\0');
+		size_t outSize = 0;
+		if (!_ifs || !CPLZLibInflate(compressed.data(), compressed.size(), data.data(), data.size(), &outSize) || outSize != size) {
+			throw InvalidHistogramCubeException("corrupt chunk");
+		}
+		_chunk.str(std::move(data));
+		_loadedChunk = chunk;
+	}
+
+	template<class F>
+	Raster<metric_t> HistogramCubeReader::_calculate(F f)
+	{
+		Raster<metric_t> out{ _align };
+		PointMetricCalculator::SettingsScope scope{ _settings };
+		PointMetricCalculator pmc;
+		for (cell_t cell : _cellsInFileOrder) {
+			readCell(cell, pmc);
+			f(pmc, out, cell);
+		}
+		pmc.cleanUp();
+		return out;
+	}
+
+	Raster<metric_t> HistogramCubeReader::calculateMetric(void(PointMetricCalculator::* f)(Raster<metric_t>&, cell_t), size_t cutoffIdx)
+	{
+		//reading a cell resets the active cutoff, so it has to be set again each time
+		return _calculate([&](PointMetricCalculator& pmc, Raster<metric_t>& out, cell_t cell) {
+			pmc.setActiveCutoff(cutoffIdx);
+			(pmc.*f)(out, cell);
+			});
+	}
+
+	Raster<metric_t> HistogramCubeReader::calculateStratumMetric(void(PointMetricCalculator::* f)(Raster<metric_t>&, cell_t, size_t), size_t stratumIdx)
+	{
+		return _calculate([&](PointMetricCalculator& pmc, Raster<metric_t>& out, cell_t cell) {(pmc.*f)(out, cell, stratumIdx); });
+	}
+}
@@ -0,0 +1,113 @@
+#pragma once
+#ifndef LP_HISTOGRAMCUBE_H
+#define LP_HISTOGRAMCUBE_H
+
+#include"run_pch.hpp"
+#include"PointMetricCalculator.hpp"
+
+namespace lapis {
+
+	class InvalidHistogramCubeException : public std::runtime_error {
+	public:
+		InvalidHistogramCubeException(std::string s) : std::runtime_error("Unable to read histogram cube: " + s) {}
+	};
+
+	//A histogram cube holds the finished PointMetricCalculator of every cell in an alignment, along with the settings they were filled with.
+	//Metrics can be recalculated from it, including ones which weren't requested in the original run, without reading the lidar data again.
+	//The file is a header, then the cell records in the order they were finished, grouped into DEFLATE-compressed chunks,
+	//then an index of where each chunk starts and where each cell's record is within its chunk
+	class HistogramCubeWriter {
+	public:
+		HistogramCubeWriter(const std::filesystem::path& file, const Alignment& a,
+			coord_t canopyCutoff, coord_t maxHt, coord_t binSize, const std::vector<coord_t>& strataBreaks,
+			const std::vector<coord_t>& additionalCutoffs = {});
+		~HistogramCubeWriter();
+
+		HistogramCubeWriter(const HistogramCubeWriter&) = delete;
+		HistogramCubeWriter& operator=(const HistogramCubeWriter&) = delete;
+
+		//this function is thread-safe. Each cell should only be written once
+		void writeCell(cell_t cell, const PointMetricCalculator& pmc);
+
+		//writes the remaining records and the index. Nothing can be written afterwards
+		//this shouldn't be called while writeCell is still being called
+		void close();
+
+		//where a cell's record is: the chunk it's in, and how far into the uncompressed chunk it starts
+		static constexpr uint32_t noChunk = std::numeric_limits<uint32_t>::max();
+		struct CellLocation {
+			uint32_t chunk = noChunk;
+			uint32_t offset = 0;
+		};
+
+	private:
+		//records are collected in memory and compressed in pieces of about this size. The compression happens outside of the lock
+		static constexpr size_t _chunkBytes = 1 << 24;
+
+		std::ofstream _ofs;
+		std::vector<CellLocation> _locations;
+		std::vector<uint64_t> _chunkStarts;
+		std::string _buffer;
+		uint32_t _nChunks = 0;
+		std::streampos _indexPointerPos;
+		std::mutex _mut;
+		std::mutex _fileMut;
+		bool _closed = false;
+
+		template<class T>
+		void _writeBytes(const T& v) {
+			_ofs.write((const char*)&v, sizeof(T));
+		}
+		void _writeChunk(uint32_t chunk, const std::string& data);
+	};
+
+	//The reader keeps the settings the cube was written with to itself, so it can be used while a run with other settings is in progress
+	class HistogramCubeReader {
+	public:
+		HistogramCubeReader(const std::filesystem::path& file);
+
+		const Alignment& alignment() const;
+		coord_t canopyCutoff() const;
+		coord_t maxHt() const;
+		coord_t binSize() const;
+		const std::vector<coord_t>& strataBreaks() const;
+		const std::vector<coord_t>& additionalCutoffs() const;
+
+		//returns false if the cell has no record. Not thread-safe
+		//the calculator can only be used for metrics inside a PointMetricCalculator::SettingsScope with settings()
+		bool readCell(cell_t cell, PointMetricCalculator& pmc);
+		const PointMetricCalculator::Settings& settings() const;
+
+		//runs the given metric on every cell in the cube. cutoffIdx is as in PointMetricCalculator::setActiveCutoff
+		Raster<metric_t> calculateMetric(void (PointMetricCalculator::* f)(Raster<metric_t>&, cell_t), size_t cutoffIdx = 0);
+		Raster<metric_t> calculateStratumMetric(void (PointMetricCalculator::* f)(Raster<metric_t>&, cell_t, size_t), size_t stratumIdx);
+
+	private:
+		std::ifstream _ifs;
+		Alignment _align;
+		coord_t _canopyCutoff = 0;
+		coord_t _maxHt = 0;
+		coord_t _binSize = 0;
+		std::vector<coord_t> _strataBreaks;
+		std::vector<coord_t> _additionalCutoffs;
+		PointMetricCalculator::Settings _settings;
+
+		std::vector<uint64_t> _chunkStarts;
+		std::vector<HistogramCubeWriter::CellLocation> _locations;
+		//the cells with records, ordered by where they are in the file, so each chunk only needs to be decompressed once when visiting all of them
+		std::vector<cell_t> _cellsInFileOrder;
+		uint32_t _loadedChunk = HistogramCubeWriter::noChunk;
+		std::istringstream _chunk;
+
+		void _loadChunk(uint32_t chunk);
+		template<class F>
+		Raster<metric_t> _calculate(F f);
+
+		template<class T>
+		void _readBytes(T* v) {
+			_ifs.read((char*)v, sizeof(T));
+		}
+	};
+}
+
+#endif
@@ -118,6 +118,20 @@ namespace lapis {
 		}
 	}
 
+	bool LapisController::recalculatePointMetrics(const fs::path& cubeFile)
+	{
+		LapisLogger& log = LapisLogger::getLogger();
+		PointMetricHandler* pmh = dynamic_cast<PointMetricHandler*>(_handlers()[PointMetricHandler::handlerRegisteredIndex].get());
+		try {
+			pmh->recalculateFromHistogramCube(cubeFile, cubeFile.parent_path() / "Recalculated");
+		}
+		catch (std::exception e) {
+			log.logError(e.what());
+			return false;
+		}
+		return true;
+	}
+
 	bool LapisController::isRunning() const
 	{
 		return _isRunning;
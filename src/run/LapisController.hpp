@@ -14,6 +14,9 @@ namespace lapis {
 
 		bool processFullArea();
 
+		//writes point metrics calculated from a histogram cube saved by an earlier run to a folder next to it, without any lidar data
+		bool recalculatePointMetrics(const std::filesystem::path& cubeFile);
+
 		bool isRunning() const;
 
 		void sendAbortSignal();
@@ -3,13 +3,49 @@
 
 namespace lapis {
 
-	void PointMetricCalculator::setInfo(coord_t canopyCutoff, coord_t max, coord_t binsize, const std::vector<coord_t>& strataBreaks)
+	void PointMetricCalculator::setInfo(coord_t canopyCutoff, coord_t max, coord_t binsize, const std::vector<coord_t>& strataBreaks,
+		const std::vector<coord_t>& additionalCutoffs)
 	{
-		_max = max;
-		_binsize = binsize;
-		_canopy = canopyCutoff;
-		SparseHistogram::setNHists((size_t)std::ceil((_max - _canopy) / _binsize));
-		_strataBreaks = strataBreaks;
+		_globalSettings = Settings(canopyCutoff, max, binsize, strataBreaks, additionalCutoffs);
+	}
+
+	PointMetricCalculator::Settings::Settings(coord_t canopyCutoff, coord_t max, coord_t binsize, const std::vector<coord_t>& strataBreaks,
+		const std::vector<coord_t>& additionalCutoffs)
+		: max(max), binsize(binsize), canopy(canopyCutoff), strataBreaks(strataBreaks), additionalCutoffs(additionalCutoffs)
+	{
+		coord_t lowest = canopy;
+		for (coord_t c : additionalCutoffs) {
+			lowest = std::min(lowest, c);
+		}
+		mainCutoffBin = (size_t)std::ceil((canopy - lowest) / binsize);
+		histMin = canopy - binsize * mainCutoffBin;
+
+		//the histogram-based metrics for a cutoff start at the bin the cutoff falls in
+		//this is computed the same way as the bins in addPoint so that every canopy point is in the histogram for its cutoff
+		cutoffBinOffsets.push_back(mainCutoffBin);
+		for (coord_t c : additionalCutoffs) {
+			cutoffBinOffsets.push_back(binFromHeight(c));
+		}
+
+		nHists = (size_t)std::ceil((max - histMin) / binsize);
+	}
+
+	PointMetricCalculator::SettingsScope::SettingsScope(const Settings& s) : _previous(_scopedSettings)
+	{
+		_scopedSettings = &s;
+	}
+
+	PointMetricCalculator::SettingsScope::~SettingsScope()
+	{
+		_scopedSettings = _previous;
+	}
+
+	size_t PointMetricCalculator::estimatedBytesPerCell()
+	{
+		const Settings& s = _s();
+		return sizeof(PointMetricCalculator) + SparseHistogram::estimatedBytes(s.nHists)
+			+ (s.strataBreaks.size() + 1) * sizeof(int)
+			+ (s.additionalCutoffs.size() ? sizeof(AdditionalCanopy) + s.additionalCutoffs.size() * sizeof(std::pair<coord_t, int>) : 0);
 	}
 
 	void PointMetricCalculator::cleanUp()
@@ -17,6 +53,7 @@ namespace lapis {
 		_hist.cleanUp();
 
 		_strataCounts = std::vector<int>();
+		_additionalCanopy.reset();
 
 		//zeroing these doesn't matter for normal runs but makes testing easier
 		_canopySum = 0;
@@ -24,11 +61,160 @@ namespace lapis {
 		_count = 0;
 	}
 
+	void PointMetricCalculator::merge(const PointMetricCalculator& other)
+	{
+		_hist.merge(other._hist, _s().nHists);
+		_canopySum += other._canopySum;
+		_count += other._count;
+		_canopyCount += other._canopyCount;
+
+		if (other._strataCounts.size()) {
+			if (!_strataCounts.size()) {
+				_strataCounts = std::vector<int>(_s().strataBreaks.size() + 1, 0);
+			}
+			for (size_t i = 0; i < _strataCounts.size(); ++i) {
+				_strataCounts[i] += other._strataCounts[i];
+			}
+		}
+
+		if (other._additionalCanopy && other._additionalCanopy->sumAndCount.size()) {
+			std::vector<std::pair<coord_t, int>>& sums = _additional().sumAndCount;
+			if (!sums.size()) {
+				sums.resize(_s().additionalCutoffs.size());
+			}
+			for (size_t i = 0; i < sums.size(); ++i) {
+				sums[i].first += other._additionalCanopy->sumAndCount[i].first;
+				sums[i].second += other._additionalCanopy->sumAndCount[i].second;
+			}
+		}
+	}
+
+	void PointMetricCalculator::setActiveCutoff(size_t idx)
+	{
+		if (!idx && !_additionalCanopy) {
+			return;
+		}
+		_additional().activeCutoff = (uint8_t)idx;
+	}
+
+	void PointMetricCalculator::_addToAdditionalCutoffs(coord_t z)
+	{
+		const std::vector<coord_t>& cutoffs = _s().additionalCutoffs;
+		std::vector<std::pair<coord_t, int>>& sums = _additional().sumAndCount;
+		if (!sums.size()) {
+			sums.resize(cutoffs.size());
+		}
+		for (size_t i = 0; i < cutoffs.size(); ++i) {
+			if (z >= cutoffs[i]) {
+				sums[i].first += z;
+				++sums[i].second;
+			}
+		}
+	}
+
+	PointMetricCalculator::AdditionalCanopy& PointMetricCalculator::_additional()
+	{
+		if (!_additionalCanopy) {
+			_additionalCanopy = std::make_unique<AdditionalCanopy>();
+		}
+		return *_additionalCanopy;
+	}
+
+	size_t PointMetricCalculator::_activeCutoff() const
+	{
+		return _additionalCanopy ? _additionalCanopy->activeCutoff : 0;
+	}
+
+	coord_t PointMetricCalculator::_cutoff() const
+	{
+		size_t active = _activeCutoff();
+		return active ? _s().additionalCutoffs[active - 1] : _s().canopy;
+	}
+
+	coord_t PointMetricCalculator::_cSum() const
+	{
+		size_t active = _activeCutoff();
+		if (!active) {
+			return _canopySum;
+		}
+		return _additionalCanopy->sumAndCount.size() ? _additionalCanopy->sumAndCount[active - 1].first : 0;
+	}
+
+	int PointMetricCalculator::_cCount() const
+	{
+		size_t active = _activeCutoff();
+		if (!active) {
+			return _canopyCount;
+		}
+		return _additionalCanopy->sumAndCount.size() ? _additionalCanopy->sumAndCount[active - 1].second : 0;
+	}
+
+	int PointMetricCalculator::_countInCanopyBin(size_t bin) const
+	{
+		return _hist.countInBin(bin + _s().cutoffBinOffsets[_activeCutoff()]);
+	}
+
+	coord_t PointMetricCalculator::_canopyBinMin(size_t bin) const
+	{
+		//measured from the main cutoff, the same way as the bins are assigned
+		const Settings& s = _s();
+		return s.canopy + s.binsize * ((coord_t)(bin + s.cutoffBinOffsets[_activeCutoff()]) - (coord_t)s.mainCutoffBin);
+	}
+
+	size_t PointMetricCalculator::_canopyHistSize()
+	{
+		size_t offset = _s().cutoffBinOffsets[_activeCutoff()];
+		return _hist.size() > offset ? _hist.size() - offset : 0;
+	}
+
+	void PointMetricCalculator::writeTo(std::ostream& out) const
+	{
+		out.write((const char*)&_count, sizeof(_count));
+		out.write((const char*)&_canopyCount, sizeof(_canopyCount));
+		out.write((const char*)&_canopySum, sizeof(_canopySum));
+		uint32_t nStrata = (uint32_t)_strataCounts.size();
+		out.write((const char*)&nStrata, sizeof(nStrata));
+		out.write((const char*)_strataCounts.data(), nStrata * sizeof(int));
+		uint32_t nAdditional = _additionalCanopy ? (uint32_t)_additionalCanopy->sumAndCount.size() : 0;
+		out.write((const char*)&nAdditional, sizeof(nAdditional));
+		for (uint32_t i = 0; i < nAdditional; ++i) {
+			const auto& v = _additionalCanopy->sumAndCount[i];
+			out.write((const char*)&v.first, sizeof(v.first));
+			out.write((const char*)&v.second, sizeof(v.second));
+		}
+		_hist.writeTo(out);
+	}
+
+	void PointMetricCalculator::readFrom(std::istream& in)
+	{
+		cleanUp();
+		in.read((char*)&_count, sizeof(_count));
+		in.read((char*)&_canopyCount, sizeof(_canopyCount));
+		in.read((char*)&_canopySum, sizeof(_canopySum));
+		uint32_t nStrata = 0;
+		in.read((char*)&nStrata, sizeof(nStrata));
+		if (nStrata) {
+			_strataCounts = std::vector<int>(nStrata);
+			in.read((char*)_strataCounts.data(), nStrata * sizeof(int));
+		}
+		uint32_t nAdditional = 0;
+		in.read((char*)&nAdditional, sizeof(nAdditional));
+		if (nAdditional) {
+			std::vector<std::pair<coord_t, int>>& sums = _additional().sumAndCount;
+			sums.resize(nAdditional);
+			for (auto& v : sums) {
+				in.read((char*)&v.first, sizeof(v.first));
+				in.read((char*)&v.second, sizeof(v.second));
+			}
+		}
+		_hist.readFrom(in, _s().nHists);
+	}
+
 	void PointMetricCalculator::meanCanopy(Raster<metric_t>& r, cell_t cell)
 	{
-		if (_canopyCount) {
+		if (_cCount()) {
 			r[cell].has_value() = true;
-			r[cell].value() = (metric_t)_canopySum / (metric_t)_canopyCount;
+			r[cell].value() = (metric_t)_cSum() / (metric_t)_cCount();
 		}
 		else {
 			r[cell].has_value() = false;
@@ -37,23 +223,23 @@ namespace lapis {
 
 	void PointMetricCalculator::stdDevCanopy(Raster<metric_t>& r, cell_t cell)
 	{
-		if (_canopyCount < 2) {
+		if (_cCount() < 2) {
 			r[cell].has_value() = false;
 			return;
 		}
-		metric_t mean = (metric_t)_canopySum / (metric_t)_canopyCount;
+		metric_t mean = (metric_t)_cSum() / (metric_t)_cCount();
 
 		metric_t sd = 0;
 
 		//right now this assumes all points fall at the midpoint of the two bins
-		for (int i = 0; i < _hist.size(); ++i) {
-			metric_t tmp = (metric_t)(_canopy + _binsize * i + (_binsize / 2));
+		for (int i = 0; i < _canopyHistSize(); ++i) {
+			metric_t tmp = (metric_t)(_canopyBinMin(i) + (_s().binsize / 2));
 			tmp -= mean;
 			tmp *= tmp;
-			tmp *= _hist.countInBin(i);
+			tmp *= _countInCanopyBin(i);
 			sd += tmp;
 		}
-		sd /= _canopyCount;
+		sd /= _cCount();
 		sd = std::sqrt(sd);
 		r[cell].has_value() = true;
 		r[cell].value() = sd;
@@ -88,101 +274,101 @@ namespace lapis {
 	void PointMetricCalculator::canopyCover(Raster<metric_t>& r, cell_t cell)
 	{
 		r[cell].has_value() = (_count > 0);
-		r[cell].value() = (metric_t)_canopyCount / (metric_t)_count * 100.f;
+		r[cell].value() = (metric_t)_cCount() / (metric_t)_count * 100.f;
 	}
 
 	void PointMetricCalculator::coverAboveMean(Raster<metric_t>& r, cell_t cell)
 	{
-		if (_canopyCount == 0) {
+		if (_cCount() == 0) {
 			r[cell].has_value() = false;
 			return;
 		}
 		r[cell].has_value() = true;
 
-		metric_t mean = (metric_t)(_canopySum / (metric_t)_canopyCount);
-		int binWithMean = (int)((mean - _canopy) / _binsize);
+		metric_t mean = (metric_t)(_cSum() / (metric_t)_cCount());
+		int binWithMean = (int)((mean - _canopyBinMin(0)) / _s().binsize);
 		metric_t countAbove = 0;
 
 		//assumes all points are at the center of their bins
-		if (_canopy + _binsize * binWithMean + (_binsize / 2) > mean) {
-			countAbove += _hist.countInBin(binWithMean);
+		if (_canopyBinMin(binWithMean) + (_s().binsize / 2) > mean) {
+			countAbove += _countInCanopyBin(binWithMean);
 		}
-		for (int i = binWithMean+1; i < _hist.size(); ++i) {
-			countAbove += _hist.countInBin(i);
+		for (int i = binWithMean+1; i < _canopyHistSize(); ++i) {
+			countAbove += _countInCanopyBin(i);
 		}
 		r[cell].value() = countAbove / _count * 100.f;
 	}
 
 	void PointMetricCalculator::canopyReliefRatio(Raster<metric_t>& r, cell_t cell)
 	{
-		if (!_canopyCount) {
+		if (!_cCount()) {
 			r[cell].has_value() = false;
 			return;
 		}
 		r[cell].has_value() = true;
-		metric_t mean = (metric_t)_canopySum / (metric_t)_canopyCount;
-		metric_t min = (metric_t)_canopy;
+		metric_t mean = (metric_t)_cSum() / (metric_t)_cCount();
+		metric_t min = (metric_t)_cutoff();
 		//this loop could be eliminated by keeping track of the max as points are added
 		metric_t max = 0;
 		size_t highestBin = 0;
-		for (size_t i = 0; i < _hist.size(); ++i) {
-			if (_hist.countInBin(i)) {
+		for (size_t i = 0; i < _canopyHistSize(); ++i) {
+			if (_countInCanopyBin(i)) {
 				highestBin = i;
 			}
 		}
-		max = _estimatePointValue(highestBin, _hist.countInBin(highestBin));
+		max = _estimatePointValue(highestBin, _countInCanopyBin(highestBin));
 
 		r[cell].value() = (mean - min) / (max - min);
 	}
 
 	void PointMetricCalculator::skewnessCanopy(Raster<metric_t>& r, cell_t cell)
 	{
-		if (_canopyCount < 2) {
+		if (_cCount() < 2) {
 			r[cell].has_value() = false;
 			return;
 		}
 		r[cell].has_value() = true;
 
-		metric_t mean = (metric_t)_canopySum / (metric_t)_canopyCount;
+		metric_t mean = (metric_t)_cSum() / (metric_t)_cCount();
 		metric_t denominator = 0;
 		metric_t numerator = 0;
 
-		for (size_t i = 0; i < _hist.size(); ++i) {
+		for (size_t i = 0; i < _canopyHistSize(); ++i) {
 			//this assumes all points are at the center of their bins
-			metric_t diffFromMean = (metric_t)(_canopy + _binsize * i + (_binsize / 2) - mean);
-			metric_t tmp = diffFromMean * diffFromMean * _hist.countInBin(i);
+			metric_t diffFromMean = (metric_t)(_canopyBinMin(i) + (_s().binsize / 2) - mean);
+			metric_t tmp = diffFromMean * diffFromMean * _countInCanopyBin(i);
 			denominator += tmp;
 			numerator += tmp * diffFromMean;
 		}
-		denominator /= _canopyCount;
+		denominator /= _cCount();
 		denominator = std::sqrt(denominator); //this is now the std dev
 		denominator *= (denominator * denominator);
-		denominator *= _canopyCount - 1ll;
+		denominator *= _cCount() - 1ll;
 		r[cell].value() = numerator / denominator;
 	}
 
 	void PointMetricCalculator::kurtosisCanopy(Raster<metric_t>& r, cell_t cell)
 	{
-		if (_canopyCount < 2) {
+		if (_cCount() < 2) {
 			r[cell].has_value() = false;
 			return;
 		}
 		r[cell].has_value() = true;
 
-		metric_t mean = (metric_t)_canopySum / (metric_t)_canopyCount;
+		metric_t mean = (metric_t)_cSum() / (metric_t)_cCount();
 		metric_t denominator = 0;
 		metric_t numerator = 0;
 
-		for (size_t i = 0; i < _hist.size(); ++i) {
+		for (size_t i = 0; i < _canopyHistSize(); ++i) {
 			//this assumes all points are at the center of their bins
-			metric_t diffFromMean = (metric_t)(_canopy + _binsize * i + (_binsize / 2) - mean);
-			metric_t tmp = diffFromMean * diffFromMean * _hist.countInBin(i);
+			metric_t diffFromMean = (metric_t)(_canopyBinMin(i) + (_s().binsize / 2) - mean);
+			metric_t tmp = diffFromMean * diffFromMean * _countInCanopyBin(i);
 			denominator += tmp;
 			numerator += tmp * diffFromMean * diffFromMean;
 		}
-		denominator /= _canopyCount; //this is now the square of the std dev
+		denominator /= _cCount(); //this is now the square of the std dev
 		denominator *= denominator;
-		denominator *= _canopyCount;
+		denominator *= _cCount();
 		r[cell].value() = numerator / denominator;
 	}
 
@@ -190,19 +376,19 @@ namespace lapis {
 	{
 		//the exact threshold is arguable, but quantiles are meaningless at low point counts
 		//and the math gets a lot more annoying if you need to account for the case where the very first point might be the quantile
-		if (_canopyCount < 4) { 
+		if (_cCount() < 4) { 
 			r[cell].has_value() = false;
 			return;
 		}
 
 		coord_t previousvalue = std::numeric_limits<coord_t>::lowest(); //the estimated value of the last valid point, in case the quantile point is the first in its bin
-		metric_t needed = (_canopyCount - 1) * q; //the quantile is the value that exceeds exactly this many points (slightly shifted when needed isn't an integer)
+		metric_t needed = (_cCount() - 1) * q; //the quantile is the value that exceeds exactly this many points (slightly shifted when needed isn't an integer)
 		size_t binIdx = -1;
 		while (true) {
 			binIdx++;
-			int fudgedBin = _hist.countInBin(binIdx);
+			int fudgedBin = _countInCanopyBin(binIdx);
 			//the very first element doesn't "count" when calculating quantiles
-			if (previousvalue < _canopy && fudgedBin > 0) {
+			if (previousvalue < _canopyBinMin(0) && fudgedBin > 0) {
 				previousvalue = _estimatePointValue(binIdx, 1);
 				fudgedBin = fudgedBin - 1;
 			}
@@ -211,7 +397,7 @@ namespace lapis {
 				break;
 			}
 			if (fudgedBin>0) {
-				previousvalue = _estimatePointValue(binIdx, _hist.countInBin(binIdx));
+				previousvalue = _estimatePointValue(binIdx, _countInCanopyBin(binIdx));
 			}
 			
 		}
@@ -266,14 +452,19 @@ namespace lapis {
 	metric_t PointMetricCalculator::_estimatePointValue(size_t binNumber, int ordinal)
 	{
 		//estimating that the sequence formed by the bin min, the observations, and the bin max is uniform
-		metric_t binmin = (metric_t)(_canopy + _binsize * binNumber);
-		metric_t step = (metric_t)(_binsize / (metric_t)(_hist.countInBin(binNumber) + 1.f));
+		metric_t binmin = (metric_t)_canopyBinMin(binNumber);
+		metric_t step = (metric_t)(_s().binsize / (metric_t)(_countInCanopyBin(binNumber) + 1.f));
 		return binmin + step * ordinal;
 	}
 
-	void SparseHistogram::setNHists(size_t nHists)
+	size_t SparseHistogram::estimatedBytes(size_t nHists)
 	{
-		_nHists = nHists;
+		//the table of pieces is allocated in full as soon as a return is added, but pieces are only allocated for bins that are used
+		//the bins never go past nHists, so there are at most this many pieces with data
+		size_t maxPieces = nHists / binsPerHist + 1;
+		//a small allowance for the allocator's bookkeeping on each piece
+		constexpr size_t pieceOverhead = 16;
+		return nHists * sizeof(_storage::value_type) + maxPieces * (sizeof(std::array<int, binsPerHist>) + pieceOverhead);
 	}
 
 	int SparseHistogram::countInBin(size_t bin) const
@@ -290,6 +481,69 @@ namespace lapis {
 		return 0;
 	}
 
+	void SparseHistogram::merge(const SparseHistogram& other, size_t nHists)
+	{
+		if (!other._data.size()) {
+			return;
+		}
+		if (!_data.size()) {
+			_data.resize(nHists);
+		}
+		for (size_t i = 0; i < other._data.size(); ++i) {
+			if (!other._data[i]) {
+				continue;
+			}
+			if (!_data[i]) {
+				_data[i] = std::make_unique<std::array<int, binsPerHist>>(*other._data[i]);
+				continue;
+			}
+			for (size_t j = 0; j < binsPerHist; ++j) {
+				(*_data[i])[j] += (*other._data[i])[j];
+			}
+		}
+		_sizeWithData = std::max(_sizeWithData, other._sizeWithData);
+	}
+
+	void SparseHistogram::writeTo(std::ostream& out) const
+	{
+		uint64_t sizeWithData = _sizeWithData;
+		out.write((const char*)&sizeWithData, sizeof(sizeWithData));
+		uint32_t nAllocated = 0;
+		for (const auto& h : _data) {
+			nAllocated += (bool)h;
+		}
+		out.write((const char*)&nAllocated, sizeof(nAllocated));
+		for (uint32_t i = 0; i < _data.size(); ++i) {
+			if (_data[i]) {
+				out.write((const char*)&i, sizeof(i));
+				out.write((const char*)_data[i]->data(), binsPerHist * sizeof(int));
+			}
+		}
+	}
+
+	void SparseHistogram::readFrom(std::istream& in, size_t nHists)
+	{
+		cleanUp();
+		uint64_t sizeWithData = 0;
+		in.read((char*)&sizeWithData, sizeof(sizeWithData));
+		_sizeWithData = (size_t)sizeWithData;
+		uint32_t nAllocated = 0;
+		in.read((char*)&nAllocated, sizeof(nAllocated));
+		if (!nAllocated) {
+			return;
+		}
+		_data.resize(nHists);
+		for (uint32_t n = 0; n < nAllocated; ++n) {
+			uint32_t i = 0;
+			in.read((char*)&i, sizeof(i));
+			if (!in || i >= nHists) {
+				throw std::runtime_error("Histogram data doesn't match the current bin settings");
+			}
+			_data[i] = std::make_unique<std::array<int, binsPerHist>>();
+			in.read((char*)_data[i]->data(), binsPerHist * sizeof(int));
+		}
+	}
+
 	void SparseHistogram::cleanUp()
 	{
 		_data = _storage();
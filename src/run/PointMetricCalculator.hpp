@@ -9,20 +9,19 @@ namespace lapis {
 	class SparseHistogram {
 		
 	public:
-		static void setNHists(size_t nHists);
-
 		SparseHistogram() = default;
 
 		int countInBin(size_t bin) const;
 
-		inline void incrementBin(size_t bin)
+		//nHists is the number of pieces the histogram can have, and must be the same for every call on the same histogram
+		inline void incrementBin(size_t bin, size_t nHists)
 		{
 			if (!_data.size()) {
-				_data.resize(_nHists);
+				_data.resize(nHists);
 			}
 
-			if (bin >= _nHists * binsPerHist) {
-				bin = _nHists * binsPerHist - 1;
+			if (bin >= nHists * binsPerHist) {
+				bin = nHists * binsPerHist - 1;
 			}
 			auto& thisHist = _data[bin / binsPerHist];
 			size_t binInHist = bin % binsPerHist;
@@ -42,13 +41,22 @@ namespace lapis {
 			return _sizeWithData;
 		}
 
+		//adds the counts in other to the counts in this
+		void merge(const SparseHistogram& other, size_t nHists);
+
+		//binary serialization; only the allocated pieces of the histogram are written
+		void writeTo(std::ostream& out) const;
+		void readFrom(std::istream& in, size_t nHists);
+
 		void cleanUp();
 
+		//an upper estimate of the heap memory used by a histogram which has seen returns across the whole range of heights
+		static size_t estimatedBytes(size_t nHists);
+
 	private:
 		inline static constexpr size_t binsPerHist = 100;
 		using _storage = std::vector<std::unique_ptr<std::array<int, binsPerHist>>>;
 		_storage _data;
-		inline static size_t _nHists;
 		size_t _sizeWithData = 0;
 	};
 
@@ -59,36 +67,94 @@ namespace lapis {
 		//This should be called before any PointMetricCalculators are constructed, and shouldn't be called after any are constructed
 		//as you might guess from the names, max should be strictly greater than canopyCutoff, and binsize should be positive
 		//it's the callers responsibility to ensure that these are in the right units
-		static void setInfo(coord_t canopyCutoff, coord_t max, coord_t binsize, const std::vector<coord_t>& strataBreaks);
+		//additionalCutoffs are other canopy cutoffs that the canopy metrics can be calculated at, using the same histogram; see setActiveCutoff
+		static void setInfo(coord_t canopyCutoff, coord_t max, coord_t binsize, const std::vector<coord_t>& strataBreaks,
+			const std::vector<coord_t>& additionalCutoffs = {});
+
+		//everything setInfo configures, in a form that can be held onto
+		struct Settings {
+			coord_t max = 0, binsize = 0, canopy = 0;
+			std::vector<coord_t> strataBreaks;
+
+			//The bins are measured from the main canopy cutoff, so adding cutoffs doesn't change the main cutoff's metrics
+			//If there are lower cutoffs, the histogram is extended downwards by whole bins to include them, and mainCutoffBin is the bin the main cutoff starts
+			//Each additional cutoff starts at the bin it falls in, so cutoffs which aren't a whole number of bins from the main one are rounded down
+			coord_t histMin = 0;
+			size_t mainCutoffBin = 0;
+			std::vector<coord_t> additionalCutoffs;
+			std::vector<size_t> cutoffBinOffsets;
+			size_t nHists = 0;
+
+			Settings() = default;
+			Settings(coord_t canopyCutoff, coord_t max, coord_t binsize, const std::vector<coord_t>& strataBreaks,
+				const std::vector<coord_t>& additionalCutoffs = {});
+
+			//this matches the binning of the main cutoff when there are no additional cutoffs exactly
+			inline size_t binFromHeight(coord_t z) const {
+				if (z >= canopy) {
+					return (size_t)((z - canopy) / binsize) + mainCutoffBin;
+				}
+				int64_t below = (int64_t)std::ceil((canopy - z) / binsize);
+				return (size_t)std::max<int64_t>((int64_t)mainCutoffBin - below, 0);
+			}
+		};
+
+		//While one of these exists, the calculators used on the thread that created it use its settings instead of the ones from setInfo
+		//This lets data written with other settings, like a histogram cube, be read while a run is in progress
+		class SettingsScope {
+		public:
+			SettingsScope(const Settings& s);
+			~SettingsScope();
+			SettingsScope(const SettingsScope&) = delete;
+			SettingsScope& operator=(const SettingsScope&) = delete;
+		private:
+			const Settings* _previous;
+		};
+
+		//an estimate of the memory used by a calculator which has had points added to it, including its histogram
+		//this should be called after setInfo
+		static size_t estimatedBytesPerCell();
 
 		//Adds an observed lidar return to this object
 		//If this is the first point added, it will cause the histogram vector to be allocated
 		inline void addPoint(const LasPoint& lp) {
+			const Settings& s = _s();
 			const coord_t& z = lp.z;
 			++_count;
-			if (z >= _canopy) {
-				_canopySum += z;
-				++_canopyCount;
-				int bin = (int)((z - _canopy) / _binsize);
+			if (z >= s.histMin) {
+				_hist.incrementBin(s.binFromHeight(z), s.nHists);
 
-				_hist.incrementBin(bin);
+				if (z >= s.canopy) {
+					_canopySum += z;
+					++_canopyCount;
+				}
+				if (s.additionalCutoffs.size()) {
+					_addToAdditionalCutoffs(z);
+				}
 			}
 
 			//because we're using return here as a control flow, the stratum logic has to go last even if we add more features to this function
 			if (!_strataCounts.size()) {
-				_strataCounts = std::vector<int>(_strataBreaks.size() + 1, 0);
+				_strataCounts = std::vector<int>(s.strataBreaks.size() + 1, 0);
 			}
-			for (size_t i = 0; i < _strataBreaks.size(); ++i) {
-				if (lp.z < _strataBreaks[i]) {
+			for (size_t i = 0; i < s.strataBreaks.size(); ++i) {
+				if (lp.z < s.strataBreaks[i]) {
 					_strataCounts[i]++;
 					return;
 				}
 			}
-			_strataCounts[_strataBreaks.size()]++;
+			_strataCounts[s.strataBreaks.size()]++;
 		}
 		//this function will deallocate the histogram vector. Call it once you're done with the data here.
 		void cleanUp();
 
+		//Adds all of the returns observed by other to this object, as though they had been added by addPoint
+		//This is used to build the calculator for a large cell out of the calculators for the small cells it contains
+		void merge(const PointMetricCalculator& other);
+
+		//Chooses which canopy cutoff the canopy metrics below use. 0 is the cutoff given to setInfo, and i>0 is additionalCutoffs[i-1]
+		void setActiveCutoff(size_t idx);
+
 		//These functions insert the result of the given calculation into the given raster at the given cell
 		void meanCanopy(Raster<metric_t>& r, cell_t cell);
 		void stdDevCanopy(Raster<metric_t>& r, cell_t cell);
@@ -124,16 +190,42 @@ namespace lapis {
 		void stratumCover(Raster<metric_t>& r, cell_t cell, size_t stratumIdx);
 		void stratumPercent(Raster<metric_t>& r, cell_t cell, size_t stratumIdx);
 
-		//TODO: put in functions to dump the data to the harddrive, or to read it off
+		//Binary serialization of everything this object has observed, so the metrics can be recalculated later without the points
+		//readFrom replaces the current contents. The current settings must be the same as the ones used when the data was written
+		void writeTo(std::ostream& out) const;
+		void readFrom(std::istream& in);
 
 	private:
-		inline static coord_t _max, _binsize, _canopy;
-		inline static std::vector<coord_t> _strataBreaks;
+		inline static Settings _globalSettings;
+		inline static thread_local const Settings* _scopedSettings = nullptr;
+		static const Settings& _s() {
+			return _scopedSettings ? *_scopedSettings : _globalSettings;
+		}
+
+		//the canopy information for the additional cutoffs, which is kept out of the calculator itself so it costs nothing if there aren't any
+		struct AdditionalCanopy {
+			std::vector<std::pair<coord_t, int>> sumAndCount;
+			uint8_t activeCutoff = 0;
+		};
+
 		SparseHistogram _hist;
 		coord_t _canopySum = 0.;
 		int _count = 0;
 		int _canopyCount = 0;
 		std::vector<int> _strataCounts;
+		std::unique_ptr<AdditionalCanopy> _additionalCanopy;
+
+		void _addToAdditionalCutoffs(coord_t z);
+		AdditionalCanopy& _additional();
+		size_t _activeCutoff() const;
+
+		//these give the canopy information for the active cutoff; canopy bins are numbered from the active cutoff
+		coord_t _cutoff() const;
+		coord_t _cSum() const;
+		int _cCount() const;
+		int _countInCanopyBin(size_t bin) const;
+		coord_t _canopyBinMin(size_t bin) const;
+		size_t _canopyHistSize();
 
 		void _quantileCanopy(Raster<metric_t>& r, cell_t cell, metric_t q);
 
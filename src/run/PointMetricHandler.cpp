@@ -3,6 +3,7 @@
 #include"PointMetricCalculator.hpp"
 #include"LapisController.hpp"
 #include"..\parameters\RunParameters.hpp"
+#include"..\parameters\PointMetricParameter.hpp"
 
 namespace lapis {
 
@@ -23,10 +24,10 @@ namespace lapis {
 	}
 
 	template<bool ALL_RETURNS, bool FIRST_RETURNS>
-	void PointMetricHandler::_assignPointsToCalculators(const std::span<LasPoint>& points)
+	void PointMetricHandler::_assignPointsToCalculators(const std::span<LasPoint>& points, const Alignment::RowColExtent& lasCells)
 	{
 		for (const LasPoint& p : points) {
-			cell_t cell = _getter->metricAlign()->cellFromXYUnsafe(p.x, p.y);
+			cell_t cell = _cellFromPoint(p, lasCells);
 
 			std::lock_guard lock{ _getter->cellMutex(cell) };
 			if constexpr (ALL_RETURNS) {
@@ -45,6 +46,7 @@ namespace lapis {
 		using namespace std::chrono;
 		for (PointMetricRasters& v : _pointMetrics) {
 			MetricFunc& f = v.fun;
+			pmc.setActiveCutoff(v.cutoffIdx);
 			(pmc.*f)(v.rasters.get(r), cell);
 		}
 		std::vector<long long> stratumTimes;
@@ -54,16 +56,343 @@ namespace lapis {
 				(pmc.*f)(v.rasters[i].get(r), cell, i);
 			}
 		}
-		pmc.cleanUp();
 	}
-	void PointMetricHandler::_initMetrics()
+	template<bool ALL_RETURNS, bool FIRST_RETURNS>
+	void PointMetricHandler::_assignPointsToBlocks(const std::span<LasPoint>& points, const Alignment::RowColExtent& lasCells)
+	{
+		for (const LasPoint& p : points) {
+			cell_t cell = _cellFromPoint(p, lasCells);
+			//every block with a cell in this las file was materialized by handlePoints, and can't be flushed until the file finishes
+			MetricBlock* blockPtr = _blocks[_blockFromCell(cell)].get();
+			if (!blockPtr) {
+				continue;
+			}
+			MetricBlock& block = *blockPtr;
+			cell_t blockCell = _cellInBlock(cell, block);
+
+			std::lock_guard lock{ _getter->cellMutex(cell) };
+			if constexpr (ALL_RETURNS) {
+				block.allReturnPMC->atCellUnsafe(blockCell).value().addPoint(p);
+			}
+			if constexpr (FIRST_RETURNS) {
+				if (p.returnNumber == 1) {
+					block.firstReturnPMC->atCellUnsafe(blockCell).value().addPoint(p);
+				}
+			}
+		}
+	}
+	Alignment::RowColExtent PointMetricHandler::_lasFileCells(const Extent& e) const
+	{
+		//this matches CellIterator(_nLaz, e, SnapType::out)
+		const Alignment& a = *_getter->metricAlign();
+		return a.rowColExtent(cropExtent(a.alignExtent(e, SnapType::out), a), SnapType::near);
+	}
+	cell_t PointMetricHandler::_cellFromPoint(const LasPoint& p, const Alignment::RowColExtent& lasCells) const
+	{
+		const Alignment& a = *_getter->metricAlign();
+		rowcol_t row = std::clamp(a.rowFromYUnsafe(p.y), lasCells.minrow, std::min(lasCells.maxrow, a.nrow() - 1));
+		rowcol_t col = std::clamp(a.colFromXUnsafe(p.x), lasCells.mincol, std::min(lasCells.maxcol, a.ncol() - 1));
+		return a.cellFromRowColUnsafe(row, col);
+	}
+	void PointMetricHandler::_processSetCell(cell_t cell, MetricRasterSet& set, ReturnType r)
+	{
+		PointMetricCalculator& pmc = set.pmc(r, cell);
+		for (size_t i = 0; i < _pointMetrics.size(); ++i) {
+			MetricFunc& f = _pointMetrics[i].fun;
+			pmc.setActiveCutoff(_pointMetrics[i].cutoffIdx);
+			(pmc.*f)(set.pointMetrics[i].get(r), cell);
+		}
+		for (size_t i = 0; i < _stratumMetrics.size(); ++i) {
+			StratumFunc& f = _stratumMetrics[i].fun;
+			for (size_t j = 0; j < set.stratumMetrics[i].size(); ++j) {
+				(pmc.*f)(set.stratumMetrics[i][j].get(r), cell, j);
+			}
+		}
+	}
+	size_t PointMetricHandler::_estimatedFullExtentMemory() const
+	{
+		size_t nReturnTypes = (size_t)_getter->doAllReturnMetrics() + (size_t)_getter->doFirstReturnMetrics();
+		size_t nMetricRasters = _pointMetrics.size() + _stratumMetrics.size() * (_getter->strataBreaks().size() + 1);
+
+		//the extra byte per value is a generous estimate of the cost of the has_value flags
+		//every calculator is assumed to have data at once, which is the worst case when a single las file covers the whole area
+		size_t perSetCell = nReturnTypes * (PointMetricCalculator::estimatedBytesPerCell() + 1 + nMetricRasters * (sizeof(metric_t) + 1));
+		size_t out = (sizeof(int) + 1 + perSetCell) * _getter->metricAlign()->ncell();
+
+		//the coarse levels are full-extent even when the fine cells are processed in blocks, but they share the budget
+		for (const CoarseLevel& level : _coarseLevels) {
+			out += (sizeof(int) + 1 + perSetCell) * level.align.ncell();
+		}
+		return out;
+	}
+	void PointMetricHandler::_allocateFullExtent()
+	{
+		using pmc = PointMetricCalculator;
+		if (_getter->doAllReturnMetrics()) {
+			_allReturnPMC = std::make_unique<Raster<pmc>>(*_getter->metricAlign());
+		}
+		if (_getter->doFirstReturnMetrics()) {
+			_firstReturnPMC = std::make_unique<Raster<pmc>>(*_getter->metricAlign());
+		}
+		for (PointMetricRasters& v : _pointMetrics) {
+			v.rasters = TwoRasters(_getter);
+		}
+		for (StratumMetricRasters& v : _stratumMetrics) {
+			for (size_t i = 0; i < _getter->strataBreaks().size() + 1; ++i) {
+				v.rasters.emplace_back(_getter);
+			}
+		}
+	}
+	Alignment PointMetricHandler::_blockAlignment(size_t blockIdx) const
+	{
+		const Alignment& a = *_getter->metricAlign();
+		rowcol_t minRow = _blockLayout.rowFromCellUnsafe(blockIdx) * _blockSize;
+		rowcol_t minCol = _blockLayout.colFromCellUnsafe(blockIdx) * _blockSize;
+		rowcol_t nrow = std::min(_blockSize, a.nrow() - minRow);
+		rowcol_t ncol = std::min(_blockSize, a.ncol() - minCol);
+		return Alignment(a.xmin() + minCol * a.xres(), a.ymax() - (minRow + nrow) * a.yres(), nrow, ncol, a.xres(), a.yres(), a.crs());
+	}
+	size_t PointMetricHandler::_blockFromCell(cell_t cell) const
+	{
+		const Alignment& a = *_getter->metricAlign();
+		return _blockLayout.cellFromRowColUnsafe(a.rowFromCellUnsafe(cell) / _blockSize, a.colFromCellUnsafe(cell) / _blockSize);
+	}
+	cell_t PointMetricHandler::_cellInBlock(cell_t cell, const MetricBlock& block) const
+	{
+		const Alignment& a = *_getter->metricAlign();
+		return block.align.cellFromRowColUnsafe(a.rowFromCellUnsafe(cell) % _blockSize, a.colFromCellUnsafe(cell) % _blockSize);
+	}
+	void PointMetricHandler::_materializeBlocks(const Extent& e)
+	{
+		std::lock_guard lock{ _getter->globalMutex() };
+		for (cell_t blockIdx : CellIterator(_blockLayout, e, SnapType::out)) {
+			if (_blocks[blockIdx] || _blockFlushed[blockIdx]) {
+				continue;
+			}
+			Alignment blockAlign = _blockAlignment(blockIdx);
+			_blocks[blockIdx] = std::make_unique<MetricBlock>(_getter, blockAlign, _pointMetrics.size(), _stratumMetrics.size());
+
+			rowcol_t minRow = _blockLayout.rowFromCellUnsafe(blockIdx) * _blockSize;
+			rowcol_t minCol = _blockLayout.colFromCellUnsafe(blockIdx) * _blockSize;
+			cell_t remaining = 0;
+			for (rowcol_t row = minRow; row < minRow + blockAlign.nrow(); ++row) {
+				for (rowcol_t col = minCol; col < minCol + blockAlign.ncol(); ++col) {
+					remaining += _nLaz.atRCUnsafe(row, col).has_value();
+				}
+			}
+			_blocks[blockIdx]->cellsRemaining = remaining;
+		}
+	}
+	std::filesystem::path PointMetricHandler::_metricDir(const std::filesystem::path& root, ReturnType r) const
+	{
+		if (_getter->doAllReturnMetrics() && _getter->doFirstReturnMetrics()) {
+			return r == ReturnType::ALL ? root / "AllReturns" : root / "FirstReturns";
+		}
+		return root;
+	}
+	void PointMetricHandler::_createBlockWriters()
+	{
+		namespace fs = std::filesystem;
+
+		//the order here has to match the order of the rasters in _flushBlock
+		auto addWriter = [&](const fs::path& dir, const std::string& baseName, OutputUnitLabel unit) {
+			fs::path fileName = getFullFilename(dir, baseName, unit);
+			fs::create_directories(dir);
+			try {
+				_blockWriters.push_back(std::make_unique<BlockRasterWriter<metric_t>>(fileName.string(), *_getter->metricAlign(), _blockSize,
+					_getter->geoTiffCompression()));
+			}
+			catch (InvalidRasterFileException e) {
+				LapisLogger::getLogger().logWarning("Error writing " + fileName.string());
+				_blockWriters.emplace_back();
+			}
+		};
+		auto addWriters = [&](const fs::path& subdir, const std::string& baseName, OutputUnitLabel unit) {
+			if (_getter->doAllReturnMetrics()) {
+				addWriter(_metricDir(pointMetricDir(), ReturnType::ALL) / subdir, baseName, unit);
+			}
+			if (_getter->doFirstReturnMetrics()) {
+				addWriter(_metricDir(pointMetricDir(), ReturnType::FIRST) / subdir, baseName, unit);
+			}
+		};
+		for (PointMetricRasters& metric : _pointMetrics) {
+			addWriters(metric.subdir, metric.name, metric.unit);
+		}
+		for (StratumMetricRasters& metric : _stratumMetrics) {
+			for (size_t i = 0; i < _getter->strataBreaks().size() + 1; ++i) {
+				addWriters("StratumMetrics", metric.baseName + _getter->strataNames()[i], metric.unit);
+			}
+		}
+	}
+	void PointMetricHandler::_flushBlock(size_t blockIdx)
+	{
+		std::unique_ptr<MetricBlock> block;
+		{
+			std::lock_guard lock{ _getter->globalMutex() };
+			block = std::move(_blocks[blockIdx]);
+			_blockFlushed[blockIdx] = true;
+		}
+		if (!block) {
+			return;
+		}
+
+		size_t writerIdx = 0;
+		auto writeRasters = [&](TwoRasters& r) {
+			if (r.all) {
+				if (_blockWriters[writerIdx]) {
+					_blockWriters[writerIdx]->writeBlock(r.all.value());
+				}
+				++writerIdx;
+			}
+			if (r.first) {
+				if (_blockWriters[writerIdx]) {
+					_blockWriters[writerIdx]->writeBlock(r.first.value());
+				}
+				++writerIdx;
+			}
+		};
+		for (TwoRasters& r : block->pointMetrics) {
+			writeRasters(r);
+		}
+		for (std::vector<TwoRasters>& v : block->stratumMetrics) {
+			for (TwoRasters& r : v) {
+				writeRasters(r);
+			}
+		}
+	}
+	void PointMetricHandler::_initCoarseLevels()
+	{
+		const Alignment& a = *_getter->metricAlign();
+		const std::vector<int>& factors = _getter->coarseMetricFactors();
+		for (size_t i = 0; i < factors.size(); ++i) {
+			Alignment coarseAlign{ a, a.xOrigin(), a.yOrigin(), a.xres() * factors[i], a.yres() * factors[i] };
+			_coarseLevels.emplace_back(_getter, coarseAlign, _getter->coarseMetricNames()[i], _pointMetrics.size(), _stratumMetrics.size());
+		}
+
+		//a coarse cell is finished once every fine cell inside it that's covered by a las file is finished
+		for (CoarseLevel& level : _coarseLevels) {
+			for (cell_t cell = 0; cell < _nLaz.ncell(); ++cell) {
+				if (!_nLaz[cell].has_value()) {
+					continue;
+				}
+				cell_t coarseCell = level.align.cellFromXYUnsafe(_nLaz.xFromCellUnsafe(cell), _nLaz.yFromCellUnsafe(cell));
+				level.cellsRemaining[coarseCell].has_value() = true;
+				level.cellsRemaining[coarseCell].value()++;
+			}
+		}
+	}
+	void PointMetricHandler::_finishCell(cell_t cell)
+	{
+		PointMetricCalculator* all = nullptr;
+		PointMetricCalculator* first = nullptr;
+		MetricBlock* block = nullptr;
+		size_t blockIdx = 0;
+
+		if (_useBlocks) {
+			blockIdx = _blockFromCell(cell);
+			block = _blocks[blockIdx].get();
+			cell_t blockCell = _cellInBlock(cell, *block);
+			if (_getter->doAllReturnMetrics()) {
+				_processSetCell(blockCell, *block, ReturnType::ALL);
+				all = &block->pmc(ReturnType::ALL, blockCell);
+			}
+			if (_getter->doFirstReturnMetrics()) {
+				_processSetCell(blockCell, *block, ReturnType::FIRST);
+				first = &block->pmc(ReturnType::FIRST, blockCell);
+			}
+		}
+		else {
+			if (_getter->doAllReturnMetrics()) {
+				all = &_allReturnPMC->atCellUnsafe(cell).value();
+				_processPMCCell(cell, *all, ReturnType::ALL);
+			}
+			if (_getter->doFirstReturnMetrics()) {
+				first = &_firstReturnPMC->atCellUnsafe(cell).value();
+				_processPMCCell(cell, *first, ReturnType::FIRST);
+			}
+		}
+
+		if (all && _allReturnCube) {
+			_allReturnCube->writeCell(cell, *all);
+		}
+		if (first && _firstReturnCube) {
+			_firstReturnCube->writeCell(cell, *first);
+		}
+		_mergeIntoCoarseLevels(cell, all, first);
+		if (all) {
+			all->cleanUp();
+		}
+		if (first) {
+			first->cleanUp();
+		}
+
+		if (block && --block->cellsRemaining == 0) {
+			_flushBlock(blockIdx);
+		}
+	}
+	void PointMetricHandler::_mergeIntoCoarseLevels(cell_t cell, PointMetricCalculator* all, PointMetricCalculator* first)
+	{
+		if (_coarseLevels.empty()) {
+			return;
+		}
+		coord_t x = _nLaz.xFromCellUnsafe(cell);
+		coord_t y = _nLaz.yFromCellUnsafe(cell);
+		for (CoarseLevel& level : _coarseLevels) {
+			cell_t coarseCell = level.align.cellFromXYUnsafe(x, y);
+			bool finished = false;
+			{
+				std::lock_guard lock{ _getter->cellMutex(coarseCell) };
+				if (all) {
+					level.pmc(ReturnType::ALL, coarseCell).merge(*all);
+				}
+				if (first) {
+					level.pmc(ReturnType::FIRST, coarseCell).merge(*first);
+				}
+				finished = --level.cellsRemaining.atCellUnsafe(coarseCell).value() == 0;
+			}
+			if (!finished) {
+				continue;
+			}
+			//nothing else will touch this coarse cell, so it doesn't need the lock anymore
+			if (all) {
+				_processSetCell(coarseCell, level, ReturnType::ALL);
+				level.pmc(ReturnType::ALL, coarseCell).cleanUp();
+			}
+			if (first) {
+				_processSetCell(coarseCell, level, ReturnType::FIRST);
+				level.pmc(ReturnType::FIRST, coarseCell).cleanUp();
+			}
+		}
+	}
+	void PointMetricHandler::_createHistogramCubes()
+	{
+		auto createCube = [&](bool allReturns) {
+			std::filesystem::path file = histogramCubeFile(allReturns);
+			std::filesystem::create_directories(file.parent_path());
+			try {
+				return std::make_unique<HistogramCubeWriter>(file, *_getter->metricAlign(),
+					_getter->canopyCutoff(), _getter->maxHt(), _getter->binSize(), _getter->strataBreaks(), _getter->additionalCanopyCutoffs());
+			}
+			catch (std::runtime_error e) {
+				LapisLogger::getLogger().logWarning("Error writing " + file.string());
+				return std::unique_ptr<HistogramCubeWriter>();
+			}
+		};
+		if (_getter->doAllReturnMetrics()) {
+			_allReturnCube = createCube(true);
+		}
+		if (_getter->doFirstReturnMetrics()) {
+			_firstReturnCube = createCube(false);
+		}
+	}
+	void PointMetricHandler::_initMetrics(const std::vector<std::string>& cutoffNames, bool haveStrata)
 	{
 		using pmc = PointMetricCalculator;
 		using oul = OutputUnitLabel;
 
 		auto addPointMetric = [&](const std::string& name, MetricFunc f, oul u,
 			const std::string& pdfDesc) {
-			_pointMetrics.emplace_back(_getter, name, f, u, pdfDesc);
+			_pointMetrics.emplace_back(name, f, u, pdfDesc);
 		};
 
 		addPointMetric("Mean_CanopyHeight", &pmc::meanCanopy, oul::Default,
@@ -129,18 +458,62 @@ namespace lapis {
 				"");
 		}
 
+		//every metric except the return count depends on the canopy cutoff, so they're repeated for each additional cutoff
+		size_t nMainMetrics = _pointMetrics.size();
+		for (size_t cutoff = 0; cutoff < cutoffNames.size(); ++cutoff) {
+			for (size_t i = 0; i < nMainMetrics; ++i) {
+				if (_pointMetrics[i].fun == &pmc::returnCount) {
+					continue;
+				}
+				PointMetricRasters metric = _pointMetrics[i];
+				metric.cutoffIdx = cutoff + 1;
+				metric.subdir = cutoffNames[cutoff];
+				_pointMetrics.push_back(metric);
+			}
+		}
+
 		if (_getter->doStratumMetrics()) {
-			if (_getter->strataBreaks().size()) {
-				_stratumMetrics.emplace_back(_getter, "StratumCover_",
+			if (haveStrata) {
+				_stratumMetrics.emplace_back("StratumCover_",
 					&pmc::stratumCover, oul::Percent,
 					"The number of returns that fall in this stratum, as a percentage of "
 				"the number of returns in this stratum or lower. A proxy for the cover present in this stratum.");
-				_stratumMetrics.emplace_back(_getter, "StratumPercent_", 
+				_stratumMetrics.emplace_back("StratumPercent_",
 					&pmc::stratumPercent, oul::Percent,
 					"The number of returns that fall in this stratum, as a percentage of the total number of returns.");
 			}
 		}
 	}
+	void PointMetricHandler::recalculateFromHistogramCube(const std::filesystem::path& cubeFile, const std::filesystem::path& outDir)
+	{
+		LapisLogger& log = LapisLogger::getLogger();
+		HistogramCubeReader cube{ cubeFile };
+
+		std::vector<std::string> cutoffNames;
+		for (coord_t cutoff : cube.additionalCutoffs()) {
+			cutoffNames.push_back(PointMetricParameter::makeCutoffName(cutoff, _getter->unitPlural()));
+		}
+		std::vector<std::string> strataNames = PointMetricParameter::makeStrataNames(cube.strataBreaks(), _getter->unitPlural());
+
+		_pointMetrics.clear();
+		_stratumMetrics.clear();
+		_initMetrics(cutoffNames, strataNames.size() > 0);
+
+		log.setProgress("Recalculating Point Metrics", (int)(_pointMetrics.size() + _stratumMetrics.size() * strataNames.size()));
+		for (PointMetricRasters& metric : _pointMetrics) {
+			writeRasterLogErrors(getFullFilename(outDir / metric.subdir, metric.name, metric.unit),
+				cube.calculateMetric(metric.fun, metric.cutoffIdx), _getter->nThread());
+			log.incrementTask();
+		}
+		for (StratumMetricRasters& metric : _stratumMetrics) {
+			for (size_t i = 0; i < strataNames.size(); ++i) {
+				writeRasterLogErrors(getFullFilename(outDir / "StratumMetrics", metric.baseName + strataNames[i], metric.unit),
+					cube.calculateStratumMetric(metric.fun, i), _getter->nThread());
+				log.incrementTask();
+			}
+		}
+		log.setProgress("Done!", 0, false);
+	}
 	void PointMetricHandler::_stratumPdf(MetadataPdf& pdf)
 	{
 		pdf.writeSubsectionTitle("Stratum metrics");
@@ -182,7 +555,7 @@ namespace lapis {
 		pdf.writeTextBlockWithWrap(percentiles.str());
 
 		for (auto& metric : _pointMetrics) {
-			if (!metric.pdfDesc.size()) {
+			if (!metric.pdfDesc.size() || metric.cutoffIdx) {
 				continue;
 			}
 			pdf.writeSubsectionTitle(getFullFilename("", metric.name, metric.unit).string());
@@ -200,14 +573,26 @@ namespace lapis {
 			pdf.writeTextBlockWithWrap(metricDesc.str());
 		}
 	}
+	void PointMetricHandler::_writeRasterSet(const std::filesystem::path& dir, MetricRasterSet& set, ReturnType r)
+	{
+		for (size_t i = 0; i < _pointMetrics.size(); ++i) {
+			writeRasterLogErrors(getFullFilename(dir / _pointMetrics[i].subdir, _pointMetrics[i].name, _pointMetrics[i].unit), set.pointMetrics[i].get(r), _getter->nThread());
+		}
+		for (size_t i = 0; i < _stratumMetrics.size(); ++i) {
+			for (size_t j = 0; j < set.stratumMetrics[i].size(); ++j) {
+				writeRasterLogErrors(getFullFilename(dir / "StratumMetrics", _stratumMetrics[i].baseName + _getter->strataNames()[j],
+					_stratumMetrics[i].unit), set.stratumMetrics[i][j].get(r), _getter->nThread());
+			}
+		}
+	}
 	void PointMetricHandler::_writePointMetricRasters(const std::filesystem::path& dir, ReturnType r) {
 		for (PointMetricRasters& metric : _pointMetrics) {
-			writeRasterLogErrors(getFullFilename(dir, metric.name, metric.unit), metric.rasters.get(r));
+			writeRasterLogErrors(getFullFilename(dir / metric.subdir, metric.name, metric.unit), metric.rasters.get(r), _getter->nThread());
 		}
 		for (StratumMetricRasters& metric : _stratumMetrics) {
 			for (size_t i = 0; i < metric.rasters.size(); ++i) {
 				writeRasterLogErrors(getFullFilename(dir / "StratumMetrics", metric.baseName + _getter->strataNames()[i],
-					metric.unit), metric.rasters[i].get(r));
+					metric.unit), metric.rasters[i].get(r), _getter->nThread());
 			}
 		}
 	}
@@ -223,7 +608,7 @@ namespace lapis {
 		using pmc = PointMetricCalculator;
 		using oul = OutputUnitLabel;
 
-		pmc::setInfo(_getter->canopyCutoff(), _getter->maxHt(), _getter->binSize(), _getter->strataBreaks());
+		pmc::setInfo(_getter->canopyCutoff(), _getter->maxHt(), _getter->binSize(), _getter->strataBreaks(), _getter->additionalCanopyCutoffs());
 
 		_nLaz = Raster<int>(*_getter->metricAlign());
 		for (const Extent& e : _getter->lasExtents()) {
@@ -233,14 +618,31 @@ namespace lapis {
 			}
 		}
 
-		if (_getter->doAllReturnMetrics()) {
-			_allReturnPMC = std::make_unique<Raster<pmc>>(*_getter->metricAlign());
+		_initMetrics(_getter->additionalCanopyCutoffNames(), _getter->strataBreaks().size() > 0);
+		_initCoarseLevels();
+		if (_getter->savePointHistograms()) {
+			_createHistogramCubes();
 		}
-		if (_getter->doFirstReturnMetrics()) {
-			_firstReturnPMC = std::make_unique<Raster<pmc>>(*_getter->metricAlign());
+
+		size_t budget = _getter->pointMetricMemoryBudget();
+		bool overBudget = budget > 0 && _estimatedFullExtentMemory() > budget;
+		_useBlocks = overBudget || _getter->streamPointMetrics();
+		if (!_useBlocks) {
+			_allocateFullExtent();
+			return;
 		}
 
-		_initMetrics();
+		if (overBudget) {
+			LapisLogger::getLogger().logMessage("Point metrics will be processed in blocks to stay within the memory budget");
+		}
+		const Alignment& a = *_getter->metricAlign();
+		rowcol_t nBlockRow = (a.nrow() + _blockSize - 1) / _blockSize;
+		rowcol_t nBlockCol = (a.ncol() + _blockSize - 1) / _blockSize;
+		_blockLayout = Alignment(a.xmin(), a.ymax() - nBlockRow * _blockSize * a.yres(), nBlockRow, nBlockCol,
+			_blockSize * a.xres(), _blockSize * a.yres(), a.crs());
+		_blocks = std::vector<std::unique_ptr<MetricBlock>>(_blockLayout.ncell());
+		_blockFlushed = std::vector<bool>(_blockLayout.ncell(), false);
+		_createBlockWriters();
 	}
 	void PointMetricHandler::handlePoints(const std::span<LasPoint>& points, const Extent& e, size_t index)
 	{
@@ -249,14 +651,27 @@ namespace lapis {
 		//This structure is kind of ugly and inelegant, but it ensures that all returns and first returns can share a call to cellFromXY
 		//without needing to pollute the loop with a bunch of if checks
 		//Right now, with only two booleans, the combinatorics are bearable; if it increases, then it probably won't be
-		if (_getter->doFirstReturnMetrics() && _getter->doAllReturnMetrics()) {
-			_assignPointsToCalculators<true, true>(points);
+		Alignment::RowColExtent lasCells = _lasFileCells(e);
+		if (_useBlocks) {
+			_materializeBlocks(e);
+			if (_getter->doFirstReturnMetrics() && _getter->doAllReturnMetrics()) {
+				_assignPointsToBlocks<true, true>(points, lasCells);
+			}
+			else if (_getter->doAllReturnMetrics()) {
+				_assignPointsToBlocks<true, false>(points, lasCells);
+			}
+			else if (_getter->doFirstReturnMetrics()) {
+				_assignPointsToBlocks<false, true>(points, lasCells);
+			}
+		}
+		else if (_getter->doFirstReturnMetrics() && _getter->doAllReturnMetrics()) {
+			_assignPointsToCalculators<true, true>(points, lasCells);
 		}
 		else if (_getter->doAllReturnMetrics()) {
-			_assignPointsToCalculators<true, false>(points);
+			_assignPointsToCalculators<true, false>(points, lasCells);
 		}
 		else if (_getter->doFirstReturnMetrics()) {
-			_assignPointsToCalculators<false, true>(points);
+			_assignPointsToCalculators<false, true>(points, lasCells);
 		}
 		log.pauseVerboseBenchmarkTimer("Assigning points to metric cells");
 	}
@@ -267,16 +682,21 @@ namespace lapis {
 
 		log.beginVerboseBenchmarkTimer("Calculating point metrics");
 
+		if (_useBlocks) {
+			_materializeBlocks(e);
+		}
+		std::vector<cell_t> finishedCells;
 		for (cell_t cell : CellIterator(_nLaz, e, SnapType::out)) {
 			std::scoped_lock lock{ _getter->cellMutex(cell) };
 			_nLaz.atCellUnsafe(cell).value()--;
-			if (_nLaz.atCellUnsafe(cell).value() != 0) {
-				continue;
+			if (_nLaz.atCellUnsafe(cell).value() == 0) {
+				finishedCells.push_back(cell);
 			}
-			if (_getter->doAllReturnMetrics())
-				_processPMCCell(cell, _allReturnPMC->atCellUnsafe(cell).value(), ReturnType::ALL);
-			if (_getter->doFirstReturnMetrics())
-				_processPMCCell(cell, _firstReturnPMC->atCellUnsafe(cell).value(), ReturnType::FIRST);
+		}
+		//once a cell's count hits 0, no other thread will add points to it, so it can be processed without holding its lock
+		//this also lets the coarse levels take their own locks without a thread ever holding two at once
+		for (cell_t cell : finishedCells) {
+			_finishCell(cell);
 		}
 		log.endVerboseBenchmarkTimer("Calculating point metrics");
 	}
@@ -285,18 +705,51 @@ namespace lapis {
 	}
 	void PointMetricHandler::handleCsmTile(const Raster<csm_t>& bufferedCsm, cell_t tile) {}
 	void PointMetricHandler::cleanup() {
-		namespace fs = std::filesystem;
-
 		LapisLogger::getLogger().setProgress("Writing Point Metrics");
-		if (_getter->doAllReturnMetrics()) {
-			fs::path allReturnsMetricDir = _getter->doFirstReturnMetrics() ? pointMetricDir() / "AllReturns" : pointMetricDir();
-			_writePointMetricRasters(allReturnsMetricDir, ReturnType::ALL);
+
+		//blocks containing cells from las files with no points never finish on their own
+		for (size_t blockIdx = 0; blockIdx < _blocks.size(); ++blockIdx) {
+			if (_blocks[blockIdx]) {
+				_flushBlock(blockIdx);
+			}
 		}
-		if (_getter->doFirstReturnMetrics()) {
-			fs::path firstReturnsMetricDir = _getter->doAllReturnMetrics() ? pointMetricDir() / "FirstReturns" : pointMetricDir();
-			_writePointMetricRasters(firstReturnsMetricDir, ReturnType::FIRST);
+
+		//closing the files finishes writing them
+		_blockWriters.clear();
+		_allReturnCube.reset();
+		_firstReturnCube.reset();
+
+		if (!_useBlocks) {
+			if (_getter->doAllReturnMetrics()) {
+				_writePointMetricRasters(_metricDir(pointMetricDir(), ReturnType::ALL), ReturnType::ALL);
+			}
+			if (_getter->doFirstReturnMetrics()) {
+				_writePointMetricRasters(_metricDir(pointMetricDir(), ReturnType::FIRST), ReturnType::FIRST);
+			}
 		}
 
+		for (CoarseLevel& level : _coarseLevels) {
+			//like the blocks, coarse cells touching las files with no points never finish on their own
+			for (cell_t cell = 0; cell < level.cellsRemaining.ncell(); ++cell) {
+				if (!level.cellsRemaining[cell].has_value() || level.cellsRemaining[cell].value() == 0) {
+					continue;
+				}
+				if (_getter->doAllReturnMetrics()) {
+					_processSetCell(cell, level, ReturnType::ALL);
+				}
+				if (_getter->doFirstReturnMetrics()) {
+					_processSetCell(cell, level, ReturnType::FIRST);
+				}
+			}
+			if (_getter->doAllReturnMetrics()) {
+				_writeRasterSet(_metricDir(pointMetricDir() / level.name, ReturnType::ALL), level, ReturnType::ALL);
+			}
+			if (_getter->doFirstReturnMetrics()) {
+				_writeRasterSet(_metricDir(pointMetricDir() / level.name, ReturnType::FIRST), level, ReturnType::FIRST);
+			}
+		}
+		_coarseLevels = std::vector<CoarseLevel>();
+
 		_pointMetrics = std::vector<PointMetricRasters>();
 
 		_stratumMetrics = std::vector<StratumMetricRasters>();
@@ -325,6 +778,18 @@ namespace lapis {
 		else if (_getter->doFirstReturnMetrics()) {
 			overall << "These metrics were calculated using only first returns.";
 		}
+		if (_getter->additionalCanopyCutoffs().size()) {
+			overall << " The canopy metrics were also calculated with other canopy cutoffs. Those are in folders named after their cutoff.";
+		}
+		if (_getter->savePointHistograms()) {
+			overall << " The HistogramCube.lphc file next to the metrics holds the height histogram of each cell, "
+				"which holds everything needed to calculate the metrics without the lidar data. "
+				"Running Lapis with --recalculate-point-metrics and the path of that file writes the metrics to a Recalculated folder next to it.";
+		}
+		if (_getter->coarseMetricNames().size()) {
+			overall << " The same metrics were also calculated at larger cellsizes. Each of those is in its own folder under "
+				"the PointMetrics directory, named after its cellsize.";
+		}
 		pdf.writeTextBlockWithWrap(overall.str());
 
 
@@ -337,12 +802,21 @@ namespace lapis {
 	{
 		return parentDir() / "PointMetrics";
 	}
+	std::filesystem::path PointMetricHandler::histogramCubeFile(bool allReturns) const
+	{
+		return _metricDir(pointMetricDir(), allReturns ? ReturnType::ALL : ReturnType::FIRST) / "HistogramCube.lphc";
+	}
 
 	PointMetricHandler::PointMetricRasters::PointMetricRasters(ParamGetter* getter, const std::string& name,
 		MetricFunc fun, OutputUnitLabel unit, const std::string& pdfDesc)
 		: name(name), fun(fun), unit(unit), rasters(getter), pdfDesc(pdfDesc)
 	{
 	}
+	PointMetricHandler::PointMetricRasters::PointMetricRasters(const std::string& name,
+		MetricFunc fun, OutputUnitLabel unit, const std::string& pdfDesc)
+		: name(name), fun(fun), unit(unit), pdfDesc(pdfDesc)
+	{
+	}
 	PointMetricHandler::StratumMetricRasters::StratumMetricRasters(ParamGetter* getter, const std::string& baseName,
 		StratumFunc fun, OutputUnitLabel unit, const std::string& pdfDesc)
 		: baseName(baseName), fun(fun), unit(unit), pdfDesc(pdfDesc)
@@ -351,15 +825,53 @@ namespace lapis {
 			rasters.emplace_back(getter);
 		}
 	}
-	PointMetricHandler::TwoRasters::TwoRasters(ParamGetter* getter)
+	PointMetricHandler::StratumMetricRasters::StratumMetricRasters(const std::string& baseName,
+		StratumFunc fun, OutputUnitLabel unit, const std::string& pdfDesc)
+		: baseName(baseName), fun(fun), unit(unit), pdfDesc(pdfDesc)
+	{
+	}
+	PointMetricHandler::TwoRasters::TwoRasters(ParamGetter* getter) : TwoRasters(getter, *getter->metricAlign())
+	{
+	}
+	PointMetricHandler::TwoRasters::TwoRasters(ParamGetter* getter, const Alignment& a)
+	{
+		if (getter->doAllReturnMetrics()) {
+			all = Raster<metric_t>(a);
+		}
+		if (getter->doFirstReturnMetrics()) {
+			first = Raster<metric_t>(a);
+		}
+	}
+	PointMetricHandler::MetricRasterSet::MetricRasterSet(ParamGetter* getter, const Alignment& a, size_t nPointMetrics, size_t nStratumMetrics)
+		: align(a)
 	{
 		if (getter->doAllReturnMetrics()) {
-			all = Raster<metric_t>(*getter->metricAlign());
+			allReturnPMC = std::make_unique<Raster<PointMetricCalculator>>(a);
 		}
 		if (getter->doFirstReturnMetrics()) {
-			first = Raster<metric_t>(*getter->metricAlign());
+			firstReturnPMC = std::make_unique<Raster<PointMetricCalculator>>(a);
+		}
+		for (size_t i = 0; i < nPointMetrics; ++i) {
+			pointMetrics.emplace_back(getter, a);
+		}
+		stratumMetrics.resize(nStratumMetrics);
+		for (std::vector<TwoRasters>& v : stratumMetrics) {
+			for (size_t i = 0; i < getter->strataBreaks().size() + 1; ++i) {
+				v.emplace_back(getter, a);
+			}
 		}
 	}
+	PointMetricCalculator& PointMetricHandler::MetricRasterSet::pmc(ReturnType r, cell_t cell)
+	{
+		if (r == ReturnType::ALL) {
+			return allReturnPMC->atCellUnsafe(cell).value();
+		}
+		return firstReturnPMC->atCellUnsafe(cell).value();
+	}
+	PointMetricHandler::CoarseLevel::CoarseLevel(ParamGetter* getter, const Alignment& a, const std::string& name, size_t nPointMetrics, size_t nStratumMetrics)
+		: MetricRasterSet(getter, a, nPointMetrics, nStratumMetrics), name(name), cellsRemaining(a)
+	{
+	}
 	Raster<metric_t>& PointMetricHandler::TwoRasters::get(ReturnType r)
 	{
 		if (r == ReturnType::ALL) {
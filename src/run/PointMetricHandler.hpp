@@ -3,6 +3,8 @@
 #define LP_POINTMETRICHANDLER_H
 
 #include"ProductHandler.hpp"
+#include"..\gis\BlockRasterWriter.hpp"
+#include"HistogramCube.hpp"
 
 namespace lapis {
 	class PointMetricHandler : public ProductHandler {
@@ -24,6 +26,11 @@ namespace lapis {
 		void describeInPdf(MetadataPdf& pdf) override;
 
 		std::filesystem::path pointMetricDir() const;
+		std::filesystem::path histogramCubeFile(bool allReturns) const;
+
+		//calculates this run's choice of metrics from a cube written by an earlier run, using the cube's cutoffs and strata, and writes them to outDir
+		//doesn't need prepareForRun or any lidar data
+		void recalculateFromHistogramCube(const std::filesystem::path& cubeFile, const std::filesystem::path& outDir);
 
 		//protected to make testing easier
 	protected:
@@ -40,7 +47,9 @@ namespace lapis {
 		struct TwoRasters {
 			std::optional<Raster<metric_t>> first;
 			std::optional<Raster<metric_t>> all;
+			TwoRasters() = default;
 			TwoRasters(ParamGetter* getter);
+			TwoRasters(ParamGetter* getter, const Alignment& a);
 			Raster<metric_t>& get(ReturnType r);
 		};
 
@@ -51,9 +60,15 @@ namespace lapis {
 			OutputUnitLabel unit;
 			TwoRasters rasters;
 			std::string pdfDesc;
+			//which canopy cutoff to use, as in PointMetricCalculator::setActiveCutoff, and the folder the output goes in
+			size_t cutoffIdx = 0;
+			std::string subdir;
 
 			PointMetricRasters(ParamGetter* getter, const std::string& name,
 				MetricFunc fun, OutputUnitLabel unit, const std::string& pdfDesc);
+			//doesn't allocate any rasters
+			PointMetricRasters(const std::string& name,
+				MetricFunc fun, OutputUnitLabel unit, const std::string& pdfDesc);
 		};
 		std::vector<PointMetricRasters> _pointMetrics;
 
@@ -67,17 +82,86 @@ namespace lapis {
 
 			StratumMetricRasters(ParamGetter* getter, const std::string& baseName,
 				StratumFunc fun, OutputUnitLabel unit, const std::string& pdfDesc);
+			//doesn't allocate any rasters
+			StratumMetricRasters(const std::string& baseName,
+				StratumFunc fun, OutputUnitLabel unit, const std::string& pdfDesc);
 		};
 		std::vector<StratumMetricRasters> _stratumMetrics;
 
+		//the calculators and metric values for a single alignment, in the same order as _pointMetrics and _stratumMetrics
+		struct MetricRasterSet {
+			Alignment align;
+			unique_raster<PointMetricCalculator> allReturnPMC;
+			unique_raster<PointMetricCalculator> firstReturnPMC;
+			std::vector<TwoRasters> pointMetrics;
+			std::vector<std::vector<TwoRasters>> stratumMetrics;
+
+			MetricRasterSet(ParamGetter* getter, const Alignment& a, size_t nPointMetrics, size_t nStratumMetrics);
+			PointMetricCalculator& pmc(ReturnType r, cell_t cell);
+		};
+
+		//If the full-extent calculators and rasters would exceed the memory budget, or if metrics should be written as they finish,
+		//the metric alignment is divided into blocks and the calculators and metric values only exist for the blocks which are currently being worked on.
+		//Once every cell in a block is finished, its values are written into the output files, and the block is freed
+		struct MetricBlock : public MetricRasterSet {
+			std::atomic<cell_t> cellsRemaining = 0;
+
+			using MetricRasterSet::MetricRasterSet;
+		};
+		static constexpr rowcol_t _blockSize = 128;
+		bool _useBlocks = false;
+		Alignment _blockLayout;
+		std::vector<std::unique_ptr<MetricBlock>> _blocks;
+		std::vector<bool> _blockFlushed;
+		//one writer for each raster in a block, in the same order that _flushBlock visits them
+		std::vector<std::unique_ptr<BlockRasterWriter<metric_t>>> _blockWriters;
+
+		//Metrics at cellsizes which are multiples of the main one. Instead of binning the points a second time,
+		//the calculators of the fine cells are merged into the calculator of the coarse cell containing them as they finish
+		struct CoarseLevel : public MetricRasterSet {
+			std::string name;
+			Raster<int> cellsRemaining;
+
+			CoarseLevel(ParamGetter* getter, const Alignment& a, const std::string& name, size_t nPointMetrics, size_t nStratumMetrics);
+		};
+		std::vector<CoarseLevel> _coarseLevels;
+
+		std::unique_ptr<HistogramCubeWriter> _allReturnCube;
+		std::unique_ptr<HistogramCubeWriter> _firstReturnCube;
+
 		ParamGetter* _getter;
 
 		template<bool ALL_RETURNS, bool FIRST_RETURNS>
-		void _assignPointsToCalculators(const std::span<LasPoint>& points);
+		void _assignPointsToCalculators(const std::span<LasPoint>& points, const Alignment::RowColExtent& lasCells);
 		void _writePointMetricRasters(const std::filesystem::path& dir, ReturnType r);
+		void _writeRasterSet(const std::filesystem::path& dir, MetricRasterSet& set, ReturnType r);
 		void _processPMCCell(cell_t cell, PointMetricCalculator& pmc, ReturnType r);
 
-		void _initMetrics();
+		size_t _estimatedFullExtentMemory() const;
+		void _allocateFullExtent();
+		Alignment _blockAlignment(size_t blockIdx) const;
+		size_t _blockFromCell(cell_t cell) const;
+		cell_t _cellInBlock(cell_t cell, const MetricBlock& block) const;
+		void _materializeBlocks(const Extent& e);
+		template<bool ALL_RETURNS, bool FIRST_RETURNS>
+		void _assignPointsToBlocks(const std::span<LasPoint>& points, const Alignment::RowColExtent& lasCells);
+		//the cells counted for the las file in _nLaz. Points on the edge of the file are kept within these, so they never land in a cell
+		//which could already be finished, or in a block which doesn't exist
+		Alignment::RowColExtent _lasFileCells(const Extent& e) const;
+		cell_t _cellFromPoint(const LasPoint& p, const Alignment::RowColExtent& lasCells) const;
+		void _processSetCell(cell_t cell, MetricRasterSet& set, ReturnType r);
+		std::filesystem::path _metricDir(const std::filesystem::path& root, ReturnType r) const;
+		void _createBlockWriters();
+		void _flushBlock(size_t blockIdx);
+
+		void _initCoarseLevels();
+		void _createHistogramCubes();
+		//called once a fine cell has no unfinished las files left; must be called without holding any cell mutex
+		void _finishCell(cell_t cell);
+		void _mergeIntoCoarseLevels(cell_t cell, PointMetricCalculator* all, PointMetricCalculator* first);
+
+		//cutoffNames are the folders of the metrics at the additional canopy cutoffs
+		void _initMetrics(const std::vector<std::string>& cutoffNames, bool haveStrata);
 		void _stratumPdf(MetadataPdf& pdf);
 		void _metricPdf(MetadataPdf& pdf);
 	};
@@ -1,6 +1,7 @@
 #include"run_pch.hpp"
 #include"ProductHandler.hpp"
 #include"PointMetricCalculator.hpp"
+#include<gdal_utils.h>
 
 namespace lapis {
 
@@ -35,6 +36,35 @@ namespace lapis {
 			LapisLogger::getLogger().logWarning("Unable to delete " + p.string());
 		}
 	}
+	void ProductHandler::writeVrtLogErrors(const std::filesystem::path& filename, const std::filesystem::path& dir, const std::string& extension) const
+	{
+		namespace fs = std::filesystem;
+		std::vector<std::string> files;
+		if (fs::exists(dir)) {
+			for (const fs::directory_entry& entry : fs::directory_iterator(dir)) {
+				if (entry.is_regular_file() && entry.path().extension() == extension) {
+					files.push_back(entry.path().string());
+				}
+			}
+		}
+		if (files.empty()) {
+			return;
+		}
+		std::sort(files.begin(), files.end());
+		std::vector<const char*> fileNames;
+		for (const std::string& f : files) {
+			fileNames.push_back(f.c_str());
+		}
+
+		int usageError = FALSE;
+		GDALDatasetH vrt = GDALBuildVRT(filename.string().c_str(), (int)fileNames.size(), nullptr, fileNames.data(), nullptr, &usageError);
+		if (vrt == nullptr || usageError) {
+			LapisLogger::getLogger().logWarning("Error writing " + filename.string());
+		}
+		if (vrt != nullptr) {
+			GDALClose(vrt);
+		}
+	}
 	std::filesystem::path ProductHandler::getFullFilename(const std::filesystem::path& dir,
 		const std::string& baseName, OutputUnitLabel u, const std::string& extension) const
 	{
@@ -52,8 +52,15 @@ namespace lapis {
 		ParamGetter* _sharedGetter;
 		void deleteTempDirIfEmpty() const;
 
+		//nThread is the number of threads GDAL may use to compress the file
+		//most writes happen while every thread is already busy, so only single-threaded steps should pass more than 1
 		template<class T>
-		void writeRasterLogErrors(const std::filesystem::path& filename, Raster<T>& r) const;
+		void writeRasterLogErrors(const std::filesystem::path& filename, Raster<T>& r, int nThread = 1) const;
+		template<class T>
+		void writeCogLogErrors(const std::filesystem::path& filename, const Raster<T>& r) const;
+
+		//writes a VRT mosaicking every file in dir with the given extension
+		void writeVrtLogErrors(const std::filesystem::path& filename, const std::filesystem::path& dir, const std::string& extension = ".tif") const;
 
 		template<class T>
 		Raster<T> getEmptyRasterFromTile(cell_t tile, const Alignment& a, coord_t minBufferMeters) const;
@@ -62,7 +69,7 @@ namespace lapis {
 	};
 
 	template<class T>
-	inline void ProductHandler::writeRasterLogErrors(const std::filesystem::path& filename, Raster<T>& r) const
+	inline void ProductHandler::writeRasterLogErrors(const std::filesystem::path& filename, Raster<T>& r, int nThread) const
 	{
 		namespace fs = std::filesystem;
 		LapisLogger& log = LapisLogger::getLogger();
@@ -70,7 +77,20 @@ namespace lapis {
 		fs::create_directories(filename.parent_path());
 
 		try {
-			r.writeRaster(filename.string());
+			r.writeRaster(filename.string(), "GTiff", std::numeric_limits<T>::lowest(), GDT_Unknown,
+				geoTiffCreationOptions(_sharedGetter->geoTiffCompression(), r.GDT(), nThread));
+		}
+		catch (InvalidRasterFileException e) {
+			LapisLogger::getLogger().logWarning("Error writing " + filename.string());
+		}
+	}
+	template<class T>
+	inline void ProductHandler::writeCogLogErrors(const std::filesystem::path& filename, const Raster<T>& r) const
+	{
+		std::filesystem::create_directories(filename.parent_path());
+
+		try {
+			r.writeCog(filename.string(), std::numeric_limits<T>::lowest(), _sharedGetter->geoTiffCompression());
 		}
 		catch (InvalidRasterFileException e) {
 			LapisLogger::getLogger().logWarning("Error writing " + filename.string());
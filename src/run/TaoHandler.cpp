@@ -20,8 +20,52 @@ namespace lapis {
 		return "TAOs";
 	}
 
-	void TaoHandler::_writeHighPointsAsArray(const std::vector<cell_t>& highPoints, const Raster<csm_t>& bufferedCsm, const Raster<taoid_t>& bufferedSegments, 
-		const Extent& unbufferedExtent, cell_t tile) const {
+	TaoHandler::TaoTable TaoHandler::_buildTaoTable(const std::vector<cell_t>& highPoints, const Raster<csm_t>& bufferedCsm,
+		const Raster<taoid_t>& bufferedSegments, cell_t tile) const {
+
+		//each tile's ids are a fixed-stride sequence, so they can be used as indices directly
+		TaoTable table{ GenerateIdByTile(_getter->layout()->ncell(), tile) };
+		table.height.resize(highPoints.size(), 0);
+		table.pixelCount.resize(highPoints.size(), 0);
+
+		for (cell_t cell : highPoints) {
+			int64_t i = table.indexOf(bufferedSegments[cell].value());
+			if (i >= 0) {
+				table.height[i] = bufferedCsm[cell].value();
+			}
+		}
+		for (cell_t cell = 0; cell < bufferedSegments.ncell(); ++cell) {
+			auto v = bufferedSegments[cell];
+			if (!v.has_value()) {
+				continue;
+			}
+			int64_t i = table.indexOf(v.value());
+			if (i >= 0) {
+				table.pixelCount[i]++;
+			}
+		}
+		return table;
+	}
+	std::vector<TaoHandler::TaoInfo> TaoHandler::_highPointInfo(const std::vector<cell_t>& highPoints, const Raster<csm_t>& bufferedCsm,
+		const Raster<taoid_t>& bufferedSegments, const TaoTable& table, const Extent& unbufferedExtent) const {
+
+		LinearUnitConverter converter{ bufferedSegments.crs().getXYLinearUnits(), bufferedSegments.crs().getZUnits() };
+		const coord_t cellArea = converter(bufferedSegments.xres()) * converter(bufferedSegments.yres());
+
+		std::vector<TaoInfo> out;
+		for (cell_t cell : highPoints) {
+			coord_t x = bufferedCsm.xFromCellUnsafe(cell);
+			coord_t y = bufferedCsm.yFromCellUnsafe(cell);
+			if (!unbufferedExtent.contains(x, y)) {
+				continue;
+			}
+			int64_t i = table.indexOf(bufferedSegments[cell].value());
+			coord_t area = i >= 0 ? table.pixelCount[i] * cellArea : 0;
+			out.emplace_back(x, y, bufferedCsm[cell].value(), area);
+		}
+		return out;
+	}
+	void TaoHandler::_writeHighPointsAsArray(const std::vector<TaoInfo>& highPoints, cell_t tile) const {
 
 		std::filesystem::create_directories(taoTempDir());
 
@@ -37,27 +81,11 @@ namespace lapis {
 			ofs.write((const char*)&x, sizeof(x));
 		};
 
-		LinearUnitConverter converter{ bufferedSegments.crs().getXYLinearUnits(), bufferedSegments.crs().getZUnits() };
-		const coord_t cellArea = converter(bufferedSegments.xres()) * converter(bufferedSegments.yres());
-
-		std::unordered_map<taoid_t, coord_t> areas;
-		for (cell_t cell = 0; cell < bufferedSegments.ncell(); ++cell) {
-			if (bufferedSegments[cell].has_value()) {
-				areas.try_emplace(bufferedSegments[cell].value(), 0);
-				areas[bufferedSegments[cell].value()] += cellArea;
-			}
-		}
-
-		for (cell_t cell : highPoints) {
-			coord_t x = bufferedCsm.xFromCellUnsafe(cell);
-			coord_t y = bufferedCsm.yFromCellUnsafe(cell);
-			if (!unbufferedExtent.contains(x, y)) {
-				continue;
-			}
-			writeBytes(x);
-			writeBytes(y);
-			writeBytes(bufferedCsm[cell].value());
-			writeBytes(areas[bufferedSegments[cell].value()]);
+		for (const TaoInfo& info : highPoints) {
+			writeBytes(info.x);
+			writeBytes(info.y);
+			writeBytes(info.height);
+			writeBytes(info.area);
 		}
 	}
 	std::vector<TaoHandler::TaoInfo> TaoHandler::_readHighPointsFromArray(cell_t tile) const {
@@ -144,26 +172,71 @@ namespace lapis {
 			layer->CreateFeature(feature.ptr);
 		}
 	}
-	void TaoHandler::_updateMap(const Raster<taoid_t>& segments, const std::vector<cell_t>& highPoints, const Extent& unbufferedExtent, cell_t tileidx)
+	void TaoHandler::_writeFinalHighPoints(const Raster<taoid_t>& segments, const std::vector<TaoInfo>& highPoints, cell_t tile)
 	{
-		{
-			std::scoped_lock<std::mutex> lock(_getter->globalMutex());
-			idMap.tileToLocalNames.try_emplace(tileidx, TaoIdMap::IDToCoord());
+		if (!_vectorWriter) {
+			_writeHighPointsAsShp(segments, highPoints, tile);
+		}
+		if (!_vectorWriter && !_parquetWriter) {
+			return;
 		}
+		std::vector<TaoVectorWriter::Tao> taos;
+		taos.reserve(highPoints.size());
+		for (const TaoInfo& highPoint : highPoints) {
+			if (!segments.contains(highPoint.x, highPoint.y)) {
+				continue;
+			}
+			taoid_t id = segments.atXYUnsafe(highPoint.x, highPoint.y).value();
+			taos.push_back({ id, highPoint.x, highPoint.y, highPoint.height, highPoint.area, tile });
+		}
+		if (_vectorWriter && _parquetWriter) {
+			_parquetWriter->write(std::vector<TaoVectorWriter::Tao>(taos));
+			_vectorWriter->write(std::move(taos));
+		}
+		else if (_vectorWriter) {
+			_vectorWriter->write(std::move(taos));
+		}
+		else {
+			_parquetWriter->write(std::move(taos));
+		}
+	}
+	void TaoHandler::_updateMap(const Raster<taoid_t>& bufferedSegments, const Raster<taoid_t>& unbufferedSegments, const std::vector<cell_t>& highPoints,
+		const Extent& unbufferedExtent, cell_t tileidx)
+	{
+		//high points outside the unbuffered extent only matter if their segments reach into it
+		std::unordered_set<taoid_t> idsInTile;
+		taoid_t lastId = 0;
+		for (cell_t cell = 0; cell < unbufferedSegments.ncell(); ++cell) {
+			auto v = unbufferedSegments[cell];
+			//segments come in runs, so this skips most of the hashing
+			if (v.has_value() && (v.value() != lastId || idsInTile.empty())) {
+				lastId = v.value();
+				idsInTile.insert(lastId);
+			}
+		}
+
+		std::array<std::vector<std::pair<TaoIdMap::XY, taoid_t>>, TaoIdMap::nShards> finalNames;
+		TaoIdMap::IDToCoord& localNames = idMap.tileToLocalNames[tileidx];
 		for (cell_t cell : highPoints) {
-			coord_t x = segments.xFromCellUnsafe(cell);
-			coord_t y = segments.yFromCellUnsafe(cell);
+			TaoIdMap::XY xy{ bufferedSegments.xFromCellUnsafe(cell), bufferedSegments.yFromCellUnsafe(cell) };
+			taoid_t id = bufferedSegments[cell].value();
 
-			//in theory, you could identify areas that belong only to this tile, and aren't even in the buffers of any other tiles
-			//this is easy in a normal case, but kind of annoying to account for edge cases
-			//this could save a lot of memory here, if it ends up being necessary to do so
+			if (unbufferedExtent.contains(xy.x, xy.y)) { //this tao id is id that other tiles will have to match
+				finalNames[TaoIdMap::shardIndex(xy)].emplace_back(xy, id);
+			}
+			else if (idsInTile.contains(id)) { //this tao id will have to change eventually
+				localNames.try_emplace(id, xy);
+			}
+		}
 
-			if (unbufferedExtent.contains(x, y)) { //this tao id is id that other tiles will have to match
-				std::scoped_lock<std::mutex> lock(_getter->globalMutex());
-				idMap.coordsToFinalName.try_emplace(TaoIdMap::XY{ x,y }, segments[cell].value());
+		for (size_t i = 0; i < TaoIdMap::nShards; ++i) {
+			if (finalNames[i].empty()) {
+				continue;
 			}
-			else { //this tao id will have to change eventually
-				idMap.tileToLocalNames[tileidx].try_emplace(segments[cell].value(), TaoIdMap::XY{ x,y });
+			TaoIdMap::Shard& shard = (*idMap.shards)[i];
+			std::scoped_lock<std::mutex> lock(shard.mut);
+			for (auto& [xy, id] : finalNames[i]) {
+				shard.coordsToFinalName.try_emplace(xy, id);
 			}
 		}
 	}
@@ -184,19 +257,23 @@ namespace lapis {
 			return segments;
 		}
 
-		auto& localNameMap = idMap.tileToLocalNames.at(tile);
+		//the final name of each local id is looked up once, rather than once per pixel
+		std::unordered_map<taoid_t, taoid_t> localToFinal;
+		for (auto& [localId, xy] : idMap.tileToLocalNames.at(tile)) {
+			const taoid_t* finalName = idMap.finalName(xy);
+			if (finalName) { //if not, this is the edge of the acquisition
+				localToFinal.emplace(localId, *finalName);
+			}
+		}
 		for (cell_t cell = 0; cell < segments.ncell(); ++cell) {
 			auto v = segments[cell];
 			if (!v.has_value()) {
 				continue;
 			}
-			if (!localNameMap.contains(v.value())) {
-				continue;
-			}
-			if (!idMap.coordsToFinalName.contains(localNameMap.at(v.value()))) { //edge of the acquisition
-				continue;
+			auto it = localToFinal.find(v.value());
+			if (it != localToFinal.end()) {
+				v.value() = it->second;
 			}
-			v.value() = idMap.coordsToFinalName.at(localNameMap.at(v.value()));
 		}
 		return segments;
 	}
@@ -208,6 +285,23 @@ namespace lapis {
 	{
 		tryRemove(taoDir());
 		tryRemove(taoTempDir());
+		idMap.tileToLocalNames = std::vector<TaoIdMap::IDToCoord>(_getter->layout()->ncell());
+
+		const Raster<bool>& layout = *_getter->layout();
+		_tilesAfter = std::vector<cell_t>(layout.ncell(), 0);
+		cell_t nAfter = 0;
+		for (cell_t tile = layout.ncell() - 1; tile >= 0; --tile) {
+			_tilesAfter[tile] = nAfter;
+			nAfter += layout.atCellUnsafe(tile).has_value();
+		}
+		if (_getter->writeTaosToGeopackage()) {
+			_vectorWriter = std::make_unique<TaoVectorWriter>(getFullFilename(taoDir(), _taoBasename, OutputUnitLabel::Unitless, "gpkg"),
+				_getter->layout()->crs());
+		}
+		if (_getter->exportTaosToParquet()) {
+			_parquetWriter = std::make_unique<TaoVectorWriter>(getFullFilename(taoDir(), _taoBasename, OutputUnitLabel::Unitless, "parquet"),
+				_getter->layout()->crs(), TaoVectorWriter::Format::GeoParquet);
+		}
 	}
 	void TaoHandler::handlePoints(const std::span<LasPoint>& points, const Extent& e, size_t index)
 	{
@@ -232,32 +326,38 @@ namespace lapis {
 		log.endVerboseBenchmarkTimer("Identifying TAOs");
 		log.beginVerboseBenchmarkTimer("Segmenting TAOs");
 		GenerateIdByTile idGenerator{ _getter->layout()->ncell(),tile };
+		_getter->taoSegAlgorithm()->setTilesRemaining(_tilesAfter[tile]);
 		Raster<taoid_t> segments = _getter->taoSegAlgorithm()->segment(bufferedCsm, highPoints, idGenerator);
 		log.endVerboseBenchmarkTimer("Segmenting TAOs");
 
-		_updateMap(segments, highPoints, unbufferedExtent, tile);
+		Raster<taoid_t> unbufferedSegments = cropRaster(segments, unbufferedExtent, SnapType::out);
+		_updateMap(segments, unbufferedSegments, highPoints, unbufferedExtent, tile);
 
 		log.beginVerboseBenchmarkTimer("Calulating TAO max height");
-		Raster<csm_t> maxHeight{ (Alignment)segments };
-		std::unordered_map<taoid_t, csm_t> heightByID;
-		for (cell_t c : highPoints) {
-			heightByID.emplace(segments[c].value(), bufferedCsm[c].value());
-		}
-		for (cell_t cell = 0; cell < segments.ncell(); ++cell) {
-			if (segments[cell].has_value()) {
+		TaoTable table = _buildTaoTable(highPoints, bufferedCsm, segments, tile);
+		Raster<csm_t> maxHeight{ (Alignment)unbufferedSegments };
+		for (cell_t cell = 0; cell < unbufferedSegments.ncell(); ++cell) {
+			auto v = unbufferedSegments[cell];
+			if (v.has_value()) {
+				int64_t i = table.indexOf(v.value());
 				maxHeight[cell].has_value() = true;
-				maxHeight[cell].value() = heightByID[segments[cell].value()];
+				maxHeight[cell].value() = i >= 0 ? table.height[i] : 0;
 			}
 		}
 		log.endVerboseBenchmarkTimer("Calculating TAO max height");
 
-		_writeHighPointsAsArray(highPoints, bufferedCsm, segments, unbufferedExtent, tile);
-
-		segments = cropRaster(segments, unbufferedExtent, SnapType::out);
-		maxHeight = cropRaster(maxHeight, unbufferedExtent, SnapType::out);
-
-		writeRasterLogErrors(getFullTileFilename(taoTempDir(), _segmentsBasename, OutputUnitLabel::Unitless, tile), segments);
 		writeRasterLogErrors(getFullTileFilename(taoDir(), _maxHeightBasename, OutputUnitLabel::Default, tile), maxHeight);
+
+		std::vector<TaoInfo> taoInfo = _highPointInfo(highPoints, bufferedCsm, segments, table, unbufferedExtent);
+		if (idMap.tileToLocalNames[tile].empty()) {
+			//every segment in this tile belongs to a high point in this tile, so the ids are already final
+			writeRasterLogErrors(getFullTileFilename(taoDir(), _segmentsBasename, OutputUnitLabel::Unitless, tile), unbufferedSegments);
+			_writeFinalHighPoints(unbufferedSegments, taoInfo, tile);
+		}
+		else {
+			_writeHighPointsAsArray(taoInfo, tile);
+			writeRasterLogErrors(getFullTileFilename(taoTempDir(), _segmentsBasename, OutputUnitLabel::Unitless, tile), unbufferedSegments);
+		}
 	}
 	void TaoHandler::cleanup()
 	{
@@ -277,13 +377,17 @@ namespace lapis {
 							thisidx = sofar;
 							++sofar;
 						}
+						//tiles with nothing to relabel were finished in handleCsmTile
+						if (idMap.tileToLocalNames[thisidx].empty()) {
+							continue;
+						}
 						Raster<taoid_t> fixedSegments = _fixTaoIdsThread(thisidx);
 						if (!fixedSegments.hasAnyValue()) {
 							continue;
 						}
 						writeRasterLogErrors(getFullTileFilename(taoDir(), _segmentsBasename, OutputUnitLabel::Unitless, thisidx), fixedSegments);
 						std::vector<TaoInfo> highPoints = _readHighPointsFromArray(thisidx);
-						_writeHighPointsAsShp(fixedSegments, highPoints, thisidx);
+						_writeFinalHighPoints(fixedSegments, highPoints, thisidx);
 					}
 				}
 			));
@@ -292,6 +396,16 @@ namespace lapis {
 			threads[i].join();
 		}
 
+		if (_vectorWriter) {
+			LapisLogger::getLogger().setProgress("Indexing TAOs");
+			_vectorWriter->finish();
+			_vectorWriter.reset();
+		}
+		if (_parquetWriter) {
+			_parquetWriter->finish();
+			_parquetWriter.reset();
+		}
+
 		tryRemove(taoTempDir());
 		deleteTempDirIfEmpty();
 	}
@@ -312,8 +426,14 @@ namespace lapis {
 
 		pdf.writeSubsectionTitle("TAOs");
 		std::stringstream ss;
-		ss << "The TAOs themselves are stored in files with names like " << getFullTileFilename("", _taoBasename, OutputUnitLabel::Unitless, 0, "shp") << ". ";
-		ss << "These are point vector files, whose locations represent the TAOs identified by the identification algorithm. ";
+		if (_getter->writeTaosToGeopackage()) {
+			ss << "The TAOs themselves are stored in " << getFullFilename("", _taoBasename, OutputUnitLabel::Unitless, "gpkg").string() << ". ";
+			ss << "This is a point vector file, with a spatial index, whose locations represent the TAOs identified by the identification algorithm. ";
+		}
+		else {
+			ss << "The TAOs themselves are stored in files with names like " << getFullTileFilename("", _taoBasename, OutputUnitLabel::Unitless, 0, "shp") << ". ";
+			ss << "These are point vector files, whose locations represent the TAOs identified by the identification algorithm. ";
+		}
 		ss << "There are six attributes in the attribute table. ID is a unique identifier for each TAO. X and Y are the coordinates of the TAO. ";
 		ss << "Height is the height of the TAO, measured from the canopy surface model, in " << pdf.strToLower(_getter->unitPlural()) << ". ";
 		ss << "Area is the area of the region assigned to each TAO by the segmentation algorithm, in square " << pdf.strToLower(_getter->unitPlural()) << ". ";
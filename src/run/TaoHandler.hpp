@@ -3,6 +3,8 @@
 #define LP_TAOHANDLER_H
 
 #include"ProductHandler.hpp"
+#include"..\algorithms\TaoSegmentAlgorithm.hpp"
+#include"TaoVectorWriter.hpp"
 
 namespace lapis {
 	class TaoHandler : public ProductHandler {
@@ -40,27 +42,75 @@ namespace lapis {
 				}
 			};
 			using IDToCoord = std::unordered_map<taoid_t, XY>;
-			std::unordered_map<cell_t, IDToCoord> tileToLocalNames;
-			std::unordered_map<XY, taoid_t, XYHasher, XYEqual> coordsToFinalName;
+			//indexed by tile. Each tile only writes to its own entry, so this doesn't need to be locked
+			//a tile's entry only contains the ids of high points in other tiles whose segments reach into this tile
+			std::vector<IDToCoord> tileToLocalNames;
+
+			//the final names are split into shards by coordinate, so tiles finishing at the same time rarely wait on each other
+			static constexpr size_t nShards = 64;
+			struct Shard {
+				std::mutex mut;
+				std::unordered_map<XY, taoid_t, XYHasher, XYEqual> coordsToFinalName;
+			};
+			std::unique_ptr<std::array<Shard, nShards>> shards = std::make_unique<std::array<Shard, nShards>>();
+
+			static size_t shardIndex(const XY& xy) {
+				return XYHasher()(xy) % nShards;
+			}
+			//returns nullptr if no tile claimed a high point at these coordinates
+			//this should only be called once all tiles have been processed
+			const taoid_t* finalName(const XY& xy) const {
+				const auto& names = (*shards)[shardIndex(xy)].coordsToFinalName;
+				auto it = names.find(xy);
+				return it == names.end() ? nullptr : &it->second;
+			}
 		};
 
 		TaoIdMap idMap;
 
+		//the number of layout tiles with a higher index than each tile. Tiles are started in order, so this is the number not yet started
+		//tiles the controller skips for having no CSM data are never seen here, which is why this isn't counted as the tiles are segmented
+		std::vector<cell_t> _tilesAfter;
+
 		struct TaoInfo {
 			coord_t x, y;
 			csm_t height;
 			coord_t area;
 		};
 
-		void _writeHighPointsAsArray(const std::vector<cell_t>& highPoints, const Raster<csm_t>& bufferedCsm, const Raster<taoid_t>& bufferedSegments,
-			const Extent& unbufferedExtent, cell_t tile) const;
+		//the attributes of every TAO segmented in a tile, indexed by the order the tile's id generator handed out their ids
+		struct TaoTable {
+			GenerateIdByTile ids;
+			std::vector<csm_t> height;
+			std::vector<cell_t> pixelCount;
+
+			//returns -1 if the id doesn't belong to one of this tile's TAOs
+			int64_t indexOf(taoid_t id) const {
+				int64_t i = ids.indexOf(id);
+				return i < (int64_t)height.size() ? i : -1;
+			}
+		};
+		TaoTable _buildTaoTable(const std::vector<cell_t>& highPoints, const Raster<csm_t>& bufferedCsm, const Raster<taoid_t>& bufferedSegments,
+			cell_t tile) const;
+
+		void _writeHighPointsAsArray(const std::vector<TaoInfo>& highPoints, cell_t tile) const;
 		std::vector<TaoInfo> _readHighPointsFromArray(cell_t tile) const;
 
 		ParamGetter* _getter;
 
-		void _updateMap(const Raster<taoid_t>& segments, const std::vector<cell_t>& highPoints, const Extent& unbufferedExtent, cell_t tileidx);
+		std::vector<TaoInfo> _highPointInfo(const std::vector<cell_t>& highPoints, const Raster<csm_t>& bufferedCsm, const Raster<taoid_t>& bufferedSegments,
+			const TaoTable& table, const Extent& unbufferedExtent) const;
+
+		void _updateMap(const Raster<taoid_t>& bufferedSegments, const Raster<taoid_t>& unbufferedSegments, const std::vector<cell_t>& highPoints,
+			const Extent& unbufferedExtent, cell_t tileidx);
 		Raster<taoid_t> _fixTaoIdsThread(cell_t tile) const;
 		void _writeHighPointsAsShp(const Raster<taoid_t>& segments, const std::vector<TaoInfo>& highPoints, cell_t tile) const;
+		//writes the high points to the geopackage if there is one, and to this tile's shapefile otherwise
+		//they're also written to the parquet export, if requested
+		void _writeFinalHighPoints(const Raster<taoid_t>& segments, const std::vector<TaoInfo>& highPoints, cell_t tile);
+
+		std::unique_ptr<TaoVectorWriter> _vectorWriter;
+		std::unique_ptr<TaoVectorWriter> _parquetWriter;
 
 		std::string _taoBasename = "TAOs";
 		std::string _segmentsBasename = "Segments";
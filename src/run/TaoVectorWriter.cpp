@@ -0,0 +1,158 @@
+#include"run_pch.hpp"
+#include"TaoVectorWriter.hpp"
+
+namespace lapis {
+
+	TaoVectorWriter::TaoVectorWriter(const std::filesystem::path& filename, const CoordRef& crs, Format format)
+		: _filename(filename), _format(format)
+	{
+		GDALRegisterWrapper::allRegister();
+		std::filesystem::create_directories(filename.parent_path());
+
+		std::string driver = _format == Format::GeoPackage ? "GPKG" : "Parquet";
+		_dataset = GDALDatasetWrapper::createVector(driver, filename.string());
+		if (_dataset.isNull()) {
+			LapisLogger::getLogger().logWarning("Error creating " + filename.string() + ". Is the " + driver + " driver available?");
+		}
+		else {
+			OGRSpatialReference srs;
+			srs.importFromWkt(crs.getCleanEPSG().getCompleteWKT().c_str());
+
+			CPLStringList options;
+			if (_format == Format::GeoPackage) {
+				options.AddString("SPATIAL_INDEX=NO");
+				options.AddString("GEOMETRY_NAME=geom");
+			}
+			else {
+				options.AddString("COMPRESSION=ZSTD");
+				options.AddString("WRITE_COVERING_BBOX=YES");
+			}
+			_layer = _dataset->CreateLayer(_layerName.c_str(), &srs, wkbPoint, options.List());
+		}
+
+		if (_layer) {
+			OGRFieldDefn idField("ID", OFTInteger64);
+			_layer->CreateField(&idField);
+			OGRFieldDefn xField("X", OFTReal);
+			_layer->CreateField(&xField);
+			OGRFieldDefn yField("Y", OFTReal);
+			_layer->CreateField(&yField);
+			OGRFieldDefn heightField("Height", OFTReal);
+			_layer->CreateField(&heightField);
+			OGRFieldDefn areaField("Area", OFTReal);
+			_layer->CreateField(&areaField);
+			OGRFieldDefn radiusField("Radius", OFTReal);
+			_layer->CreateField(&radiusField);
+			if (_format == Format::GeoParquet) {
+				OGRFieldDefn tileField("Tile", OFTInteger64);
+				_layer->CreateField(&tileField);
+			}
+		}
+
+		_writerThread = std::thread([this]() {_writerLoop(); });
+	}
+
+	TaoVectorWriter::~TaoVectorWriter()
+	{
+		finish();
+	}
+
+	void TaoVectorWriter::write(std::vector<Tao>&& taos)
+	{
+		if (taos.empty()) {
+			return;
+		}
+		std::unique_lock lock{ _mut };
+		_cv.wait(lock, [&] {return _queue.size() < _maxQueuedBatches; });
+		_queue.push(std::move(taos));
+		lock.unlock();
+		_cv.notify_all();
+	}
+
+	void TaoVectorWriter::finish()
+	{
+		if (!_writerThread.joinable()) {
+			return;
+		}
+		{
+			std::lock_guard lock{ _mut };
+			_finishing = true;
+		}
+		_cv.notify_all();
+		_writerThread.join();
+
+		if (_layer && _format == Format::GeoPackage) {
+			std::string sql = "SELECT gpkgAddSpatialIndex('" + _layerName + "', 'geom')";
+			OGRLayer* result = _dataset->ExecuteSQL(sql.c_str(), nullptr, nullptr);
+			if (result) {
+				_dataset->ReleaseResultSet(result);
+			}
+		}
+		_layer = nullptr;
+		_dataset = GDALDatasetWrapper();
+	}
+
+	void TaoVectorWriter::_writerLoop()
+	{
+		size_t featuresInTransaction = 0;
+		while (true) {
+			std::vector<Tao> batch;
+			{
+				std::unique_lock lock{ _mut };
+				_cv.wait(lock, [&] {return _queue.size() || _finishing; });
+				if (_queue.empty()) {
+					break;
+				}
+				batch = std::move(_queue.front());
+				_queue.pop();
+			}
+			_cv.notify_all();
+
+			if (!_layer) {
+				continue;
+			}
+			//the parquet driver doesn't support transactions, and batches its rows into row groups itself
+			if (_format != Format::GeoPackage) {
+				_writeBatch(batch);
+				continue;
+			}
+			if (featuresInTransaction == 0) {
+				_dataset->StartTransaction();
+			}
+			_writeBatch(batch);
+			featuresInTransaction += batch.size();
+			if (featuresInTransaction >= _featuresPerTransaction) {
+				_dataset->CommitTransaction();
+				featuresInTransaction = 0;
+			}
+		}
+		if (featuresInTransaction > 0) {
+			_dataset->CommitTransaction();
+		}
+	}
+
+	void TaoVectorWriter::_writeBatch(const std::vector<Tao>& taos)
+	{
+		for (const Tao& tao : taos) {
+			OGRFeatureWrapper feature(_layer);
+			feature->SetField("ID", (int64_t)tao.id);
+			feature->SetField("X", tao.x);
+			feature->SetField("Y", tao.y);
+			feature->SetField("Height", tao.height);
+			feature->SetField("Area", tao.area);
+			feature->SetField("Radius", std::sqrt(tao.area / M_PI));
+			if (_format == Format::GeoParquet) {
+				feature->SetField("Tile", (int64_t)tao.tile);
+			}
+
+			OGRPoint point;
+			point.setX(tao.x);
+			point.setY(tao.y);
+			feature->SetGeometry(&point);
+
+			if (_layer->CreateFeature(feature.ptr) != OGRERR_NONE) {
+				LapisLogger::getLogger().logWarning("Error writing TAO to " + _filename.string());
+			}
+		}
+	}
+}
@@ -0,0 +1,62 @@
+#pragma once
+#ifndef LP_TAOVECTORWRITER_H
+#define LP_TAOVECTORWRITER_H
+
+#include"run_pch.hpp"
+
+namespace lapis {
+
+	//Writes TAOs from any number of threads into a single file.
+	//The tile threads queue their TAOs, and a single writer thread inserts them.
+	//For geopackages, the inserts are done in large transactions, and the spatial index is built once everything has been written,
+	//which is much faster than maintaining it during the inserts.
+	//GeoParquet output is meant for loading the attributes into analytics tools. Each tile's TAOs are written contiguously, with
+	//the tile in its own column, so the row group statistics let readers skip most of the file when filtering by space
+	class TaoVectorWriter {
+	public:
+		enum class Format {
+			GeoPackage, GeoParquet
+		};
+
+		struct Tao {
+			taoid_t id;
+			coord_t x, y;
+			csm_t height;
+			coord_t area;
+			cell_t tile;
+		};
+
+		TaoVectorWriter(const std::filesystem::path& filename, const CoordRef& crs, Format format = Format::GeoPackage);
+		~TaoVectorWriter();
+
+		TaoVectorWriter(const TaoVectorWriter&) = delete;
+		TaoVectorWriter& operator=(const TaoVectorWriter&) = delete;
+
+		//queues the TAOs to be written. This function is thread-safe, and blocks if the writer has fallen too far behind
+		void write(std::vector<Tao>&& taos);
+
+		//writes everything still in the queue, builds the spatial index, and closes the file
+		void finish();
+
+	private:
+		static constexpr size_t _maxQueuedBatches = 64;
+		static constexpr size_t _featuresPerTransaction = 100000;
+		inline static const std::string _layerName = "TAOs";
+
+		std::filesystem::path _filename;
+		Format _format;
+		GDALDatasetWrapper _dataset;
+		OGRLayer* _layer = nullptr;
+
+		std::mutex _mut;
+		std::condition_variable _cv;
+		std::queue<std::vector<Tao>> _queue;
+		bool _finishing = false;
+		std::thread _writerThread;
+
+		void _writerLoop();
+		void _writeBatch(const std::vector<Tao>& taos);
+	};
+}
+
+#endif
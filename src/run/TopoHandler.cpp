@@ -29,37 +29,38 @@ namespace lapis {
 	{
 		tryRemove(topoDir());
 
-		merger = std::make_unique<ElevMerger>(_getter);
+		_elevNumerator = Raster<coord_t>(*_getter->metricAlign());
+		_elevDenominator = Raster<coord_t>(*_getter->metricAlign());
 
 		using oul = OutputUnitLabel;
 		if (_getter->useRadians()) {
-			_topoMetrics.emplace_back("Slope", viewSlopeRadians<metric_t, coord_t>, oul::Radian,
+			_topoMetrics.emplace_back("Slope", &TopoMetrics3x3<metric_t>::slope, oul::Radian,
 				"The slope of the terrain, calculated on a 3x3 window around each pixel. The units are radians.");
-			_topoMetrics.emplace_back("Aspect", viewAspectRadians<metric_t, coord_t>, oul::Radian,
+			_topoMetrics.emplace_back("Aspect", &TopoMetrics3x3<metric_t>::aspect, oul::Radian,
 				"The aspect of the terrain, calculated on a 3x3 window around each pixel. The units are radians."
 				"A value near 0 or 2pi indicated a northward-facing slope, and it continues clockwise, so pi/2 is east, pi is south, and 3pi/2 is west.");
 		}
 		else {
-			_topoMetrics.emplace_back("Slope", viewSlopeDegrees<metric_t, coord_t>, oul::Degree,
+			_topoMetrics.emplace_back("Slope", &TopoMetrics3x3<metric_t>::slope, oul::Degree,
 				"The slope of the terrain, calculated on a 3x3 window around each pixel. The units are degrees.");
-			_topoMetrics.emplace_back("Aspect", viewAspectDegrees<metric_t, coord_t>, oul::Degree,
+			_topoMetrics.emplace_back("Aspect", &TopoMetrics3x3<metric_t>::aspect, oul::Degree,
 				"The aspect of the terrain, calculated on a 3x3 window around each pixel. The units are degrees."
 				"A value near 0 or 360 indicated a northward-facing slope, and it continues clockwise, so 90 is east, 180 is south, and 270 is west.");
 		}
 
-		_topoMetrics.emplace_back("Curvature", viewCurvature<metric_t, coord_t>, oul::Unitless,
+		_topoMetrics.emplace_back("Curvature", &TopoMetrics3x3<metric_t>::curvature, oul::Unitless,
 			"The overall curvature of the terrain. Ranges from 0 (nearly flat) to 100 (extremely curved).");
-		_topoMetrics.emplace_back("ProfileCurvature", viewProfileCurvature<metric_t, coord_t>, oul::Unitless,
+		_topoMetrics.emplace_back("ProfileCurvature", &TopoMetrics3x3<metric_t>::profileCurvature, oul::Unitless,
 			"The curvature of the terrain in the direction of the slope. Ranges from 0 (flat) to 100 (extremely curved)");
-		_topoMetrics.emplace_back("PlanCurvature", viewPlanCurvature<metric_t, coord_t>, oul::Unitless,
+		_topoMetrics.emplace_back("PlanCurvature", &TopoMetrics3x3<metric_t>::planCurvature, oul::Unitless,
 			"The curvature of the terrain perpindicular to the direction of the slope. Ranges from 0 (flat) to 100 (extremely curved).");
-		_topoMetrics.emplace_back("SolarRadiationIndex", viewSRI<metric_t, coord_t>, oul::Unitless,
+		_topoMetrics.emplace_back("SolarRadiationIndex", &TopoMetrics3x3<metric_t>::solarRadiationIndex, oul::Unitless,
 			"An index of how much sunlight each pixel receives, based on its slope, aspect, and latitude. Ranges from 0 (very little) to 2 (a lot).");
 
 		std::stringstream triss;
 		triss << "A measure of how rugged the terrain is. Values below 100 meters (330 feet) indicate relative flatness. "
 			<< "Values above 500 meters(1600 feet) indicate very rough terrain. The units are " << _getter->unitPlural() << ".";
-			_topoMetrics.emplace_back("TopoRuggednessIndex", viewTRI<metric_t, coord_t>, oul::Default,
+			_topoMetrics.emplace_back("TopoRuggednessIndex", &TopoMetrics3x3<metric_t>::ruggedness, oul::Default,
 				triss.str());
 
 
@@ -82,7 +83,53 @@ namespace lapis {
 	{
 		LapisLogger& log = LapisLogger::getLogger();
 		log.beginVerboseBenchmarkTimer("Calculating mean elevation");
-		merger->addRaster(dem);
+		const Alignment& metricAlign = *_getter->metricAlign();
+		if (!metricAlign.overlaps(dem)) {
+			log.endVerboseBenchmarkTimer("Calculating mean elevation");
+			return;
+		}
+
+		//the dem is summed into the metric cells it covers without holding the lock, and then added to the totals
+		Alignment local = cropAlignment(metricAlign, dem, SnapType::out);
+		std::vector<coord_t> sum(local.ncell(), 0.);
+		std::vector<coord_t> count(local.ncell(), 0.);
+
+		std::vector<rowcol_t> localCol(dem.ncol());
+		for (rowcol_t col = 0; col < dem.ncol(); ++col) {
+			coord_t x = dem.xFromColUnsafe(col);
+			localCol[col] = (x < local.xmin() || x >= local.xmax()) ? -1 : local.colFromXUnsafe(x);
+		}
+		for (rowcol_t row = 0; row < dem.nrow(); ++row) {
+			coord_t y = dem.yFromRowUnsafe(row);
+			if (y < local.ymin() || y >= local.ymax()) {
+				continue;
+			}
+			cell_t rowStart = (cell_t)local.rowFromYUnsafe(y) * local.ncol();
+			for (rowcol_t col = 0; col < dem.ncol(); ++col) {
+				auto v = dem.atRCUnsafe(row, col);
+				if (!v.has_value() || localCol[col] < 0) {
+					continue;
+				}
+				sum[rowStart + localCol[col]] += v.value();
+				count[rowStart + localCol[col]]++;
+			}
+		}
+
+		Alignment::RowColExtent rc = metricAlign.rowColExtent(local, SnapType::near);
+		std::lock_guard lock{ *_elevMut };
+		for (rowcol_t row = 0; row < local.nrow(); ++row) {
+			for (rowcol_t col = 0; col < local.ncol(); ++col) {
+				cell_t localCell = local.cellFromRowColUnsafe(row, col);
+				if (count[localCell] == 0) {
+					continue;
+				}
+				cell_t cell = metricAlign.cellFromRowColUnsafe(row + rc.minrow, col + rc.mincol);
+				_elevNumerator[cell].has_value() = true;
+				_elevNumerator[cell].value() += sum[localCell];
+				_elevDenominator[cell].has_value() = true;
+				_elevDenominator[cell].value() += count[localCell];
+			}
+		}
 		log.endVerboseBenchmarkTimer("Calculating mean elevation");
 	}
 	void TopoHandler::handleCsmTile(const Raster<csm_t>& bufferedCsm, cell_t tile)
@@ -90,36 +137,117 @@ namespace lapis {
 	}
 	void TopoHandler::cleanup()
 	{
-		Raster<coord_t> elev = merger->meanElev();
+		Raster<coord_t> elev = _elevNumerator / _elevDenominator;
+		_elevNumerator = Raster<coord_t>();
+		_elevDenominator = Raster<coord_t>();
+
+		//each output is written on another thread while the next metric is calculated. Only one write is in flight at a time,
+		//so no more than one finished raster is waiting in memory
+		std::thread writer;
+		struct JoinOnExit {
+			std::thread& t;
+			~JoinOnExit() {
+				if (t.joinable()) {
+					t.join();
+				}
+			}
+		} joinOnExit{ writer };
+		auto writeInBackground = [&](const std::filesystem::path& filename, auto&& r) {
+			if (writer.joinable()) {
+				writer.join();
+			}
+			writer = std::thread([this, filename, r = std::move(r)]() mutable {
+				//an exception escaping this thread would end the whole process
+				try {
+					writeRasterLogErrors(filename, r);
+				}
+				catch (std::exception e) {
+					LapisLogger::getLogger().logError("Error writing " + filename.string() + ": " + e.what());
+				}
+				});
+		};
+		writeInBackground(getFullFilename(topoDir(), "MeanElevation", OutputUnitLabel::Default), Raster<coord_t>(elev));
 
-		writeRasterLogErrors(getFullFilename(topoDir(), "MeanElevation", OutputUnitLabel::Default), elev);
+		auto takeNew = [](metric_t a, metric_t b) {return b; };
+		std::mutex mergeMut;
 
 		LapisLogger& log = LapisLogger::getLogger();
 		log.setProgress("Calculating Small-Scale Topography");
+		Alignment elevAlign = (Alignment)elev;
+		TopoMetrics3x3<metric_t> smallScale{ Raster<metric_t>(elevAlign), Raster<metric_t>(elevAlign), Raster<metric_t>(elevAlign),
+			Raster<metric_t>(elevAlign), Raster<metric_t>(elevAlign), Raster<metric_t>(elevAlign), Raster<metric_t>(elevAlign) };
+		_forEachRowBlock(elev, [&](const Extent& block) {
+			Raster<coord_t> withHalo = cropRaster(elev, _rowHalo(elev, block, elev.yres()), SnapType::near);
+			TopoMetrics3x3<metric_t> blockMetrics = topoMetrics3x3<metric_t, coord_t>(withHalo, _getter->useRadians());
+			std::lock_guard lock{ mergeMut };
+			for (TopoMetric& metric : _topoMetrics) {
+				(smallScale.*metric.field).overlay(cropRaster(blockMetrics.*metric.field, block, SnapType::near), takeNew);
+			}
+			});
 		for (TopoMetric& metric : _topoMetrics) {
-			Raster<metric_t> r = focal<metric_t, coord_t>(elev, 3, metric.fun);
-			writeRasterLogErrors(getFullFilename(topoDir(), metric.name, metric.unit), r);
+			writeInBackground(getFullFilename(topoDir(), metric.name, metric.unit), std::move(smallScale.*metric.field));
 		}
 
 		log.setProgress("Calculating Large-Scale Topography");
-		Extent unbuffered = (Extent)elev;
 		Raster<coord_t> buffered = _getter->bufferedElev(elev);
 		for (TopoRadiusMetric& metric : _topoRadiusMetrics) {
 			auto& radii = _getter->topoWindows();
 			auto& radiusNames = _getter->topoWindowNames();
 			for (size_t i = 0; i < radii.size(); ++i) {
-				Raster<metric_t> r = metric.fun(buffered, radii[i], unbuffered);
-				if (r.ncell() != elev.ncell()) {
-					r = cropRaster(r, elev, SnapType::near);
-				}
-				if (r.ncell() != elev.ncell()) {
-					r = extendRaster(r, elev, SnapType::near);
-				}
+				Raster<metric_t> r{ elevAlign };
+				//the window reaches one cell past the radius
+				coord_t haloDist = radii[i] + 2 * std::max(buffered.xres(), buffered.yres());
+				_forEachRowBlock(elev, [&](const Extent& block) {
+					Raster<coord_t> withHalo = cropRaster(buffered, _rowHalo(buffered, block, haloDist), SnapType::near);
+					Raster<metric_t> blockResult = metric.fun(withHalo, radii[i], block);
+					std::lock_guard lock{ mergeMut };
+					r.overlay(blockResult, takeNew);
+					});
 				r.mask(elev);
 				std::string fullName = metric.name + "_" + radiusNames[i];
-				writeRasterLogErrors(getFullFilename(topoDir(), fullName, metric.unit), r);
+				writeInBackground(getFullFilename(topoDir(), fullName, metric.unit), std::move(r));
+			}
+		}
+	}
+	void TopoHandler::_forEachRowBlock(const Alignment& a, const std::function<void(const Extent&)>& f)
+	{
+		if (a.nrow() == 0 || a.ncol() == 0) {
+			return;
+		}
+		//several blocks per thread, so threads which finish early can pick up more of the work
+		int nThread = std::max(1, _getter->nThread());
+		rowcol_t nBlock = std::min(a.nrow(), nThread * 4);
+		rowcol_t rowsPerBlock = (a.nrow() + nBlock - 1) / nBlock;
+
+		rowcol_t nextRow = 0;
+		std::mutex mut;
+		auto blockThread = [&]() {
+			while (true) {
+				rowcol_t minRow;
+				{
+					std::lock_guard lock{ mut };
+					if (nextRow >= a.nrow()) {
+						return;
+					}
+					minRow = nextRow;
+					nextRow += rowsPerBlock;
+				}
+				rowcol_t maxRow = std::min(minRow + rowsPerBlock, a.nrow()) - 1;
+				f(Extent(a.xmin(), a.xmax(), a.ymax() - (maxRow + 1) * a.yres(), a.ymax() - minRow * a.yres(), a.crs()));
 			}
+		};
+
+		std::vector<std::thread> threads;
+		for (int i = 0; i < nThread; ++i) {
+			threads.push_back(std::thread(blockThread));
 		}
+		for (std::thread& t : threads) {
+			t.join();
+		}
+	}
+	Extent TopoHandler::_rowHalo(const Extent& r, const Extent& block, coord_t haloDist)
+	{
+		return cropExtent(r, Extent(r.xmin(), r.xmax(), block.ymin() - haloDist, block.ymax() + haloDist, r.crs()));
 	}
 	void TopoHandler::describeInPdf(MetadataPdf& pdf)
 	{
@@ -152,105 +280,12 @@ namespace lapis {
 		return parentDir() / "Topography";
 	}
 
-	TopoHandler::TopoMetric::TopoMetric(const std::string& name, TopoFunc fun, OutputUnitLabel unit, const std::string& pdfDesc)
-		: name(name), fun(fun), unit(unit), pdfDesc(pdfDesc)
+	TopoHandler::TopoMetric::TopoMetric(const std::string& name, TopoMetricField field, OutputUnitLabel unit, const std::string& pdfDesc)
+		: name(name), field(field), unit(unit), pdfDesc(pdfDesc)
 	{
 	}
 	TopoHandler::TopoRadiusMetric::TopoRadiusMetric(const std::string& name, TopoRadiusFunc fun, OutputUnitLabel unit, const std::string& pdfDesc)
 		: name(name), fun(fun), unit(unit), pdfDesc(pdfDesc)
 	{
 	}
-	void TopoHandler::ElevMergerRasterCell::addRaster(const Raster<coord_t>& dtm, const Extent& thisCell)
-	{
-		if (anyData && !miniRaster) {
-			//should be an inaccessible branch if upstream functions do what they ought to
-			return;
-		}
-		if (!anyData) {
-			//set up
-			Alignment a = extendAlignment(dtm, thisCell, SnapType::near);
-			a = cropAlignment(a, thisCell, SnapType::near);
-			miniRaster = std::make_unique<Raster<coord_t>>(a);
-			anyData = true;
-		}
-
-		for (cell_t dtmCell : CellIterator(dtm, *miniRaster, SnapType::near)) {
-
-			if (!dtm[dtmCell].has_value()) {
-				continue;
-			}
-
-			coord_t x = dtm.xFromCell(dtmCell);
-			coord_t y = dtm.yFromCell(dtmCell);
-
-			cell_t miniCell = miniRaster->cellFromXYUnsafe(x, y);
-			if (miniRaster->atCellUnsafe(miniCell).has_value()) {
-				continue;
-			}
-
-			miniRaster->atCellUnsafe(miniCell).has_value() = true;
-			miniRaster->atCellUnsafe(miniCell).value() = dtm[dtmCell].value();
-		}
-
-		//if the raster is full, cache the mean and dealloc early
-		coord_t numerator = 0;
-		coord_t denominator = 0;
-		for (cell_t cell : CellIterator(*miniRaster)) {
-			if (!miniRaster->atCellUnsafe(cell).has_value()) {
-				return;
-			}
-			numerator += miniRaster->atCellUnsafe(cell).value();
-			denominator++;
-		}
-		finishedMean.value() = numerator / denominator;
-		finishedMean.has_value() = true;
-		miniRaster.reset(nullptr);
-
-	}
-	xtl::xoptional<coord_t> TopoHandler::ElevMergerRasterCell::reportMeanAndDealloc()
-	{
-		if (!anyData) {
-			return xtl::missing<coord_t>();
-		}
-		if (anyData && !miniRaster) {
-			return finishedMean;
-		}
-
-		coord_t numerator = 0;
-		coord_t denominator = 0;
-		for (cell_t cell : CellIterator(*miniRaster)) {
-			if (!miniRaster->atCellUnsafe(cell).has_value()) {
-				continue;
-			}
-			numerator += miniRaster->atCellUnsafe(cell).value();
-			denominator++;
-		}
-		miniRaster.reset(nullptr);
-		if (denominator == 0) {
-			return xtl::missing<coord_t>();
-		}
-		finishedMean.has_value() = true;
-		finishedMean.value() = numerator / denominator;
-		return finishedMean;
-	}
-	TopoHandler::ElevMerger::ElevMerger(TopoHandler::ParamGetter* p) : cells(*p->metricAlign()), getter(p)
-	{
-	}
-	void TopoHandler::ElevMerger::addRaster(const Raster<coord_t>& dtm)
-	{
-		for (cell_t cell : CellIterator(cells, dtm, SnapType::out)) {
-			std::scoped_lock<std::mutex> lock{ getter->cellMutex(cell) };
-			cells[cell].value().addRaster(dtm, cells.extentFromCell(cell));
-		}
-	}
-	Raster<coord_t> TopoHandler::ElevMerger::meanElev()
-	{
-		Raster<coord_t> meanElev = Raster<coord_t>((Alignment)cells);
-		for (cell_t cell : CellIterator(meanElev)) {
-			auto v = cells[cell].value().reportMeanAndDealloc();
-			meanElev[cell].has_value() = v.has_value();
-			meanElev[cell].value() = v.value();
-		}
-		return meanElev;
-	}
 }
\ No newline at end of file
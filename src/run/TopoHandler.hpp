@@ -27,14 +27,15 @@ namespace lapis {
 
 	protected:
 
-		using TopoFunc = ViewFunc<metric_t, coord_t>;
+		//all of the 3x3 metrics are calculated together by topoMetrics3x3; this picks out which of its outputs a metric is
+		using TopoMetricField = Raster<metric_t> TopoMetrics3x3<metric_t>::*;
 		struct TopoMetric {
 			std::string name;
-			TopoFunc fun;
+			TopoMetricField field;
 			OutputUnitLabel unit;
 			std::string pdfDesc;
 
-			TopoMetric(const std::string& name, TopoFunc fun, OutputUnitLabel unit, const std::string& pdfDesc);
+			TopoMetric(const std::string& name, TopoMetricField field, OutputUnitLabel unit, const std::string& pdfDesc);
 		};
 		std::vector<TopoMetric> _topoMetrics;
 
@@ -51,29 +52,16 @@ namespace lapis {
 
 		ParamGetter* _getter;
 
-		class ElevMergerRasterCell {
-		public:
-			void addRaster(const Raster<coord_t>& dtm, const Extent& thisCell);
-			xtl::xoptional<coord_t> reportMeanAndDealloc();
+		//splits the rows of a into blocks and calls f with the extent of each block, on several threads
+		void _forEachRowBlock(const Alignment& a, const std::function<void(const Extent&)>& f);
+		//the extent of the rows of r within haloDist of the block, in the y direction only
+		static Extent _rowHalo(const Extent& r, const Extent& block, coord_t haloDist);
 
-		private:
-			xtl::xoptional<coord_t> finishedMean;
-			std::unique_ptr<Raster<coord_t>> miniRaster;
-			bool anyData = false;
-		};
-
-		class ElevMerger {
-		public:
-			ElevMerger(TopoHandler::ParamGetter* p);
-			void addRaster(const Raster<coord_t>& dtm);
-			Raster<coord_t> meanElev();
-
-		private:
-			Raster<ElevMergerRasterCell> cells;
-			TopoHandler::ParamGetter* getter;
-		};
-
-		std::unique_ptr<ElevMerger> merger;
+		//the sum and count of the DEM cells in each metric cell, which give the mean elevation
+		//where the DEMs of different las files overlap, every DEM cell is counted, so the overlap is the average of the DEMs covering it
+		Raster<coord_t> _elevNumerator;
+		Raster<coord_t> _elevDenominator;
+		std::unique_ptr<std::mutex> _elevMut = std::make_unique<std::mutex>();
 	};
 }
 
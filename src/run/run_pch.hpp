@@ -5,6 +5,7 @@
 //std
 #include<iostream>
 #include<mutex>
+#include<condition_variable>
 #include<map>
 #include<chrono>
 #include<thread>
@@ -12,6 +13,7 @@
 #include<filesystem>
 #include<unordered_set>
 #include<queue>
+#include<list>
 #include<unordered_map>
 #include<sstream>
 
@@ -67,4 +67,40 @@ namespace lapis {
 			}
 		}
 	}
-}
\ No newline at end of file
+
+	TEST(CsmAlgorithmsTest, maxPointExactFootprintTest) {
+		Alignment a{ Extent(0,5,0,5),5,5 };
+
+		//near the upper-right of its cell, so the footprint reaches the cells to the right, above, and diagonally up and to the right
+		//only the exact method will see the diagonal cell, because none of the nine samples land in it
+		LidarPointVector points;
+		points.push_back(LasPoint{ 2.75,2.9,10,0,0 });
+
+		MaxPoint exact{ 0.6, true };
+		auto exactMaker = exact.getCsmMaker(a);
+		exactMaker->addPoints(points);
+		Raster<csm_t> exactCsm = *exactMaker->currentCsm();
+
+		MaxPoint approx{ 0.6 };
+		auto approxMaker = approx.getCsmMaker(a);
+		approxMaker->addPoints(points);
+		Raster<csm_t> approxCsm = *approxMaker->currentCsm();
+
+		for (auto [x, y] : std::vector<std::pair<coord_t, coord_t>>{ {2.5,2.5},{3.5,2.5},{2.5,3.5} }) {
+			ASSERT_TRUE(exactCsm.atXY(x, y).has_value());
+			EXPECT_NEAR(exactCsm.atXY(x, y).value(), 10, 0.01);
+			ASSERT_TRUE(approxCsm.atXY(x, y).has_value());
+			EXPECT_NEAR(approxCsm.atXY(x, y).value(), 10, 0.01);
+		}
+		ASSERT_TRUE(exactCsm.atXY(3.5, 3.5).has_value());
+		EXPECT_NEAR(exactCsm.atXY(3.5, 3.5).value(), 10, 0.01);
+		EXPECT_FALSE(approxCsm.atXY(3.5, 3.5).has_value());
+
+		//the return itself keeps the highest value, to avoid ties with its neighbors
+		EXPECT_GT(exactCsm.atXY(2.5, 2.5).value(), exactCsm.atXY(3.5, 2.5).value());
+
+		for (auto [x, y] : std::vector<std::pair<coord_t, coord_t>>{ {1.5,2.5},{2.5,1.5},{3.5,1.5},{1.5,3.5} }) {
+			EXPECT_FALSE(exactCsm.atXY(x, y).has_value());
+		}
+	}
+}
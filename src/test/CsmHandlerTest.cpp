@@ -12,6 +12,12 @@ namespace lapis {
 		std::vector<CSMMetricRaster>& csmMetrics() {
 			return _csmMetrics;
 		}
+		CsmTileStore& csmStore() {
+			return _csmStore;
+		}
+		void writeVrt(const std::filesystem::path& filename, const std::filesystem::path& dir) {
+			writeVrtLogErrors(filename, dir);
+		}
 	};
 
 	void setReasonableCsmDefaults(CsmParameterSpoofer& spoof) {
@@ -78,15 +84,10 @@ namespace lapis {
 		ch.handlePoints(points, lasExtent, 0);
 		ch.finishLasFile(lasExtent,0);
 
-		fs::path expectedPath = ch.getFullTempFilename(ch.csmTempDir(), "CanopySurfaceModel", OutputUnitLabel::Default, 0);
+		Raster<csm_t> output{ (Alignment)expected };
+		ch.csmStore().readInto(output);
+		EXPECT_FALSE(fs::exists(ch.csmTempDir()));
 
-		ASSERT_TRUE(fs::exists(expectedPath));
-		Raster<csm_t> output{ expectedPath.string() };
-		ASSERT_TRUE(output.xmin() <= expected.xmin());
-		ASSERT_TRUE(output.xmax() >= expected.xmax());
-		ASSERT_TRUE(output.ymin() <= expected.ymin());
-		ASSERT_TRUE(output.ymax() >= expected.ymax());
-		
 		for (cell_t cell = 0; cell < expected.ncell(); ++cell) {
 			coord_t x = expected.xFromCell(cell);
 			coord_t y = expected.yFromCell(cell);
@@ -130,9 +131,8 @@ namespace lapis {
 		spoof.addLasExtent(leftHalf);
 		spoof.addLasExtent(rightHalf);
 
-		fs::create_directories(ch.csmTempDir());
-		leftHalf.writeRaster(ch.getFullTempFilename(ch.csmTempDir(),"CanopySurfaceModel",OutputUnitLabel::Default,0).string());
-		rightHalf.writeRaster(ch.getFullTempFilename(ch.csmTempDir(), "CanopySurfaceModel", OutputUnitLabel::Default, 1).string());
+		ch.csmStore().addCsm(leftHalf);
+		ch.csmStore().addCsm(rightHalf);
 
 
 		Raster<csm_t> buffered = ch.getBufferedCsm(0);
@@ -175,4 +175,86 @@ namespace lapis {
 
 	}
 
-}
\ No newline at end of file
+	TEST(CsmHandlerTest, tilestorespilltest) {
+		CsmParameterSpoofer spoof;
+		setReasonableCsmDefaults(spoof);
+
+		namespace fs = std::filesystem;
+		fs::remove_all(spoof.outFolder());
+		fs::path spillDir = spoof.outFolder() / "spill";
+
+		//a budget this small forces every tile to be written to disk as soon as it's filled
+		CsmTileStore store{ *spoof.csmAlign(), spoof.layout(), [](csm_t a, csm_t b) {return std::max(a, b); }, 1, spillDir, GeoTiffCompression::Zstd };
+
+		Raster<csm_t> full{ *spoof.csmAlign() };
+		for (cell_t cell = 0; cell < full.ncell(); ++cell) {
+			full[cell].has_value() = true;
+			full[cell].value() = (csm_t)cell;
+		}
+		Raster<csm_t> lower{ *spoof.csmAlign() };
+		for (cell_t cell = 0; cell < lower.ncell(); ++cell) {
+			lower[cell].has_value() = true;
+			lower[cell].value() = -1;
+		}
+
+		store.addCsm(lower);
+		store.addCsm(full);
+		EXPECT_EQ(store.bytesInMemory(), 0);
+		EXPECT_TRUE(fs::exists(spillDir));
+		for (const fs::directory_entry& spilled : fs::directory_iterator(spillDir)) {
+			GDALDatasetWrapper wgd = rasterGDALWrapper(spilled.path().string());
+			ASSERT_FALSE(wgd.isNull());
+			const char* compression = wgd->GetMetadataItem("COMPRESSION", "IMAGE_STRUCTURE");
+			ASSERT_NE(compression, nullptr);
+			EXPECT_EQ(std::string(compression), "ZSTD");
+		}
+
+		Raster<csm_t> output{ (Alignment)full };
+		store.readInto(output);
+		for (cell_t cell = 0; cell < full.ncell(); ++cell) {
+			ASSERT_TRUE(output[cell].has_value());
+			EXPECT_EQ(output[cell].value(), full[cell].value());
+		}
+
+		store.clear();
+		EXPECT_FALSE(fs::exists(spillDir));
+		fs::remove_all(spoof.outFolder());
+	}
+
+	TEST(CsmHandlerTest, vrttest) {
+		CsmParameterSpoofer spoof;
+		setReasonableCsmDefaults(spoof);
+
+		namespace fs = std::filesystem;
+		fs::remove_all(spoof.outFolder());
+		fs::path tileDir = spoof.outFolder() / "tiles";
+		fs::create_directories(tileDir);
+
+		Raster<csm_t> fullCsm{ *spoof.csmAlign() };
+		for (cell_t cell = 0; cell < fullCsm.ncell(); ++cell) {
+			fullCsm[cell].has_value() = true;
+			fullCsm[cell].value() = (csm_t)cell;
+		}
+		coord_t midX = (fullCsm.xmin() + fullCsm.xmax()) / 2;
+		Raster<csm_t> leftHalf = cropRaster(fullCsm, Extent(fullCsm.xmin(), midX, fullCsm.ymin(), fullCsm.ymax()), SnapType::ll);
+		Raster<csm_t> rightHalf = cropRaster(fullCsm, Extent(midX, fullCsm.xmax(), fullCsm.ymin(), fullCsm.ymax()), SnapType::ll);
+		leftHalf.writeRaster((tileDir / "left.tif").string());
+		rightHalf.writeRaster((tileDir / "right.tif").string());
+
+		CsmHandlerProtectedAccess ch(&spoof);
+		fs::path vrt = spoof.outFolder() / "mosaic.vrt";
+		ch.writeVrt(vrt, tileDir);
+		ASSERT_TRUE(fs::exists(vrt));
+
+		{
+			Raster<csm_t> mosaic{ vrt.string() };
+			ASSERT_TRUE(mosaic.isSameAlignment(fullCsm));
+			for (cell_t cell = 0; cell < fullCsm.ncell(); ++cell) {
+				ASSERT_TRUE(mosaic[cell].has_value());
+				EXPECT_EQ(mosaic[cell].value(), fullCsm[cell].value());
+			}
+		}
+
+		fs::remove_all(spoof.outFolder());
+	}
+}
@@ -1,5 +1,6 @@
 #include"test_pch.hpp"
 #include"..\algorithms\AllCsmPostProcessors.hpp"
+#include<random>
 
 namespace lapis {
 
@@ -102,4 +103,95 @@ namespace lapis {
 			}
 		}
 	}
-}
\ No newline at end of file
+
+	TEST(CsmPostAlgosTest, matchesRayWalkTest) {
+		//a direct port of the per-cell versions of smoothing and filling, which the row-based versions should agree with
+		Raster<csm_t> r{ Alignment(Extent(0, 40, 0, 30), 30, 40) };
+		std::mt19937 gen{ 12345 };
+		std::uniform_real_distribution<float> height{ 0, 50 };
+		std::bernoulli_distribution present{ 0.6 };
+		for (cell_t cell = 0; cell < r.ncell(); ++cell) {
+			//a block of missing data big enough that some of it shouldn't be filled
+			bool inGap = r.rowFromCell(cell) >= 10 && r.rowFromCell(cell) < 20 && r.colFromCell(cell) >= 10 && r.colFromCell(cell) < 25;
+			r[cell].has_value() = !inGap && present(gen);
+			r[cell].value() = height(gen);
+		}
+
+		const int neighborsNeeded = 6;
+		const coord_t lookDist = 4.5;
+		const rowcol_t cardinalDist = (rowcol_t)lookDist;
+		const rowcol_t diagonalDist = (rowcol_t)(lookDist / std::sqrt(2));
+		const csm_t sqrtTwo = (csm_t)std::sqrt(2.);
+
+		auto referenceFill = [&](rowcol_t row, rowcol_t col) -> xtl::xoptional<csm_t> {
+			std::vector<std::pair<rowcol_t, rowcol_t>> directions = { {0,1},{0,-1},{1,0},{-1,0},{1,1},{1,-1},{-1,1},{-1,-1} };
+			int misses = 0;
+			csm_t numerator = 0, denominator = 0;
+			for (size_t i = 0; i < directions.size(); ++i) {
+				bool diagonal = i >= 4;
+				rowcol_t maxDist = diagonal ? diagonalDist : cardinalDist;
+				bool missed = true;
+				for (rowcol_t d = 1; d <= maxDist; ++d) {
+					rowcol_t thisRow = row + d * directions[i].first;
+					rowcol_t thisCol = col + d * directions[i].second;
+					if (thisRow < 0 || thisCol < 0 || thisRow >= r.nrow() || thisCol >= r.ncol()) {
+						missed = false;
+						break;
+					}
+					auto v = r.atRCUnsafe(thisRow, thisCol);
+					if (v.has_value()) {
+						missed = false;
+						csm_t inverseDist = 1 / ((diagonal ? sqrtTwo : (csm_t)1.) * d);
+						numerator += inverseDist * v.value();
+						denominator += inverseDist;
+						break;
+					}
+				}
+				if (missed) {
+					misses++;
+				}
+			}
+			if (misses > 8 - neighborsNeeded || denominator == 0) {
+				return xtl::missing<csm_t>();
+			}
+			return numerator / denominator;
+		};
+
+		Raster<csm_t> out = SmoothAndFill{ 5,neighborsNeeded,lookDist }.postProcess(r);
+		ASSERT_TRUE(out.isSameAlignment(r));
+
+		int nFilled = 0, nUnfilled = 0;
+		for (rowcol_t row = 0; row < r.nrow(); ++row) {
+			for (rowcol_t col = 0; col < r.ncol(); ++col) {
+				auto actual = out.atRC(row, col);
+				if (r.atRC(row, col).has_value()) {
+					double sum = 0;
+					int count = 0;
+					for (rowcol_t br = std::max(0, row - 2); br <= std::min(r.nrow() - 1, row + 2); ++br) {
+						for (rowcol_t bc = std::max(0, col - 2); bc <= std::min(r.ncol() - 1, col + 2); ++bc) {
+							if (r.atRC(br, bc).has_value()) {
+								sum += r.atRC(br, bc).value();
+								count++;
+							}
+						}
+					}
+					ASSERT_TRUE(actual.has_value());
+					EXPECT_NEAR(actual.value(), sum / count, 0.001);
+					continue;
+				}
+
+				auto expected = referenceFill(row, col);
+				ASSERT_EQ(actual.has_value(), expected.has_value());
+				if (expected.has_value()) {
+					nFilled++;
+					EXPECT_EQ(actual.value(), expected.value());
+				}
+				else {
+					nUnfilled++;
+				}
+			}
+		}
+		EXPECT_GT(nFilled, 0);
+		EXPECT_GT(nUnfilled, 0);
+	}
+}
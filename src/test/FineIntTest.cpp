@@ -28,33 +28,34 @@ namespace lapis {
 		fih.handlePoints(points, *spoof.fineIntAlign(), 0);
 		fih.finishLasFile(*spoof.fineIntAlign(), 0);
 
-		std::filesystem::path numName = fih.getFullTempFilename(fih.fineIntTempDir(), "numerator", OutputUnitLabel::Unitless, 0);
-		std::filesystem::path denomName = fih.getFullTempFilename(fih.fineIntTempDir(), "denominator", OutputUnitLabel::Unitless, 0);
-		ASSERT_TRUE(std::filesystem::exists(numName));
-		ASSERT_TRUE(std::filesystem::exists(denomName));
-
-		Raster<intensity_t> expectedNum{ *spoof.fineIntAlign() };
-		expectedNum.atXY(0.5, 0.5).has_value() = true;
-		expectedNum.atXY(0.5, 0.5).value() = 2;
-		expectedNum.atXY(1.5, 1.5).has_value() = true;
-		expectedNum.atXY(1.5, 1.5).value() = 4;
-		Raster<intensity_t> expectedDenom = expectedNum / (intensity_t)2.;
-
-		Raster<intensity_t> actualNum{ numName.string() };
-		Raster<intensity_t> actualDenom{ denomName.string() };
-
-		ASSERT_TRUE(actualNum.isSameAlignment(actualDenom));
-		ASSERT_TRUE(actualNum.isSameAlignment(expectedNum));
-
-		for (cell_t cell = 0; cell < actualNum.ncell(); ++cell) {
-			EXPECT_EQ(actualNum[cell].has_value(), expectedNum[cell].has_value());
-			EXPECT_EQ(actualDenom[cell].has_value(), expectedDenom[cell].has_value());
-			if (actualNum[cell].has_value()) {
-				EXPECT_EQ(actualNum[cell].value(), expectedNum[cell].value());
-				EXPECT_EQ(actualDenom[cell].value(), expectedDenom[cell].value());
+		//the sums are kept in memory until the tile is written
+		EXPECT_FALSE(std::filesystem::exists(fih.tempDir() / "Intensity"));
+
+		cell_t testTile = 2;
+		fih.handleCsmTile(Raster<csm_t>(), testTile);
+
+		Raster<intensity_t> expected{ cropAlignment(*spoof.fineIntAlign(),spoof.layout()->extentFromCell(testTile), SnapType::near) };
+		expected.atXY(0.5, 0.5).has_value() = true;
+		expected.atXY(0.5, 0.5).value() = 2;
+		expected.atXY(1.5, 1.5).has_value() = true;
+		expected.atXY(1.5, 1.5).value() = 2;
+
+		std::filesystem::path name = fih.getFullTileFilename(fih.fineIntDir(), "MeanCanopyIntensity", OutputUnitLabel::Unitless, testTile);
+		ASSERT_TRUE(std::filesystem::exists(name));
+		Raster<intensity_t> actual{ name.string() };
+
+		ASSERT_TRUE(actual.isSameAlignment(expected));
+		for (cell_t cell = 0; cell < expected.ncell(); ++cell) {
+			EXPECT_EQ(expected[cell].has_value(), actual[cell].has_value());
+			if (expected[cell].has_value()) {
+				EXPECT_EQ(expected[cell].value(), actual[cell].value());
 			}
 		}
 
+		//once a tile has been written, its sums are freed
+		std::filesystem::remove(name);
+		fih.handleCsmTile(Raster<csm_t>(), testTile);
+		EXPECT_FALSE(std::filesystem::exists(name));
 
 		std::filesystem::remove_all(spoof.outFolder());
 	}
@@ -78,8 +79,13 @@ namespace lapis {
 		points.push_back({ 2.5,0.5,3,9,0 });
 		points.push_back({ 1.5,1.5,3,3,0 });
 
+		std::filesystem::path name = fih.getFullTileFilename(fih.fineIntDir(), "MeanCanopyIntensity", OutputUnitLabel::Unitless,testTile);
+
 		fih.handlePoints(points, *spoof.fineIntAlign(), 0);
 		fih.finishLasFile(*spoof.fineIntAlign(), 0);
+
+		//the second las file overlaps the tile, so it can't be written yet
+		EXPECT_FALSE(std::filesystem::exists(name));
 		
 		points.clear();
 		points.push_back({ 1.5,1.5,3,5,0 });
@@ -88,6 +94,9 @@ namespace lapis {
 		fih.handlePoints(points, *spoof.fineIntAlign(), 1);
 		fih.finishLasFile(*spoof.fineIntAlign(), 1);
 
+		//once every overlapping las file has finished, the tile is written without waiting for the csm
+		EXPECT_TRUE(std::filesystem::exists(name));
+
 		Raster<intensity_t> expected{ cropAlignment(*spoof.fineIntAlign(),spoof.layout()->extentFromCell(testTile), SnapType::near) };
 		expected.atXY(0.5, 0.5).has_value() = true;
 		expected.atXY(0.5, 0.5).value() = 6;
@@ -96,7 +105,6 @@ namespace lapis {
 
 		fih.handleCsmTile(Raster<csm_t>(),testTile);
 
-		std::filesystem::path name = fih.getFullTileFilename(fih.fineIntDir(), "MeanCanopyIntensity", OutputUnitLabel::Unitless,testTile);
 		ASSERT_TRUE(std::filesystem::exists(name));
 		Raster<intensity_t> actual{ name.string() };
 
@@ -57,15 +57,36 @@ namespace lapis {
 	void SharedParameterSpoofer::addLasExtent(const Extent& e)
 	{
 		_lasExtents.push_back(e);
+		_lasExtentIndex = ExtentIndex(_lasExtents);
 	}
 	const std::vector<Extent>& SharedParameterSpoofer::lasExtents()
 	{
 		return _lasExtents;
 	}
+	const ExtentIndex& SharedParameterSpoofer::lasExtentIndex()
+	{
+		return _lasExtentIndex;
+	}
 	std::string SharedParameterSpoofer::layoutTileName(cell_t tile)
 	{
 		return std::to_string(tile);
 	}
+	void SharedParameterSpoofer::setMemoryBudget(size_t bytes)
+	{
+		_memoryBudget = bytes;
+	}
+	size_t SharedParameterSpoofer::memoryBudget()
+	{
+		return _memoryBudget;
+	}
+	void SharedParameterSpoofer::setGeoTiffCompression(GeoTiffCompression compression)
+	{
+		_compression = compression;
+	}
+	GeoTiffCompression SharedParameterSpoofer::geoTiffCompression()
+	{
+		return _compression;
+	}
 	const std::string& SharedParameterSpoofer::unitSingular()
 	{
 		static std::string out = "meter";
@@ -126,6 +147,19 @@ namespace lapis {
 	{
 		return _canopyCutoff;
 	}
+	void PointMetricParameterSpoofer::setAdditionalCanopyCutoffs(const std::vector<coord_t>& cutoffs, const std::vector<std::string>& names)
+	{
+		_additionalCutoffs = cutoffs;
+		_additionalCutoffNames = names;
+	}
+	const std::vector<coord_t>& PointMetricParameterSpoofer::additionalCanopyCutoffs()
+	{
+		return _additionalCutoffs;
+	}
+	const std::vector<std::string>& PointMetricParameterSpoofer::additionalCanopyCutoffNames()
+	{
+		return _additionalCutoffNames;
+	}
 	void PointMetricParameterSpoofer::setMaxHt(coord_t v)
 	{
 		_maxHt = v;
@@ -151,6 +185,35 @@ namespace lapis {
 	{
 		return _strataNames;
 	}
+	void PointMetricParameterSpoofer::setStreamPointMetrics(bool b)
+	{
+		_streamPointMetrics = b;
+	}
+	bool PointMetricParameterSpoofer::streamPointMetrics()
+	{
+		return _streamPointMetrics;
+	}
+	void PointMetricParameterSpoofer::setSavePointHistograms(bool b)
+	{
+		_savePointHistograms = b;
+	}
+	bool PointMetricParameterSpoofer::savePointHistograms()
+	{
+		return _savePointHistograms;
+	}
+	void PointMetricParameterSpoofer::setCoarseMetrics(const std::vector<int>& factors, const std::vector<std::string>& names)
+	{
+		_coarseFactors = factors;
+		_coarseNames = names;
+	}
+	const std::vector<int>& PointMetricParameterSpoofer::coarseMetricFactors()
+	{
+		return _coarseFactors;
+	}
+	const std::vector<std::string>& PointMetricParameterSpoofer::coarseMetricNames()
+	{
+		return _coarseNames;
+	}
 	void CsmParameterSpoofer::setCsmAlign(const Alignment& a)
 	{
 		_csmAlign = std::make_shared<Alignment>(a);
@@ -191,6 +254,14 @@ namespace lapis {
 	{
 		return _doCsmMetrics;
 	}
+	void CsmParameterSpoofer::setWriteCsmAsCog(bool b)
+	{
+		_writeCsmAsCog = b;
+	}
+	bool CsmParameterSpoofer::writeCsmAsCog()
+	{
+		return _writeCsmAsCog;
+	}
 	void TaoParameterSpoofer::setDoTaos(bool b)
 	{
 		_doTaos = b;
@@ -215,6 +286,22 @@ namespace lapis {
 	{
 		return _taoSegAlgorithm.get();
 	}
+	void TaoParameterSpoofer::setWriteTaosToGeopackage(bool b)
+	{
+		_writeTaosToGeopackage = b;
+	}
+	bool TaoParameterSpoofer::writeTaosToGeopackage()
+	{
+		return _writeTaosToGeopackage;
+	}
+	void TaoParameterSpoofer::setExportTaosToParquet(bool b)
+	{
+		_exportTaosToParquet = b;
+	}
+	bool TaoParameterSpoofer::exportTaosToParquet()
+	{
+		return _exportTaosToParquet;
+	}
 	void FineIntParameterSpoofer::setFineIntAlign(const Alignment& a)
 	{
 		_fineIntAlign = std::make_shared<Alignment>(a);
@@ -271,4 +358,12 @@ namespace lapis {
 	{
 		return _names;
 	}
+	void TopoParameterSpoofer::setUseRadians(bool b)
+	{
+		_useRadians = b;
+	}
+	bool TopoParameterSpoofer::useRadians()
+	{
+		return _useRadians;
+	}
 }
\ No newline at end of file
@@ -34,9 +34,16 @@ namespace lapis {
 
 		void addLasExtent(const Extent& e);
 		const std::vector<Extent>& lasExtents() override;
+		const ExtentIndex& lasExtentIndex() override;
 
 		std::string layoutTileName(cell_t tile) override;
 
+		void setMemoryBudget(size_t bytes);
+		size_t memoryBudget() override;
+
+		void setGeoTiffCompression(GeoTiffCompression compression);
+		GeoTiffCompression geoTiffCompression() override;
+
 		const std::string& unitSingular() override;
 		const std::string& unitPlural() override;
 
@@ -47,6 +54,9 @@ namespace lapis {
 		std::filesystem::path _outFolder;
 		std::string _name;
 		std::vector<Extent> _lasExtents;
+		ExtentIndex _lasExtentIndex;
+		size_t _memoryBudget = 0;
+		GeoTiffCompression _compression = GeoTiffCompression::None;
 		std::mutex _mut;
 	};
 
@@ -79,6 +89,10 @@ namespace lapis {
 		void setCanopyCutoff(coord_t v);
 		coord_t canopyCutoff() override;
 
+		void setAdditionalCanopyCutoffs(const std::vector<coord_t>& cutoffs, const std::vector<std::string>& names);
+		const std::vector<coord_t>& additionalCanopyCutoffs() override;
+		const std::vector<std::string>& additionalCanopyCutoffNames() override;
+
 		void setMaxHt(coord_t v);
 		coord_t maxHt() override;
 
@@ -88,12 +102,24 @@ namespace lapis {
 		const std::vector<coord_t>& strataBreaks() override;
 		const std::vector<std::string>& strataNames() override;
 
+		void setStreamPointMetrics(bool b);
+		bool streamPointMetrics() override;
+
+		void setSavePointHistograms(bool b);
+		bool savePointHistograms() override;
+
+		void setCoarseMetrics(const std::vector<int>& factors, const std::vector<std::string>& names);
+		const std::vector<int>& coarseMetricFactors() override;
+		const std::vector<std::string>& coarseMetricNames() override;
+
 	private:
 		bool _doPointMetrics = true;
 		bool _doFirstReturnMetrics = true;
 		bool _doAllReturnMetrics = true;
 		bool _doStratumMetrics = true;
 		bool _doAdvancedPointMetrics = true;
+		bool _streamPointMetrics = false;
+		bool _savePointHistograms = false;
 
 		coord_t _canopyCutoff = 2;
 
@@ -101,6 +127,12 @@ namespace lapis {
 
 		std::vector<coord_t> _strataBreaks;
 		std::vector<std::string> _strataNames;
+
+		std::vector<coord_t> _additionalCutoffs;
+		std::vector<std::string> _additionalCutoffNames;
+
+		std::vector<int> _coarseFactors;
+		std::vector<std::string> _coarseNames;
 	};
 
 	class CsmParameterSpoofer : public virtual CsmParameterGetter, public SharedParameterSpoofer {
@@ -120,10 +152,14 @@ namespace lapis {
 		void setDoCsmMetrics(bool b);
 		bool doCsmMetrics() override;
 
+		void setWriteCsmAsCog(bool b);
+		bool writeCsmAsCog() override;
+
 	private:
 		std::shared_ptr<Alignment> _csmAlign;
 		bool _doCsm = true;
 		bool _doCsmMetrics = true;
+		bool _writeCsmAsCog = false;
 
 		std::unique_ptr<CsmAlgorithm> _csmAlgorithm;
 		std::unique_ptr<CsmPostProcessor> _csmPostProcessAlgorithm;
@@ -142,10 +178,18 @@ namespace lapis {
 		void setTaoSegAlgorithm(TaoSegmentAlgorithm* algo);
 		TaoSegmentAlgorithm* taoSegAlgorithm() override;
 
+		void setWriteTaosToGeopackage(bool b);
+		bool writeTaosToGeopackage() override;
+
+		void setExportTaosToParquet(bool b);
+		bool exportTaosToParquet() override;
+
 	private:
 		std::unique_ptr<TaoIdAlgorithm> _taoIdAlgorithm;
 		std::unique_ptr<TaoSegmentAlgorithm> _taoSegAlgorithm;
 		bool _doTaos = true;
+		bool _writeTaosToGeopackage = false;
+		bool _exportTaosToParquet = false;
 	};
 
 	class FineIntParameterSpoofer : public virtual FineIntParameterGetter, public SharedParameterSpoofer {
@@ -178,8 +222,12 @@ namespace lapis {
 		const std::vector<coord_t>& topoWindows();
 		const std::vector<std::string>& topoWindowNames();
 
+		void setUseRadians(bool b);
+		bool useRadians() override;
+
 	private:
 		bool _doTopo = true;
+		bool _useRadians = false;
 		Raster<coord_t> _elev;
 		std::vector<coord_t> _windows;
 		std::vector<std::string> _names;
@@ -126,4 +126,119 @@ namespace lapis {
 		EXPECT_FALSE(r[1].has_value());
 	}
 	
-}
\ No newline at end of file
+
+	TEST_F(PointMetricCalculatorTest, merge) {
+		PointMetricCalculator merged;
+		merged.merge(sparsePMC);
+		merged.merge(densePMC);
+
+		PointMetricCalculator expected;
+		for (coord_t i = -10; i < 21; ++i) {
+			expected.addPoint({ 0,0,i,0,0 });
+		}
+		for (int i = 0; i < 1000; ++i) {
+			expected.addPoint({ 0,0,2 + i * 0.01,0,0 });
+		}
+
+		Raster<metric_t> expectedR = r;
+		merged.returnCount(r, 0);
+		expected.returnCount(expectedR, 0);
+		EXPECT_EQ(r[0].value(), expectedR[0].value());
+		merged.meanCanopy(r, 0);
+		expected.meanCanopy(expectedR, 0);
+		EXPECT_NEAR(r[0].value(), expectedR[0].value(), 0.0001);
+		merged.p50Canopy(r, 0);
+		expected.p50Canopy(expectedR, 0);
+		EXPECT_NEAR(r[0].value(), expectedR[0].value(), 0.0001);
+
+		merged.cleanUp();
+		expected.cleanUp();
+	}
+
+	TEST_F(PointMetricCalculatorTest, serialization) {
+		std::stringstream ss;
+		sparsePMC.writeTo(ss);
+		PointMetricCalculator read;
+		read.readFrom(ss);
+
+		Raster<metric_t> expectedR = r;
+		read.returnCount(r, 0);
+		sparsePMC.returnCount(expectedR, 0);
+		EXPECT_EQ(r[0].value(), expectedR[0].value());
+		read.meanCanopy(r, 0);
+		sparsePMC.meanCanopy(expectedR, 0);
+		EXPECT_NEAR(r[0].value(), expectedR[0].value(), 0.0001);
+		read.p75Canopy(r, 0);
+		sparsePMC.p75Canopy(expectedR, 0);
+		EXPECT_NEAR(r[0].value(), expectedR[0].value(), 0.0001);
+
+		read.cleanUp();
+	}
+
+	TEST_F(PointMetricCalculatorTest, additionalCutoffs) {
+		PointMetricCalculator::setInfo(2, 100, 0.1, {}, { 5 });
+		PointMetricCalculator multi;
+		for (coord_t i = -10; i < 21; ++i) {
+			multi.addPoint({ 0,0,i,0,0 });
+		}
+
+		multi.setActiveCutoff(0);
+		multi.meanCanopy(r, 0);
+		EXPECT_NEAR(r[0].value(), 11, 0.1);
+
+		multi.setActiveCutoff(1);
+		multi.meanCanopy(r, 0);
+		EXPECT_NEAR(r[0].value(), 12.5, 0.1);
+		multi.canopyCover(r, 0);
+		EXPECT_NEAR(r[0].value(), 16. / 31. * 100., 0.1);
+		Raster<metric_t> multiP50 = r;
+		multi.p50Canopy(multiP50, 0);
+		Raster<metric_t> multiSd = r;
+		multi.stdDevCanopy(multiSd, 0);
+		multi.cleanUp();
+
+		PointMetricCalculator::setInfo(5, 100, 0.1, {});
+		PointMetricCalculator single;
+		for (coord_t i = -10; i < 21; ++i) {
+			single.addPoint({ 0,0,i,0,0 });
+		}
+		//the additional cutoff is rounded to the histogram's bins, so these can differ by up to a bin
+		single.p50Canopy(r, 0);
+		EXPECT_NEAR(r[0].value(), multiP50[0].value(), 0.1);
+		single.stdDevCanopy(r, 0);
+		EXPECT_NEAR(r[0].value(), multiSd[0].value(), 0.1);
+		single.cleanUp();
+
+		PointMetricCalculator::setInfo(2, 100, 0.1, {});
+	}
+
+	TEST_F(PointMetricCalculatorTest, additionalCutoffsDontChangeMainCutoff) {
+		using Func = void(PointMetricCalculator::*)(Raster<metric_t>& r, cell_t cell);
+		std::vector<Func> funcs = { &PointMetricCalculator::meanCanopy, &PointMetricCalculator::stdDevCanopy,
+			&PointMetricCalculator::p25Canopy, &PointMetricCalculator::p50Canopy, &PointMetricCalculator::p95Canopy,
+			&PointMetricCalculator::canopyCover, &PointMetricCalculator::skewnessCanopy, &PointMetricCalculator::coverAboveMean };
+
+		auto calculate = [&]() {
+			PointMetricCalculator pmc;
+			for (int i = 0; i < 500; ++i) {
+				pmc.addPoint({ 0,0,i * 0.0437,0,0 });
+			}
+			std::vector<metric_t> out;
+			for (Func f : funcs) {
+				(pmc.*f)(r, 0);
+				out.push_back(r[0].value());
+			}
+			pmc.cleanUp();
+			return out;
+		};
+
+		PointMetricCalculator::setInfo(2, 100, 0.01, {});
+		std::vector<metric_t> expected = calculate();
+
+		//1.37 isn't a whole number of bins below 2 in floating point, which used to shift the main cutoff's bins
+		PointMetricCalculator::setInfo(2, 100, 0.01, {}, { 1.37, 5 });
+		EXPECT_EQ(calculate(), expected);
+
+		PointMetricCalculator::setInfo(2, 100, 0.1, {});
+	}
+}
@@ -25,6 +25,15 @@ namespace lapis {
 		std::vector<StratumMetricRasters>& stratumMetrics() {
 			return _stratumMetrics;
 		}
+		bool useBlocks() const {
+			return _useBlocks;
+		}
+		std::vector<std::unique_ptr<MetricBlock>>& blocks() {
+			return _blocks;
+		}
+		std::vector<CoarseLevel>& coarseLevels() {
+			return _coarseLevels;
+		}
 	};
 
 	void setReasonablePointMetricDefaults(PointMetricParameterSpoofer& spoof) {
@@ -190,4 +199,268 @@ namespace lapis {
 		}
 	}
 
+	TEST(PointMetricHandlerTest, lowmemorytest) {
+		PointMetricParameterSpoofer spoof;
+		setReasonablePointMetricDefaults(spoof);
+		spoof.setDoFirstReturnMetrics(false);
+		spoof.setDoStratumMetrics(false);
+		spoof.setMemoryBudget(1);
+		spoof.setGeoTiffCompression(GeoTiffCompression::Zstd);
+
+		Extent extentone = Extent(0, 2, 0, 2);
+		Extent extenttwo = Extent(1, 3, 1, 2);
+		spoof.addLasExtent(extentone);
+		spoof.addLasExtent(extenttwo);
+
+		PointMetricHandlerProtectedAccess pmh(&spoof);
+		pmh.prepareForRun();
+
+		ASSERT_TRUE(pmh.useBlocks());
+		EXPECT_FALSE(pmh.allReturnPMC());
+		ASSERT_GT(pmh.pointMetrics().size(), 0);
+		EXPECT_FALSE(pmh.pointMetrics()[0].rasters.all.has_value());
+		ASSERT_EQ(pmh.blocks().size(), 1);
+		EXPECT_FALSE(pmh.blocks()[0]);
+
+		LidarPointVector points;
+		points.push_back(LasPoint{ 0.5,0.5,3,0,0 });
+		points.push_back(LasPoint{ 0.5,1.5,1,0,0 });
+		points.push_back(LasPoint{ 0.5,1.5,3,0,0 });
+		points.push_back(LasPoint{ 1.5,1.5,3,0,0 });
+		pmh.handlePoints(points, extentone, 0);
+		pmh.finishLasFile(extentone, 0);
+		EXPECT_TRUE(pmh.blocks()[0]);
+
+		points.clear();
+		points.push_back(LasPoint{ 2.5,1.5,1,0,0 });
+		pmh.handlePoints(points, extenttwo, 1);
+		pmh.finishLasFile(extenttwo, 1);
+		EXPECT_FALSE(pmh.blocks()[0]);
+
+		pmh.cleanup();
+
+		std::vector<bool> expectedCoverHasValue = {
+			false,false,false,
+			true,true,true,
+			true,false,false
+		};
+		std::vector<metric_t> expectedCoverValue = {
+			-9999,-9999,-9999,
+			50,100,0,
+			100,-9999,-9999
+		};
+		Raster<metric_t> cover{ pmh.getFullFilename(pmh.pointMetricDir(), "CanopyCover", OutputUnitLabel::Percent).string() };
+		ASSERT_TRUE(cover.isSameAlignment(*spoof.metricAlign()));
+		for (cell_t cell = 0; cell < cover.ncell(); ++cell) {
+			EXPECT_EQ(expectedCoverHasValue[cell], cover[cell].has_value());
+			if (expectedCoverHasValue[cell]) {
+				EXPECT_EQ(expectedCoverValue[cell], cover[cell].value());
+			}
+		}
+
+		//the files written block by block should use the compression from the parameters too
+		GDALDatasetWrapper wgd = rasterGDALWrapper(pmh.getFullFilename(pmh.pointMetricDir(), "CanopyCover", OutputUnitLabel::Percent).string());
+		ASSERT_FALSE(wgd.isNull());
+		const char* compression = wgd->GetMetadataItem("COMPRESSION", "IMAGE_STRUCTURE");
+		ASSERT_NE(compression, nullptr);
+		EXPECT_EQ(std::string(compression), "ZSTD");
+	}
+
+	TEST(PointMetricHandlerTest, blockedgetest) {
+		PointMetricParameterSpoofer spoof;
+		setReasonablePointMetricDefaults(spoof);
+		spoof.setDoFirstReturnMetrics(false);
+		spoof.setDoStratumMetrics(false);
+		spoof.setStreamPointMetrics(true);
+
+		//two blocks side by side, with one las file in each
+		spoof.setMetricAlign(Alignment(Extent(0, 256, 0, 1), 1, 256));
+		Extent left = Extent(0, 128, 0, 1);
+		Extent right = Extent(128, 256, 0, 1);
+		spoof.addLasExtent(left);
+		spoof.addLasExtent(right);
+
+		PointMetricHandlerProtectedAccess pmh(&spoof);
+		pmh.prepareForRun();
+		ASSERT_TRUE(pmh.useBlocks());
+		ASSERT_EQ(pmh.blocks().size(), 2);
+
+		//this point is on the edge shared by the las files and the blocks, and the block to the right doesn't exist yet
+		LidarPointVector points;
+		points.push_back(LasPoint{ 128,0.5,3,0,0 });
+		pmh.handlePoints(points, left, 0);
+		EXPECT_FALSE(pmh.blocks()[1]);
+		pmh.finishLasFile(left, 0);
+
+		points.clear();
+		points.push_back(LasPoint{ 200.5,0.5,1,0,0 });
+		pmh.handlePoints(points, right, 1);
+		pmh.finishLasFile(right, 1);
+
+		pmh.cleanup();
+
+		Raster<metric_t> cover{ pmh.getFullFilename(pmh.pointMetricDir(), "CanopyCover", OutputUnitLabel::Percent).string() };
+		ASSERT_TRUE(cover.isSameAlignment(*spoof.metricAlign()));
+		ASSERT_TRUE(cover.atRCUnsafe(0, 127).has_value());
+		EXPECT_EQ(100, cover.atRCUnsafe(0, 127).value());
+		EXPECT_FALSE(cover.atRCUnsafe(0, 128).has_value());
+		ASSERT_TRUE(cover.atRCUnsafe(0, 200).has_value());
+		EXPECT_EQ(0, cover.atRCUnsafe(0, 200).value());
+	}
+
+	TEST(PointMetricHandlerTest, streamoutputtest) {
+		PointMetricParameterSpoofer spoof;
+		setReasonablePointMetricDefaults(spoof);
+		spoof.addLasExtent(Extent(0, 2, 0, 2));
+
+		PointMetricHandlerProtectedAccess pmh(&spoof);
+		pmh.prepareForRun();
+		EXPECT_FALSE(pmh.useBlocks());
+
+		spoof.setStreamPointMetrics(true);
+		pmh = PointMetricHandlerProtectedAccess(&spoof);
+		pmh.prepareForRun();
+		EXPECT_TRUE(pmh.useBlocks());
+		EXPECT_FALSE(pmh.allReturnPMC());
+		EXPECT_FALSE(pmh.firstReturnPMC());
+		pmh.cleanup();
+	}
+
+	TEST(PointMetricHandlerTest, coarsemetrictest) {
+		PointMetricParameterSpoofer spoof;
+		setReasonablePointMetricDefaults(spoof);
+		spoof.setDoFirstReturnMetrics(false);
+		spoof.setDoStratumMetrics(false);
+		spoof.setCoarseMetrics({ 3 }, { "Cellsize3" });
+
+		Extent extentone = Extent(0, 2, 0, 2);
+		Extent extenttwo = Extent(1, 3, 1, 2);
+		spoof.addLasExtent(extentone);
+		spoof.addLasExtent(extenttwo);
+
+		PointMetricHandlerProtectedAccess pmh(&spoof);
+		pmh.prepareForRun();
+
+		ASSERT_EQ(pmh.coarseLevels().size(), 1);
+		const Raster<int>& remaining = pmh.coarseLevels()[0].cellsRemaining;
+		ASSERT_EQ(remaining.ncell(), 1);
+		ASSERT_TRUE(remaining[0].has_value());
+		EXPECT_EQ(remaining[0].value(), 5);
+
+		LidarPointVector points;
+		points.push_back(LasPoint{ 0.5,0.5,3,0,0 });
+		points.push_back(LasPoint{ 0.5,1.5,1,0,0 });
+		points.push_back(LasPoint{ 0.5,1.5,3,0,0 });
+		points.push_back(LasPoint{ 1.5,1.5,3,0,0 });
+		pmh.handlePoints(points, extentone, 0);
+		pmh.finishLasFile(extentone, 0);
+		EXPECT_EQ(remaining[0].value(), 2);
+
+		points.clear();
+		points.push_back(LasPoint{ 2.5,1.5,1,0,0 });
+		pmh.handlePoints(points, extenttwo, 1);
+		pmh.finishLasFile(extenttwo, 1);
+		EXPECT_EQ(remaining[0].value(), 0);
+
+		pmh.cleanup();
+
+		Raster<metric_t> cover{ pmh.getFullFilename(pmh.pointMetricDir() / "Cellsize3", "CanopyCover", OutputUnitLabel::Percent).string()};
+		ASSERT_EQ(cover.ncell(), 1);
+		ASSERT_TRUE(cover[0].has_value());
+		EXPECT_NEAR(cover[0].value(), 60, 0.01);
+
+		Raster<metric_t> count{ pmh.getFullFilename(pmh.pointMetricDir() / "Cellsize3", "TotalReturnCount", OutputUnitLabel::Unitless).string() };
+		ASSERT_TRUE(count[0].has_value());
+		EXPECT_EQ(count[0].value(), 5);
+	}
+
+	TEST(PointMetricHandlerTest, histogramcubetest) {
+		PointMetricParameterSpoofer spoof;
+		setReasonablePointMetricDefaults(spoof);
+		spoof.setDoFirstReturnMetrics(false);
+		spoof.setDoStratumMetrics(false);
+		spoof.setSavePointHistograms(true);
+
+		Extent e = Extent(0, 2, 0, 2);
+		spoof.addLasExtent(e);
+
+		PointMetricHandlerProtectedAccess pmh(&spoof);
+		pmh.prepareForRun();
+
+		LidarPointVector points;
+		points.push_back(LasPoint{ 0.5,0.5,3,0,0 });
+		points.push_back(LasPoint{ 0.5,1.5,1,0,0 });
+		points.push_back(LasPoint{ 0.5,1.5,3,0,0 });
+		points.push_back(LasPoint{ 1.5,1.5,5,0,0 });
+		pmh.handlePoints(points, e, 0);
+		pmh.finishLasFile(e, 0);
+		pmh.cleanup();
+
+		//the cube should use its own settings, not whatever the current run is using
+		PointMetricCalculator::setInfo(10, 50, 1, {});
+
+		HistogramCubeReader cube{ pmh.histogramCubeFile(true) };
+		ASSERT_TRUE(cube.alignment().isSameAlignment(*spoof.metricAlign()));
+		EXPECT_EQ(cube.canopyCutoff(), spoof.canopyCutoff());
+
+		Raster<metric_t> cover = cube.calculateMetric(&PointMetricCalculator::canopyCover);
+		Raster<metric_t> mean = cube.calculateMetric(&PointMetricCalculator::meanCanopy);
+		Raster<metric_t> expectedCover{ pmh.getFullFilename(pmh.pointMetricDir(), "CanopyCover", OutputUnitLabel::Percent).string() };
+		for (cell_t cell = 0; cell < cover.ncell(); ++cell) {
+			EXPECT_EQ(cover[cell].has_value(), expectedCover[cell].has_value());
+			if (expectedCover[cell].has_value()) {
+				EXPECT_NEAR(cover[cell].value(), expectedCover[cell].value(), 0.01);
+			}
+		}
+		cell_t cell = cover.cellFromXYUnsafe(1.5, 1.5);
+		ASSERT_TRUE(mean[cell].has_value());
+		EXPECT_NEAR(mean[cell].value(), 5, 0.01);
+	}
+
+	TEST(PointMetricHandlerTest, recalculatefromcubetest) {
+		PointMetricParameterSpoofer spoof;
+		setReasonablePointMetricDefaults(spoof);
+		spoof.setDoFirstReturnMetrics(false);
+		spoof.setSavePointHistograms(true);
+		//the names recalculation makes up from the cube, so the outputs land in the same places
+		spoof.setStrata({ 2,4,8 }, { "LessThan2meters","2To4meters","4To8meters","GreaterThan8meters" });
+		spoof.setAdditionalCanopyCutoffs({ 4 }, { "CanopyCutoff4meters" });
+
+		Extent e = Extent(0, 2, 0, 2);
+		spoof.addLasExtent(e);
+
+		PointMetricHandlerProtectedAccess pmh(&spoof);
+		pmh.prepareForRun();
+
+		LidarPointVector points;
+		points.push_back(LasPoint{ 0.5,0.5,3,0,0 });
+		points.push_back(LasPoint{ 0.5,1.5,1,0,0 });
+		points.push_back(LasPoint{ 0.5,1.5,3,0,0 });
+		points.push_back(LasPoint{ 1.5,1.5,5,0,0 });
+		points.push_back(LasPoint{ 1.5,1.5,9,0,0 });
+		pmh.handlePoints(points, e, 0);
+		pmh.finishLasFile(e, 0);
+		pmh.cleanup();
+
+		std::filesystem::path recalcDir = pmh.pointMetricDir() / "Recalculated";
+		PointMetricHandlerProtectedAccess recalc(&spoof);
+		recalc.recalculateFromHistogramCube(pmh.histogramCubeFile(true), recalcDir);
+
+		auto expectSame = [&](const std::filesystem::path& subdir, const std::string& name, OutputUnitLabel u) {
+			Raster<metric_t> expected{ pmh.getFullFilename(pmh.pointMetricDir() / subdir, name, u).string() };
+			Raster<metric_t> actual{ recalc.getFullFilename(recalcDir / subdir, name, u).string() };
+			ASSERT_TRUE(actual.isSameAlignment(expected));
+			for (cell_t cell = 0; cell < expected.ncell(); ++cell) {
+				EXPECT_EQ(actual[cell].has_value(), expected[cell].has_value());
+				if (expected[cell].has_value()) {
+					EXPECT_NEAR(actual[cell].value(), expected[cell].value(), 0.01);
+				}
+			}
+		};
+		expectSame("", "CanopyCover", OutputUnitLabel::Percent);
+		expectSame("", "Mean_CanopyHeight", OutputUnitLabel::Default);
+		expectSame("", "TotalReturnCount", OutputUnitLabel::Unitless);
+		expectSame("CanopyCutoff4meters", "CanopyCover", OutputUnitLabel::Percent);
+		expectSame("StratumMetrics", "StratumPercent_4To8meters", OutputUnitLabel::Percent);
+	}
 }
\ No newline at end of file
@@ -109,6 +109,12 @@ namespace lapis {
 		MaxPoint* algo = dynamic_cast<MaxPoint*>(rp().csmAlgorithm());
 		ASSERT_NE(algo, nullptr);
 		EXPECT_EQ(algo->footprintRadius(),0.05);
+		EXPECT_FALSE(algo->exactFootprint());
+
+		prepareParamsNoSlowStuff({ "--footprint=0.1","--exact-footprint" });
+		algo = dynamic_cast<MaxPoint*>(rp().csmAlgorithm());
+		ASSERT_NE(algo, nullptr);
+		EXPECT_TRUE(algo->exactFootprint());
 
 		prepareParamsNoSlowStuff({ "--smooth=1","--no-csm-fill"});
 		EXPECT_NE(dynamic_cast<DoNothingCsm*>(rp().csmPostProcessAlgorithm()), nullptr);
@@ -13,7 +13,7 @@ namespace lapis {
 
 		void writeArray(const std::vector<cell_t>& highPoints, const Raster<csm_t>& csm, const Raster<taoid_t>& segments,
 			const Extent& unbufferedExtent, cell_t tile) {
-			_writeHighPointsAsArray(highPoints, csm, segments, unbufferedExtent, tile);
+			_writeHighPointsAsArray(_highPointInfo(highPoints, csm, segments, _buildTaoTable(highPoints, csm, segments, tile), unbufferedExtent), tile);
 		}
 		std::vector<TaoInfo> readArray(cell_t tile) {
 			return _readHighPointsFromArray(tile);
@@ -22,6 +22,21 @@ namespace lapis {
 		using TaoInfoProtected = TaoInfo;
 	};
 
+	class WatershedSegmentProtectedAccess : public WatershedSegment {
+	public:
+		using WatershedSegment::WatershedSegment;
+
+		void setTilesRemaining(cell_t nTile) override {
+			reported.push_back(nTile);
+			WatershedSegment::setTilesRemaining(nTile);
+		}
+		int threadsForCall(const Raster<csm_t>& csm) const {
+			return _threadsForCall(csm, 1);
+		}
+
+		std::vector<cell_t> reported;
+	};
+
 	void setReasonableTaoDefaults(TaoParameterSpoofer& spoof) {
 		setReasonableSharedDefaults(spoof);
 		spoof.setTaoIdAlgorithm(new HighPoints(2, 0));
@@ -102,8 +117,24 @@ namespace lapis {
 		//the buffered csm here should just be all the tiles stitched together, so the outputs should be fairly easy to predict
 		Extent tileExtent = spoof.layout()->extentFromCell(testTile);
 
+		//none of the segments in this tile belong to high points in other tiles, so the final outputs are written immediately
+		std::filesystem::path tempSegmentsFile = th.getFullTileFilename(th.taoTempDir(), "Segments", OutputUnitLabel::Unitless, testTile);
+		EXPECT_FALSE(std::filesystem::exists(tempSegmentsFile));
+
 		std::vector<cell_t> expectedHighPoints = spoof.taoIdAlgorithm()->identifyTaos(fullCsm);
-		auto actualHighPoints = th.readArray(testTile);
+		std::vector<TaoHandlerProtectedAccess::TaoInfoProtected> actualHighPoints;
+		{
+			std::filesystem::path taoFile = th.getFullTileFilename(th.taoDir(), "TAOs", OutputUnitLabel::Unitless, testTile, "shp");
+			GDALDatasetWrapper taos = vectorGDALWrapper(taoFile.string());
+			ASSERT_FALSE(taos.isNull());
+			OGRLayer* layer = taos->GetLayer(0);
+			OGRFeature* feature;
+			while ((feature = layer->GetNextFeature()) != nullptr) {
+				actualHighPoints.push_back({ feature->GetFieldAsDouble("X"), feature->GetFieldAsDouble("Y"),
+					(csm_t)feature->GetFieldAsDouble("Height"), feature->GetFieldAsDouble("Area") });
+				OGRFeature::DestroyFeature(feature);
+			}
+		}
 		EXPECT_GT(actualHighPoints.size(), 0);
 		for (size_t i = 0; i < expectedHighPoints.size(); ++i) {
 
@@ -127,7 +158,7 @@ namespace lapis {
 		Raster<taoid_t> fullSegments = spoof.taoSegAlgorithm()->segment(fullCsm, expectedHighPoints, idGen);
 
 		Raster<taoid_t> expectedSegments = cropRaster(fullSegments, tileExtent, SnapType::out);
-		std::filesystem::path segmentsFile = th.getFullTileFilename(th.taoTempDir(), "Segments", OutputUnitLabel::Unitless, testTile);
+		std::filesystem::path segmentsFile = th.getFullTileFilename(th.taoDir(), "Segments", OutputUnitLabel::Unitless, testTile);
 		Raster<taoid_t> actualSegments = Raster<taoid_t>(segmentsFile.string());
 		ASSERT_TRUE(expectedSegments.isSameAlignment(actualSegments));
 
@@ -228,4 +259,155 @@ namespace lapis {
 
 		std::filesystem::remove_all(spoof.outFolder());
 	}
-}
\ No newline at end of file
+
+	TEST(TaoHandlerTest, emptytilestest) {
+		TaoParameterSpoofer spoof;
+		setReasonableTaoDefaults(spoof);
+		WatershedSegmentProtectedAccess* algo = new WatershedSegmentProtectedAccess(2, 100, 0.01, 4, 0);
+		spoof.setTaoSegAlgorithm(algo);
+		for (cell_t tile = 0; tile < spoof.layout()->ncell(); ++tile) {
+			spoof.layout()->atCellUnsafe(tile).has_value() = true;
+		}
+
+		std::filesystem::remove_all(spoof.outFolder());
+
+		TaoHandlerProtectedAccess th(&spoof);
+		th.prepareForRun();
+
+		//only the last tile has any data, so the controller would skip the others without calling handleCsmTile
+		cell_t lastTile = spoof.layout()->ncell() - 1;
+		Raster<csm_t> fullCsm{ Alignment(0,0,8,8,0.5,0.5) };
+		Extent lastExtent = spoof.layout()->extentFromCell(lastTile);
+		for (cell_t cell = 0; cell < fullCsm.ncell(); ++cell) {
+			if (lastExtent.contains(fullCsm.xFromCellUnsafe(cell), fullCsm.yFromCellUnsafe(cell))) {
+				fullCsm[cell].has_value() = true;
+				fullCsm[cell].value() = (csm_t)(cell % 7 + 3);
+			}
+		}
+		EXPECT_EQ(algo->threadsForCall(fullCsm), 1);
+
+		th.handleCsmTile(fullCsm, lastTile);
+		ASSERT_EQ(algo->reported.size(), 1);
+		EXPECT_EQ(algo->reported[0], 0);
+		EXPECT_EQ(algo->threadsForCall(fullCsm), 4);
+
+		th.cleanup();
+		std::filesystem::remove_all(spoof.outFolder());
+	}
+
+	TEST(TaoHandlerTest, geopackagetest) {
+		TaoParameterSpoofer spoof;
+		setReasonableTaoDefaults(spoof);
+		spoof.setWriteTaosToGeopackage(true);
+
+		std::filesystem::remove_all(spoof.outFolder());
+
+		TaoHandlerProtectedAccess th(&spoof);
+		th.prepareForRun();
+
+		Raster<csm_t> fullCsm{ Alignment(0,0,6,6,0.5,0.5) };
+		for (cell_t cell = 0; cell < fullCsm.ncell(); ++cell) {
+			if (cell % 2 == 0) {
+				fullCsm[cell].value() = (csm_t)cell;
+				fullCsm[cell].has_value() = cell;
+			}
+		}
+
+		for (cell_t tile = 0; tile < spoof.layout()->ncell(); ++tile) {
+			th.handleCsmTile(fullCsm, tile);
+		}
+		th.cleanup();
+
+		std::filesystem::path filename = th.getFullFilename(th.taoDir(), "TAOs", OutputUnitLabel::Unitless, "gpkg");
+		ASSERT_TRUE(std::filesystem::exists(filename));
+		for (cell_t tile = 0; tile < spoof.layout()->ncell(); ++tile) {
+			EXPECT_FALSE(std::filesystem::exists(th.getFullTileFilename(th.taoDir(), "TAOs", OutputUnitLabel::Unitless, tile, "shp")));
+		}
+
+		std::vector<cell_t> expectedHighPoints = spoof.taoIdAlgorithm()->identifyTaos(fullCsm);
+		std::unordered_set<taoid_t> ids;
+		{
+			GDALDatasetWrapper gpkg = vectorGDALWrapper(filename.string());
+			ASSERT_FALSE(gpkg.isNull());
+			OGRLayer* layer = gpkg->GetLayer(0);
+			OGRFeature* feature;
+			while ((feature = layer->GetNextFeature()) != nullptr) {
+				taoid_t id = (taoid_t)feature->GetFieldAsInteger64("ID");
+				EXPECT_FALSE(ids.contains(id));
+				ids.insert(id);
+				OGRFeature::DestroyFeature(feature);
+			}
+		}
+		EXPECT_EQ(ids.size(), expectedHighPoints.size());
+
+		std::filesystem::remove_all(spoof.outFolder());
+	}
+
+	TEST(TaoHandlerTest, parquettest) {
+		GDALRegisterWrapper::allRegister();
+		if (!GetGDALDriverManager()->GetDriverByName("Parquet")) {
+			GTEST_SKIP() << "GDAL was built without the Parquet driver";
+		}
+
+		TaoParameterSpoofer spoof;
+		setReasonableTaoDefaults(spoof);
+		spoof.setExportTaosToParquet(true);
+
+		std::filesystem::remove_all(spoof.outFolder());
+
+		TaoHandlerProtectedAccess th(&spoof);
+		th.prepareForRun();
+
+		Raster<csm_t> fullCsm{ Alignment(0,0,6,6,0.5,0.5) };
+		for (cell_t cell = 0; cell < fullCsm.ncell(); ++cell) {
+			if (cell % 2 == 0) {
+				fullCsm[cell].value() = (csm_t)cell;
+				fullCsm[cell].has_value() = cell;
+			}
+		}
+
+		for (cell_t tile = 0; tile < spoof.layout()->ncell(); ++tile) {
+			th.handleCsmTile(fullCsm, tile);
+		}
+		th.cleanup();
+
+		std::filesystem::path filename = th.getFullFilename(th.taoDir(), "TAOs", OutputUnitLabel::Unitless, "parquet");
+		ASSERT_TRUE(std::filesystem::exists(filename));
+
+		//the shapefiles are still written alongside the export
+		std::unordered_set<taoid_t> shpIds;
+		for (cell_t tile = 0; tile < spoof.layout()->ncell(); ++tile) {
+			std::filesystem::path shp = th.getFullTileFilename(th.taoDir(), "TAOs", OutputUnitLabel::Unitless, tile, "shp");
+			if (!std::filesystem::exists(shp)) {
+				continue;
+			}
+			GDALDatasetWrapper wrapper = vectorGDALWrapper(shp.string());
+			OGRLayer* layer = wrapper->GetLayer(0);
+			OGRFeature* feature;
+			while ((feature = layer->GetNextFeature()) != nullptr) {
+				shpIds.insert((taoid_t)feature->GetFieldAsInteger64("ID"));
+				OGRFeature::DestroyFeature(feature);
+			}
+		}
+
+		std::unordered_set<taoid_t> parquetIds;
+		{
+			GDALDatasetWrapper parquet = vectorGDALWrapper(filename.string());
+			ASSERT_FALSE(parquet.isNull());
+			OGRLayer* layer = parquet->GetLayer(0);
+			OGRFeature* feature;
+			while ((feature = layer->GetNextFeature()) != nullptr) {
+				taoid_t id = (taoid_t)feature->GetFieldAsInteger64("ID");
+				EXPECT_FALSE(parquetIds.contains(id));
+				parquetIds.insert(id);
+				cell_t tile = (cell_t)feature->GetFieldAsInteger64("Tile");
+				EXPECT_GE(tile, 0);
+				EXPECT_LT(tile, spoof.layout()->ncell());
+				OGRFeature::DestroyFeature(feature);
+			}
+		}
+		EXPECT_EQ(parquetIds, shpIds);
+
+		std::filesystem::remove_all(spoof.outFolder());
+	}
+}
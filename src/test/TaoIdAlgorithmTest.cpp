@@ -1,5 +1,7 @@
 #include"test_pch.hpp"
 #include"..\algorithms\AllTaoIdAlgorithms.hpp"
+#include"..\utils\LapisLogger.hpp"
+#include<random>
 
 namespace lapis {
 
@@ -72,4 +74,79 @@ namespace lapis {
 
 		EXPECT_EQ(highPoints.size(), 1);
 	}
-}
\ No newline at end of file
+
+	//a straightforward check of each pixel against its eight neighbors, to compare the optimized candidate search against
+	std::vector<cell_t> referenceHighPoints(const Raster<csm_t>& csm, coord_t minHt) {
+		std::vector<cell_t> out;
+		for (rowcol_t row = 0; row < csm.nrow(); ++row) {
+			for (rowcol_t col = 0; col < csm.ncol(); ++col) {
+				auto center = csm.atRCUnsafe(row, col);
+				if (!center.has_value() || center.value() < minHt) {
+					continue;
+				}
+				bool isHighPoint = true;
+				for (rowcol_t dr = -1; dr <= 1; ++dr) {
+					for (rowcol_t dc = -1; dc <= 1; ++dc) {
+						rowcol_t r = row + dr, c = col + dc;
+						if ((dr == 0 && dc == 0) || r < 0 || c < 0 || r >= csm.nrow() || c >= csm.ncol()) {
+							continue;
+						}
+						auto compare = csm.atRCUnsafe(r, c);
+						if (!compare.has_value()) {
+							continue;
+						}
+						bool higherPriority = dc > 0 || (dc == 0 && dr > 0);
+						if (higherPriority ? compare.value() > center.value() : compare.value() >= center.value()) {
+							isHighPoint = false;
+						}
+					}
+				}
+				if (isHighPoint) {
+					out.push_back(csm.cellFromRowColUnsafe(row, col));
+				}
+			}
+		}
+		return out;
+	}
+
+	Raster<csm_t> randomCsmWithTies(rowcol_t nrow, rowcol_t ncol, unsigned int seed) {
+		Raster<csm_t> r{ Alignment(Extent(0,ncol,0,nrow),nrow,ncol) };
+		std::mt19937 gen{ seed };
+		std::uniform_int_distribution<int> height{ 0,20 };
+		std::uniform_int_distribution<int> hasValue{ 0,9 };
+		for (cell_t cell = 0; cell < r.ncell(); ++cell) {
+			//integer heights make ties common
+			r[cell].has_value() = hasValue(gen) > 0;
+			r[cell].value() = (csm_t)height(gen);
+		}
+		return r;
+	}
+
+	TEST(TaoAlgorithmTest, highPointsMatchesReferenceTest) {
+		Raster<csm_t> r = randomCsmWithTies(57, 63, 17);
+		HighPoints algo(3, 0);
+		EXPECT_EQ(algo.identifyTaos(r), referenceHighPoints(r, 3));
+	}
+
+	//run with --gtest_also_run_disabled_tests
+	TEST(TaoAlgorithmTest, DISABLED_highPointsBenchmark) {
+		Raster<csm_t> r = randomCsmWithTies(4000, 4000, 5);
+		HighPoints algo(3, 0);
+		LapisLogger& log = LapisLogger::getLogger();
+
+		std::vector<cell_t> optimized, reference;
+		log.beginVerboseBenchmarkTimer("High points benchmark");
+		optimized = algo.identifyTaos(r);
+		log.endVerboseBenchmarkTimer("High points benchmark");
+		log.beginVerboseBenchmarkTimer("Reference high points benchmark");
+		reference = referenceHighPoints(r, 3);
+		log.endVerboseBenchmarkTimer("Reference high points benchmark");
+		EXPECT_EQ(optimized, reference);
+
+		double optimizedSeconds = log.verboseBenchmarkSeconds("High points benchmark").value();
+		double referenceSeconds = log.verboseBenchmarkSeconds("Reference high points benchmark").value();
+		log.logMessage("High points on a " + std::to_string(r.nrow()) + "x" + std::to_string(r.ncol()) + " CSM: "
+			+ std::to_string(optimizedSeconds) + "s, reference: " + std::to_string(referenceSeconds) + "s");
+		EXPECT_LT(optimizedSeconds, referenceSeconds);
+	}
+}
@@ -1,6 +1,8 @@
 #include"test_pch.hpp"
 #include<unordered_set>
+#include<random>
 #include"..\algorithms\AllTaoSegmentAlgorithms.hpp"
+#include"..\utils\LapisLogger.hpp"
 
 
 namespace lapis {
@@ -67,4 +69,171 @@ namespace lapis {
 			}
 		}
 	}
-}
\ No newline at end of file
+
+	struct SuccessiveIds : public UniqueIdGenerator {
+		taoid_t previd = 0;
+		taoid_t nextId() override {
+			return ++previd;
+		}
+	};
+
+	//a direct implementation of the watershed with a queue per height bin, to compare the optimized version against
+	Raster<taoid_t> referenceWatershed(const Raster<csm_t>& csm, const std::vector<cell_t>& taos, UniqueIdGenerator& idGen,
+		coord_t canopyCutoff, coord_t maxHt, coord_t binSize) {
+		const taoid_t CANDIDATE = (taoid_t)-2;
+		const taoid_t QUEUED = (taoid_t)-3;
+		size_t nBins = (size_t)std::ceil((maxHt - canopyCutoff) / binSize);
+		std::vector<std::queue<cell_t>> queues(nBins);
+		size_t currentBin = 0;
+		size_t size = 0;
+		auto push = [&](csm_t height, cell_t cell) {
+			size_t bin = std::min(std::max((size_t)((maxHt - height) / binSize), currentBin), nBins - 1);
+			queues[bin].push(cell);
+			++size;
+		};
+
+		Raster<taoid_t> labels{ (Alignment)csm };
+		for (cell_t cell = 0; cell < labels.ncell(); ++cell) {
+			if (csm[cell].has_value()) {
+				labels[cell].has_value() = true;
+				labels[cell].value() = csm[cell].value() >= canopyCutoff ? CANDIDATE : 0;
+			}
+		}
+		for (cell_t c : taos) {
+			labels[c].value() = QUEUED;
+			push(csm[c].value(), c);
+		}
+		while (size) {
+			while (queues[currentBin].empty()) {
+				++currentBin;
+			}
+			cell_t c = queues[currentBin].front();
+			queues[currentBin].pop();
+			--size;
+			if (labels[c].value() == QUEUED) {
+				labels[c].value() = idGen.nextId();
+			}
+			rowcol_t row = labels.rowFromCellUnsafe(c);
+			rowcol_t col = labels.colFromCellUnsafe(c);
+			std::vector<std::pair<rowcol_t, rowcol_t>> neighbors = { {row + 1,col},{row - 1,col},{row,col + 1},{row,col - 1},
+				{row + 1,col + 1},{row - 1,col - 1},{row + 1,col - 1},{row - 1,col + 1} };
+			for (auto [r, cl] : neighbors) {
+				if (r < 0 || cl < 0 || r >= csm.nrow() || cl >= csm.ncol()) {
+					continue;
+				}
+				cell_t n = csm.cellFromRowColUnsafe(r, cl);
+				if (!labels[n].has_value() || labels[n].value() != CANDIDATE) {
+					continue;
+				}
+				labels[n].value() = labels[c].value();
+				push(csm[n].value(), n);
+			}
+		}
+		return labels;
+	}
+
+	//a bumpy surface with some holes, and every local maximum as a tao
+	void randomCanopy(rowcol_t nrow, rowcol_t ncol, unsigned int seed, Raster<csm_t>& csm, std::vector<cell_t>& taos) {
+		csm = Raster<csm_t>{ Alignment(Extent(0,ncol,0,nrow),nrow,ncol) };
+		std::mt19937 gen{ seed };
+		std::uniform_real_distribution<double> noise{ 0,3 };
+		std::uniform_int_distribution<int> hole{ 0,19 };
+		for (cell_t cell = 0; cell < csm.ncell(); ++cell) {
+			rowcol_t row = csm.rowFromCellUnsafe(cell);
+			rowcol_t col = csm.colFromCellUnsafe(cell);
+			csm[cell].has_value() = hole(gen) > 0;
+			csm[cell].value() = (csm_t)(15 + 10 * std::sin(row * 0.4) * std::cos(col * 0.3) + noise(gen));
+		}
+		taos.clear();
+		for (cell_t cell = 0; cell < csm.ncell(); ++cell) {
+			if (!csm[cell].has_value()) {
+				continue;
+			}
+			rowcol_t row = csm.rowFromCellUnsafe(cell);
+			rowcol_t col = csm.colFromCellUnsafe(cell);
+			bool isMax = true;
+			for (rowcol_t r = std::max(row - 1, 0); r <= std::min(row + 1, csm.nrow() - 1); ++r) {
+				for (rowcol_t c = std::max(col - 1, 0); c <= std::min(col + 1, csm.ncol() - 1); ++c) {
+					auto v = csm.atRCUnsafe(r, c);
+					if ((r != row || c != col) && v.has_value() && v.value() >= csm[cell].value()) {
+						isMax = false;
+					}
+				}
+			}
+			if (isMax) {
+				taos.push_back(cell);
+			}
+		}
+	}
+
+	TEST(TaoSegmentAlgorithmTest, WatershedMatchesReferenceTest) {
+		Raster<csm_t> csm;
+		std::vector<cell_t> taos;
+		randomCanopy(80, 90, 3, csm, taos);
+
+		SuccessiveIds idGen, referenceIdGen;
+		WatershedSegment algo{ 2,30,0.1 };
+		Raster<taoid_t> actual = algo.segment(csm, taos, idGen);
+		Raster<taoid_t> expected = referenceWatershed(csm, taos, referenceIdGen, 2, 30, 0.1);
+		for (cell_t cell = 0; cell < csm.ncell(); ++cell) {
+			ASSERT_EQ(actual[cell].has_value(), expected[cell].has_value());
+			if (expected[cell].has_value()) {
+				EXPECT_EQ(actual[cell].value(), expected[cell].value());
+			}
+		}
+	}
+
+	TEST(TaoSegmentAlgorithmTest, ParallelWatershedMatchesSerialTest) {
+		Raster<csm_t> csm;
+		std::vector<cell_t> taos;
+		randomCanopy(150, 120, 11, csm, taos);
+
+		//a high cutoff splits the canopy into many separate regions, and a low one leaves it mostly connected
+		for (coord_t cutoff : { 2., 14. }) {
+			SuccessiveIds idGen, referenceIdGen;
+			WatershedSegment algo{ cutoff,30,0.1,4,0 };
+			algo.setTilesRemaining(0);
+			Raster<taoid_t> actual = algo.segment(csm, taos, idGen);
+			Raster<taoid_t> expected = referenceWatershed(csm, taos, referenceIdGen, cutoff, 30, 0.1);
+			EXPECT_EQ(idGen.previd, referenceIdGen.previd);
+			for (cell_t cell = 0; cell < csm.ncell(); ++cell) {
+				ASSERT_EQ(actual[cell].has_value(), expected[cell].has_value());
+				if (expected[cell].has_value()) {
+					EXPECT_EQ(actual[cell].value(), expected[cell].value());
+				}
+			}
+		}
+	}
+
+	//run with --gtest_also_run_disabled_tests
+	TEST(TaoSegmentAlgorithmTest, DISABLED_WatershedBenchmark) {
+		Raster<csm_t> csm;
+		std::vector<cell_t> taos;
+		randomCanopy(4000, 4000, 5, csm, taos);
+		LapisLogger& log = LapisLogger::getLogger();
+
+		SuccessiveIds idGen, referenceIdGen, parallelIdGen;
+		WatershedSegment algo{ 2,30,0.1 };
+		WatershedSegment parallelAlgo{ 14,30,0.1,(int)std::thread::hardware_concurrency() };
+		parallelAlgo.setTilesRemaining(0);
+
+		log.beginVerboseBenchmarkTimer("Watershed benchmark");
+		algo.segment(csm, taos, idGen);
+		log.endVerboseBenchmarkTimer("Watershed benchmark");
+		log.beginVerboseBenchmarkTimer("Reference watershed benchmark");
+		referenceWatershed(csm, taos, referenceIdGen, 2, 30, 0.1);
+		log.endVerboseBenchmarkTimer("Reference watershed benchmark");
+		log.beginVerboseBenchmarkTimer("Parallel watershed benchmark");
+		parallelAlgo.segment(csm, taos, parallelIdGen);
+		log.endVerboseBenchmarkTimer("Parallel watershed benchmark");
+
+		double optimizedSeconds = log.verboseBenchmarkSeconds("Watershed benchmark").value();
+		double referenceSeconds = log.verboseBenchmarkSeconds("Reference watershed benchmark").value();
+		double parallelSeconds = log.verboseBenchmarkSeconds("Parallel watershed benchmark").value();
+		log.logMessage("Watershed on a " + std::to_string(csm.nrow()) + "x" + std::to_string(csm.ncol()) + " CSM: "
+			+ std::to_string(optimizedSeconds) + "s, reference: " + std::to_string(referenceSeconds)
+			+ "s, parallel with a fragmented canopy: " + std::to_string(parallelSeconds) + "s");
+		//the flat queue should at least double the throughput of the reference
+		EXPECT_LE(2 * optimizedSeconds, referenceSeconds);
+	}
+}
@@ -1,5 +1,6 @@
 #include"test_pch.hpp"
 #include"..\gis\RasterAlgos.hpp"
+#include<random>
 
 namespace lapis {
 
@@ -27,4 +28,110 @@ namespace lapis {
 			EXPECT_NEAR(v.value(), -radius, 1);
 		}
 	}
-}
\ No newline at end of file
+
+	//the straightforward version of the tpi calculation, visiting every cell in the window
+	Raster<metric_t> referenceTopoPosIndex(const Raster<coord_t>& bufferedElev, coord_t radius, const Extent& unbuffered) {
+		Raster<metric_t> tpi{ (Alignment)bufferedElev };
+		std::vector<RowColOffset> circle = cellOffsetsFromRadius(bufferedElev, radius);
+		for (rowcol_t row = 0; row < tpi.nrow(); ++row) {
+			for (rowcol_t col = 0; col < tpi.ncol(); ++col) {
+				cell_t cell = bufferedElev.cellFromRowColUnsafe(row, col);
+				if (!bufferedElev[cell].has_value()) {
+					continue;
+				}
+				coord_t numerator = 0;
+				coord_t denominator = 0;
+				for (RowColOffset offset : circle) {
+					rowcol_t otherrow = row + offset.rowOffset;
+					rowcol_t othercol = col + offset.colOffset;
+					if (otherrow < 0 || othercol < 0 || otherrow >= bufferedElev.nrow() || othercol >= bufferedElev.ncol()) {
+						continue;
+					}
+					auto v = bufferedElev.atRCUnsafe(otherrow, othercol);
+					if (v.has_value()) {
+						denominator++;
+						numerator += v.value();
+					}
+				}
+				if (denominator > 0) {
+					tpi[cell].has_value() = true;
+					tpi[cell].value() = (metric_t)(bufferedElev[cell].value() - numerator / denominator);
+				}
+			}
+		}
+		return cropRaster(tpi, unbuffered, SnapType::near);
+	}
+
+	TEST(TopoTest, tpiMatchesReferenceTest) {
+		Raster<coord_t> r{ Alignment(Extent(0,600,0,400),40,60) };
+		std::mt19937 gen{ 42 };
+		std::uniform_real_distribution<coord_t> elev{ 1000, 3000 };
+		std::uniform_int_distribution<int> hole{ 0, 9 };
+		for (cell_t cell = 0; cell < r.ncell(); ++cell) {
+			if (hole(gen) > 0) {
+				r[cell].has_value() = true;
+				r[cell].value() = elev(gen);
+			}
+		}
+
+		Extent unbuffered = Extent(100, 500, 50, 350);
+		for (coord_t radius : { 10., 25., 100., 1000. }) {
+			Raster<metric_t> expected = referenceTopoPosIndex(r, radius, unbuffered);
+			Raster<metric_t> actual = topoPosIndex(r, radius, unbuffered);
+			ASSERT_TRUE(expected.isSameAlignment(actual));
+			for (cell_t cell = 0; cell < expected.ncell(); ++cell) {
+				ASSERT_EQ(expected[cell].has_value(), actual[cell].has_value());
+				if (expected[cell].has_value()) {
+					EXPECT_NEAR(expected[cell].value(), actual[cell].value(), 1e-3);
+				}
+			}
+		}
+	}
+
+	TEST(TopoTest, fusedTopoMatchesFocalTest) {
+		Raster<coord_t> r{ Alignment(Extent(500000,500300,5000000,5000200),20,30) };
+		r.defineCRS(CoordRef("EPSG:26910"));
+		std::mt19937 gen{ 7 };
+		std::uniform_real_distribution<coord_t> elev{ 100, 150 };
+		std::uniform_int_distribution<int> hole{ 0, 19 };
+		for (cell_t cell = 0; cell < r.ncell(); ++cell) {
+			if (hole(gen) > 0) {
+				r[cell].has_value() = true;
+				r[cell].value() = elev(gen);
+			}
+		}
+
+		auto expectSame = [&](const Raster<metric_t>& expected, const Raster<metric_t>& actual) {
+			ASSERT_TRUE(expected.isSameAlignment(actual));
+			for (cell_t cell = 0; cell < expected.ncell(); ++cell) {
+				ASSERT_EQ(expected[cell].has_value(), actual[cell].has_value());
+				if (expected[cell].has_value()) {
+					EXPECT_NEAR(expected[cell].value(), actual[cell].value(), 1e-4);
+				}
+			}
+		};
+
+		TopoMetrics3x3<metric_t> degrees = topoMetrics3x3<metric_t, coord_t>(r, false);
+		expectSame(focal<metric_t, coord_t>(r, 3, viewSlopeDegrees<metric_t, coord_t>), degrees.slope);
+		expectSame(focal<metric_t, coord_t>(r, 3, viewAspectDegrees<metric_t, coord_t>), degrees.aspect);
+		expectSame(focal<metric_t, coord_t>(r, 3, viewCurvature<metric_t, coord_t>), degrees.curvature);
+		expectSame(focal<metric_t, coord_t>(r, 3, viewProfileCurvature<metric_t, coord_t>), degrees.profileCurvature);
+		expectSame(focal<metric_t, coord_t>(r, 3, viewPlanCurvature<metric_t, coord_t>), degrees.planCurvature);
+		expectSame(focal<metric_t, coord_t>(r, 3, viewSRI<metric_t, coord_t>), degrees.solarRadiationIndex);
+		expectSame(focal<metric_t, coord_t>(r, 3, viewTRI<metric_t, coord_t>), degrees.ruggedness);
+
+		TopoMetrics3x3<metric_t> radians = topoMetrics3x3<metric_t, coord_t>(r, true);
+		expectSame(focal<metric_t, coord_t>(r, 3, viewSlopeRadians<metric_t, coord_t>), radians.slope);
+		expectSame(focal<metric_t, coord_t>(r, 3, viewAspectRadians<metric_t, coord_t>), radians.aspect);
+
+		//a general kernel, with windows which hang off the edge of the raster
+		auto countKernel = [](const StencilWindow<coord_t, 5>& w) {
+			metric_t count = 0;
+			for (cell_t cell = 0; cell < 25; ++cell) {
+				count += w.hasValue[cell] ? 1.f : 0.f;
+			}
+			return xtl::xoptional<metric_t>(count);
+		};
+		expectSame(focal<metric_t, coord_t>(r, 5, viewCount<metric_t, coord_t>), focalStencil<metric_t, coord_t, 5>(r, countKernel));
+	}
+}
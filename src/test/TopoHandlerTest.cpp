@@ -1,6 +1,7 @@
 #include"test_pch.hpp"
 #include"ParameterSpoofer.hpp"
 #include"..\run\TopoHandler.hpp"
+#include"..\gis\RasterAlgos.hpp"
 
 namespace lapis {
 	class TopoHandlerProtectedAccess : public TopoHandler {
@@ -69,4 +70,85 @@ namespace lapis {
 			}
 		}
 	}
-}
\ No newline at end of file
+
+	TEST(TopoHandlerTest, overlappingdemtest) {
+		TopoParameterSpoofer spoof;
+		setReasonableSharedDefaults(spoof);
+
+		TopoHandlerProtectedAccess th(&spoof);
+		th.prepareForRun();
+
+		//where two dems overlap, both are counted
+		Raster<coord_t> first{ Alignment(Extent(0,2,0,3),6,4) };
+		Raster<coord_t> second{ Alignment(Extent(1,3,0,3),6,4) };
+		for (cell_t cell = 0; cell < first.ncell(); ++cell) {
+			first[cell].has_value() = true;
+			first[cell].value() = 10;
+			second[cell].has_value() = true;
+			second[cell].value() = 20;
+		}
+		th.handleDem(first, 0);
+		th.handleDem(second, 1);
+
+		for (rowcol_t row = 0; row < 3; ++row) {
+			cell_t left = th.elevNumerator().cellFromRowCol(row, 0);
+			cell_t middle = th.elevNumerator().cellFromRowCol(row, 1);
+			cell_t right = th.elevNumerator().cellFromRowCol(row, 2);
+			EXPECT_EQ(th.elevNumerator()[left].value() / th.elevDenominator()[left].value(), 10);
+			EXPECT_EQ(th.elevNumerator()[middle].value() / th.elevDenominator()[middle].value(), 15);
+			EXPECT_EQ(th.elevDenominator()[middle].value(), 8);
+			EXPECT_EQ(th.elevNumerator()[right].value() / th.elevDenominator()[right].value(), 20);
+		}
+	}
+
+	TEST(TopoHandlerTest, cleanuptest) {
+		TopoParameterSpoofer spoof;
+		setReasonableSharedDefaults(spoof);
+		Alignment a{ Extent(0,40,0,30),30,40 };
+		spoof.setMetricAlign(a);
+		spoof.setWindows({ 3., 8. });
+
+		std::filesystem::remove_all(spoof.outFolder());
+
+		Raster<coord_t> dem{ a };
+		for (cell_t cell = 0; cell < dem.ncell(); ++cell) {
+			if (cell % 7 != 0) {
+				dem[cell].has_value() = true;
+				dem[cell].value() = 100 + 5 * std::sin(cell * 0.37);
+			}
+		}
+		spoof.setBufferedElev(dem);
+
+		TopoHandlerProtectedAccess th(&spoof);
+		th.prepareForRun();
+		th.handleDem(dem, 0);
+		th.cleanup();
+
+		auto expectSame = [](const auto& expected, const std::filesystem::path& file) {
+			ASSERT_TRUE(std::filesystem::exists(file));
+			Raster<metric_t> actual{ file.string() };
+			ASSERT_TRUE(actual.isSameAlignment(expected));
+			for (cell_t cell = 0; cell < expected.ncell(); ++cell) {
+				ASSERT_EQ(expected[cell].has_value(), actual[cell].has_value());
+				if (expected[cell].has_value()) {
+					EXPECT_NEAR(expected[cell].value(), actual[cell].value(), 1e-4);
+				}
+			}
+		};
+
+		expectSame(dem, th.getFullFilename(th.topoDir(), "MeanElevation", OutputUnitLabel::Default));
+
+		TopoMetrics3x3<metric_t> smallScale = topoMetrics3x3<metric_t, coord_t>(dem, false);
+		expectSame(smallScale.slope, th.getFullFilename(th.topoDir(), "Slope", OutputUnitLabel::Degree));
+		expectSame(smallScale.curvature, th.getFullFilename(th.topoDir(), "Curvature", OutputUnitLabel::Unitless));
+		expectSame(smallScale.ruggedness, th.getFullFilename(th.topoDir(), "TopoRuggednessIndex", OutputUnitLabel::Default));
+
+		for (size_t i = 0; i < spoof.topoWindows().size(); ++i) {
+			Raster<metric_t> tpi = topoPosIndex(dem, spoof.topoWindows()[i], dem);
+			tpi.mask(dem);
+			expectSame(tpi, th.getFullFilename(th.topoDir(), "TopoPositionIndex_" + spoof.topoWindowNames()[i], OutputUnitLabel::Default));
+		}
+
+		std::filesystem::remove_all(spoof.outFolder());
+	}
+}
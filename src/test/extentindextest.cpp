@@ -0,0 +1,42 @@
+#include"test_pch.hpp"
+#include"..\gis\ExtentIndex.hpp"
+
+namespace lapis {
+
+	TEST(ExtentIndexTest, overlapping) {
+		std::vector<Extent> extents;
+		for (int row = 0; row < 10; ++row) {
+			for (int col = 0; col < 10; ++col) {
+				extents.emplace_back(col * 100., (col + 1) * 100., row * 100., (row + 1) * 100.);
+			}
+		}
+		//one large extent and one very small one, to make sure the grid handles uneven sizes
+		extents.emplace_back(-50, 1050, 450, 460);
+		extents.emplace_back(301, 302, 301, 302);
+
+		ExtentIndex index{ extents };
+		EXPECT_EQ(index.size(), extents.size());
+
+		std::vector<Extent> queries = {
+			Extent(250, 350, 250, 350),
+			Extent(0, 1000, 0, 1000),
+			Extent(100, 200, 100, 200), //exactly equal to one extent; its neighbors only touch it
+			Extent(2000, 3000, 2000, 3000),
+			Extent(-500, -100, 0, 1000),
+			Extent(301.5, 301.6, 301.5, 301.6)
+		};
+
+		for (const Extent& q : queries) {
+			std::vector<size_t> expected;
+			for (size_t i = 0; i < extents.size(); ++i) {
+				if (extents[i].overlaps(q)) {
+					expected.push_back(i);
+				}
+			}
+			EXPECT_EQ(index.overlapping(q), expected);
+		}
+
+		ExtentIndex empty;
+		EXPECT_EQ(empty.overlapping(Extent(0, 1, 0, 1)).size(), 0);
+	}
+}
@@ -71,4 +71,25 @@ namespace lapis {
 		EXPECT_NEAR(out[2].value(), 2.06, 0.01);
 		EXPECT_NEAR(out[3].value(), 1.7, 0.01);
 	}
-}
\ No newline at end of file
+
+	TEST_F(RasterAlgosTest, AggregateCanopyMetrics) {
+		CanopyAggregates<double> fused = aggregateCanopyMetrics<double, double>(r, a);
+
+		std::vector<std::pair<Raster<double>*, ViewFunc<double, double>>> compare = {
+			{&fused.max, &viewMax<double, double>},
+			{&fused.mean, &viewMean<double, double>},
+			{&fused.stdDev, &viewStdDev<double, double>},
+			{&fused.rumple, &viewRumple<double, double>}
+		};
+		for (auto& [actual, f] : compare) {
+			Raster<double> expected = aggregate(r, a, f);
+			ASSERT_EQ((Alignment)*actual, a);
+			for (cell_t cell = 0; cell < a.ncell(); ++cell) {
+				EXPECT_EQ((*actual)[cell].has_value(), expected[cell].has_value());
+				if (expected[cell].has_value()) {
+					EXPECT_NEAR((*actual)[cell].value(), expected[cell].value(), 0.0001);
+				}
+			}
+		}
+	}
+}
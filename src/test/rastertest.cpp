@@ -187,6 +187,80 @@ namespace lapis {
 		EXPECT_EQ(r, r2);
 	}
 
+	TEST_F(RasterTest, writeCog) {
+		std::string dir = LAPISTESTFILES;
+		Raster<int> r{ dir + "/testraster.img" };
+		std::string file = dir + "/testcog.tif";
+		r.writeCog(file);
+		Raster<int> r2{ file };
+		EXPECT_EQ(r, r2);
+
+		{
+			GDALDatasetWrapper wgd = rasterGDALWrapper(file);
+			ASSERT_FALSE(wgd.isNull());
+			int blockX, blockY;
+			wgd->GetRasterBand(1)->GetBlockSize(&blockX, &blockY);
+			EXPECT_EQ(blockX, 256);
+			EXPECT_EQ(blockY, 256);
+		}
+		std::filesystem::remove(file);
+
+		r.writeCog(file, std::numeric_limits<int>::lowest(), GeoTiffCompression::Zstd);
+		{
+			GDALDatasetWrapper wgd = rasterGDALWrapper(file);
+			ASSERT_FALSE(wgd.isNull());
+			const char* compression = wgd->GetMetadataItem("COMPRESSION", "IMAGE_STRUCTURE");
+			ASSERT_NE(compression, nullptr);
+			EXPECT_EQ(std::string(compression), "ZSTD");
+		}
+		Raster<int> r3{ file };
+		EXPECT_EQ(r, r3);
+		std::filesystem::remove(file);
+
+		//overviews are only built once the raster is larger than a block
+		Raster<int> large{ Alignment(Extent(0, 1024, 0, 1024), 1024, 1024) };
+		for (cell_t cell = 0; cell < large.ncell(); ++cell) {
+			large[cell].has_value() = true;
+			large[cell].value() = (int)(cell % 1000);
+		}
+		large.writeCog(file);
+		{
+			GDALDatasetWrapper wgd = rasterGDALWrapper(file);
+			ASSERT_FALSE(wgd.isNull());
+			EXPECT_GT(wgd->GetRasterBand(1)->GetOverviewCount(), 0);
+		}
+		std::filesystem::remove(file);
+	}
+
+	TEST_F(RasterTest, writeCompressed) {
+		std::string dir = LAPISTESTFILES;
+		Raster<int> r{ dir + "/testraster.img" };
+		std::string file = dir + "/testcompressed.tif";
+		r.writeRaster(file, "GTiff", std::numeric_limits<int>::lowest(), GDT_Unknown,
+			geoTiffCreationOptions(GeoTiffCompression::Deflate, Raster<int>::GDT(), 2));
+		Raster<int> r2{ file };
+		EXPECT_EQ(r, r2);
+
+		{
+			GDALDatasetWrapper wgd = rasterGDALWrapper(file);
+			ASSERT_FALSE(wgd.isNull());
+			const char* compression = wgd->GetMetadataItem("COMPRESSION", "IMAGE_STRUCTURE");
+			ASSERT_NE(compression, nullptr);
+			EXPECT_EQ(std::string(compression), "DEFLATE");
+			int blockX, blockY;
+			wgd->GetRasterBand(1)->GetBlockSize(&blockX, &blockY);
+			EXPECT_EQ(blockX, 256);
+			EXPECT_EQ(blockY, 256);
+		}
+		std::filesystem::remove(file);
+
+		EXPECT_EQ(geoTiffCreationOptions(GeoTiffCompression::None, GDT_Float32, 4).size(), (size_t)0);
+		std::vector<std::string> floatOptions = geoTiffCreationOptions(GeoTiffCompression::Zstd, GDT_Float32, 4);
+		EXPECT_NE(std::find(floatOptions.begin(), floatOptions.end(), "COMPRESS=ZSTD"), floatOptions.end());
+		EXPECT_NE(std::find(floatOptions.begin(), floatOptions.end(), "PREDICTOR=3"), floatOptions.end());
+		EXPECT_NE(std::find(floatOptions.begin(), floatOptions.end(), "NUM_THREADS=4"), floatOptions.end());
+	}
+
 	TEST_F(RasterTest, arithmetic) {
 		Raster<float> lhs{ Alignment(Extent(0,2,0,2),2,2) };
 		Raster<float> rhs{ (Alignment)lhs };
@@ -459,4 +533,28 @@ namespace lapis {
 		}
 		EXPECT_THROW(x.overlayInside(y); , AlignmentMismatchException);
 	}
-}
\ No newline at end of file
+
+	TEST_F(RasterTest, rowAccess) {
+		Raster<int> x{ Alignment(Extent(0,3,0,2),3,2) };
+		for (cell_t cell = 0; cell < x.ncell(); ++cell) {
+			x[cell].value() = (int)cell;
+			x[cell].has_value() = cell % 2 == 0;
+		}
+
+		EXPECT_EQ(x.values().size(), (size_t)6);
+		std::span<const int> row = x.rowValues(1);
+		EXPECT_EQ(row.size(), (size_t)3);
+		EXPECT_EQ(row[0], 3);
+		EXPECT_EQ(row[2], 5);
+
+		std::vector<uint8_t> hasValue(2);
+		x.rowHasValue(1, 1, hasValue);
+		EXPECT_EQ(hasValue, std::vector<uint8_t>({ 1,0 }));
+
+		x.rowValues(0)[1] = 10;
+		x.setRowHasValue(0, 0, std::vector<uint8_t>({ 0,1,0 }));
+		std::vector<int> exp_value = { -9999,10,-9999,-9999,4,-9999 };
+		std::vector<bool> exp_has_value = { false,true,false,false,true,false };
+		verifyRaster(x, exp_value, exp_has_value);
+	}
+}
@@ -199,6 +199,18 @@ namespace lapis {
 	{
 		_verboseTimers[what].endOnThisThread();
 	}
+	std::optional<double> LapisLogger::verboseBenchmarkSeconds(const std::string& what)
+	{
+		auto it = _verboseTimers.find(what);
+		if (it == _verboseTimers.end()) {
+			return std::nullopt;
+		}
+		std::optional<Duration> mean = it->second.meanDuration();
+		if (!mean.has_value()) {
+			return std::nullopt;
+		}
+		return std::chrono::duration<double>(mean.value()).count();
+	}
 	void LapisLogger::turnOnVerboseBenchmarking()
 	{
 		_displayVerboseBenchmark = true;
@@ -9,6 +9,7 @@
 #include<chrono>
 #include<iostream>
 #include<fstream>
+#include<optional>
 
 namespace lapis {
 
@@ -32,6 +33,8 @@ namespace lapis {
 		void beginVerboseBenchmarkTimer(const std::string& what);
 		void pauseVerboseBenchmarkTimer(const std::string& what);
 		void endVerboseBenchmarkTimer(const std::string& what);
+		//the mean time in seconds of the finished runs of a verbose benchmark timer, or nullopt if none have finished
+		std::optional<double> verboseBenchmarkSeconds(const std::string& what);
 
 		void turnOnVerboseBenchmarking();
 		void turnOffVerboseBenchmarking();